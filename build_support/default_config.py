@@ -10,6 +10,10 @@
 # Valgrind.
 test_attempt_mem_leak_check = False
 
+# Should the kernel record how often each lock is acquired, how often it has to wait, and for how long? The results can
+# be read from \proc\lockstat. This slows down every lock operation, so is normally disabled.
+kernel_lock_stats = False
+
 # Folder that is the root of a filesystem for an Azalea system - imagine that if you were running Linux, it would be a
 # folder you could chroot too. When built, the important system files end up here.
 sys_image_root = "../azalea_sys_image"
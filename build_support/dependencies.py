@@ -57,6 +57,10 @@ list_program = [
     '#user/list/SConscript',
   ]
 
+sched_bench_program = [
+    '#user/sched_bench/SConscript',
+  ]
+
 ncurses_program = [
     '#user/ncurses_test/SConscript',
   ]
@@ -0,0 +1,288 @@
+/// @file
+/// @brief Implements a simple non-thread-safe minimum heap.
+///
+/// The heap is a pairing heap. Each item is stored in a klib_heap_item, which can be embedded in the object being
+/// stored, so no memory is allocated by the heap itself. Inserting an item and finding the smallest item take constant
+/// time, and removing an item takes logarithmic time (amortized).
+///
+/// Each item with children points at its first child, and the children of an item are linked through
+/// klib_heap_item::next. klib_heap_item::prev points at the previous sibling, or the parent if the item is the first
+/// child.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "klib/panic/panic.h"
+#include "klib/tracing/tracing.h"
+#include "klib/misc/assert.h"
+
+template <typename T> struct klib_heap;
+
+/// @brief Contains the details of a single item within a klib_heap and the item's position within the heap.
+///
+/// As with klib_list_item, this object can be embedded within the object being stored in the heap.
+template <typename T> struct klib_heap_item
+{
+  /// @brief The previous sibling of this item, or its parent if this is the first child. nullptr for the root.
+  ///
+  klib_heap_item<T> *prev;
+
+  /// @brief The first child of this item, or nullptr if it has no children.
+  ///
+  klib_heap_item<T> *child;
+
+  /// @brief The next sibling of this item, or nullptr if this is the last child.
+  ///
+  klib_heap_item<T> *next;
+
+  /// @brief The heap this item is stored in, or nullptr if it is not in a heap.
+  ///
+  klib_heap<T> *heap_obj;
+
+  /// @brief The key the heap is ordered by. Items with smaller keys are nearer the root.
+  ///
+  uint64_t key;
+
+  /// @brief The item being stored in the heap.
+  ///
+  T item;
+};
+
+/// @brief The 'root' of a minimum heap of objects of type T.
+template <typename T> struct klib_heap
+{
+  /// @brief The item with the smallest key, or nullptr if the heap is empty.
+  ///
+  klib_heap_item<T> *root;
+};
+
+/// @cond
+// These are only used by the functions below.
+template <typename T> klib_heap_item<T> *klib_heap_int_meld(klib_heap_item<T> *a, klib_heap_item<T> *b);
+template <typename T> klib_heap_item<T> *klib_heap_int_merge_pairs(klib_heap_item<T> *first);
+/// @endcond
+
+/// @brief Initialise a new heap root object.
+///
+/// Heap root objects must be initialised before they can be used.
+///
+/// @param new_heap The new heap object to initialise. Must not be nullptr.
+template <typename T> void klib_heap_initialize(klib_heap<T> *new_heap)
+{
+  ASSERT(new_heap != nullptr);
+  new_heap->root = nullptr;
+}
+
+/// @brief Initialise a new heap item object.
+///
+/// Heap item objects must be initialised before they can be used.
+///
+/// @param new_item The new item object to initialise. Must not be nullptr.
+template <typename T> void klib_heap_item_initialize(klib_heap_item<T> *new_item)
+{
+  ASSERT(new_item != nullptr);
+  new_item->item = nullptr;
+  new_item->heap_obj = nullptr;
+  new_item->prev = nullptr;
+  new_item->child = nullptr;
+  new_item->next = nullptr;
+  new_item->key = 0;
+}
+
+/// @brief Add an item to a heap.
+///
+/// @param heap The heap to add new_item to. Must not be nullptr.
+///
+/// @param new_item The item to add. Must not be nullptr, and must not be in any heap already.
+///
+/// @param key The key to store new_item with.
+template <typename T> void klib_heap_insert(klib_heap<T> *heap, klib_heap_item<T> *new_item, uint64_t key)
+{
+  ASSERT(heap != nullptr);
+  ASSERT(new_item != nullptr);
+  ASSERT(new_item->heap_obj == nullptr);
+
+  new_item->key = key;
+  new_item->prev = nullptr;
+  new_item->child = nullptr;
+  new_item->next = nullptr;
+  new_item->heap_obj = heap;
+
+  heap->root = klib_heap_int_meld(heap->root, new_item);
+}
+
+/// @brief Remove an item from the heap it is in.
+///
+/// @param entry_to_remove The item to remove. Must be in a heap already and must not be nullptr.
+template <typename T> void klib_heap_remove(klib_heap_item<T> *entry_to_remove)
+{
+  klib_heap<T> *heap;
+  klib_heap_item<T> *children;
+
+  ASSERT(entry_to_remove != nullptr);
+  ASSERT(entry_to_remove->heap_obj != nullptr);
+
+  heap = entry_to_remove->heap_obj;
+  children = klib_heap_int_merge_pairs(entry_to_remove->child);
+
+  if (heap->root == entry_to_remove)
+  {
+    ASSERT(entry_to_remove->prev == nullptr);
+    heap->root = children;
+  }
+  else
+  {
+    // Detach this item, and all its children, from the heap. Then put its children back.
+    ASSERT(entry_to_remove->prev != nullptr);
+    if (entry_to_remove->prev->child == entry_to_remove)
+    {
+      entry_to_remove->prev->child = entry_to_remove->next;
+    }
+    else
+    {
+      entry_to_remove->prev->next = entry_to_remove->next;
+    }
+
+    if (entry_to_remove->next != nullptr)
+    {
+      entry_to_remove->next->prev = entry_to_remove->prev;
+    }
+
+    heap->root = klib_heap_int_meld(heap->root, children);
+  }
+
+  entry_to_remove->heap_obj = nullptr;
+  entry_to_remove->prev = nullptr;
+  entry_to_remove->child = nullptr;
+  entry_to_remove->next = nullptr;
+}
+
+/// @brief Return the item with the smallest key in a heap, without removing it.
+///
+/// @param heap The heap to examine. Must not be nullptr.
+///
+/// @return The item with the smallest key, or nullptr if the heap is empty.
+template <typename T> klib_heap_item<T> *klib_heap_peek_min(klib_heap<T> *heap)
+{
+  ASSERT(heap != nullptr);
+  return heap->root;
+}
+
+/// @brief Determine whether the provided heap is empty.
+///
+/// @param heap The heap to examine. Must not be nullptr.
+///
+/// @return True if the heap is empty, false otherwise.
+template <typename T> bool klib_heap_is_empty(klib_heap<T> *heap)
+{
+  ASSERT(heap != nullptr);
+  return (heap->root == nullptr);
+}
+
+/// @brief Determine whether or not the provided heap item is part of any heap.
+///
+/// @param heap_item_obj The heap item to examine.
+///
+/// @return True if the object is part of a heap, false otherwise.
+template <typename T> bool klib_heap_item_is_in_any_heap(klib_heap_item<T> *heap_item_obj)
+{
+  ASSERT(heap_item_obj != nullptr);
+  return (heap_item_obj->heap_obj != nullptr);
+}
+
+/// @cond
+/// @brief Combine two heaps, by making the root with the larger key the first child of the other.
+///
+/// @param a The root of the first heap. May be nullptr.
+///
+/// @param b The root of the second heap. May be nullptr.
+///
+/// @return The root of the combined heap.
+template <typename T> klib_heap_item<T> *klib_heap_int_meld(klib_heap_item<T> *a, klib_heap_item<T> *b)
+{
+  klib_heap_item<T> *temp;
+
+  if (a == nullptr)
+  {
+    return b;
+  }
+  if (b == nullptr)
+  {
+    return a;
+  }
+
+  if (b->key < a->key)
+  {
+    temp = a;
+    a = b;
+    b = temp;
+  }
+
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != nullptr)
+  {
+    a->child->prev = b;
+  }
+  a->child = b;
+
+  a->prev = nullptr;
+  a->next = nullptr;
+
+  return a;
+}
+
+/// @brief Combine a list of sibling heaps into a single heap.
+///
+/// The siblings are melded in pairs from left to right, then the resulting heaps are melded together from right to
+/// left. This keeps the heap shallow enough for removals to take logarithmic time on average.
+///
+/// @param first The first sibling. May be nullptr.
+///
+/// @return The root of the combined heap.
+template <typename T> klib_heap_item<T> *klib_heap_int_merge_pairs(klib_heap_item<T> *first)
+{
+  klib_heap_item<T> *pairs = nullptr;
+  klib_heap_item<T> *a;
+  klib_heap_item<T> *b;
+  klib_heap_item<T> *rest;
+  klib_heap_item<T> *result = nullptr;
+
+  // First pass. The melded pairs are kept in a stack linked through their next pointers.
+  while (first != nullptr)
+  {
+    a = first;
+    b = a->next;
+    rest = (b != nullptr) ? b->next : nullptr;
+
+    a->next = nullptr;
+    if (b != nullptr)
+    {
+      b->next = nullptr;
+    }
+
+    a = klib_heap_int_meld(a, b);
+    a->next = pairs;
+    pairs = a;
+
+    first = rest;
+  }
+
+  // Second pass. Popping the stack visits the pairs from right to left.
+  while (pairs != nullptr)
+  {
+    a = pairs;
+    pairs = pairs->next;
+    a->next = nullptr;
+    result = klib_heap_int_meld(result, a);
+  }
+
+  if (result != nullptr)
+  {
+    result->prev = nullptr;
+  }
+
+  return result;
+}
+/// @endcond
@@ -29,6 +29,7 @@
 #include "user_interfaces/kernel_types.h"
 #include "user_interfaces/error_codes.h"
 #include "klib/data_structures/lists.h"
+#include "klib/data_structures/heaps.h"
 #include "klib/data_structures/map_helpers.h"
 #include "panic/panic.h"
 #include "misc/assert.h"
@@ -9,6 +9,7 @@
 #include "klib/panic/panic.h"
 
 #include <stdlib.h>
+#include <new>
 
 // This file contains definitions for the operators new and delete. They refer to kmalloc / kfree directly.
 
@@ -42,6 +43,55 @@ void operator delete[](void *unlucky) noexcept
   kfree(unlucky);
 }
 
+// kmalloc() doesn't guarantee any alignment greater than 8 bytes, so over-aligned types are allocated with enough
+// spare space to align them. The address of the underlying allocation is stored just before the aligned block, so
+// that it can be freed again.
+void *operator new(uint64_t size, std::align_val_t align)
+{
+  uint64_t alignment = static_cast<uint64_t>(align);
+  uint64_t raw;
+  uint64_t aligned;
+
+  if (alignment < sizeof(void *))
+  {
+    alignment = sizeof(void *);
+  }
+
+  raw = reinterpret_cast<uint64_t>(kmalloc(size + alignment + sizeof(void *)));
+  aligned = (raw + sizeof(void *) + alignment - 1) & ~(alignment - 1);
+  reinterpret_cast<void **>(aligned)[-1] = reinterpret_cast<void *>(raw);
+
+  return reinterpret_cast<void *>(aligned);
+}
+
+void *operator new[](uint64_t size, std::align_val_t align)
+{
+  return operator new(size, align);
+}
+
+void operator delete(void *unlucky, std::align_val_t) noexcept
+{
+  if (unlucky != nullptr)
+  {
+    kfree(reinterpret_cast<void **>(unlucky)[-1]);
+  }
+}
+
+void operator delete(void *unlucky, uint64_t, std::align_val_t align) noexcept
+{
+  operator delete(unlucky, align);
+}
+
+void operator delete[](void *unlucky, std::align_val_t align) noexcept
+{
+  operator delete(unlucky, align);
+}
+
+void operator delete[](void *unlucky, uint64_t, std::align_val_t align) noexcept
+{
+  operator delete(unlucky, align);
+}
+
 /*
 namespace std
 {
@@ -86,8 +86,9 @@ namespace
   const uint32_t MAX_FREE_SLABS = 5;
 
   // This is currently redundant since the addition of the mutex system, below. It remains in place to (hopefully!)
-  // simplify a removal of the mutex in a later update of the allocator.
-  kernel_spinlock slabs_list_lock;
+  // simplify a removal of the mutex in a later update of the allocator. Every allocation takes it, so it is a queued
+  // lock.
+  kernel_mcs_lock slabs_list_lock;
   PTR_LIST free_slabs_list[NUM_SLAB_LISTS];
   PTR_LIST partial_slabs_list[NUM_SLAB_LISTS];
   PTR_LIST full_slabs_list[NUM_SLAB_LISTS];
@@ -139,6 +140,7 @@ void *kmalloc(uint64_t mem_size)
   SYNC_ACQ_RESULT res;
   bool release_mutex_at_end = true;
   uint64_t large_alloc_addr;
+  kernel_mcs_node list_lock_node;
 
   // Make sure the one-time-only initialisation of the system is complete. This set of ifs and asserts isn't meant to
   // provide full thread safety, instead it is meant to prevent any accidental circular recursion starting.
@@ -194,7 +196,7 @@ void *kmalloc(uint64_t mem_size)
   // This prevents two threads choosing the same slab and both attempting to allocate the last remaining item from it.
   // If a second thread finds no remaining slabs in any list, it will simply allocate a new one. This leads to some
   // extra slabs being used.
-  klib_synch_spinlock_lock(slabs_list_lock);
+  klib_synch_mcs_lock(slabs_list_lock, list_lock_node);
   if(!klib_list_is_empty(&partial_slabs_list[slab_idx]))
   {
     // Use one of the partially empty slabs
@@ -202,7 +204,7 @@ void *kmalloc(uint64_t mem_size)
     slab_header_ptr = (slab_header *)slab_ptr;
 
     klib_list_remove(&slab_header_ptr->list_entry);
-    klib_synch_spinlock_unlock(slabs_list_lock);
+    klib_synch_mcs_unlock(slabs_list_lock, list_lock_node);
   }
   else if (!klib_list_is_empty(&free_slabs_list[slab_idx]))
   {
@@ -211,12 +213,12 @@ void *kmalloc(uint64_t mem_size)
     slab_header_ptr = (slab_header *)slab_ptr;
 
     klib_list_remove(&slab_header_ptr->list_entry);
-    klib_synch_spinlock_unlock(slabs_list_lock);
+    klib_synch_mcs_unlock(slabs_list_lock, list_lock_node);
   }
   else
   {
     // No slabs free, so allocate a new slab.
-    klib_synch_spinlock_unlock(slabs_list_lock);
+    klib_synch_mcs_unlock(slabs_list_lock, list_lock_node);
     slab_ptr = allocate_new_slab(slab_idx);
     slab_header_ptr = (slab_header *)slab_ptr;
   }
@@ -226,7 +228,7 @@ void *kmalloc(uint64_t mem_size)
 
   // If the slab is completely full, add it to the appropriate list. If it isn't, it must be at least partially full
   // now, so add it to that list.
-  klib_synch_spinlock_lock(slabs_list_lock);
+  klib_synch_mcs_lock(slabs_list_lock, list_lock_node);
   if (slab_is_full(slab_ptr, slab_idx))
   {
     klib_list_add_head(&full_slabs_list[slab_idx], &slab_header_ptr->list_entry);
@@ -235,7 +237,7 @@ void *kmalloc(uint64_t mem_size)
   {
     klib_list_add_head(&partial_slabs_list[slab_idx], &slab_header_ptr->list_entry);
   }
-  klib_synch_spinlock_unlock(slabs_list_lock);
+  klib_synch_mcs_unlock(slabs_list_lock, list_lock_node);
 
   // If this slab is more than 90% full and there aren't any spare empty slabs
   // left, pre-allocate one now.
@@ -251,9 +253,9 @@ void *kmalloc(uint64_t mem_size)
   {
     slab_ptr = allocate_new_slab(slab_idx);
     slab_header_ptr = (slab_header *)slab_ptr;
-    klib_synch_spinlock_lock(slabs_list_lock);
+    klib_synch_mcs_lock(slabs_list_lock, list_lock_node);
     klib_list_add_head(&free_slabs_list[slab_idx], &slab_header_ptr->list_entry);
-    klib_synch_spinlock_unlock(slabs_list_lock);
+    klib_synch_mcs_unlock(slabs_list_lock, list_lock_node);
   }
 
   if (release_mutex_at_end)
@@ -293,6 +295,7 @@ void kfree(void *mem_block)
   uint64_t dealloc_addr;
   bool release_mutex_at_end = true;
   SYNC_ACQ_RESULT res;
+  kernel_mcs_node list_lock_node;
 
   ASSERT(allocator_initialized);
 
@@ -373,9 +376,9 @@ void kfree(void *mem_block)
     slab_ptr->allocation_count = slab_ptr->allocation_count - 1;
     if (slab_is_empty(slab_ptr, chunk_size_idx))
     {
-      klib_synch_spinlock_lock(slabs_list_lock);
+      klib_synch_mcs_lock(slabs_list_lock, list_lock_node);
       klib_list_remove(&slab_ptr->list_entry);
-      klib_synch_spinlock_unlock(slabs_list_lock);
+      klib_synch_mcs_unlock(slabs_list_lock, list_lock_node);
       free_slabs = klib_list_get_length(&free_slabs_list[chunk_size_idx]);
       if (free_slabs >= MAX_FREE_SLABS)
       {
@@ -383,17 +386,17 @@ void kfree(void *mem_block)
       }
       else
       {
-        klib_synch_spinlock_lock(slabs_list_lock);
+        klib_synch_mcs_lock(slabs_list_lock, list_lock_node);
         klib_list_add_tail(&free_slabs_list[chunk_size_idx], &slab_ptr->list_entry);
-        klib_synch_spinlock_unlock(slabs_list_lock);
+        klib_synch_mcs_unlock(slabs_list_lock, list_lock_node);
       }
     }
     else if(slab_was_full)
     {
-      klib_synch_spinlock_lock(slabs_list_lock);
+      klib_synch_mcs_lock(slabs_list_lock, list_lock_node);
       klib_list_remove(&slab_ptr->list_entry);
       klib_list_add_tail(&partial_slabs_list[chunk_size_idx], &slab_ptr->list_entry);
-      klib_synch_spinlock_unlock(slabs_list_lock);
+      klib_synch_mcs_unlock(slabs_list_lock, list_lock_node);
     }
   }
 
@@ -450,7 +453,7 @@ void init_allocator_system()
     klib_list_add_tail(&free_slabs_list[i], &new_empty_slab_header->list_entry);
   }
 
-  klib_synch_spinlock_init(slabs_list_lock);
+  klib_synch_mcs_init(slabs_list_lock);
   klib_synch_mutex_init(allocator_gen_lock);
 
   allocator_initialized = true;
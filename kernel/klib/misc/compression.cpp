@@ -0,0 +1,366 @@
+/// @file
+/// @brief A simple, fast LZ77-style compressor.
+///
+/// The compressed format is a series of sequences, each of which is some literal bytes followed by a match - a copy of
+/// bytes that have already been output. Each sequence is:
+/// - A token byte. The upper four bits give the number of literal bytes, the lower four bits give the length of the
+///   match less KLIB_LZ_MIN_MATCH. If either value is 15, it is continued in extra length bytes.
+/// - Extra literal length bytes, if needed. Each is added to the length, and the last one has a value less than 255.
+/// - The literal bytes.
+/// - The offset of the match, as a two byte little-endian value counting backwards from the current output position.
+/// - Extra match length bytes, in the same format as the extra literal length bytes.
+///
+/// The final sequence contains only literals, and ends at the end of the compressed data. The format is similar to LZ4,
+/// favouring speed over compression ratio, but makes no attempt to be compatible with it.
+
+// Known defects:
+// - Inputs must be smaller than 4GB.
+
+#include "klib/misc/compression.h"
+
+namespace
+{
+  /// The smallest match that is worth encoding.
+  const uint64_t KLIB_LZ_MIN_MATCH = 4;
+
+  /// The largest distance back to a match that can be encoded.
+  const uint64_t KLIB_LZ_MAX_OFFSET = 0xFFFF;
+
+  /// @brief Read four bytes from the input as a single value.
+  ///
+  /// @param ptr The bytes to read.
+  ///
+  /// @return The four bytes, combined.
+  inline uint32_t read_four(const uint8_t *ptr)
+  {
+    return static_cast<uint32_t>(ptr[0]) |
+           (static_cast<uint32_t>(ptr[1]) << 8) |
+           (static_cast<uint32_t>(ptr[2]) << 16) |
+           (static_cast<uint32_t>(ptr[3]) << 24);
+  }
+
+  /// @brief Calculate the hash table index for four bytes of input.
+  ///
+  /// @param sequence The four bytes, as returned by read_four().
+  ///
+  /// @return An index in to klib_lz_workspace::hash_table.
+  inline uint32_t hash_four(uint32_t sequence)
+  {
+    return (sequence * 2654435761U) >> 20;
+  }
+
+  static_assert(KLIB_LZ_HASH_ENTRIES == (1 << 12), "hash_four() must be updated to match the hash table size");
+
+  /// @brief Write the extra length bytes for a value that doesn't fit in its token.
+  ///
+  /// @param remainder The part of the length not covered by the token.
+  ///
+  /// @param output The output buffer.
+  ///
+  /// @param[inout] output_pos The position in output to write to. Updated to point after the length bytes.
+  ///
+  /// @param output_max The size of output.
+  ///
+  /// @return True if the length bytes fit in the output, false otherwise.
+  bool write_extra_length(uint64_t remainder, uint8_t *output, uint64_t &output_pos, uint64_t output_max)
+  {
+    while (remainder >= 255)
+    {
+      if (output_pos >= output_max)
+      {
+        return false;
+      }
+      output[output_pos++] = 255;
+      remainder -= 255;
+    }
+
+    if (output_pos >= output_max)
+    {
+      return false;
+    }
+    output[output_pos++] = static_cast<uint8_t>(remainder);
+
+    return true;
+  }
+
+  /// @brief Read extra length bytes from compressed data.
+  ///
+  /// @param input The compressed data.
+  ///
+  /// @param[inout] input_pos The position of the first length byte. Updated to point after the length bytes.
+  ///
+  /// @param input_len The length of input.
+  ///
+  /// @param[inout] length The length to add the extra bytes to.
+  ///
+  /// @return True if the length bytes were read successfully, false if the input ended first.
+  bool read_extra_length(const uint8_t *input, uint64_t &input_pos, uint64_t input_len, uint64_t &length)
+  {
+    uint8_t byte;
+
+    do
+    {
+      if (input_pos >= input_len)
+      {
+        return false;
+      }
+      byte = input[input_pos++];
+      length += byte;
+    } while (byte == 255);
+
+    return true;
+  }
+
+  /// @brief Write a single sequence to the output.
+  ///
+  /// @param literals The literal bytes of the sequence.
+  ///
+  /// @param literal_len The number of literal bytes.
+  ///
+  /// @param offset The distance back to the match. Ignored if match_len is zero.
+  ///
+  /// @param match_len The length of the match, or zero if this is the final sequence.
+  ///
+  /// @param output The output buffer.
+  ///
+  /// @param[inout] output_pos The position in output to write to. Updated to point after the sequence.
+  ///
+  /// @param output_max The size of output.
+  ///
+  /// @return True if the sequence fits in the output, false otherwise.
+  bool write_sequence(const uint8_t *literals,
+                      uint64_t literal_len,
+                      uint64_t offset,
+                      uint64_t match_len,
+                      uint8_t *output,
+                      uint64_t &output_pos,
+                      uint64_t output_max)
+  {
+    uint64_t token_pos = output_pos;
+    uint8_t token;
+
+    if (output_pos >= output_max)
+    {
+      return false;
+    }
+    output_pos++;
+
+    if (literal_len >= 15)
+    {
+      token = 0xF0;
+      if (!write_extra_length(literal_len - 15, output, output_pos, output_max))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      token = static_cast<uint8_t>(literal_len << 4);
+    }
+
+    if ((output_pos + literal_len) > output_max)
+    {
+      return false;
+    }
+    for (uint64_t i = 0; i < literal_len; i++)
+    {
+      output[output_pos++] = literals[i];
+    }
+
+    if (match_len != 0)
+    {
+      if ((output_pos + 2) > output_max)
+      {
+        return false;
+      }
+      output[output_pos++] = static_cast<uint8_t>(offset & 0xFF);
+      output[output_pos++] = static_cast<uint8_t>(offset >> 8);
+
+      match_len -= KLIB_LZ_MIN_MATCH;
+      if (match_len >= 15)
+      {
+        token |= 0x0F;
+        if (!write_extra_length(match_len - 15, output, output_pos, output_max))
+        {
+          return false;
+        }
+      }
+      else
+      {
+        token |= static_cast<uint8_t>(match_len);
+      }
+    }
+
+    output[token_pos] = token;
+
+    return true;
+  }
+}
+
+/// @brief Compress a buffer.
+///
+/// @param input The data to compress.
+///
+/// @param input_len The number of bytes in input.
+///
+/// @param output Buffer to write the compressed data in to.
+///
+/// @param output_max The size of output. Compression is abandoned if the compressed data won't fit, so a small buffer
+///                   can be used to reject data that doesn't compress well.
+///
+/// @param workspace Working storage for the compressor. Its contents on entry don't matter.
+///
+/// @return The number of bytes of compressed data written to output, or zero if the compressed data wouldn't fit.
+uint64_t klib_lz_compress(const uint8_t *input,
+                          uint64_t input_len,
+                          uint8_t *output,
+                          uint64_t output_max,
+                          klib_lz_workspace &workspace)
+{
+  uint64_t input_pos = 0;
+  uint64_t output_pos = 0;
+  uint64_t anchor = 0;
+  uint64_t candidate;
+  uint64_t match_len;
+  uint32_t sequence;
+  uint32_t hash;
+
+  if ((input == nullptr) || (output == nullptr) || (input_len > 0xFFFFFFFF))
+  {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < KLIB_LZ_HASH_ENTRIES; i++)
+  {
+    workspace.hash_table[i] = 0;
+  }
+
+  while ((input_pos + KLIB_LZ_MIN_MATCH) <= input_len)
+  {
+    sequence = read_four(input + input_pos);
+    hash = hash_four(sequence);
+    candidate = workspace.hash_table[hash];
+    workspace.hash_table[hash] = static_cast<uint32_t>(input_pos);
+
+    // Hash collisions are possible, so make sure the candidate really matches.
+    if ((candidate < input_pos) &&
+        ((input_pos - candidate) <= KLIB_LZ_MAX_OFFSET) &&
+        (read_four(input + candidate) == sequence))
+    {
+      match_len = KLIB_LZ_MIN_MATCH;
+      while (((input_pos + match_len) < input_len) && (input[candidate + match_len] == input[input_pos + match_len]))
+      {
+        match_len++;
+      }
+
+      if (!write_sequence(input + anchor,
+                          input_pos - anchor,
+                          input_pos - candidate,
+                          match_len,
+                          output,
+                          output_pos,
+                          output_max))
+      {
+        return 0;
+      }
+
+      input_pos += match_len;
+      anchor = input_pos;
+    }
+    else
+    {
+      input_pos++;
+    }
+  }
+
+  if (!write_sequence(input + anchor, input_len - anchor, 0, 0, output, output_pos, output_max))
+  {
+    return 0;
+  }
+
+  return output_pos;
+}
+
+/// @brief Decompress a buffer compressed by klib_lz_compress().
+///
+/// The compressed data is checked as it is decompressed, so corrupt data will not cause reads or writes outside of the
+/// buffers.
+///
+/// @param input The compressed data.
+///
+/// @param input_len The number of bytes of compressed data.
+///
+/// @param output Buffer to write the decompressed data in to.
+///
+/// @param output_max The size of output.
+///
+/// @return The number of bytes written to output, or zero if the compressed data is corrupt or the output buffer is too
+///         small.
+uint64_t klib_lz_decompress(const uint8_t *input, uint64_t input_len, uint8_t *output, uint64_t output_max)
+{
+  uint64_t input_pos = 0;
+  uint64_t output_pos = 0;
+  uint64_t literal_len;
+  uint64_t match_len;
+  uint64_t offset;
+  uint8_t token;
+
+  if ((input == nullptr) || (output == nullptr))
+  {
+    return 0;
+  }
+
+  while (input_pos < input_len)
+  {
+    token = input[input_pos++];
+
+    literal_len = token >> 4;
+    if ((literal_len == 15) && !read_extra_length(input, input_pos, input_len, literal_len))
+    {
+      return 0;
+    }
+
+    if (((input_pos + literal_len) > input_len) || ((output_pos + literal_len) > output_max))
+    {
+      return 0;
+    }
+    for (uint64_t i = 0; i < literal_len; i++)
+    {
+      output[output_pos++] = input[input_pos++];
+    }
+
+    if (input_pos == input_len)
+    {
+      // This was the final sequence.
+      break;
+    }
+
+    if ((input_pos + 2) > input_len)
+    {
+      return 0;
+    }
+    offset = static_cast<uint64_t>(input[input_pos]) | (static_cast<uint64_t>(input[input_pos + 1]) << 8);
+    input_pos += 2;
+
+    match_len = token & 0x0F;
+    if ((match_len == 15) && !read_extra_length(input, input_pos, input_len, match_len))
+    {
+      return 0;
+    }
+    match_len += KLIB_LZ_MIN_MATCH;
+
+    if ((offset == 0) || (offset > output_pos) || ((output_pos + match_len) > output_max))
+    {
+      return 0;
+    }
+
+    // The match may overlap the bytes being written, so copy one byte at a time.
+    for (uint64_t i = 0; i < match_len; i++)
+    {
+      output[output_pos] = output[output_pos - offset];
+      output_pos++;
+    }
+  }
+
+  return output_pos;
+}
@@ -0,0 +1,25 @@
+/// @file
+/// @brief A simple, fast LZ77-style compressor.
+
+#pragma once
+
+#include <stdint.h>
+
+/// The number of entries in the compressor's hash table. Must be a power of two.
+const uint32_t KLIB_LZ_HASH_ENTRIES = 4096;
+
+/// @brief Working storage for klib_lz_compress().
+///
+/// This is too large to comfortably fit on a kernel stack, so callers are expected to allocate it once and reuse it.
+struct klib_lz_workspace
+{
+  /// For each hash of four input bytes, the offset in the input where those bytes were last seen.
+  uint32_t hash_table[KLIB_LZ_HASH_ENTRIES];
+};
+
+uint64_t klib_lz_compress(const uint8_t *input,
+                          uint64_t input_len,
+                          uint8_t *output,
+                          uint64_t output_max,
+                          klib_lz_workspace &workspace);
+uint64_t klib_lz_decompress(const uint8_t *input, uint64_t input_len, uint8_t *output, uint64_t output_max);
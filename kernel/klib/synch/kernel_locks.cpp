@@ -1,11 +1,37 @@
 /// @file
-/// @brief Implements a basic spinlock.
+/// @brief Implements basic spinlocks and queued (MCS) spinlocks.
+///
+/// Basic spinlocks are taken with interrupts enabled, so a thread waiting for one may be preempted. They are not fair:
+/// whichever thread sees the lock free first takes it, so a preempted waiter doesn't hold up the others. Queued
+/// spinlocks hand themselves to waiting threads in the order the threads asked for them, which is only safe because
+/// interrupts are disabled while a thread waits for or holds one. If the kernel is built with KERNEL_LOCKSTAT, all of
+/// these locks record contention statistics - see kernel_lockstat.h.
+//
+// Known defects:
+// - Threads can be preempted while holding a basic spinlock, in which case other threads wanting it spin until the
+//   holder runs again.
 
 #include "kernel_locks.h"
+#include "kernel_lockstat.h"
 #include "klib/klib.h"
 #include "processor/processor.h"
 #include <atomic>
 
+#ifdef AZALEA_TEST_CODE
+#include <thread>
+#endif
+
+namespace
+{
+  // Set in a kernel_rwlock while a writer holds it.
+  const uint64_t RW_WRITER_HELD = 0x8000000000000000ULL;
+
+  // Set in a kernel_rwlock while a writer waits for it.
+  const uint64_t RW_WRITER_WAITING = 0x4000000000000000ULL;
+
+  void spin_pause();
+}
+
 /// @brief Initialise a kernel spinlock object
 ///
 /// @param[in] lock The spinlock to initialise.
@@ -20,34 +46,54 @@ void klib_synch_spinlock_init(kernel_spinlock &lock)
 
 /// @brief Acquire and lock a spinlock
 ///
-/// This function will not return until it has locked the spinlock.
+/// This function will not return until it has locked the spinlock. Waiting threads are not queued, so they may acquire
+/// the lock in any order.
 ///
 /// @param[in] lock The spinlock object to lock.
 void klib_synch_spinlock_lock(kernel_spinlock &lock)
 {
   KL_TRC_ENTRY;
 
-  uint64_t expected = 0;
-  uint64_t desired = 1;
-  do
+#ifdef KERNEL_LOCKSTAT
+  uint64_t start = klib_lockstat_now();
+  bool contended = false;
+#endif
+
+  // Wait by reading the lock rather than trying to write it, so that waiting processors share its cache line until it
+  // is released.
+  while (lock.exchange(1, std::memory_order_acquire) != 0)
   {
-    expected = 0;
-    std::atomic_compare_exchange_strong(&lock, &expected, desired);
-  } while (expected == 1);
+#ifdef KERNEL_LOCKSTAT
+    contended = true;
+#endif
+    while (lock.load(std::memory_order_relaxed) != 0)
+    {
+      spin_pause();
+    }
+  }
+
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_acquired(&lock, LOCKSTAT_CALLER(), LOCKSTAT_KIND::SPINLOCK, contended, start);
+#endif
 
   KL_TRC_EXIT;
 }
 
 /// @brief Unlock a previously locked kernel spinlock.
 ///
-/// No checking is performed to ensure the owner is the one doing the unlocking.
+/// No checking is performed to ensure the owner is the one doing the unlocking. Unlocking a lock that isn't locked has
+/// no effect.
 ///
 /// @param[in] lock The lock to unlock.
 void klib_synch_spinlock_unlock(kernel_spinlock &lock)
 {
   KL_TRC_ENTRY;
 
-  lock = 0;
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_released(&lock);
+#endif
+
+  lock.store(0, std::memory_order_release);
 
   KL_TRC_EXIT;
 }
@@ -62,17 +108,266 @@ bool klib_synch_spinlock_try_lock(kernel_spinlock &lock)
   KL_TRC_ENTRY;
 
   bool res;
-  uint64_t expected = 0;
-  uint64_t desired = 1;
-  std::atomic_compare_exchange_weak(&lock, &expected, desired);
 
-  res = (expected == 0);
+  res = (lock.load(std::memory_order_relaxed) == 0) && (lock.exchange(1, std::memory_order_acquire) == 0);
+
+#ifdef KERNEL_LOCKSTAT
+  if (res)
+  {
+    klib_lockstat_acquired(&lock, LOCKSTAT_CALLER(), LOCKSTAT_KIND::SPINLOCK, false, 0);
+  }
+#endif
 
   KL_TRC_EXIT;
 
   return res;
 }
 
+/// @brief Is a spinlock locked?
+///
+/// The result may be out of date as soon as it is returned, unless the caller holds the lock.
+///
+/// @param[in] lock The lock to check.
+///
+/// @return True if the lock is held by any thread, false otherwise.
+bool klib_synch_spinlock_is_locked(kernel_spinlock &lock)
+{
+  return (lock.load(std::memory_order_relaxed) != 0);
+}
+
+/// @brief Initialise a queued spinlock.
+///
+/// @param[in] lock The lock to initialise.
+void klib_synch_mcs_init(kernel_mcs_lock &lock)
+{
+  KL_TRC_ENTRY;
+
+  lock = nullptr;
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Acquire and lock a queued spinlock.
+///
+/// This function will not return until it has locked the lock. Threads waiting for the lock acquire it in the order
+/// they called this function, and each waits by spinning on its own node.
+///
+/// Interrupts are disabled until klib_synch_mcs_unlock() is called. Otherwise a waiting thread could be preempted, and
+/// the threads queued behind it would have to wait until it had run again, even if the lock had been released.
+///
+/// @param[in] lock The lock to lock.
+///
+/// @param[in] node A node for this thread to queue with. It must stay valid until klib_synch_mcs_unlock() is called.
+void klib_synch_mcs_lock(kernel_mcs_lock &lock, kernel_mcs_node &node)
+{
+  KL_TRC_ENTRY;
+
+  kernel_mcs_node *prev;
+
+#ifdef KERNEL_LOCKSTAT
+  uint64_t start = klib_lockstat_now();
+#endif
+
+  node.saved_flags = proc_save_and_stop_interrupts();
+  node.next.store(nullptr, std::memory_order_relaxed);
+  node.waiting.store(true, std::memory_order_relaxed);
+
+  prev = lock.exchange(&node, std::memory_order_acq_rel);
+  if (prev != nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Queue behind ", prev, "\n");
+    prev->next.store(&node, std::memory_order_release);
+    while (node.waiting.load(std::memory_order_acquire))
+    {
+      spin_pause();
+    }
+  }
+
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_acquired(&lock, LOCKSTAT_CALLER(), LOCKSTAT_KIND::MCS, (prev != nullptr), start);
+#endif
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Unlock a queued spinlock, handing it to the next waiting thread if there is one.
+///
+/// Interrupts are restored to the state they were in before klib_synch_mcs_lock() was called.
+///
+/// @param[in] lock The lock to unlock. It must be held by this thread.
+///
+/// @param[in] node The node that was given to klib_synch_mcs_lock().
+void klib_synch_mcs_unlock(kernel_mcs_lock &lock, kernel_mcs_node &node)
+{
+  KL_TRC_ENTRY;
+
+  kernel_mcs_node *next;
+  kernel_mcs_node *expected;
+
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_released(&lock);
+#endif
+
+  next = node.next.load(std::memory_order_acquire);
+  if (next == nullptr)
+  {
+    expected = &node;
+    if (lock.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "No waiters\n");
+      proc_restore_interrupts(node.saved_flags);
+      KL_TRC_EXIT;
+      return;
+    }
+
+    // Another thread has joined the queue, but hasn't linked itself to this node yet.
+    do
+    {
+      spin_pause();
+      next = node.next.load(std::memory_order_acquire);
+    } while (next == nullptr);
+  }
+
+  next->waiting.store(false, std::memory_order_release);
+  proc_restore_interrupts(node.saved_flags);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Initialise a reader-writer spinlock.
+///
+/// @param[in] lock The lock to initialise.
+void klib_synch_rwlock_init(kernel_rwlock &lock)
+{
+  KL_TRC_ENTRY;
+
+  lock = 0;
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Lock a reader-writer spinlock for reading.
+///
+/// This function will not return until it has locked the lock. Other readers may hold the lock at the same time.
+///
+/// @param[in] lock The lock to lock.
+void klib_synch_rwlock_lock_read(kernel_rwlock &lock)
+{
+  KL_TRC_ENTRY;
+
+  uint64_t old_val = lock.load(std::memory_order_relaxed);
+
+#ifdef KERNEL_LOCKSTAT
+  uint64_t start = klib_lockstat_now();
+  bool contended = false;
+#endif
+
+  while (true)
+  {
+    if ((old_val & (RW_WRITER_HELD | RW_WRITER_WAITING)) != 0)
+    {
+#ifdef KERNEL_LOCKSTAT
+      contended = true;
+#endif
+      spin_pause();
+      old_val = lock.load(std::memory_order_relaxed);
+    }
+    else if (lock.compare_exchange_weak(old_val, old_val + 1, std::memory_order_acquire, std::memory_order_relaxed))
+    {
+      break;
+    }
+  }
+
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_acquired(&lock, LOCKSTAT_CALLER(), LOCKSTAT_KIND::RW_READ, contended, start);
+#endif
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Unlock a reader-writer spinlock that this thread locked for reading.
+///
+/// @param[in] lock The lock to unlock.
+void klib_synch_rwlock_unlock_read(kernel_rwlock &lock)
+{
+  KL_TRC_ENTRY;
+
+  ASSERT((lock.load(std::memory_order_relaxed) & ~(RW_WRITER_HELD | RW_WRITER_WAITING)) != 0);
+
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_released(&lock);
+#endif
+
+  lock.fetch_sub(1, std::memory_order_release);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Lock a reader-writer spinlock for writing.
+///
+/// This function will not return until it has locked the lock, and no other thread holds it.
+///
+/// @param[in] lock The lock to lock.
+void klib_synch_rwlock_lock_write(kernel_rwlock &lock)
+{
+  KL_TRC_ENTRY;
+
+  uint64_t old_val = lock.load(std::memory_order_relaxed);
+
+#ifdef KERNEL_LOCKSTAT
+  uint64_t start = klib_lockstat_now();
+  bool contended = false;
+#endif
+
+  while (true)
+  {
+    if ((old_val & ~RW_WRITER_WAITING) == 0)
+    {
+      // Taking the lock clears the waiting flag. Any other waiting writer sets it again the next time it checks.
+      if (lock.compare_exchange_weak(old_val, RW_WRITER_HELD, std::memory_order_acquire, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else
+    {
+#ifdef KERNEL_LOCKSTAT
+      contended = true;
+#endif
+      if ((old_val & RW_WRITER_WAITING) == 0)
+      {
+        lock.fetch_or(RW_WRITER_WAITING, std::memory_order_relaxed);
+      }
+      spin_pause();
+      old_val = lock.load(std::memory_order_relaxed);
+    }
+  }
+
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_acquired(&lock, LOCKSTAT_CALLER(), LOCKSTAT_KIND::RW_WRITE, contended, start);
+#endif
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Unlock a reader-writer spinlock that this thread locked for writing.
+///
+/// @param[in] lock The lock to unlock.
+void klib_synch_rwlock_unlock_write(kernel_rwlock &lock)
+{
+  KL_TRC_ENTRY;
+
+  ASSERT((lock.load(std::memory_order_relaxed) & RW_WRITER_HELD) != 0);
+
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_released(&lock);
+#endif
+
+  lock.fetch_and(~RW_WRITER_HELD, std::memory_order_release);
+
+  KL_TRC_EXIT;
+}
+
 /// @brief Basic constructor for kernel spinlock wrapper objects.
 ///
 kernel_spinlock_obj::kernel_spinlock_obj()
@@ -90,7 +385,7 @@ kernel_spinlock_obj::~kernel_spinlock_obj()
 {
   KL_TRC_ENTRY;
 
-  if(underlying_lock != 0)
+  if(klib_synch_spinlock_is_locked(underlying_lock))
   {
     klib_synch_spinlock_unlock(underlying_lock);
   }
@@ -119,3 +414,25 @@ void kernel_spinlock_obj::unlock()
 
   KL_TRC_EXIT;
 }
+
+namespace
+{
+  /// @brief Tell the processor that this thread is spinning while waiting for a lock.
+  ///
+  /// This saves power, and avoids a memory order violation penalty when the lock is released.
+  void spin_pause()
+  {
+    asm volatile("pause");
+
+#ifdef AZALEA_TEST_CODE
+    // Test threads share the host's processors with everything else, so the thread that is next in line for a lock
+    // may not be running. Every so often, give it the chance to.
+    static thread_local uint32_t spins = 0;
+    spins++;
+    if ((spins % 128) == 0)
+    {
+      std::this_thread::yield();
+    }
+#endif
+  }
+}
@@ -6,12 +6,60 @@
 #include <stdint.h>
 #include <atomic>
 
-typedef std::atomic<uint64_t> kernel_spinlock; ///< Kernel spinlock type.
+/// @brief Kernel spinlock type.
+///
+/// This is a test-and-set lock, so waiting threads acquire the lock in no particular order. It holds 1 while locked
+/// and 0 while free.
+typedef std::atomic<uint64_t> kernel_spinlock;
 
 void klib_synch_spinlock_init(kernel_spinlock &lock);
 extern "C" void klib_synch_spinlock_lock(kernel_spinlock &lock);
 bool klib_synch_spinlock_try_lock(kernel_spinlock &lock);
 extern "C" void klib_synch_spinlock_unlock(kernel_spinlock &lock);
+bool klib_synch_spinlock_is_locked(kernel_spinlock &lock);
+
+/// @brief A thread's place in the queue waiting for a kernel_mcs_lock.
+///
+/// The thread locking the lock provides the node, normally on its own stack. The node must remain valid, and be given
+/// to klib_synch_mcs_unlock(), until the lock is released.
+struct kernel_mcs_node
+{
+  /// The thread that joined the queue after this one, if there is one yet.
+  std::atomic<kernel_mcs_node *> next;
+
+  /// Set while the owning thread waits for the lock. The previous holder clears it to hand the lock over.
+  std::atomic<bool> waiting;
+
+  /// The owning thread's interrupt state before it locked the lock, restored when it unlocks the lock.
+  uint64_t saved_flags;
+};
+
+/// @brief A queued (MCS) spinlock.
+///
+/// Each waiting thread spins on its own kernel_mcs_node, rather than on the lock itself, and the lock is handed from
+/// one thread to the next in the order they asked for it. Interrupts are disabled while a thread waits for or holds
+/// the lock, so the critical section must be short and must not block. This is better than kernel_spinlock for locks
+/// that are heavily contended by many processors. The lock points at the last node in the queue, or is nullptr if it
+/// is free.
+typedef std::atomic<kernel_mcs_node *> kernel_mcs_lock;
+
+void klib_synch_mcs_init(kernel_mcs_lock &lock);
+void klib_synch_mcs_lock(kernel_mcs_lock &lock, kernel_mcs_node &node);
+void klib_synch_mcs_unlock(kernel_mcs_lock &lock, kernel_mcs_node &node);
+
+/// @brief A reader-writer spinlock.
+///
+/// Any number of readers can hold the lock at once, or a single writer. A writer waiting for the lock stops new readers
+/// from taking it, so that a steady stream of readers can't hold off writers forever. The top bit is set while a writer
+/// holds the lock, the next bit while a writer waits for it, and the remaining bits count the readers holding it. A
+/// value of zero is a free lock.
+typedef std::atomic<uint64_t> kernel_rwlock;
+
+void klib_synch_rwlock_init(kernel_rwlock &lock);
+void klib_synch_rwlock_lock_read(kernel_rwlock &lock);
+void klib_synch_rwlock_unlock_read(kernel_rwlock &lock);
+void klib_synch_rwlock_lock_write(kernel_rwlock &lock);
+void klib_synch_rwlock_unlock_write(kernel_rwlock &lock);
 
 /// @brief Standard results for attempting to lock any synch object.
 ///
@@ -0,0 +1,305 @@
+/// @file
+/// @brief Implements lock contention statistics (lockstat).
+///
+/// Statistics are kept in a fixed-size table of acquisition sites, so that recording them never allocates memory or
+/// takes a lock - both of which would be awkward from inside the lock functions. Sites claim an entry in the table the
+/// first time they acquire a lock, using open addressing.
+///
+/// To work out how long a lock was held for, the time it was acquired is kept in a second table, of held locks, until
+/// it is released. A reader-writer lock may have several readers at once, so it can have several entries in that
+/// table, and each release claims whichever of them it finds first.
+//
+// Known defects:
+// - Once the table of sites is full, acquisitions from new sites aren't recorded.
+// - If too many locks are held at once, some hold times aren't recorded.
+// - Locks taken through wrappers, such as kernel_spinlock_obj, are all recorded against the wrapper.
+// - Reading the statistics while locks are in use gives a snapshot whose counts may not quite agree with each other.
+// - When several readers hold the same reader-writer lock, a reader's hold time may be measured from another reader's
+//   acquisition.
+
+//#define ENABLE_TRACING
+
+#ifdef KERNEL_LOCKSTAT
+
+#include "klib/klib.h"
+#include "klib/synch/kernel_lockstat.h"
+
+#include <atomic>
+#include <algorithm>
+
+namespace
+{
+  /// The number of locks whose hold times can be tracked at once. Must be a power of two.
+  const uint64_t LOCKSTAT_MAX_HELD = 1024;
+
+  /// How far to search the tables for a free or matching entry before giving up.
+  const uint64_t LOCKSTAT_MAX_PROBES = 16;
+
+  /// Marks an entry in the held locks table that is being filled in, so that it can't be released until it's complete.
+  const void * const LOCKSTAT_CLAIMING = reinterpret_cast<const void *>(1);
+
+  /// @brief The statistics for one acquisition site. All fields only ever increase until reset.
+  struct lockstat_site
+  {
+    std::atomic<const void *> site; ///< The acquisition site, or nullptr if this entry is unused.
+    std::atomic<LOCKSTAT_KIND> kind; ///< The kind of lock acquired at this site.
+    std::atomic<uint64_t> acquisitions; ///< See klib_lockstat_entry.
+    std::atomic<uint64_t> contentions; ///< See klib_lockstat_entry.
+    std::atomic<uint64_t> wait_cycles; ///< See klib_lockstat_entry.
+    std::atomic<uint64_t> hold_cycles; ///< See klib_lockstat_entry.
+    std::atomic<uint64_t> max_hold_cycles; ///< See klib_lockstat_entry.
+  };
+
+  /// @brief A lock that is currently held.
+  struct lockstat_held
+  {
+    std::atomic<const void *> lock; ///< The held lock, or nullptr if this entry is unused.
+    lockstat_site *site; ///< The site the lock was acquired from.
+    uint64_t acquired_at; ///< The time the lock was acquired.
+  };
+
+  lockstat_site sites[LOCKSTAT_MAX_SITES];
+  lockstat_held held_locks[LOCKSTAT_MAX_HELD];
+
+  uint64_t hash_address(const void *addr);
+  lockstat_site *find_site(const void *site, LOCKSTAT_KIND kind);
+  void update_max(std::atomic<uint64_t> &max, uint64_t value);
+}
+
+/// @brief Read the processor's cycle counter, for timing lock operations.
+///
+/// @return The current cycle count.
+uint64_t klib_lockstat_now()
+{
+  uint32_t low;
+  uint32_t high;
+
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+  return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+/// @brief Record that a lock has been acquired.
+///
+/// @param lock The lock that was acquired.
+///
+/// @param site The address the lock was acquired from.
+///
+/// @param kind The kind of lock.
+///
+/// @param contended Whether the lock had to wait for another holder.
+///
+/// @param start The time the attempt to acquire the lock started, from klib_lockstat_now().
+void klib_lockstat_acquired(const void *lock, const void *site, LOCKSTAT_KIND kind, bool contended, uint64_t start)
+{
+  uint64_t now = klib_lockstat_now();
+  lockstat_site *entry = find_site(site, kind);
+  uint64_t slot = hash_address(lock);
+  const void *expected;
+
+  if (entry != nullptr)
+  {
+    entry->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    if (contended)
+    {
+      entry->contentions.fetch_add(1, std::memory_order_relaxed);
+      entry->wait_cycles.fetch_add(now - start, std::memory_order_relaxed);
+    }
+
+    for (uint64_t i = 0; i < LOCKSTAT_MAX_PROBES; i++, slot++)
+    {
+      lockstat_held &held = held_locks[slot % LOCKSTAT_MAX_HELD];
+      expected = nullptr;
+      if (held.lock.compare_exchange_strong(expected, LOCKSTAT_CLAIMING, std::memory_order_acquire))
+      {
+        held.site = entry;
+        held.acquired_at = now;
+        held.lock.store(lock, std::memory_order_release);
+        break;
+      }
+    }
+  }
+}
+
+/// @brief Record that a lock is being released.
+///
+/// This must be called before the lock is actually released, while the caller still holds it. Locks whose acquisition
+/// wasn't recorded are ignored.
+///
+/// @param lock The lock being released.
+void klib_lockstat_released(const void *lock)
+{
+  uint64_t slot = hash_address(lock);
+  uint64_t held_for;
+  lockstat_site *site;
+  uint64_t acquired_at;
+  const void *expected;
+
+  for (uint64_t i = 0; i < LOCKSTAT_MAX_PROBES; i++, slot++)
+  {
+    lockstat_held &held = held_locks[slot % LOCKSTAT_MAX_HELD];
+    if (held.lock.load(std::memory_order_acquire) == lock)
+    {
+      site = held.site;
+      acquired_at = held.acquired_at;
+
+      // Another reader of the same lock may release this entry first, in which case keep looking.
+      expected = lock;
+      if (held.lock.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel))
+      {
+        held_for = klib_lockstat_now() - acquired_at;
+        site->hold_cycles.fetch_add(held_for, std::memory_order_relaxed);
+        update_max(site->max_hold_cycles, held_for);
+        break;
+      }
+    }
+  }
+}
+
+/// @brief Copy the statistics of the busiest acquisition sites.
+///
+/// Sites are sorted by the total time spent waiting at them, most first, then by the number of contended
+/// acquisitions, so that the locks serialising the system most come at the top.
+///
+/// @param entries Storage for the statistics. Must have space for max_entries entries.
+///
+/// @param max_entries The maximum number of entries to copy.
+///
+/// @return The number of entries copied.
+uint64_t klib_lockstat_snapshot(klib_lockstat_entry *entries, uint64_t max_entries)
+{
+  KL_TRC_ENTRY;
+
+  klib_lockstat_entry *all_entries = new klib_lockstat_entry[LOCKSTAT_MAX_SITES];
+  uint64_t count = 0;
+
+  ASSERT((entries != nullptr) || (max_entries == 0));
+
+  for (uint64_t i = 0; i < LOCKSTAT_MAX_SITES; i++)
+  {
+    lockstat_site &site = sites[i];
+    if (site.site.load(std::memory_order_acquire) != nullptr)
+    {
+      all_entries[count].site = site.site.load(std::memory_order_relaxed);
+      all_entries[count].kind = site.kind.load(std::memory_order_relaxed);
+      all_entries[count].acquisitions = site.acquisitions.load(std::memory_order_relaxed);
+      all_entries[count].contentions = site.contentions.load(std::memory_order_relaxed);
+      all_entries[count].wait_cycles = site.wait_cycles.load(std::memory_order_relaxed);
+      all_entries[count].hold_cycles = site.hold_cycles.load(std::memory_order_relaxed);
+      all_entries[count].max_hold_cycles = site.max_hold_cycles.load(std::memory_order_relaxed);
+      count++;
+    }
+  }
+
+  std::sort(all_entries,
+            all_entries + count,
+            [](const klib_lockstat_entry &a, const klib_lockstat_entry &b)
+            {
+              return (a.wait_cycles > b.wait_cycles) ||
+                     ((a.wait_cycles == b.wait_cycles) && (a.contentions > b.contentions));
+            });
+
+  if (count > max_entries)
+  {
+    count = max_entries;
+  }
+  std::copy(all_entries, all_entries + count, entries);
+
+  delete[] all_entries;
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Entries: ", count, "\n");
+  KL_TRC_EXIT;
+
+  return count;
+}
+
+/// @brief Reset all statistics to zero.
+///
+/// Locks currently held keep their acquisition times, so their hold times are still recorded when they are released.
+void klib_lockstat_reset()
+{
+  KL_TRC_ENTRY;
+
+  for (uint64_t i = 0; i < LOCKSTAT_MAX_SITES; i++)
+  {
+    sites[i].acquisitions = 0;
+    sites[i].contentions = 0;
+    sites[i].wait_cycles = 0;
+    sites[i].hold_cycles = 0;
+    sites[i].max_hold_cycles = 0;
+  }
+
+  KL_TRC_EXIT;
+}
+
+namespace
+{
+  /// @brief Choose where to start searching a table for an address.
+  ///
+  /// @param addr The address to hash.
+  ///
+  /// @return A hash of the address. Callers reduce it to the size of their table.
+  uint64_t hash_address(const void *addr)
+  {
+    // Locks and call sites are at least a few bytes apart, so the lowest bits carry little information. Multiplying by
+    // a large odd constant mixes the rest into the top bits.
+    return (reinterpret_cast<uint64_t>(addr) * 0x9E3779B97F4A7C15ULL) >> 40;
+  }
+
+  /// @brief Find the entry for an acquisition site, claiming a new one if needed.
+  ///
+  /// @param site The acquisition site.
+  ///
+  /// @param kind The kind of lock acquired at the site.
+  ///
+  /// @return The site's entry, or nullptr if the table is too full to add it.
+  lockstat_site *find_site(const void *site, LOCKSTAT_KIND kind)
+  {
+    uint64_t slot = hash_address(site);
+    lockstat_site *result = nullptr;
+    const void *expected;
+
+    for (uint64_t i = 0; i < LOCKSTAT_MAX_PROBES; i++, slot++)
+    {
+      lockstat_site &entry = sites[slot % LOCKSTAT_MAX_SITES];
+      expected = entry.site.load(std::memory_order_acquire);
+
+      if (expected == site)
+      {
+        result = &entry;
+        break;
+      }
+      else if ((expected == nullptr) && entry.site.compare_exchange_strong(expected, site))
+      {
+        entry.kind = kind;
+        result = &entry;
+        break;
+      }
+      else if (expected == site)
+      {
+        // Another thread claimed this entry for the same site at the same time.
+        result = &entry;
+        break;
+      }
+    }
+
+    return result;
+  }
+
+  /// @brief Atomically raise a maximum to a new value, if the new value is larger.
+  ///
+  /// @param max The maximum to update.
+  ///
+  /// @param value The new value.
+  void update_max(std::atomic<uint64_t> &max, uint64_t value)
+  {
+    uint64_t old_max = max.load(std::memory_order_relaxed);
+
+    while ((value > old_max) && !max.compare_exchange_weak(old_max, value, std::memory_order_relaxed))
+    {
+      // old_max has been updated, so just try again.
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,51 @@
+/// @file
+/// @brief Declares lock contention statistics (lockstat).
+///
+/// When the kernel is built with KERNEL_LOCKSTAT defined, spinlocks of all kinds and mutexes record how often they are
+/// acquired, how often they had to wait, how long they waited for and how long they were held. The statistics are kept
+/// per acquisition site - the address the lock was taken from - so that all locks of the same kind taken by the same
+/// code are counted together. Times are in processor cycles.
+///
+/// Without KERNEL_LOCKSTAT, none of this is compiled in and locks don't pay anything for it.
+
+#pragma once
+
+#ifdef KERNEL_LOCKSTAT
+
+#include <stdint.h>
+
+/// @brief The address that the current function will return to, used as a lock's acquisition site.
+#define LOCKSTAT_CALLER() __builtin_return_address(0)
+
+/// The number of acquisition sites that can be recorded. Must be a power of two.
+const uint64_t LOCKSTAT_MAX_SITES = 1024;
+
+/// @brief The kinds of lock that lockstat records.
+enum class LOCKSTAT_KIND
+{
+  SPINLOCK, ///< A kernel_spinlock.
+  MUTEX, ///< A klib_mutex.
+  MCS, ///< A kernel_mcs_lock.
+  RW_READ, ///< A kernel_rwlock, locked for reading.
+  RW_WRITE, ///< A kernel_rwlock, locked for writing.
+};
+
+/// @brief The statistics recorded for one acquisition site.
+struct klib_lockstat_entry
+{
+  const void *site; ///< The address the lock was acquired from.
+  LOCKSTAT_KIND kind; ///< The kind of lock acquired there.
+  uint64_t acquisitions; ///< The number of times a lock was acquired there.
+  uint64_t contentions; ///< The number of those acquisitions that had to wait for another holder.
+  uint64_t wait_cycles; ///< The total number of cycles spent waiting.
+  uint64_t hold_cycles; ///< The total number of cycles the lock was held for, after being acquired there.
+  uint64_t max_hold_cycles; ///< The longest time the lock was held for, after being acquired there.
+};
+
+uint64_t klib_lockstat_now();
+void klib_lockstat_acquired(const void *lock, const void *site, LOCKSTAT_KIND kind, bool contended, uint64_t start);
+void klib_lockstat_released(const void *lock);
+uint64_t klib_lockstat_snapshot(klib_lockstat_entry *entries, uint64_t max_entries);
+void klib_lockstat_reset();
+
+#endif
@@ -1,11 +1,53 @@
 /// @file
 /// @brief KLIB mutex implementation.
+///
+/// Mutexes are adaptive. A thread that finds the mutex locked by a thread running on another processor spins for a
+/// short while first, since the owner may well release it before a sleep and wake up could complete. Otherwise, the
+/// thread joins the mutex's queue and sleeps until the mutex is handed to it.
+///
+/// A thread that owns a mutex inherits the priority of the threads sleeping while waiting for it, so that it can't be
+/// kept from running by threads of a priority in between. The inherited priority is passed along the chain, if the
+/// owner is itself waiting for another mutex, to a limited depth. All priority inheritance state - which mutex each
+/// thread waits for, which mutexes with waiters each thread owns, and the lists of waiting threads - is only changed
+/// while holding pi_lock as well as any mutex's own lock, so that chains can be followed without taking the lock of
+/// each mutex in them.
+///
+/// If the kernel is built with KERNEL_LOCKSTAT, mutexes record contention statistics - see kernel_lockstat.h.
+//
+// Known defects:
+// - pi_lock is shared by all mutexes, so threads that are waiting for, or handing over, different mutexes contend for
+//   it. It isn't needed when a mutex is acquired or released without waiting.
+// - Chains of owners waiting for other mutexes longer than MUTEX_MAX_PI_DEPTH don't pass on priority to the end.
+// - Changing the priority of a thread that is already waiting for a mutex doesn't change the owner's inherited
+//   priority until that is next recalculated.
+// - A spinning thread checks whether the owner is still running by comparing it to each processor's current thread,
+//   without holding a reference to it. If the owner is destroyed and a new thread is created at the same address and
+//   starts running, the spinning thread may spin until MUTEX_MAX_SPINS is reached instead of sleeping straight away.
 
 //#define ENABLE_TRACING
 
 #include "processor/processor.h"
 #include "processor/timing/timing.h"
 #include "klib/klib.h"
+#include "klib/synch/kernel_lockstat.h"
+
+namespace
+{
+  // The maximum number of times to check a locked mutex while spinning, before sleeping instead.
+  const uint32_t MUTEX_MAX_SPINS = 1000;
+
+  // The maximum number of owners that an inherited priority is passed along, when owners are themselves waiting for
+  // other mutexes. This limits the time spent with pi_lock held, and the damage done by chains that deadlock.
+  const uint32_t MUTEX_MAX_PI_DEPTH = 8;
+
+  // Protects the priority inheritance state of all mutexes and threads. Taken after the lock of any mutex.
+  kernel_spinlock pi_lock{0};
+
+  void spin_on_owner(klib_mutex &mutex, task_thread *owner);
+  void pi_add_waiter(klib_mutex &mutex, task_thread *waiter);
+  void pi_remove_waiter(klib_mutex &mutex, task_thread *waiter);
+  void pi_update_chain(task_thread *thread);
+}
 
 /// @brief Initialize a mutex object.
 ///
@@ -22,6 +64,8 @@ void klib_synch_mutex_init(klib_mutex &mutex)
   mutex.mutex_locked = false;
   mutex.owner_thread = nullptr;
   klib_list_initialize(&mutex.waiting_threads_list);
+  klib_list_item_initialize(&mutex.pi_item);
+  mutex.pi_item.item = &mutex;
 
   klib_synch_spinlock_unlock(mutex.access_lock);
 
@@ -30,8 +74,9 @@ void klib_synch_mutex_init(klib_mutex &mutex)
 
 /// @brief Acquire the mutex for the currently running thread.
 ///
-/// It is permissible for a thread to call this function when it already owns the mutex - nothing happens. Threads
-/// acquire the mutex in order that they call this function.
+/// It is permissible for a thread to call this function when it already owns the mutex - nothing happens. Threads that
+/// have to sleep while waiting for the mutex acquire it in the order they called this function. A thread that spins
+/// instead can only take the mutex when no threads are sleeping, so it can't overtake them.
 ///
 /// @param mutex The mutex to acquire.
 ///
@@ -45,6 +90,11 @@ void klib_synch_mutex_init(klib_mutex &mutex)
 SYNC_ACQ_RESULT klib_synch_mutex_acquire(klib_mutex &mutex, uint64_t max_wait)
 {
   SYNC_ACQ_RESULT res = SYNC_ACQ_TIMEOUT;
+  task_thread *owner;
+#ifdef KERNEL_LOCKSTAT
+  uint64_t start = klib_lockstat_now();
+  bool contended = false;
+#endif
   klib_synch_spinlock_lock(mutex.access_lock);
   KL_TRC_ENTRY;
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Acquiring mutex ", &mutex, " in thread ", task_get_cur_thread(), "\n");
@@ -59,7 +109,7 @@ SYNC_ACQ_RESULT klib_synch_mutex_acquire(klib_mutex &mutex, uint64_t max_wait)
     KL_TRC_TRACE(TRC_LVL::FLOW, "Mutex unlocked, so acquire now.\n");
     mutex.mutex_locked = true;
     mutex.owner_thread = task_get_cur_thread();
-    KL_TRC_TRACE(TRC_LVL::EXTRA, "Locked in: ", task_get_cur_thread(), " (", mutex.owner_thread, ")\n");
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Locked in: ", task_get_cur_thread(), " (", mutex.owner_thread.load(), ")\n");
     res = SYNC_ACQ_ACQUIRED;
   }
   else if (max_wait == 0)
@@ -70,62 +120,99 @@ SYNC_ACQ_RESULT klib_synch_mutex_acquire(klib_mutex &mutex, uint64_t max_wait)
   else
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Mutex locked, timed or indefinite wait.\n");
+#ifdef KERNEL_LOCKSTAT
+    contended = true;
+#endif
 
-    // Wait for the mutex to become free. Add this thread to the list of waiting threads, then suspend this thread.
-    task_thread *this_thread = task_get_cur_thread();
-    ASSERT(this_thread != nullptr);
-    ASSERT(!klib_list_item_is_in_any_list(this_thread->synch_list_item));
-    ASSERT(this_thread->synch_list_item->item.get() == this_thread);
+    // If nobody is queued and the owner is running, it may release the mutex very soon - so spin for a while rather
+    // than going to sleep. The access lock can't be held while spinning, since the owner needs it to release the mutex.
+    owner = mutex.owner_thread;
+    ASSERT(owner != nullptr);
+    if (klib_list_is_empty(&mutex.waiting_threads_list) &&
+        (proc_mp_proc_count() > 1) &&
+        task_thread_is_running(owner))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Spin while owner ", owner, " is running\n");
+      klib_synch_spinlock_unlock(mutex.access_lock);
+      spin_on_owner(mutex, owner);
+      klib_synch_spinlock_lock(mutex.access_lock);
 
-    ASSERT(mutex.owner_thread != nullptr);
+      if (!mutex.mutex_locked)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Mutex freed while spinning, acquire now.\n");
+        mutex.mutex_locked = true;
+        mutex.owner_thread = task_get_cur_thread();
+        res = SYNC_ACQ_ACQUIRED;
+      }
+    }
 
-    klib_list_add_tail(&mutex.waiting_threads_list, this_thread->synch_list_item);
+    if (res != SYNC_ACQ_ACQUIRED)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Sleep until the mutex is handed over.\n");
 
-    // To avoid marking this thread as not being scheduled before freeing the lock - which would deadlock anyone else
-    // trying to use this mutex, stop scheduling for the time being.
-    task_continue_this_thread();
-    this_thread->stop_thread();
+      // Wait for the mutex to become free. Add this thread to the list of waiting threads, then suspend this thread.
+      task_thread *this_thread = task_get_cur_thread();
+      ASSERT(this_thread != nullptr);
+      ASSERT(!klib_list_item_is_in_any_list(&this_thread->mutex_wait_item));
+      ASSERT(this_thread->mutex_wait_item.item == this_thread);
 
-    // If there is a period to wait then specify it to the scheduler now. The scheduler won't react until after
-    // scheduling is resumed.
-    if (max_wait != MUTEX_MAX_WAIT)
-    {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "Set thread wakeup time\n");
-      this_thread->wake_thread_after = time_get_system_timer_count(true) + (1000 * max_wait);
-    }
+      ASSERT(mutex.owner_thread != nullptr);
 
-    // Freeing the lock means that we could immediately become the owner thread. That's OK, we'll check once we come
-    // back to this code after yielding.
-    klib_synch_spinlock_unlock(mutex.access_lock);
-
-    // Don't yield without resuming normal scheduling, otherwise we'll come straight back here without acquiring the
-    // mutex. Once task_yield is called, the scheduler won't resume this process because it has been removed from the
-    // running list by task_stop_thread.
-    task_resume_scheduling();
-    task_yield();
-
-    // We've been scheduled again! We should now own the mutex.
-    klib_synch_spinlock_lock(mutex.access_lock);
-    ASSERT(mutex.mutex_locked);
-    ASSERT((!(max_wait == MUTEX_MAX_WAIT)) || (mutex.owner_thread == this_thread));
-    if (mutex.owner_thread == this_thread)
-    {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "Acquired mutex: ", &mutex, " in thread ", task_get_cur_thread(), " (", this_thread, ")\n");
-      res = SYNC_ACQ_ACQUIRED;
-    }
-    else
-    {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "Failed to acquire mutex before timeout\n");
-      res = SYNC_ACQ_TIMEOUT;
-      klib_list_remove(this_thread->synch_list_item);
+      // Joining the queue passes this thread's priority on to the owner.
+      pi_add_waiter(mutex, this_thread);
+
+      // To avoid marking this thread as not being scheduled before freeing the lock - which would deadlock anyone else
+      // trying to use this mutex, stop scheduling for the time being.
+      task_continue_this_thread();
+      this_thread->stop_thread();
+
+      // If there is a period to wait then specify it to the scheduler now. The scheduler won't react until after
+      // scheduling is resumed.
+      if (max_wait != MUTEX_MAX_WAIT)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Set thread wakeup time\n");
+        this_thread->wake_thread_after = time_get_system_timer_count(true) + (1000 * max_wait);
+      }
+
+      // Freeing the lock means that we could immediately become the owner thread. That's OK, we'll check once we come
+      // back to this code after yielding.
+      klib_synch_spinlock_unlock(mutex.access_lock);
+
+      // Don't yield without resuming normal scheduling, otherwise we'll come straight back here without acquiring the
+      // mutex. Once task_yield is called, the scheduler won't resume this process because it has been removed from the
+      // running list by task_stop_thread.
+      task_resume_scheduling();
+      task_yield();
+
+      // We've been scheduled again! We should now own the mutex.
+      klib_synch_spinlock_lock(mutex.access_lock);
+      ASSERT(mutex.mutex_locked);
+      ASSERT((!(max_wait == MUTEX_MAX_WAIT)) || (mutex.owner_thread == this_thread));
+      if (mutex.owner_thread == this_thread)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Acquired mutex: ", &mutex, " in thread ", task_get_cur_thread(),
+                                    " (", this_thread, ")\n");
+        res = SYNC_ACQ_ACQUIRED;
+      }
+      else
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Failed to acquire mutex before timeout\n");
+        res = SYNC_ACQ_TIMEOUT;
+        pi_remove_waiter(mutex, this_thread);
+      }
     }
   }
 
   if (res == SYNC_ACQ_ACQUIRED)
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Mutex locked? ", mutex.mutex_locked, " Owner: ", mutex.owner_thread, "\n");
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Mutex locked? ", mutex.mutex_locked.load(),
+                                " Owner: ", mutex.owner_thread.load(), "\n");
     KL_TRC_TRACE(TRC_LVL::FLOW, "This thread: ", task_get_cur_thread(), "\n");
     ASSERT(mutex.mutex_locked && (mutex.owner_thread == task_get_cur_thread()));
+
+#ifdef KERNEL_LOCKSTAT
+    klib_lockstat_acquired(&mutex, LOCKSTAT_CALLER(), LOCKSTAT_KIND::MUTEX, contended, start);
+#endif
   }
   KL_TRC_EXIT;
   klib_synch_spinlock_unlock(mutex.access_lock);
@@ -147,13 +234,18 @@ void klib_synch_mutex_release(klib_mutex &mutex, const bool disregard_owner)
   klib_synch_spinlock_lock(mutex.access_lock);
   KL_TRC_ENTRY;
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Releasing mutex ", &mutex, " from thread ", task_get_cur_thread(), "\n");
-  KL_TRC_TRACE(TRC_LVL::EXTRA, "Owner thread: ", mutex.owner_thread, "\n");
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Owner thread: ", mutex.owner_thread.load(), "\n");
 
-  klib_list_item<std::shared_ptr<task_thread>> *next_owner;
+  klib_list_item<task_thread *> *next_owner;
+  task_thread *old_owner;
 
   ASSERT(mutex.mutex_locked);
   ASSERT((disregard_owner) || (mutex.owner_thread == task_get_cur_thread()));
 
+#ifdef KERNEL_LOCKSTAT
+  klib_lockstat_released(&mutex);
+#endif
+
   next_owner = mutex.waiting_threads_list.head;
   if (next_owner == nullptr)
   {
@@ -165,11 +257,207 @@ void klib_synch_mutex_release(klib_mutex &mutex, const bool disregard_owner)
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Getting next owner from the head of list\n");
     KL_TRC_TRACE(TRC_LVL::EXTRA, "Next owner is", next_owner->item, "\n");
-    mutex.owner_thread = next_owner->item.get();
+
+    // The old owner gives up whatever it inherited through this mutex, and the new owner inherits from the threads
+    // still waiting.
+    klib_synch_spinlock_lock(pi_lock);
+    old_owner = mutex.owner_thread;
+    ASSERT(klib_list_item_is_in_any_list(&mutex.pi_item));
+    klib_list_remove(&mutex.pi_item);
+
+    mutex.owner_thread = next_owner->item;
     klib_list_remove(next_owner);
+    next_owner->item->pi_blocked_on = nullptr;
+    if (!klib_list_is_empty(&mutex.waiting_threads_list))
+    {
+      klib_list_add_tail(&next_owner->item->pi_held_mutexes, &mutex.pi_item);
+    }
+
+    pi_update_chain(next_owner->item);
+    pi_update_chain(old_owner);
+    klib_synch_spinlock_unlock(pi_lock);
+
     next_owner->item->start_thread();
   }
 
   KL_TRC_EXIT;
   klib_synch_spinlock_unlock(mutex.access_lock);
 }
+
+/// @brief Stop a thread waiting for a mutex, because the thread is being destroyed.
+///
+/// It is safe to call this for a thread that isn't waiting for a mutex.
+///
+/// @param thread The thread to remove from its mutex's queue.
+void klib_synch_mutex_cancel_wait(task_thread *thread)
+{
+  klib_mutex *mutex;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(thread != nullptr);
+
+  // The mutex can't be taken from pi_blocked_on under pi_lock, since each mutex's own lock must be taken first. But if
+  // the thread is still waiting for the mutex once its lock is held, pi_blocked_on can't change.
+  mutex = thread->pi_blocked_on;
+  if (mutex != nullptr)
+  {
+    klib_synch_spinlock_lock(mutex->access_lock);
+    if ((thread->pi_blocked_on == mutex) && klib_list_item_is_in_any_list(&thread->mutex_wait_item))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Remove from wait list of mutex ", mutex, "\n");
+      pi_remove_waiter(*mutex, thread);
+    }
+    klib_synch_spinlock_unlock(mutex->access_lock);
+  }
+
+  KL_TRC_EXIT;
+}
+
+namespace
+{
+  /// @brief Spin while a mutex stays locked by a thread that is running on another processor.
+  ///
+  /// @param mutex The mutex to watch.
+  ///
+  /// @param owner The thread that owned the mutex when spinning started.
+  void spin_on_owner(klib_mutex &mutex, task_thread *owner)
+  {
+    KL_TRC_ENTRY;
+
+    for (uint32_t i = 0; i < MUTEX_MAX_SPINS; i++)
+    {
+      if (!mutex.mutex_locked)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Mutex is free\n");
+        break;
+      }
+
+      // If the mutex has changed hands, another thread got there first. If the owner isn't running, it can't release
+      // the mutex until it has been scheduled again. Either way, it's better to sleep.
+      if ((mutex.owner_thread != owner) || !task_thread_is_running(owner))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Owner changed or stopped running\n");
+        break;
+      }
+
+      asm volatile("pause");
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Add a thread to the end of a mutex's queue, and pass its priority on to the owner.
+  ///
+  /// The mutex's lock must be held, and the mutex must be locked.
+  ///
+  /// @param mutex The mutex being waited for.
+  ///
+  /// @param waiter The thread that is going to wait.
+  void pi_add_waiter(klib_mutex &mutex, task_thread *waiter)
+  {
+    task_thread *owner = mutex.owner_thread;
+
+    KL_TRC_ENTRY;
+
+    ASSERT(owner != nullptr);
+
+    klib_synch_spinlock_lock(pi_lock);
+
+    klib_list_add_tail(&mutex.waiting_threads_list, &waiter->mutex_wait_item);
+    waiter->pi_blocked_on = &mutex;
+    if (!klib_list_item_is_in_any_list(&mutex.pi_item))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "First waiter for mutex ", &mutex, "\n");
+      klib_list_add_tail(&owner->pi_held_mutexes, &mutex.pi_item);
+    }
+    pi_update_chain(owner);
+
+    klib_synch_spinlock_unlock(pi_lock);
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Remove a thread from a mutex's queue without giving it the mutex, and recalculate the owner's priority.
+  ///
+  /// The mutex's lock must be held, and the mutex must be locked.
+  ///
+  /// @param mutex The mutex being waited for.
+  ///
+  /// @param waiter The thread that is giving up waiting.
+  void pi_remove_waiter(klib_mutex &mutex, task_thread *waiter)
+  {
+    task_thread *owner = mutex.owner_thread;
+
+    KL_TRC_ENTRY;
+
+    ASSERT(owner != nullptr);
+
+    klib_synch_spinlock_lock(pi_lock);
+
+    klib_list_remove(&waiter->mutex_wait_item);
+    waiter->pi_blocked_on = nullptr;
+    if (klib_list_is_empty(&mutex.waiting_threads_list) && klib_list_item_is_in_any_list(&mutex.pi_item))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Last waiter for mutex ", &mutex, "\n");
+      klib_list_remove(&mutex.pi_item);
+    }
+    pi_update_chain(owner);
+
+    klib_synch_spinlock_unlock(pi_lock);
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Recalculate the priority a thread inherits from the threads waiting for it.
+  ///
+  /// If the thread's priority changes and it is itself waiting for a mutex, that mutex's owner is recalculated too, and
+  /// so on along the chain for up to MUTEX_MAX_PI_DEPTH owners. pi_lock must be held.
+  ///
+  /// @param thread The thread to recalculate.
+  void pi_update_chain(task_thread *thread)
+  {
+    THREAD_PRIORITY inherited;
+    THREAD_PRIORITY old_priority;
+    klib_list_item<klib_mutex *> *held;
+    klib_list_item<task_thread *> *waiter;
+
+    KL_TRC_ENTRY;
+
+    for (uint32_t depth = 0; (thread != nullptr) && (depth < MUTEX_MAX_PI_DEPTH); depth++)
+    {
+      // Lower values are higher priorities, so BATCH means nothing has been inherited.
+      inherited = THREAD_PRIORITY::BATCH;
+      for (held = thread->pi_held_mutexes.head; held != nullptr; held = held->next)
+      {
+        for (waiter = held->item->waiting_threads_list.head; waiter != nullptr; waiter = waiter->next)
+        {
+          if (static_cast<uint32_t>(waiter->item->priority) < static_cast<uint32_t>(inherited))
+          {
+            inherited = waiter->item->priority;
+          }
+        }
+      }
+
+      if (inherited == thread->inherited_priority)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "No change at depth ", depth, "\n");
+        break;
+      }
+
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Thread ", thread, " inherits ", static_cast<uint32_t>(inherited), "\n");
+      old_priority = thread->priority;
+      task_set_inherited_priority(thread, inherited);
+      if ((thread->priority == old_priority) || (thread->pi_blocked_on == nullptr))
+      {
+        break;
+      }
+
+      // The owner of the mutex this thread waits for may inherit from it in turn. That mutex has waiters, so its owner
+      // can only change while pi_lock is held.
+      thread = thread->pi_blocked_on->owner_thread;
+    }
+
+    KL_TRC_EXIT;
+  }
+}
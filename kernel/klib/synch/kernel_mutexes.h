@@ -4,6 +4,7 @@
 #pragma once
 
 #include <memory>
+#include <atomic>
 
 #include "klib/synch/kernel_locks.h"
 #include "klib/data_structures/lists.h"
@@ -19,12 +20,20 @@ const uint64_t MUTEX_MAX_WAIT = 0xFFFFFFFFFFFFFFFF; ///< Constant defining an in
 /// synchronization.
 struct klib_mutex
 {
-  bool mutex_locked{false}; ///<Is the mutex locked by any process?
-  task_thread *owner_thread{nullptr}; ///< Which process has locked the thread?
+  /// Is the mutex locked by any thread? This is only changed while access_lock is held, but may be read without it.
+  std::atomic<bool> mutex_locked{false};
 
-  /// Which processes are waiting to grab this mutex?
-  ///
-  klib_list<std::shared_ptr<task_thread>> waiting_threads_list{nullptr, nullptr};
+  /// Which thread has locked the mutex? This is only changed while access_lock is held, but may be read without it.
+  std::atomic<task_thread *> owner_thread{nullptr};
+
+  /// Which threads are waiting to grab this mutex? The list is made of the threads' task_thread::mutex_wait_item
+  /// fields, so adding a thread to it doesn't need to allocate anything or take a reference to the thread. It is only
+  /// changed while both access_lock and the priority inheritance lock in kernel_mutexes.cpp are held.
+  klib_list<task_thread *> waiting_threads_list{nullptr, nullptr};
+
+  /// While other threads are waiting for this mutex, this item is in the owner's task_thread::pi_held_mutexes list, so
+  /// that the owner can inherit their priority. Protected by the priority inheritance lock in kernel_mutexes.cpp.
+  klib_list_item<klib_mutex *> pi_item{nullptr, nullptr, nullptr, nullptr};
 
   /// This lock is used to synchronize access to the fields in this structure.
   ///
@@ -34,3 +43,4 @@ struct klib_mutex
 void klib_synch_mutex_init(klib_mutex &mutex);
 SYNC_ACQ_RESULT klib_synch_mutex_acquire(klib_mutex &mutex, uint64_t max_wait);
 void klib_synch_mutex_release(klib_mutex &mutex, const bool disregard_owner);
+void klib_synch_mutex_cancel_wait(task_thread *thread);
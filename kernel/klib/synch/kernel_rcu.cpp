@@ -0,0 +1,164 @@
+/// @file
+/// @brief Implements a simple read-copy-update (RCU) mechanism.
+///
+/// Readers count themselves in and out of read-side sections using a pair of counters chosen by the parity of the
+/// domain's epoch. To wait for a grace period, a writer advances the epoch, so that new readers use the other pair of
+/// counters, and then waits until every reader counted in the old pair has been counted out again. Readers that start
+/// after the epoch advances can only see data published before it did, so the writer doesn't need to wait for them.
+///
+/// This is similar to sleepable RCU in Linux, in that the read-side counters are per-domain rather than being based on
+/// context switches. It is much simpler, though - there is no deferred freeing, and writers simply wait.
+//
+// Known defects:
+// - Each grace period waits for all readers in the domain, not just those using the data being updated.
+
+//#define ENABLE_TRACING
+
+#include "klib/klib.h"
+#include "klib/synch/kernel_rcu.h"
+#include "processor/processor.h"
+
+static_assert(RCU_SLOT_ALIGN == PROC_CACHE_LINE_SIZE, "RCU reader slots must fill whole cache lines");
+
+namespace
+{
+  uint64_t count_unfinished_readers(klib_rcu_domain &domain, uint64_t parity);
+}
+
+/// @brief Initialise an RCU domain.
+///
+/// @param domain The domain to initialise. There must be no readers or writers using it.
+void klib_rcu_init(klib_rcu_domain &domain)
+{
+  KL_TRC_ENTRY;
+
+  domain.epoch = 0;
+  klib_synch_spinlock_init(domain.sync_lock);
+
+  for (uint32_t i = 0; i < RCU_READER_SLOTS; i++)
+  {
+    for (uint32_t j = 0; j < 2; j++)
+    {
+      domain.slots[i].lock_count[j] = 0;
+      domain.slots[i].unlock_count[j] = 0;
+    }
+  }
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Start a read-side section.
+///
+/// Data protected by the domain that is found during the read-side section will not be freed until after the section
+/// has finished. The section mustn't wait for anything, since writers to the domain have to wait for it to finish.
+///
+/// @param domain The domain to read.
+///
+/// @return A token that must be passed to klib_rcu_read_unlock() at the end of the section.
+uint64_t klib_rcu_read_lock(klib_rcu_domain &domain)
+{
+  KL_TRC_ENTRY;
+
+  uint32_t slot = proc_mp_this_proc_id() % RCU_READER_SLOTS;
+  uint64_t epoch;
+  uint64_t parity;
+
+  while (true)
+  {
+    epoch = domain.epoch.load();
+    parity = epoch & 1;
+    domain.slots[slot].lock_count[parity].fetch_add(1);
+
+    // If the epoch has moved on, a writer might already have decided that there are no readers using this parity. So
+    // count this reader out again and use the new parity instead.
+    if (domain.epoch.load() == epoch)
+    {
+      break;
+    }
+
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Epoch changed, retry\n");
+    domain.slots[slot].unlock_count[parity].fetch_add(1);
+  }
+
+  KL_TRC_EXIT;
+
+  return (static_cast<uint64_t>(slot) << 1) | parity;
+}
+
+/// @brief Finish a read-side section.
+///
+/// The thread may have moved to a different processor since the section started, which is fine.
+///
+/// @param domain The domain being read.
+///
+/// @param token The token returned by klib_rcu_read_lock().
+void klib_rcu_read_unlock(klib_rcu_domain &domain, uint64_t token)
+{
+  KL_TRC_ENTRY;
+
+  ASSERT((token >> 1) < RCU_READER_SLOTS);
+  domain.slots[token >> 1].unlock_count[token & 1].fetch_add(1, std::memory_order_release);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Wait until all read-side sections that started before this call have finished.
+///
+/// After this returns, data that was unpublished before the call can be freed. This must not be called from within a
+/// read-side section of the same domain.
+///
+/// @param domain The domain to wait for.
+void klib_rcu_synchronize(klib_rcu_domain &domain)
+{
+  KL_TRC_ENTRY;
+
+  uint64_t old_parity;
+
+  klib_synch_spinlock_lock(domain.sync_lock);
+
+  old_parity = domain.epoch.fetch_add(1) & 1;
+  while (count_unfinished_readers(domain, old_parity) != 0)
+  {
+    task_yield();
+  }
+
+  klib_synch_spinlock_unlock(domain.sync_lock);
+
+  KL_TRC_EXIT;
+}
+
+namespace
+{
+  /// @brief How many readers that used the given parity haven't yet finished?
+  ///
+  /// @param domain The domain to check.
+  ///
+  /// @param parity The parity of the epoch the readers started in.
+  ///
+  /// @return The number of readers still in their read-side sections. This may be an overestimate if readers are
+  ///         starting or finishing at the same time, but never an underestimate for readers that started before the
+  ///         epoch last changed.
+  uint64_t count_unfinished_readers(klib_rcu_domain &domain, uint64_t parity)
+  {
+    KL_TRC_ENTRY;
+
+    uint64_t unlocks = 0;
+    uint64_t locks = 0;
+
+    // Count the unlocks first. Any reader whose unlock is counted here must have had its lock counted before then, so
+    // it will also be counted in the locks below.
+    for (uint32_t i = 0; i < RCU_READER_SLOTS; i++)
+    {
+      unlocks += domain.slots[i].unlock_count[parity].load();
+    }
+    for (uint32_t i = 0; i < RCU_READER_SLOTS; i++)
+    {
+      locks += domain.slots[i].lock_count[parity].load();
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Locks: ", locks, ", unlocks: ", unlocks, "\n");
+    KL_TRC_EXIT;
+
+    return locks - unlocks;
+  }
+}
@@ -0,0 +1,54 @@
+/// @file
+/// @brief Declares a simple read-copy-update (RCU) mechanism for read-mostly data structures.
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#include "klib/synch/kernel_locks.h"
+
+/// @brief The number of reader slots in each RCU domain.
+///
+/// Readers are spread across the slots by processor, so that readers on different processors don't contend for the
+/// same cache line.
+const uint32_t RCU_READER_SLOTS = 16;
+
+/// @brief The alignment of each reader slot. This must match PROC_CACHE_LINE_SIZE, which can't be included here.
+const uint64_t RCU_SLOT_ALIGN = 64;
+
+/// @brief Counts the readers entering and leaving read-side sections using one slot of an RCU domain.
+///
+/// There is one pair of counts for each parity of the domain's epoch. Both counts only ever increase, so a reader that
+/// moves between processors during its read-side section can be counted in one slot and uncounted in another.
+struct alignas(RCU_SLOT_ALIGN) klib_rcu_reader_slot
+{
+  /// The number of read-side sections started in each epoch parity.
+  std::atomic<uint64_t> lock_count[2]{ {0}, {0} };
+
+  /// The number of read-side sections finished in each epoch parity.
+  std::atomic<uint64_t> unlock_count[2]{ {0}, {0} };
+};
+
+/// @brief A group of data structures protected by RCU.
+///
+/// Readers of the data structures call klib_rcu_read_lock() and klib_rcu_read_unlock() around their accesses, and take
+/// no locks. Writers publish updated copies of the data, and then call klib_rcu_synchronize() before freeing the
+/// copies that readers may still be using. Read-side sections should be short, and mustn't wait for anything, since
+/// writers wait for all of them to finish.
+struct klib_rcu_domain
+{
+  /// The current epoch. Its parity selects which counts new readers use.
+  std::atomic<uint64_t> epoch{0};
+
+  /// Serialises writers waiting for grace periods.
+  kernel_spinlock sync_lock{0};
+
+  /// The reader counts.
+  klib_rcu_reader_slot slots[RCU_READER_SLOTS];
+};
+
+void klib_rcu_init(klib_rcu_domain &domain);
+uint64_t klib_rcu_read_lock(klib_rcu_domain &domain);
+void klib_rcu_read_unlock(klib_rcu_domain &domain, uint64_t token);
+void klib_rcu_synchronize(klib_rcu_domain &domain);
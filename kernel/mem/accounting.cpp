@@ -0,0 +1,145 @@
+/// @file
+/// @brief Per-process memory accounting.
+///
+/// The counters themselves are stored in mem_process_info::stats, and are updated by the parts of the memory manager
+/// that allocate the relevant resources. The functions here deal with finding the right counters, charging resources
+/// allocated outside the memory manager, and checking limits.
+
+// Known defects:
+// - Limits are only checked before allocations made by system calls. Memory allocated by the kernel on behalf of a
+//   process (stacks for new threads, pages of mapped files) can exceed the limits.
+// - The check and the later allocation are not atomic, so two threads allocating at once can exceed the limits.
+
+//#define ENABLE_TRACING
+
+#include "klib/klib.h"
+#include "mem/mem.h"
+#include "mem/mem-int.h"
+#include "processor/processor.h"
+
+/// @brief Find the accounting counters for a process.
+///
+/// @param context The process to find counters for. If nullptr, use the current process - or the kernel, if there is
+///                no current process.
+///
+/// @return The counters for the selected process, or nullptr if that process has no memory information.
+mem_process_stats *mem_acct_get_stats(task_process *context)
+{
+  mem_process_stats *result = nullptr;
+  task_thread *cur_thread;
+
+  KL_TRC_ENTRY;
+
+  if (context == nullptr)
+  {
+    cur_thread = task_get_cur_thread();
+    if (cur_thread != nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Use current process\n");
+      context = cur_thread->parent_process.get();
+    }
+  }
+
+  if (context == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Use kernel counters\n");
+    result = &task0_entry.stats;
+  }
+  else if (context->mem_info != nullptr)
+  {
+    result = &context->mem_info->stats;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Stats: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Charge (or refund) a process for kernel heap allocated on its behalf.
+///
+/// @param context The process to charge. If nullptr, the current process is charged.
+///
+/// @param bytes The number of bytes to charge. Negative values refund previous charges.
+void mem_acct_charge_kernel_heap(task_process *context, int64_t bytes)
+{
+  mem_process_stats *stats;
+
+  KL_TRC_ENTRY;
+
+  stats = mem_acct_get_stats(context);
+  if (stats != nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Charge ", bytes, " bytes\n");
+    stats->kernel_heap_bytes += bytes;
+  }
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Would a process remain within its limits if it allocated more memory?
+///
+/// @param context The process to check. If nullptr, the current process is checked.
+///
+/// @param extra_virtual_pages The number of extra pages of virtual address space to be reserved.
+///
+/// @param extra_resident_pages The number of extra pages of physical RAM to be mapped.
+///
+/// @return True if the allocation is within the process's limits, false otherwise.
+bool mem_acct_within_limits(task_process *context, uint64_t extra_virtual_pages, uint64_t extra_resident_pages)
+{
+  bool result = true;
+  mem_process_stats *stats;
+  uint64_t limit;
+
+  KL_TRC_ENTRY;
+
+  stats = mem_acct_get_stats(context);
+  if (stats != nullptr)
+  {
+    limit = stats->virtual_limit_pages;
+    if ((limit != 0) && ((stats->virtual_pages + extra_virtual_pages) > limit))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Virtual limit exceeded\n");
+      result = false;
+    }
+
+    limit = stats->resident_limit_pages;
+    if ((limit != 0) && ((stats->resident_pages + extra_resident_pages) > limit))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Resident limit exceeded\n");
+      result = false;
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Set the memory limits for a process.
+///
+/// Setting a limit lower than the current usage doesn't release any memory, it simply prevents further allocations.
+///
+/// @param context The process to set limits for. If nullptr, the current process is used.
+///
+/// @param max_virtual_pages The maximum number of pages of virtual address space to reserve. Zero means no limit.
+///
+/// @param max_resident_pages The maximum number of pages of physical RAM to map. Zero means no limit.
+void mem_acct_set_limits(task_process *context, uint64_t max_virtual_pages, uint64_t max_resident_pages)
+{
+  mem_process_stats *stats;
+
+  KL_TRC_ENTRY;
+
+  stats = mem_acct_get_stats(context);
+  if (stats != nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Limits - virtual: ", max_virtual_pages, ", resident: ", max_resident_pages, "\n");
+    stats->virtual_limit_pages = max_virtual_pages;
+    stats->resident_limit_pages = max_resident_pages;
+  }
+
+  KL_TRC_EXIT;
+}
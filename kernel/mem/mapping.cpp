@@ -21,6 +21,32 @@ namespace
 
   /// A lock to protect the whole counter and release system.
   kernel_spinlock counter_lock;
+
+  /// @brief Find the accounting counters to update for a mapping.
+  ///
+  /// Pages in the upper half of the address space are shared by all processes, so are charged to the kernel.
+  ///
+  /// @param virt_addr The virtual address being mapped or unmapped.
+  ///
+  /// @param context The process the mapping is in. If nullptr, the current process.
+  ///
+  /// @return The counters to update.
+  mem_process_stats *mem_map_stats(uint64_t virt_addr, task_process *context)
+  {
+    mem_process_stats *result;
+
+    if ((virt_addr & 0x8000000000000000) != 0)
+    {
+      result = &task0_entry.stats;
+    }
+    else
+    {
+      result = mem_acct_get_stats(context);
+      ASSERT(result != nullptr);
+    }
+
+    return result;
+  }
 }
 
 /// Set the page use counter table to zero, since the only pages currently in use will never be unmapped.
@@ -61,6 +87,7 @@ void mem_map_virtual_page(uint64_t virt_addr,
   KL_TRC_ENTRY;
 
   mem_x64_map_virtual_page(virt_addr, phys_addr, context, cache_mode);
+  mem_map_stats(virt_addr, context)->resident_pages++;
 
   klib_synch_spinlock_lock(counter_lock);
 
@@ -100,6 +127,8 @@ void mem_unmap_virtual_page(uint64_t virt_addr, task_process *context, bool allo
 
   if (phys_addr != 0)
   {
+    mem_map_stats(virt_addr, context)->resident_pages--;
+
     klib_synch_spinlock_lock(counter_lock);
     ASSERT((phys_addr % MEM_PAGE_SIZE) == 0);
     phys_page_num = phys_addr / MEM_PAGE_SIZE;
@@ -124,6 +153,106 @@ void mem_unmap_virtual_page(uint64_t virt_addr, task_process *context, bool allo
   KL_TRC_EXIT;
 }
 
+/// @brief How many virtual pages are mapped to a given physical page?
+///
+/// @param phys_addr The address of the beginning of a physical page.
+///
+/// @return The number of virtual pages mapped to phys_addr. Pages beyond the range tracked by the memory manager always
+///         return zero.
+uint32_t mem_map_get_use_count(uint64_t phys_addr)
+{
+  uint32_t result = 0;
+  uint64_t phys_page_num;
+
+  KL_TRC_ENTRY;
+
+  ASSERT((phys_addr % MEM_PAGE_SIZE) == 0);
+  phys_page_num = phys_addr / MEM_PAGE_SIZE;
+
+  klib_synch_spinlock_lock(counter_lock);
+  if (phys_page_num < MEM_MAX_SUPPORTED_PAGES)
+  {
+    result = page_use_counters[phys_page_num];
+  }
+  klib_synch_spinlock_unlock(counter_lock);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Use count: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Stop a physical page being freed or swapped out while the kernel refers to it by its physical address.
+///
+/// The pin counts as one more use of the page, so the page isn't freed when the last virtual page mapped to it is
+/// unmapped, and the swap scanner leaves it alone. Release it with mem_map_unpin_page().
+///
+/// @param phys_addr The address of the beginning of a physical page.
+///
+/// @return True if the page was pinned. False if nothing was using the page, in which case it may already have been
+///         freed. Pages beyond the range tracked by the memory manager are never freed, so are always pinned.
+bool mem_map_pin_page(uint64_t phys_addr)
+{
+  bool result = true;
+  uint64_t phys_page_num;
+
+  KL_TRC_ENTRY;
+
+  ASSERT((phys_addr % MEM_PAGE_SIZE) == 0);
+  phys_page_num = phys_addr / MEM_PAGE_SIZE;
+
+  klib_synch_spinlock_lock(counter_lock);
+  if (phys_page_num < MEM_MAX_SUPPORTED_PAGES)
+  {
+    if (page_use_counters[phys_page_num] == 0)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Page not in use\n");
+      result = false;
+    }
+    else
+    {
+      page_use_counters[phys_page_num]++;
+    }
+  }
+  klib_synch_spinlock_unlock(counter_lock);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Release a pin taken by mem_map_pin_page().
+///
+/// If nothing else is using the page any more, it is freed.
+///
+/// @param phys_addr The address of the beginning of the pinned physical page.
+void mem_map_unpin_page(uint64_t phys_addr)
+{
+  uint64_t phys_page_num;
+
+  KL_TRC_ENTRY;
+
+  ASSERT((phys_addr % MEM_PAGE_SIZE) == 0);
+  phys_page_num = phys_addr / MEM_PAGE_SIZE;
+
+  klib_synch_spinlock_lock(counter_lock);
+  if (phys_page_num < MEM_MAX_SUPPORTED_PAGES)
+  {
+    ASSERT(page_use_counters[phys_page_num] > 0);
+    page_use_counters[phys_page_num]--;
+
+    if (page_use_counters[phys_page_num] == 0)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Deallocate unpinned page: ", phys_addr, "\n");
+      mem_deallocate_physical_pages(reinterpret_cast<void *>(phys_addr), 1);
+    }
+  }
+  klib_synch_spinlock_unlock(counter_lock);
+
+  KL_TRC_EXIT;
+}
+
 /// @brief Map a range of virtual addresses to an equally long range of physical addresses.
 ///
 /// @param physical_start The address of the first physical page in the mapping. The physical pages must be contiguous.
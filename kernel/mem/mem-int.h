@@ -34,6 +34,7 @@ void mem_map_virtual_page(uint64_t virt_addr,
                           task_process *context = nullptr,
                           MEM_CACHE_MODES cache_mode = MEM_WRITE_BACK);
 void mem_unmap_virtual_page(uint64_t virt_addr, task_process *context, bool allow_phys_page_free);
+uint32_t mem_map_get_use_count(uint64_t phys_addr);
 
 void mem_vmm_init_proc_data(vmm_process_data &proc_data_ref);
 void mem_vmm_free_proc_data(task_process *process);
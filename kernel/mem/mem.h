@@ -51,10 +51,24 @@ struct vmm_process_data
   task_thread *vmm_user_thread_id;
 };
 
+/// @brief Memory accounting counters for a single process.
+///
+/// These are updated incrementally by the memory manager as allocations are made and released. Pages are always of
+/// size MEM_PAGE_SIZE, except for page table pages which are of the size required by the architecture.
+struct mem_process_stats
+{
+  std::atomic<uint64_t> virtual_pages{0}; ///< Pages of virtual address space reserved by the process.
+  std::atomic<uint64_t> resident_pages{0}; ///< Pages of physical RAM currently mapped into the process.
+  std::atomic<uint64_t> page_table_pages{0}; ///< Page table pages used to describe the process's address space.
+  std::atomic<uint64_t> kernel_heap_bytes{0}; ///< Bytes of kernel heap allocated on behalf of the process.
+  std::atomic<uint64_t> swapped_pages{0}; ///< Pages of the process held compressed in the swap store.
+
+  std::atomic<uint64_t> virtual_limit_pages{0}; ///< Maximum value of virtual_pages, or zero for no limit.
+  std::atomic<uint64_t> resident_limit_pages{0}; ///< Maximum value of resident_pages, or zero for no limit.
+};
+
 /// @brief A structure to contain information specific to a single process.
 ///
-/// In future, this will be able to track things like allocation counts and so on, but for now it just contains the x64
-/// specific data.
 struct mem_process_info
 {
   /// @brief Pointer to architecture-specific information about a specific process.
@@ -65,6 +79,10 @@ struct mem_process_info
   /// @brief Virtual Memory Manager data corresponding to this process.
   ///
   vmm_process_data process_vmm_data;
+
+  /// @brief Memory accounting counters for this process.
+  ///
+  mem_process_stats stats;
 };
 
 /// Selectable caching modes for users of the memory system. Yes, these are very similar to the constants in
@@ -96,6 +114,14 @@ struct e820_record
 
 static_assert(sizeof(e820_record) == 24, "e820 record size wrong");
 
+/// @brief Possible outcomes of the memory manager attempting to handle a page fault.
+enum class MEM_FAULT_RESULT
+{
+  NOT_HANDLED, ///< The fault wasn't in memory the memory manager can page in.
+  RESOLVED, ///< The page is now mapped. The faulting instruction can be retried immediately.
+  THREAD_SUSPENDED, ///< The faulting thread has been stopped until the page is ready. Another thread should run.
+};
+
 /// @brief Pointer to an 'E820' memory map.
 ///
 /// This is usually provided by a multiboot compliant bootloader.
@@ -124,6 +150,10 @@ void mem_deallocate_virtual_range(void *start, uint32_t num_pages, task_process
 void mem_unmap_range(void *virtual_start, uint32_t num_pages, task_process *context, bool allow_phys_page_free);
 void mem_deallocate_pages(void *virtual_start, uint32_t num_pages);
 void *mem_get_phys_addr(void *virtual_addr, task_process *context = nullptr);
+bool mem_test_and_clear_dirty(void *virtual_addr, task_process *context = nullptr);
+bool mem_test_and_clear_accessed(void *virtual_addr, task_process *context = nullptr);
+bool mem_map_pin_page(uint64_t phys_addr);
+void mem_map_unpin_page(uint64_t phys_addr);
 
 bool mem_is_valid_virt_addr(uint64_t virtual_addr);
 
@@ -137,6 +167,20 @@ mem_process_info *mem_task_get_task0_entry();
 mem_process_info *mem_task_create_task_entry();
 void mem_task_free_task(task_process *proc);
 
+// Per-process memory accounting.
+mem_process_stats *mem_acct_get_stats(task_process *context);
+void mem_acct_charge_kernel_heap(task_process *context, int64_t bytes);
+bool mem_acct_within_limits(task_process *context, uint64_t extra_virtual_pages, uint64_t extra_resident_pages);
+void mem_acct_set_limits(task_process *context, uint64_t max_virtual_pages, uint64_t max_resident_pages);
+
+// Compressed in-memory swap for anonymous pages that haven't been used recently.
+void mem_swap_track_range(task_process *process, void *start, uint64_t num_pages);
+void mem_swap_release_range(task_process *process, void *start, uint64_t num_pages);
+void mem_swap_release_process(task_process *process);
+MEM_FAULT_RESULT mem_swap_handle_fault(uint64_t fault_addr, task_thread *thread, bool may_suspend);
+ERR_CODE mem_swap_fault_in(uint64_t addr, task_process *process);
+void mem_swap_scanner_thread();
+
 /// @brief Invalidate the page table TLB on the calling processor.
 extern "C" void mem_invalidate_tlb();
 
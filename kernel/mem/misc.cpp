@@ -27,6 +27,7 @@ void *mem_allocate_pages(uint32_t num_pages)
   void *cur_phys_addr;
 
   return_addr = mem_allocate_virtual_range(num_pages);
+  ASSERT(return_addr != nullptr);
   cur_virtual_addr = (uint8_t *)return_addr;
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Returned virtual address", return_addr, "\n");
@@ -0,0 +1,877 @@
+/// @file
+/// @brief Implements the page cache, which allows files to be mapped into the address space of processes.
+///
+/// When a file is mapped, only a virtual address range is reserved in the process. The first access to each page
+/// causes a page fault, which is handled in one of two ways:
+/// - If the page is already resident in the cache (perhaps because another process has mapped the same file), it is
+///   mapped into the process immediately and the faulting instruction is retried.
+/// - Otherwise, the faulting thread is suspended and queued for the pager thread. The page fault handler can't block,
+///   so the pager thread reads the page from the file, maps it into the process and then restarts the faulting thread.
+///   If the page can't be read, the faulting process is terminated, as it would be for any other invalid access.
+///
+/// The kernel may be holding locks when it accesses a mapping on a process's behalf, so a kernel mode fault is only
+/// handled if the page is already resident. System calls read in the pages of any buffers they are given, using
+/// mem_page_cache_fault_in(), before taking any locks.
+///
+/// Pages that have been written to by a process are written back to the file when the mapping is synchronised or
+/// removed, or when the process exits.
+
+// Known defects:
+// - The offset of a mapping must be a multiple of MEM_PAGE_SIZE, and mappings can only be placed at an address chosen
+//   by the kernel.
+// - There is no coherence between the page cache and writes made to the file using its handle.
+// - Dirty bits are cleared without a TLB shootdown, so writes made by a thread on another processor immediately after
+//   a sync may not be written back until the next write to that page.
+// - Data written beyond the end of the file within the final page is never written back, and the file is never
+//   extended.
+// - Pages are only released when the last mapping of the file is removed - there is no eviction under memory pressure.
+// - A page can't be read in on behalf of a kernel mode fault, so a system call that is given a buffer in a mapped file
+//   but doesn't call mem_page_cache_fault_in() first causes a kernel panic.
+
+//#define ENABLE_TRACING
+
+#include <string.h>
+
+#include "klib/klib.h"
+#include "mem/mem.h"
+#include "mem/page_cache.h"
+#include "processor/processor.h"
+
+namespace
+{
+  /// All page caches that currently exist, indexed by the file they are caching.
+  std::map<IBasicFile *, std::weak_ptr<mem_page_cache_file>> *cache_registry = nullptr;
+
+  /// Lock protecting cache_registry.
+  kernel_spinlock cache_registry_lock = 0;
+
+  /// All file mappings in all processes.
+  klib_list<std::shared_ptr<mem_file_mapping>> all_mappings = { nullptr, nullptr };
+
+  /// Lock protecting all_mappings, and the page_mapped bitmap of each mapping.
+  kernel_spinlock all_mappings_lock = 0;
+
+  /// Threads waiting for the pager thread to read in the page they faulted on.
+  klib_list<std::shared_ptr<task_thread>> pager_queue = { nullptr, nullptr };
+
+  /// Lock protecting pager_queue.
+  kernel_spinlock pager_queue_lock = 0;
+
+  /// The thread reading pages from files on behalf of faulting threads.
+  task_thread *pager_thread = nullptr;
+
+  mem_file_mapping *find_mapping(task_process *process, uint64_t addr);
+  bool page_is_mapped(mem_file_mapping *mapping, uint64_t page_idx);
+  void set_page_mapped(mem_file_mapping *mapping, uint64_t page_idx);
+  uint64_t mapping_heap_size(uint64_t num_pages);
+  ERR_CODE map_file_page(task_process *process, uint64_t page_addr);
+  void pager_service_fault(std::shared_ptr<task_thread> thread);
+  void terminate_faulting_process(std::shared_ptr<task_thread> thread, uint64_t fault_addr);
+}
+
+/// @brief Standard constructor
+///
+/// Page caches should be created using the 'get' static member, so that there is only one per file.
+///
+/// @param file The file to cache.
+mem_page_cache_file::mem_page_cache_file(std::shared_ptr<IBasicFile> file) : _file(file)
+{
+  KL_TRC_ENTRY;
+
+  klib_synch_spinlock_init(_pages_lock);
+  klib_synch_mutex_init(_io_lock);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Retrieve the page cache for a file, creating it if necessary.
+///
+/// @param file The file to retrieve the cache for. Must not be nullptr.
+///
+/// @return The page cache for file.
+std::shared_ptr<mem_page_cache_file> mem_page_cache_file::get(std::shared_ptr<IBasicFile> file)
+{
+  std::shared_ptr<mem_page_cache_file> result;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(file != nullptr);
+
+  klib_synch_spinlock_lock(cache_registry_lock);
+  if (cache_registry == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Create cache registry\n");
+    cache_registry = new std::map<IBasicFile *, std::weak_ptr<mem_page_cache_file>>();
+  }
+
+  auto it = cache_registry->find(file.get());
+  if (it != cache_registry->end())
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Found existing cache\n");
+    result = it->second.lock();
+  }
+
+  if (result == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Create new cache\n");
+    result = std::shared_ptr<mem_page_cache_file>(new mem_page_cache_file(file));
+    (*cache_registry)[file.get()] = result;
+  }
+  klib_synch_spinlock_unlock(cache_registry_lock);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Cache: ", result.get(), "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Standard destructor.
+///
+/// Releases all pages held by this cache. Pages are not written back - that should have happened when each mapping
+/// was removed.
+mem_page_cache_file::~mem_page_cache_file()
+{
+  KL_TRC_ENTRY;
+
+  klib_synch_spinlock_lock(cache_registry_lock);
+  ASSERT(cache_registry != nullptr);
+  auto it = cache_registry->find(_file.get());
+
+  // If the entry hasn't expired then a new cache for the same file has already replaced this one.
+  if ((it != cache_registry->end()) && (it->second.expired()))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Remove from registry\n");
+    cache_registry->erase(it);
+  }
+  klib_synch_spinlock_unlock(cache_registry_lock);
+
+  for (auto &page : _pages)
+  {
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Release page ", page.first, "\n");
+    mem_deallocate_pages(page.second.kernel_addr, 1);
+  }
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Find a page of the file if it is already resident in RAM.
+///
+/// This function doesn't block, so it is safe to call from the page fault handler.
+///
+/// @param page_idx The number of the page within the file.
+///
+/// @param[out] page Details of the page, if it is resident.
+///
+/// @return True if the page is resident, false otherwise.
+bool mem_page_cache_file::find_resident_page(uint64_t page_idx, mem_page_cache_page &page)
+{
+  bool result = false;
+
+  KL_TRC_ENTRY;
+
+  klib_synch_spinlock_lock(_pages_lock);
+  auto it = _pages.find(page_idx);
+  if (it != _pages.end())
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Page is resident\n");
+    page = it->second;
+    result = true;
+  }
+  klib_synch_spinlock_unlock(_pages_lock);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Make sure a page of the file is resident in RAM, reading it from the file if necessary.
+///
+/// This function may block while the file is read.
+///
+/// @param page_idx The number of the page within the file.
+///
+/// @param[out] page Details of the page, if it is now resident.
+///
+/// @return ERR_CODE::NO_ERROR if the page is resident, or any error returned while reading the file.
+ERR_CODE mem_page_cache_file::load_page(uint64_t page_idx, mem_page_cache_page &page)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  mem_page_cache_page new_page;
+  uint64_t bytes_read = 0;
+
+  KL_TRC_ENTRY;
+
+  klib_synch_mutex_acquire(_io_lock, MUTEX_MAX_WAIT);
+
+  if (find_resident_page(page_idx, page))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Page already loaded\n");
+  }
+  else
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Read page ", page_idx, " from file\n");
+    new_page.kernel_addr = reinterpret_cast<uint8_t *>(mem_allocate_pages(1));
+    ASSERT(new_page.kernel_addr != nullptr);
+
+    // Anything beyond the end of the file must read as zero.
+    memset(new_page.kernel_addr, 0, MEM_PAGE_SIZE);
+
+    result = _file->read_bytes(page_idx * MEM_PAGE_SIZE,
+                               MEM_PAGE_SIZE,
+                               new_page.kernel_addr,
+                               MEM_PAGE_SIZE,
+                               bytes_read);
+    if (result == ERR_CODE::NO_ERROR)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Read ", bytes_read, " bytes\n");
+      new_page.phys_addr = mem_get_phys_addr(new_page.kernel_addr);
+      new_page.valid_bytes = bytes_read;
+
+      klib_synch_spinlock_lock(_pages_lock);
+      _pages[page_idx] = new_page;
+      klib_synch_spinlock_unlock(_pages_lock);
+
+      page = new_page;
+    }
+    else
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Failed to read page\n");
+      mem_deallocate_pages(new_page.kernel_addr, 1);
+    }
+  }
+
+  klib_synch_mutex_release(_io_lock, false);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Write a resident page back to the file.
+///
+/// @param page_idx The number of the page within the file.
+///
+/// @return ERR_CODE::NOT_FOUND if the page isn't resident, or any error returned while writing the file.
+ERR_CODE mem_page_cache_file::write_back_page(uint64_t page_idx)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  mem_page_cache_page page;
+  uint64_t bytes_written;
+
+  KL_TRC_ENTRY;
+
+  klib_synch_mutex_acquire(_io_lock, MUTEX_MAX_WAIT);
+
+  if (!find_resident_page(page_idx, page))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Page not resident\n");
+    result = ERR_CODE::NOT_FOUND;
+  }
+  else if (page.valid_bytes != 0)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Write back page ", page_idx, "\n");
+    result = _file->write_bytes(page_idx * MEM_PAGE_SIZE,
+                                page.valid_bytes,
+                                page.kernel_addr,
+                                page.valid_bytes,
+                                bytes_written);
+  }
+
+  klib_synch_mutex_release(_io_lock, false);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Map part of a file into the address space of a process.
+///
+/// No pages are read at this point - they are read from the file when the process first accesses them.
+///
+/// @param file The file to map. Must not be nullptr.
+///
+/// @param offset The offset within the file to begin the mapping. Must be a multiple of MEM_PAGE_SIZE.
+///
+/// @param num_pages The number of pages to map. Must not be zero, and the mapping must not extend beyond the page
+///                  containing the end of the file.
+///
+/// @param process The process to map the file into. Must not be nullptr.
+///
+/// @param[out] map_addr The address in process where the file has been mapped.
+///
+/// @return ERR_CODE::INVALID_PARAM if any parameter is invalid, ERR_CODE::OUT_OF_RESOURCE if there is no room for the
+///         mapping in the process's address space, any error returned while finding the size of the file, or
+///         ERR_CODE::NO_ERROR otherwise.
+ERR_CODE mem_map_file(std::shared_ptr<IBasicFile> file,
+                      uint64_t offset,
+                      uint64_t num_pages,
+                      task_process *process,
+                      void *&map_addr)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  std::shared_ptr<mem_file_mapping> mapping;
+  uint64_t file_size = 0;
+  uint64_t file_pages;
+  uint64_t first_file_page = offset / MEM_PAGE_SIZE;
+  void *start_addr;
+
+  KL_TRC_ENTRY;
+
+  if ((file == nullptr) ||
+      (process == nullptr) ||
+      (num_pages == 0) ||
+      (num_pages > UINT32_MAX) ||
+      ((offset % MEM_PAGE_SIZE) != 0))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid parameters\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    result = file->get_file_size(file_size);
+    file_pages = (file_size / MEM_PAGE_SIZE) + (((file_size % MEM_PAGE_SIZE) != 0) ? 1 : 0);
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "File size: ", file_size, "\n");
+
+    if (result != ERR_CODE::NO_ERROR)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't get file size\n");
+    }
+    else if ((first_file_page > file_pages) || (num_pages > (file_pages - first_file_page)))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Mapping extends beyond the end of the file\n");
+      result = ERR_CODE::INVALID_PARAM;
+    }
+    else
+    {
+      start_addr = mem_allocate_virtual_range(num_pages, process);
+      if (start_addr == nullptr)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "No room in the process's address space\n");
+        result = ERR_CODE::OUT_OF_RESOURCE;
+      }
+      else
+      {
+        mapping = std::make_shared<mem_file_mapping>();
+        mapping->process = process;
+        mapping->num_pages = num_pages;
+        mapping->first_file_page = first_file_page;
+        mapping->cache = mem_page_cache_file::get(file);
+        mapping->page_mapped = std::unique_ptr<uint64_t[]>(new uint64_t[(num_pages + 63) / 64]());
+        mapping->start_addr = reinterpret_cast<uint64_t>(start_addr);
+        klib_list_item_initialize(&mapping->list_item);
+        mapping->list_item.item = mapping;
+
+        KL_TRC_TRACE(TRC_LVL::EXTRA, "Mapping file at ", mapping->start_addr, "\n");
+
+        klib_synch_spinlock_lock(all_mappings_lock);
+        klib_list_add_tail(&all_mappings, &mapping->list_item);
+        klib_synch_spinlock_unlock(all_mappings_lock);
+
+        mem_acct_charge_kernel_heap(process, mapping_heap_size(num_pages));
+
+        map_addr = start_addr;
+      }
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Write any pages of a mapping that have been written to back to the file.
+///
+/// @param map_addr The address of the mapping, as returned by mem_map_file().
+///
+/// @param process The process containing the mapping.
+///
+/// @return ERR_CODE::NOT_FOUND if there is no mapping at map_addr, or any error returned while writing the file.
+ERR_CODE mem_sync_file_mapping(void *map_addr, task_process *process)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  ERR_CODE write_result;
+  mem_file_mapping *mapping;
+  std::shared_ptr<mem_file_mapping> mapping_str;
+  uint64_t addr = reinterpret_cast<uint64_t>(map_addr);
+
+  KL_TRC_ENTRY;
+
+  klib_synch_spinlock_lock(all_mappings_lock);
+  mapping = find_mapping(process, addr);
+  if ((mapping != nullptr) && (mapping->start_addr == addr))
+  {
+    mapping_str = mapping->list_item.item;
+  }
+  klib_synch_spinlock_unlock(all_mappings_lock);
+
+  if (mapping_str == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "No mapping found\n");
+    result = ERR_CODE::NOT_FOUND;
+  }
+  else
+  {
+    for (uint64_t i = 0; i < mapping_str->num_pages; i++)
+    {
+      if (page_is_mapped(mapping_str.get(), i) &&
+          mem_test_and_clear_dirty(reinterpret_cast<void *>(addr + (i * MEM_PAGE_SIZE)), process))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Page ", i, " is dirty\n");
+        write_result = mapping_str->cache->write_back_page(mapping_str->first_file_page + i);
+        if (write_result != ERR_CODE::NO_ERROR)
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Failed to write back page\n");
+          result = write_result;
+        }
+      }
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Remove a file mapping from a process, writing back any pages that have been written to.
+///
+/// @param map_addr The address of the mapping, as returned by mem_map_file().
+///
+/// @param process The process containing the mapping.
+///
+/// @return ERR_CODE::NOT_FOUND if there is no mapping at map_addr, ERR_CODE::NO_ERROR otherwise. The mapping is
+///         removed even if writing back changes fails.
+ERR_CODE mem_unmap_file(void *map_addr, task_process *process)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  mem_file_mapping *mapping;
+  std::shared_ptr<mem_file_mapping> mapping_str;
+  uint64_t addr = reinterpret_cast<uint64_t>(map_addr);
+
+  KL_TRC_ENTRY;
+
+  // Sync first, since it needs to be able to find the mapping. A thread touching the mapping while it is being removed
+  // might cause a new page to be mapped, but that is no worse than it touching the mapping after it has been removed.
+  mem_sync_file_mapping(map_addr, process);
+
+  klib_synch_spinlock_lock(all_mappings_lock);
+  mapping = find_mapping(process, addr);
+  if ((mapping != nullptr) && (mapping->start_addr == addr))
+  {
+    mapping_str = mapping->list_item.item;
+    klib_list_remove(&mapping->list_item);
+  }
+  klib_synch_spinlock_unlock(all_mappings_lock);
+
+  if (mapping_str == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "No mapping found\n");
+    result = ERR_CODE::NOT_FOUND;
+  }
+  else
+  {
+    for (uint64_t i = 0; i < mapping_str->num_pages; i++)
+    {
+      if (page_is_mapped(mapping_str.get(), i))
+      {
+        // The cache continues to hold its own reference to the physical page.
+        mem_unmap_range(reinterpret_cast<void *>(addr + (i * MEM_PAGE_SIZE)), 1, process, true);
+      }
+    }
+    mem_deallocate_virtual_range(map_addr, mapping_str->num_pages, process);
+    mem_acct_charge_kernel_heap(process, -static_cast<int64_t>(mapping_heap_size(mapping_str->num_pages)));
+
+    // Break the reference cycle between the mapping and its list item.
+    mapping_str->list_item.item = nullptr;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Remove all file mappings from a process, writing back any pages that have been written to.
+///
+/// @param process The process to remove mappings from.
+void mem_unmap_all_files(task_process *process)
+{
+  klib_list_item<std::shared_ptr<mem_file_mapping>> *item;
+  void *next_addr;
+
+  KL_TRC_ENTRY;
+
+  do
+  {
+    next_addr = nullptr;
+
+    klib_synch_spinlock_lock(all_mappings_lock);
+    for (item = all_mappings.head; item != nullptr; item = item->next)
+    {
+      if (item->item->process == process)
+      {
+        next_addr = reinterpret_cast<void *>(item->item->start_addr);
+        break;
+      }
+    }
+    klib_synch_spinlock_unlock(all_mappings_lock);
+
+    if (next_addr != nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Unmap file at ", next_addr, "\n");
+      mem_unmap_file(next_addr, process);
+    }
+  } while (next_addr != nullptr);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Attempt to resolve a page fault by mapping part of a file.
+///
+/// This is called from the page fault handler, so it must not block. Instead, if the page needs reading from the file
+/// the faulting thread is stopped and queued for the pager thread.
+///
+/// @param fault_addr The address that caused the fault.
+///
+/// @param thread The thread that caused the fault. Must not be nullptr.
+///
+/// @param may_suspend Can the faulting thread be suspended until the page is ready? This must be false for faults in
+///                    kernel mode, since the kernel may be holding locks.
+///
+/// @return A suitable value from MEM_FAULT_RESULT.
+MEM_FAULT_RESULT mem_page_cache_handle_fault(uint64_t fault_addr, task_thread *thread, bool may_suspend)
+{
+  MEM_FAULT_RESULT result = MEM_FAULT_RESULT::NOT_HANDLED;
+  mem_file_mapping *mapping;
+  mem_page_cache_page page;
+  task_process *process;
+  uint64_t page_addr = fault_addr - (fault_addr % MEM_PAGE_SIZE);
+  uint64_t page_idx;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(thread != nullptr);
+  process = thread->parent_process.get();
+
+  klib_synch_spinlock_lock(all_mappings_lock);
+  mapping = find_mapping(process, page_addr);
+  if (mapping != nullptr)
+  {
+    page_idx = (page_addr - mapping->start_addr) / MEM_PAGE_SIZE;
+    if (page_is_mapped(mapping, page_idx))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Another thread has already mapped this page\n");
+      result = MEM_FAULT_RESULT::RESOLVED;
+    }
+    else if (mapping->cache->find_resident_page(mapping->first_file_page + page_idx, page))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Map resident page\n");
+      mem_map_range(page.phys_addr, reinterpret_cast<void *>(page_addr), 1, process);
+      set_page_mapped(mapping, page_idx);
+      result = MEM_FAULT_RESULT::RESOLVED;
+    }
+    else if (may_suspend && (pager_thread != nullptr))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Queue thread for pager\n");
+      thread->page_fault_addr = page_addr;
+
+      klib_synch_spinlock_lock(pager_queue_lock);
+      ASSERT(!klib_list_item_is_in_any_list(thread->synch_list_item));
+      klib_list_add_tail(&pager_queue, thread->synch_list_item);
+      thread->stop_thread();
+      pager_thread->start_thread();
+      klib_synch_spinlock_unlock(pager_queue_lock);
+
+      result = MEM_FAULT_RESULT::THREAD_SUSPENDED;
+    }
+  }
+  klib_synch_spinlock_unlock(all_mappings_lock);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", static_cast<uint64_t>(result), "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Make sure a page of a mapped file is mapped into its process, reading it from the file if necessary.
+///
+/// Unlike mem_page_cache_handle_fault(), this function may block, so it must not be called while holding any
+/// spinlocks.
+///
+/// @param addr An address within the page.
+///
+/// @param process The process containing the page. Must not be nullptr.
+///
+/// @return Any error returned while reading the file, or ERR_CODE::NO_ERROR otherwise - including if addr isn't part
+///         of a file mapping at all.
+ERR_CODE mem_page_cache_fault_in(uint64_t addr, task_process *process)
+{
+  ERR_CODE result;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(process != nullptr);
+
+  result = map_file_page(process, addr - (addr % MEM_PAGE_SIZE));
+  if (result == ERR_CODE::NOT_FOUND)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Not a mapped file\n");
+    result = ERR_CODE::NO_ERROR;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Reads pages from files on behalf of threads that faulted on them.
+///
+/// This thread is stopped whenever there is no work for it to do, and started again by the page fault handler.
+void mem_page_cache_pager_thread()
+{
+  std::shared_ptr<task_thread> faulting_thread;
+
+  KL_TRC_ENTRY;
+
+  pager_thread = task_get_cur_thread();
+  ASSERT(pager_thread != nullptr);
+
+  while (1)
+  {
+    faulting_thread = nullptr;
+
+    klib_synch_spinlock_lock(pager_queue_lock);
+    if (!klib_list_is_empty(&pager_queue))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Retrieve faulting thread\n");
+      faulting_thread = pager_queue.head->item;
+      klib_list_remove(pager_queue.head);
+    }
+    else
+    {
+      // This is done with the queue lock held, so the fault handler can't queue a thread and start this one between
+      // the check above and this thread stopping.
+      KL_TRC_TRACE(TRC_LVL::FLOW, "No more faults to service\n");
+      pager_thread->stop_thread();
+    }
+    klib_synch_spinlock_unlock(pager_queue_lock);
+
+    if (faulting_thread != nullptr)
+    {
+      pager_service_fault(faulting_thread);
+    }
+    else
+    {
+      task_yield();
+    }
+  }
+
+  // Won't get here:
+  //KL_TRC_EXIT;
+}
+
+namespace
+{
+  /// @brief Find the file mapping containing a given address.
+  ///
+  /// all_mappings_lock must be held by the caller.
+  ///
+  /// @param process The process to search in.
+  ///
+  /// @param addr The address to search for.
+  ///
+  /// @return The mapping containing addr, or nullptr if there isn't one.
+  mem_file_mapping *find_mapping(task_process *process, uint64_t addr)
+  {
+    mem_file_mapping *result = nullptr;
+    mem_file_mapping *candidate;
+    klib_list_item<std::shared_ptr<mem_file_mapping>> *item;
+
+    KL_TRC_ENTRY;
+
+    for (item = all_mappings.head; item != nullptr; item = item->next)
+    {
+      candidate = item->item.get();
+      if ((candidate->process == process) &&
+          (addr >= candidate->start_addr) &&
+          (addr < (candidate->start_addr + (candidate->num_pages * MEM_PAGE_SIZE))))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Found mapping\n");
+        result = candidate;
+        break;
+      }
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+
+  /// @brief Has a page of a file mapping been mapped into its process yet?
+  ///
+  /// The result can only be relied upon if all_mappings_lock is held, or if the mapping is no longer in all_mappings.
+  ///
+  /// @param mapping The mapping containing the page.
+  ///
+  /// @param page_idx The number of the page within the mapping.
+  ///
+  /// @return True if the page has been mapped, false otherwise.
+  bool page_is_mapped(mem_file_mapping *mapping, uint64_t page_idx)
+  {
+    ASSERT(page_idx < mapping->num_pages);
+    return (mapping->page_mapped[page_idx / 64] & (1ULL << (page_idx % 64))) != 0;
+  }
+
+  /// @brief Record that a page of a file mapping has been mapped into its process.
+  ///
+  /// all_mappings_lock must be held by the caller.
+  ///
+  /// @param mapping The mapping containing the page.
+  ///
+  /// @param page_idx The number of the page within the mapping.
+  void set_page_mapped(mem_file_mapping *mapping, uint64_t page_idx)
+  {
+    ASSERT(page_idx < mapping->num_pages);
+    mapping->page_mapped[page_idx / 64] |= (1ULL << (page_idx % 64));
+  }
+
+  /// @brief How much kernel heap is used to keep track of a file mapping?
+  ///
+  /// @param num_pages The number of pages in the mapping.
+  ///
+  /// @return The number of bytes to charge to the process owning the mapping.
+  uint64_t mapping_heap_size(uint64_t num_pages)
+  {
+    return sizeof(mem_file_mapping) + (((num_pages + 63) / 64) * sizeof(uint64_t));
+  }
+
+  /// @brief Read in a page of a mapped file, if necessary, and map it into its process.
+  ///
+  /// This function may block while the file is read.
+  ///
+  /// @param process The process containing the mapping.
+  ///
+  /// @param page_addr The address of the page within process.
+  ///
+  /// @return ERR_CODE::NOT_FOUND if page_addr isn't part of a file mapping, any error returned while reading the file,
+  ///         or ERR_CODE::NO_ERROR otherwise.
+  ERR_CODE map_file_page(task_process *process, uint64_t page_addr)
+  {
+    mem_file_mapping *mapping;
+    std::shared_ptr<mem_file_mapping> mapping_str;
+    mem_page_cache_page page;
+    uint64_t page_idx = 0;
+    bool already_mapped = false;
+    ERR_CODE result = ERR_CODE::NO_ERROR;
+
+    KL_TRC_ENTRY;
+
+    klib_synch_spinlock_lock(all_mappings_lock);
+    mapping = find_mapping(process, page_addr);
+    if (mapping != nullptr)
+    {
+      mapping_str = mapping->list_item.item;
+      page_idx = (page_addr - mapping->start_addr) / MEM_PAGE_SIZE;
+      already_mapped = page_is_mapped(mapping, page_idx);
+    }
+    klib_synch_spinlock_unlock(all_mappings_lock);
+
+    if (mapping_str == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "No mapping at ", page_addr, "\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+    else if (already_mapped)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Page already mapped\n");
+    }
+    else
+    {
+      result = mapping_str->cache->load_page(mapping_str->first_file_page + page_idx, page);
+      if (result == ERR_CODE::NO_ERROR)
+      {
+        klib_synch_spinlock_lock(all_mappings_lock);
+        if (klib_list_item_is_in_any_list(&mapping_str->list_item) && !page_is_mapped(mapping_str.get(), page_idx))
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Map page ", page_idx, " at ", page_addr, "\n");
+          mem_map_range(page.phys_addr, reinterpret_cast<void *>(page_addr), 1, process);
+          set_page_mapped(mapping_str.get(), page_idx);
+        }
+        klib_synch_spinlock_unlock(all_mappings_lock);
+      }
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+
+  /// @brief Read in the page a thread faulted on, map it, and restart the thread.
+  ///
+  /// @param thread The thread that faulted.
+  void pager_service_fault(std::shared_ptr<task_thread> thread)
+  {
+    uint64_t page_addr = thread->page_fault_addr;
+    ERR_CODE result;
+
+    KL_TRC_ENTRY;
+
+    result = map_file_page(thread->parent_process.get(), page_addr);
+    if (result == ERR_CODE::NOT_FOUND)
+    {
+      // Restart the thread anyway - it'll fault again and be dealt with like any other bad access.
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Mapping removed before the page could be read\n");
+      thread->start_thread();
+    }
+    else if (result == ERR_CODE::NO_ERROR)
+    {
+      thread->start_thread();
+    }
+    else
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Failed to read page, terminate process\n");
+      terminate_faulting_process(thread, page_addr);
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Terminate a process whose thread faulted on a page that couldn't be read from its file.
+  ///
+  /// This is treated in the same way as any other invalid access by the process. The faulting thread stays suspended
+  /// until the process is destroyed.
+  ///
+  /// @param thread The thread that faulted.
+  ///
+  /// @param fault_addr The address of the page that couldn't be read. Used as the process's exit code.
+  void terminate_faulting_process(std::shared_ptr<task_thread> thread, uint64_t fault_addr)
+  {
+    std::shared_ptr<task_process> process = thread->parent_process;
+
+    KL_TRC_ENTRY;
+
+    ASSERT(process != nullptr);
+    if (process->kernel_mode)
+    {
+      panic("Failed to read mapped file page for kernel process");
+    }
+
+    process->stop_process();
+    if (!process->in_dead_list)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Add process ", process.get(), " to dead list\n");
+      process->proc_status = OPER_STATUS::FAILED;
+      process->exit_code = fault_addr;
+      process->add_to_dead_list();
+    }
+
+    KL_TRC_EXIT;
+  }
+}
@@ -0,0 +1,80 @@
+/// @file
+/// @brief Declares the page cache, which allows files to be mapped into the address space of processes.
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <map>
+
+#include "klib/klib.h"
+#include "mem/mem.h"
+#include "system_tree/fs/fs_file_interface.h"
+
+/// @brief A single page of a file that is resident in RAM.
+struct mem_page_cache_page
+{
+  uint8_t *kernel_addr; ///< The address of this page in kernel space.
+  void *phys_addr; ///< The physical address of this page.
+  uint64_t valid_bytes; ///< How many bytes of this page were read from the file. The remainder is beyond end-of-file.
+};
+
+/// @brief The pages of a single file that are currently resident in RAM.
+///
+/// There is at most one of these objects per file. All processes that map the same file share the same physical pages,
+/// so changes made by one process are immediately visible in the others.
+class mem_page_cache_file
+{
+protected:
+  mem_page_cache_file(std::shared_ptr<IBasicFile> file);
+
+public:
+  static std::shared_ptr<mem_page_cache_file> get(std::shared_ptr<IBasicFile> file);
+  ~mem_page_cache_file();
+
+  bool find_resident_page(uint64_t page_idx, mem_page_cache_page &page);
+  ERR_CODE load_page(uint64_t page_idx, mem_page_cache_page &page);
+  ERR_CODE write_back_page(uint64_t page_idx);
+
+protected:
+  /// The file being cached.
+  std::shared_ptr<IBasicFile> _file;
+
+  /// Protects _pages. This is a spinlock so that the page fault handler can search for resident pages.
+  kernel_spinlock _pages_lock;
+
+  /// Serialises reads and writes of the underlying file.
+  klib_mutex _io_lock;
+
+  /// All the pages of this file currently resident in RAM, indexed by page number within the file.
+  std::map<uint64_t, mem_page_cache_page> _pages;
+};
+
+/// @brief A range of a process's address space that is backed by a file.
+struct mem_file_mapping
+{
+  task_process *process; ///< The process containing this mapping.
+  uint64_t start_addr; ///< The first virtual address of the mapping.
+  uint64_t num_pages; ///< The number of pages in the mapping.
+  uint64_t first_file_page; ///< The page number within the file corresponding to start_addr.
+  std::shared_ptr<mem_page_cache_file> cache; ///< The cache for the file being mapped.
+
+  /// Bitmap with one bit for each page of the mapping, set once that page has been mapped into the process.
+  std::unique_ptr<uint64_t[]> page_mapped;
+
+  /// Item used to store this mapping in the list of all mappings.
+  klib_list_item<std::shared_ptr<mem_file_mapping>> list_item;
+};
+
+ERR_CODE mem_map_file(std::shared_ptr<IBasicFile> file,
+                      uint64_t offset,
+                      uint64_t num_pages,
+                      task_process *process,
+                      void *&map_addr);
+ERR_CODE mem_sync_file_mapping(void *map_addr, task_process *process);
+ERR_CODE mem_unmap_file(void *map_addr, task_process *process);
+void mem_unmap_all_files(task_process *process);
+
+MEM_FAULT_RESULT mem_page_cache_handle_fault(uint64_t fault_addr, task_thread *thread, bool may_suspend);
+ERR_CODE mem_page_cache_fault_in(uint64_t addr, task_process *process);
+void mem_page_cache_pager_thread();
@@ -9,6 +9,7 @@
 #include "klib/klib.h"
 #include "mem/mem.h"
 #include "mem/mem-int.h"
+#include "mem/page_cache.h"
 #include "mem/x64/mem-x64-int.h"
 #include "processor/processor.h"
 
@@ -52,12 +53,19 @@ mem_process_info *mem_task_create_task_entry()
 
   new_proc_info->arch_specific_data = (void *)new_x64_proc_info;
 
+  // Charge the process for the PML4 and for these information blocks.
+  new_proc_info->stats.page_table_pages = 1;
+  new_proc_info->stats.kernel_heap_bytes = sizeof(mem_process_info) + sizeof(process_x64_data);
+
   KL_TRC_EXIT;
   return new_proc_info;
 }
 
 /// @brief Destroy a task's memory manager information block and releases all physical pages unique to this process.
 ///
+/// Any files mapped into the process have their changes written back first, and any of its pages held in the swap
+/// store are discarded.
+///
 /// @param proc The process to free information for.
 void mem_task_free_task(task_process *proc)
 {
@@ -73,6 +81,8 @@ void mem_task_free_task(task_process *proc)
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Delete task info\n");
 
+    mem_unmap_all_files(proc);
+    mem_swap_release_process(proc);
     mem_vmm_free_proc_data(proc);
     mem_x64_pml4_deallocate(*x64_data);
 
@@ -0,0 +1,788 @@
+/// @file
+/// @brief Compressed in-memory swap for anonymous pages that haven't been used recently.
+///
+/// Pages of RAM allocated by processes for their own use are tracked here. A scanner thread periodically sweeps over
+/// all tracked pages like the hand of a clock, testing and clearing the accessed flag of each. Pages that haven't been
+/// accessed for several sweeps are unmapped from their process and compressed into the kernel heap, freeing the
+/// physical page. Pages that consist of a single repeated value (most commonly, pages that have never been written to)
+/// don't need compressing at all - only the value is stored.
+///
+/// When the process next touches a swapped out page, the page fault handler allocates a new physical page, decompresses
+/// the contents into it and maps it back into the process. swap_lock is not held while decompressing, so other faults
+/// and the scanner thread can carry on meanwhile. The page fault handler can't free kernel heap, so the compressed copy
+/// is left for the scanner thread to release on its next sweep.
+///
+/// The kernel may be holding locks when it touches a page on a process's behalf, so a kernel mode fault never waits
+/// for a page to finish being swapped. Instead, system calls swap in the pages of any buffers they are given, using
+/// mem_swap_fault_in(), before taking any locks.
+
+// Known defects:
+// - The accessed flag is cleared without a TLB shootdown, so a page that is being used continuously by a thread on
+//   another processor may appear to be unused. Such a page will be swapped out and immediately swapped back in again.
+// - Pages shared with other processes, or pinned by mem_map_pin_page(), are never swapped out. A page being shared at
+//   the same moment as it is swapped out may not be shared correctly.
+// - If no physical page is available to swap a page back in to, the faulting process is treated as having made an
+//   invalid access.
+// - Tracked pages are held in a single list, so finding the page that caused a fault takes time proportional to the
+//   number of tracked pages in the whole system.
+// - Only pages allocated by syscall_allocate_backing_memory() are tracked.
+// - Only one page is decompressed at a time, since there is only one fault_window.
+// - Pages swapped in by mem_swap_fault_in() may be swapped out again before the system call uses them, if the call
+//   blocks for several sweeps first. If the kernel then faults on a page that is being swapped, or there is no RAM
+//   to swap it in to, the fault can't be handled.
+
+//#define ENABLE_TRACING
+
+#include <string.h>
+
+#include "klib/klib.h"
+#include "klib/misc/compression.h"
+#include "mem/mem.h"
+#include "mem/mem-int.h"
+#include "processor/processor.h"
+#include "processor/timing/timing.h"
+
+namespace
+{
+  /// @brief The states a tracked page can be in.
+  enum class SWAP_PAGE_STATE
+  {
+    RESIDENT, ///< The page is mapped into its process as normal.
+    SWAPPING_OUT, ///< The scanner thread has unmapped the page and is compressing it.
+    COMPRESSED, ///< The page is not mapped, its contents are held in the swap store.
+    SWAPPING_IN, ///< The page fault handler is decompressing the page.
+  };
+
+  /// @brief A single anonymous page of a process that may be swapped out.
+  struct swap_page
+  {
+    task_process *process; ///< The process owning this page.
+    uint64_t virt_addr; ///< The address of the page within process.
+    SWAP_PAGE_STATE state; ///< The current state of this page.
+    uint32_t idle_scans; ///< The number of consecutive sweeps that have found this page unused.
+
+    /// The compressed contents of the page. If the page is resident, this is an out-of-date copy waiting to be freed
+    /// by the scanner thread. If the page is compressed and this is nullptr, every 8 bytes of the page are equal to
+    /// fill_value.
+    uint8_t *compressed_data;
+    uint64_t compressed_size; ///< The number of bytes in compressed_data.
+    uint64_t fill_value; ///< The value filling the page, if compressed_data is nullptr.
+
+    /// Item used to store this page in the list of all tracked pages.
+    klib_list_item<swap_page *> list_item;
+  };
+
+  /// Pages that have not been accessed for this many consecutive sweeps are swapped out.
+  const uint32_t SWAP_COLD_SWEEPS = 4;
+
+  /// The time between the start of each sweep, in nanoseconds.
+  const uint64_t SWAP_SWEEP_INTERVAL_NS = 1000000000;
+
+  /// Pages that don't compress to this size or smaller are left in RAM, since swapping them saves little.
+  const uint64_t SWAP_MAX_COMPRESSED_SIZE = (MEM_PAGE_SIZE / 4) * 3;
+
+  /// All tracked pages in all processes.
+  klib_list<swap_page *> swap_pages = { nullptr, nullptr };
+
+  /// The number of items in swap_pages.
+  uint64_t num_swap_pages = 0;
+
+  /// The next item in swap_pages for the scanner thread to examine.
+  klib_list_item<swap_page *> *clock_hand = nullptr;
+
+  /// Threads that faulted on a page while it was being swapped out or in, waiting for that to finish.
+  klib_list<std::shared_ptr<task_thread>> swap_wait_queue = { nullptr, nullptr };
+
+  /// Lock protecting swap_pages, num_swap_pages, clock_hand, swap_wait_queue, and the contents of each swap_page.
+  kernel_spinlock swap_lock = 0;
+
+  /// Kernel address used by the page fault handler to decompress pages. Only used while fault_window_lock is held.
+  uint8_t *fault_window = nullptr;
+
+  /// Lock protecting fault_window. If both this and swap_lock are needed, this one must be taken first.
+  kernel_spinlock fault_window_lock = 0;
+
+  /// Kernel address used by the scanner thread to read pages being swapped out.
+  uint8_t *scan_window = nullptr;
+
+  swap_page *find_swap_page(task_process *process, uint64_t addr);
+  void remove_swap_page(swap_page *page);
+  void release_matching_pages(task_process *process, uint64_t start_addr, uint64_t end_addr);
+  void restart_waiting_threads(swap_page *page);
+  bool swap_in_page(swap_page *page);
+  void swap_out_page(swap_page *page, uint64_t phys_addr, uint8_t *buffer, klib_lz_workspace &workspace);
+  void sweep_all_pages(uint8_t *buffer, klib_lz_workspace &workspace);
+}
+
+/// @brief Allow pages of a process to be swapped out.
+///
+/// The pages must be anonymous memory, not shared with any other process, and already mapped.
+///
+/// @param process The process owning the pages. Must not be nullptr.
+///
+/// @param start The address of the first page within process.
+///
+/// @param num_pages The number of pages to track.
+void mem_swap_track_range(task_process *process, void *start, uint64_t num_pages)
+{
+  swap_page *page;
+  uint64_t addr = reinterpret_cast<uint64_t>(start);
+
+  KL_TRC_ENTRY;
+
+  ASSERT(process != nullptr);
+  ASSERT((addr % MEM_PAGE_SIZE) == 0);
+
+  for (uint64_t i = 0; i < num_pages; i++, addr += MEM_PAGE_SIZE)
+  {
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Track page at ", addr, "\n");
+    page = new swap_page;
+    page->process = process;
+    page->virt_addr = addr;
+    page->state = SWAP_PAGE_STATE::RESIDENT;
+    page->idle_scans = 0;
+    page->compressed_data = nullptr;
+    page->compressed_size = 0;
+    page->fill_value = 0;
+    klib_list_item_initialize(&page->list_item);
+    page->list_item.item = page;
+
+    klib_synch_spinlock_lock(swap_lock);
+    klib_list_add_tail(&swap_pages, &page->list_item);
+    num_swap_pages++;
+    klib_synch_spinlock_unlock(swap_lock);
+  }
+
+  mem_acct_charge_kernel_heap(process, num_pages * sizeof(swap_page));
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Stop tracking pages of a process, discarding any swapped out contents.
+///
+/// This should be called before the pages are unmapped from the process.
+///
+/// @param process The process owning the pages. Must not be nullptr.
+///
+/// @param start The address of the first page within process.
+///
+/// @param num_pages The number of pages to stop tracking. Pages in this range that aren't tracked are ignored.
+void mem_swap_release_range(task_process *process, void *start, uint64_t num_pages)
+{
+  uint64_t addr = reinterpret_cast<uint64_t>(start);
+
+  KL_TRC_ENTRY;
+
+  ASSERT(process != nullptr);
+  release_matching_pages(process, addr, addr + (num_pages * MEM_PAGE_SIZE));
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Stop tracking all pages of a process, discarding any swapped out contents.
+///
+/// @param process The process to release pages from. Must not be nullptr.
+void mem_swap_release_process(task_process *process)
+{
+  KL_TRC_ENTRY;
+
+  ASSERT(process != nullptr);
+  release_matching_pages(process, 0, UINT64_MAX);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Attempt to resolve a page fault by swapping a page back in.
+///
+/// This is called from the page fault handler, so it must not block.
+///
+/// @param fault_addr The address that caused the fault.
+///
+/// @param thread The thread that caused the fault. Must not be nullptr.
+///
+/// @param may_suspend Can the faulting thread be suspended until the page is ready? This must be false for faults in
+///                    kernel mode, since the kernel may be holding locks.
+///
+/// @return A suitable value from MEM_FAULT_RESULT.
+MEM_FAULT_RESULT mem_swap_handle_fault(uint64_t fault_addr, task_thread *thread, bool may_suspend)
+{
+  MEM_FAULT_RESULT result = MEM_FAULT_RESULT::NOT_HANDLED;
+  swap_page *page;
+  uint64_t page_addr = fault_addr - (fault_addr % MEM_PAGE_SIZE);
+  bool needs_swap_in = false;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(thread != nullptr);
+
+  klib_synch_spinlock_lock(swap_lock);
+  page = find_swap_page(thread->parent_process.get(), page_addr);
+  if (page != nullptr)
+  {
+    switch (page->state)
+    {
+    case SWAP_PAGE_STATE::RESIDENT:
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Another thread has already swapped in this page\n");
+      result = MEM_FAULT_RESULT::RESOLVED;
+      break;
+
+    case SWAP_PAGE_STATE::SWAPPING_OUT:
+    case SWAP_PAGE_STATE::SWAPPING_IN:
+      if (!may_suspend)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Page is being swapped, but thread can't wait\n");
+        break;
+      }
+
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Wait for page to finish being swapped\n");
+      thread->page_fault_addr = page_addr;
+      ASSERT(!klib_list_item_is_in_any_list(thread->synch_list_item));
+      klib_list_add_tail(&swap_wait_queue, thread->synch_list_item);
+      thread->stop_thread();
+      result = MEM_FAULT_RESULT::THREAD_SUSPENDED;
+      break;
+
+    case SWAP_PAGE_STATE::COMPRESSED:
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Swap in page\n");
+      page->state = SWAP_PAGE_STATE::SWAPPING_IN;
+      needs_swap_in = true;
+      break;
+    }
+  }
+  klib_synch_spinlock_unlock(swap_lock);
+
+  if (needs_swap_in && swap_in_page(page))
+  {
+    result = MEM_FAULT_RESULT::RESOLVED;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", static_cast<uint64_t>(result), "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Make sure a page of a process isn't swapped out, swapping it back in if necessary.
+///
+/// Unlike mem_swap_handle_fault(), this function may block, so it must not be called while holding any spinlocks.
+///
+/// @param addr An address within the page.
+///
+/// @param process The process owning the page. Must not be nullptr.
+///
+/// @return ERR_CODE::OUT_OF_RESOURCE if there is no RAM to swap the page in to, ERR_CODE::NO_ERROR otherwise -
+///         including if the page isn't tracked at all.
+ERR_CODE mem_swap_fault_in(uint64_t addr, task_process *process)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  swap_page *page;
+  uint64_t page_addr = addr - (addr % MEM_PAGE_SIZE);
+  bool waiting_for_swap = false;
+  bool needs_swap_in = false;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(process != nullptr);
+
+  do
+  {
+    if (waiting_for_swap)
+    {
+      task_yield();
+    }
+    waiting_for_swap = false;
+
+    klib_synch_spinlock_lock(swap_lock);
+    page = find_swap_page(process, page_addr);
+    if (page != nullptr)
+    {
+      if (page->state == SWAP_PAGE_STATE::COMPRESSED)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Swap in page\n");
+        page->state = SWAP_PAGE_STATE::SWAPPING_IN;
+        needs_swap_in = true;
+      }
+      else if (page->state != SWAP_PAGE_STATE::RESIDENT)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Wait for page to finish being swapped\n");
+        waiting_for_swap = true;
+      }
+    }
+    klib_synch_spinlock_unlock(swap_lock);
+  } while (waiting_for_swap);
+
+  if (needs_swap_in && !swap_in_page(page))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "No RAM to swap in to\n");
+    result = ERR_CODE::OUT_OF_RESOURCE;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Periodically sweeps all tracked pages, swapping out those that haven't been used recently.
+void mem_swap_scanner_thread()
+{
+  uint8_t *buffer;
+  klib_lz_workspace *workspace;
+
+  KL_TRC_ENTRY;
+
+  scan_window = reinterpret_cast<uint8_t *>(mem_allocate_virtual_range(1));
+  fault_window = reinterpret_cast<uint8_t *>(mem_allocate_virtual_range(1));
+  buffer = new uint8_t[SWAP_MAX_COMPRESSED_SIZE];
+  workspace = new klib_lz_workspace;
+
+  while (1)
+  {
+    time_sleep_process(SWAP_SWEEP_INTERVAL_NS);
+    sweep_all_pages(buffer, *workspace);
+  }
+
+  // Won't get here:
+  //KL_TRC_EXIT;
+}
+
+namespace
+{
+  /// @brief Find the tracked page at a given address.
+  ///
+  /// swap_lock must be held by the caller.
+  ///
+  /// @param process The process to search in.
+  ///
+  /// @param addr The address of the page.
+  ///
+  /// @return The tracked page, or nullptr if there isn't one.
+  swap_page *find_swap_page(task_process *process, uint64_t addr)
+  {
+    swap_page *result = nullptr;
+    klib_list_item<swap_page *> *item;
+
+    KL_TRC_ENTRY;
+
+    for (item = swap_pages.head; item != nullptr; item = item->next)
+    {
+      if ((item->item->process == process) && (item->item->virt_addr == addr))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Found page\n");
+        result = item->item;
+        break;
+      }
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+
+  /// @brief Remove a page from the list of tracked pages, moving the clock hand past it if needed.
+  ///
+  /// swap_lock must be held by the caller.
+  ///
+  /// @param page The page to remove.
+  void remove_swap_page(swap_page *page)
+  {
+    KL_TRC_ENTRY;
+
+    if (clock_hand == &page->list_item)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Move clock hand\n");
+      clock_hand = clock_hand->next;
+    }
+
+    klib_list_remove(&page->list_item);
+    num_swap_pages--;
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Stop tracking all pages of a process within an address range.
+  ///
+  /// @param process The process owning the pages.
+  ///
+  /// @param start_addr The first address to release pages from.
+  ///
+  /// @param end_addr The address after the last address to release pages from.
+  void release_matching_pages(task_process *process, uint64_t start_addr, uint64_t end_addr)
+  {
+    klib_list<swap_page *> released_pages = { nullptr, nullptr };
+    klib_list_item<swap_page *> *item;
+    klib_list_item<swap_page *> *next;
+    swap_page *page;
+    mem_process_stats *stats = mem_acct_get_stats(process);
+    int64_t heap_refund = 0;
+    bool waiting_for_swap = false;
+
+    KL_TRC_ENTRY;
+
+    ASSERT(stats != nullptr);
+
+    // Move the pages to a list of their own so that they can be freed without holding the lock. A page being swapped
+    // in or out belongs to the page fault handler or scanner thread until that finishes, which doesn't take long, so
+    // wait for it. In particular, the scanner thread unmaps pages without holding swap_lock, so the process's page
+    // tables must not be freed until it has finished.
+    do
+    {
+      if (waiting_for_swap)
+      {
+        task_yield();
+      }
+      waiting_for_swap = false;
+
+      klib_synch_spinlock_lock(swap_lock);
+      for (item = swap_pages.head; item != nullptr; item = next)
+      {
+        next = item->next;
+        page = item->item;
+
+        if ((page->process == process) && (page->virt_addr >= start_addr) && (page->virt_addr < end_addr))
+        {
+          if ((page->state == SWAP_PAGE_STATE::SWAPPING_IN) || (page->state == SWAP_PAGE_STATE::SWAPPING_OUT))
+          {
+            KL_TRC_TRACE(TRC_LVL::FLOW, "Wait for page at ", page->virt_addr, " to finish being swapped\n");
+            waiting_for_swap = true;
+          }
+          else
+          {
+            KL_TRC_TRACE(TRC_LVL::EXTRA, "Release page at ", page->virt_addr, "\n");
+            remove_swap_page(page);
+            heap_refund += sizeof(swap_page);
+
+            if (page->state == SWAP_PAGE_STATE::COMPRESSED)
+            {
+              stats->swapped_pages--;
+            }
+            heap_refund += page->compressed_size;
+            klib_list_add_tail(&released_pages, &page->list_item);
+          }
+        }
+      }
+      klib_synch_spinlock_unlock(swap_lock);
+    } while (waiting_for_swap);
+
+    while (!klib_list_is_empty(&released_pages))
+    {
+      page = released_pages.head->item;
+      klib_list_remove(&page->list_item);
+
+      delete[] page->compressed_data;
+      delete page;
+    }
+
+    mem_acct_charge_kernel_heap(process, -heap_refund);
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Restart any threads waiting for a page to finish being swapped out or in.
+  ///
+  /// swap_lock must be held by the caller.
+  ///
+  /// @param page The page that has finished being swapped.
+  void restart_waiting_threads(swap_page *page)
+  {
+    klib_list_item<std::shared_ptr<task_thread>> *item;
+    klib_list_item<std::shared_ptr<task_thread>> *next;
+    std::shared_ptr<task_thread> thread;
+
+    KL_TRC_ENTRY;
+
+    for (item = swap_wait_queue.head; item != nullptr; item = next)
+    {
+      next = item->next;
+      if ((item->item->parent_process.get() == page->process) && (item->item->page_fault_addr == page->virt_addr))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Restart thread ", item->item.get(), "\n");
+        thread = item->item;
+        klib_list_remove(item);
+        thread->start_thread();
+      }
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Decompress a page into a new physical page and map it back into its process.
+  ///
+  /// The page must be in the SWAPPING_IN state, which stops anything else changing or releasing it, and swap_lock must
+  /// not be held. This function doesn't block, so it is safe to call from the page fault handler. Whatever happens,
+  /// the page leaves the SWAPPING_IN state, and any threads waiting for it are restarted.
+  ///
+  /// @param page The page to swap in.
+  ///
+  /// @return True if the page was swapped in, false if there is no physical RAM to swap it in to.
+  bool swap_in_page(swap_page *page)
+  {
+    bool result = false;
+    void *phys_addr;
+    uint64_t *fill_ptr;
+    uint64_t decompressed_size;
+    mem_process_stats *stats;
+
+    KL_TRC_ENTRY;
+
+    ASSERT(page->state == SWAP_PAGE_STATE::SWAPPING_IN);
+    ASSERT(fault_window != nullptr);
+
+    phys_addr = mem_allocate_physical_pages(1);
+    if (phys_addr == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "No RAM to swap in to\n");
+    }
+    else
+    {
+      // Nothing else changes the compressed data of a page in the SWAPPING_IN state, so it can be read without holding
+      // swap_lock.
+      klib_synch_spinlock_lock(fault_window_lock);
+      mem_map_range(phys_addr, fault_window, 1);
+
+      if (page->compressed_data != nullptr)
+      {
+        decompressed_size = klib_lz_decompress(page->compressed_data,
+                                               page->compressed_size,
+                                               fault_window,
+                                               MEM_PAGE_SIZE);
+        ASSERT(decompressed_size == MEM_PAGE_SIZE);
+      }
+      else
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Fill page with ", page->fill_value, "\n");
+        fill_ptr = reinterpret_cast<uint64_t *>(fault_window);
+        for (uint64_t i = 0; i < (MEM_PAGE_SIZE / sizeof(uint64_t)); i++)
+        {
+          fill_ptr[i] = page->fill_value;
+        }
+      }
+    }
+
+    klib_synch_spinlock_lock(swap_lock);
+    if (phys_addr == nullptr)
+    {
+      page->state = SWAP_PAGE_STATE::COMPRESSED;
+    }
+    else
+    {
+      // Map the page into the process before unmapping it from the kernel, so that its use count never drops to zero.
+      mem_map_range(phys_addr, reinterpret_cast<void *>(page->virt_addr), 1, page->process);
+
+      page->state = SWAP_PAGE_STATE::RESIDENT;
+      page->idle_scans = 0;
+
+      stats = mem_acct_get_stats(page->process);
+      ASSERT(stats != nullptr);
+      stats->swapped_pages--;
+
+      result = true;
+    }
+    restart_waiting_threads(page);
+    klib_synch_spinlock_unlock(swap_lock);
+
+    if (phys_addr != nullptr)
+    {
+      mem_unmap_range(fault_window, 1, nullptr, false);
+      klib_synch_spinlock_unlock(fault_window_lock);
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+
+  /// @brief Unmap a page from its process and compress it.
+  ///
+  /// Only called by the scanner thread. The page must be in the SWAPPING_OUT state, which stops anything else changing
+  /// it, but swap_lock must not be held.
+  ///
+  /// @param page The page to swap out.
+  ///
+  /// @param phys_addr The physical page currently backing page.
+  ///
+  /// @param buffer Buffer of size SWAP_MAX_COMPRESSED_SIZE to compress the page in to.
+  ///
+  /// @param workspace Working storage for the compressor.
+  void swap_out_page(swap_page *page, uint64_t phys_addr, uint8_t *buffer, klib_lz_workspace &workspace)
+  {
+    uint64_t *fill_ptr;
+    uint64_t fill_value;
+    bool same_filled = true;
+    uint8_t *compressed_data = nullptr;
+    uint64_t compressed_size = 0;
+    bool free_phys_page;
+    mem_process_stats *stats;
+
+    KL_TRC_ENTRY;
+
+    ASSERT(page->state == SWAP_PAGE_STATE::SWAPPING_OUT);
+    ASSERT(scan_window != nullptr);
+
+    // Keep the page mapped in the kernel while it is unmapped from the process, so it isn't freed. Then make sure no
+    // processor can still write to it through an old TLB entry before reading it.
+    mem_map_range(reinterpret_cast<void *>(phys_addr), scan_window, 1);
+    mem_unmap_range(reinterpret_cast<void *>(page->virt_addr), 1, page->process, false);
+    proc_mp_signal_all_processors(PROC_IPI_MSGS::TLB_SHOOTDOWN, true, true);
+
+    fill_ptr = reinterpret_cast<uint64_t *>(scan_window);
+    fill_value = fill_ptr[0];
+    for (uint64_t i = 1; i < (MEM_PAGE_SIZE / sizeof(uint64_t)); i++)
+    {
+      if (fill_ptr[i] != fill_value)
+      {
+        same_filled = false;
+        break;
+      }
+    }
+
+    if (!same_filled)
+    {
+      compressed_size = klib_lz_compress(scan_window, MEM_PAGE_SIZE, buffer, SWAP_MAX_COMPRESSED_SIZE, workspace);
+      KL_TRC_TRACE(TRC_LVL::EXTRA, "Compressed size: ", compressed_size, "\n");
+      if (compressed_size != 0)
+      {
+        compressed_data = new uint8_t[compressed_size];
+        memcpy(compressed_data, buffer, compressed_size);
+      }
+    }
+
+    klib_synch_spinlock_lock(swap_lock);
+    if (mem_map_get_use_count(phys_addr) > 1)
+    {
+      // Something other than scan_window has pinned the page since it was chosen, such as a thread waiting on a shared
+      // futex in it. The page must keep its physical address, so put it back.
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Page pinned while being swapped out, restore it\n");
+      mem_map_range(reinterpret_cast<void *>(phys_addr), reinterpret_cast<void *>(page->virt_addr), 1, page->process);
+      page->state = SWAP_PAGE_STATE::RESIDENT;
+      page->idle_scans = 0;
+      free_phys_page = false;
+    }
+    else if (same_filled || (compressed_data != nullptr))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Page swapped out\n");
+      page->state = SWAP_PAGE_STATE::COMPRESSED;
+      page->compressed_data = compressed_data;
+      page->compressed_size = compressed_size;
+      page->fill_value = fill_value;
+      compressed_data = nullptr;
+
+      stats = mem_acct_get_stats(page->process);
+      ASSERT(stats != nullptr);
+      stats->swapped_pages++;
+      stats->kernel_heap_bytes += compressed_size;
+
+      free_phys_page = true;
+    }
+    else
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Page doesn't compress well, restore it\n");
+      mem_map_range(reinterpret_cast<void *>(phys_addr), reinterpret_cast<void *>(page->virt_addr), 1, page->process);
+      page->state = SWAP_PAGE_STATE::RESIDENT;
+      page->idle_scans = 0;
+      free_phys_page = false;
+    }
+    restart_waiting_threads(page);
+    klib_synch_spinlock_unlock(swap_lock);
+
+    mem_unmap_range(scan_window, 1, nullptr, free_phys_page);
+
+    // This is only non-null if the compressed data wasn't needed after all.
+    delete[] compressed_data;
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Make one full sweep over all tracked pages, swapping out any that have become cold.
+  ///
+  /// Also frees out-of-date compressed data left behind by the page fault handler.
+  ///
+  /// @param buffer Buffer of size SWAP_MAX_COMPRESSED_SIZE for compressing pages.
+  ///
+  /// @param workspace Working storage for the compressor.
+  void sweep_all_pages(uint8_t *buffer, klib_lz_workspace &workspace)
+  {
+    uint64_t pages_to_visit;
+    swap_page *page;
+    swap_page *cold_page;
+    uint8_t *stale_data;
+    uint64_t phys_addr = 0;
+    mem_process_stats *stats;
+
+    KL_TRC_ENTRY;
+
+    klib_synch_spinlock_lock(swap_lock);
+    pages_to_visit = num_swap_pages;
+    klib_synch_spinlock_unlock(swap_lock);
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Sweep ", pages_to_visit, " pages\n");
+
+    for (uint64_t i = 0; i < pages_to_visit; i++)
+    {
+      cold_page = nullptr;
+      stale_data = nullptr;
+
+      klib_synch_spinlock_lock(swap_lock);
+      if (clock_hand == nullptr)
+      {
+        clock_hand = swap_pages.head;
+      }
+
+      if (clock_hand == nullptr)
+      {
+        // All pages have been released since the sweep started.
+        klib_synch_spinlock_unlock(swap_lock);
+        break;
+      }
+
+      page = clock_hand->item;
+      clock_hand = clock_hand->next;
+
+      if (page->state == SWAP_PAGE_STATE::RESIDENT)
+      {
+        if (page->compressed_data != nullptr)
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Free out-of-date compressed data\n");
+          stale_data = page->compressed_data;
+          stats = mem_acct_get_stats(page->process);
+          ASSERT(stats != nullptr);
+          stats->kernel_heap_bytes -= page->compressed_size;
+          page->compressed_data = nullptr;
+          page->compressed_size = 0;
+        }
+
+        if (mem_test_and_clear_accessed(reinterpret_cast<void *>(page->virt_addr), page->process))
+        {
+          page->idle_scans = 0;
+        }
+        else
+        {
+          page->idle_scans++;
+          if (page->idle_scans >= SWAP_COLD_SWEEPS)
+          {
+            phys_addr = reinterpret_cast<uint64_t>(mem_get_phys_addr(reinterpret_cast<void *>(page->virt_addr),
+                                                                     page->process));
+            if ((phys_addr != 0) && (mem_map_get_use_count(phys_addr) == 1))
+            {
+              KL_TRC_TRACE(TRC_LVL::FLOW, "Page at ", page->virt_addr, " is cold\n");
+              page->state = SWAP_PAGE_STATE::SWAPPING_OUT;
+              cold_page = page;
+            }
+          }
+        }
+      }
+      klib_synch_spinlock_unlock(swap_lock);
+
+      delete[] stale_data;
+
+      if (cold_page != nullptr)
+      {
+        swap_out_page(cold_page, phys_addr, buffer, workspace);
+      }
+    }
+
+    KL_TRC_EXIT;
+  }
+}
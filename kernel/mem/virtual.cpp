@@ -59,6 +59,7 @@ namespace
   void mem_vmm_free_range_item(vmm_range_data *item);
   bool mem_vmm_lock(vmm_process_data *proc_data_ptr);
   void mem_vmm_unlock(vmm_process_data *proc_data_ptr);
+  mem_process_stats *mem_vmm_stats(task_process *process);
 };
 
 //------------------------------------------------------------------------------
@@ -81,15 +82,16 @@ namespace
 ///
 /// @param process_to_use The process to do the allocation in. If nullptr, a kernel allocation is made.
 ///
-/// @return The address of the virtual range allocated.
+/// @return The address of the virtual range allocated, or nullptr if there is no free range large enough.
 ///
 /// @see mem_deallocate_virtual_range
 void *mem_allocate_virtual_range(uint32_t num_pages, task_process *process_to_use)
 {
   vmm_process_data *proc_data_ptr;
-  klib_list_item<vmm_range_data *> *selected_list_item;
-  vmm_range_data *selected_range_data;
+  klib_list_item<vmm_range_data *> *selected_list_item = nullptr;
+  vmm_range_data *selected_range_data = nullptr;
   bool acquired_lock;
+  void *result = nullptr;
 
   KL_TRC_ENTRY;
 
@@ -116,28 +118,41 @@ void *mem_allocate_virtual_range(uint32_t num_pages, task_process *process_to_us
 
   // How many pages are we actually going to allocate. If num_pages is exactly
   // a power of two, it will be used. Otherwise, it will be rounded up to the
-  // next power of two.
-  uint32_t actual_num_pages;
+  // next power of two - which may not fit in 32 bits.
+  uint64_t actual_num_pages;
   actual_num_pages = round_to_power_two(num_pages);
 
   // What range are we going to allocate from?
-  selected_list_item = mem_vmm_get_suitable_range(actual_num_pages, proc_data_ptr);
-  selected_range_data = (vmm_range_data *)selected_list_item->item;
-
-  // If this range is too large, split it in to pieces. Otherwise, simply mark
-  // it allocated and return it.
-  ASSERT(selected_range_data->number_of_pages >= actual_num_pages);
-  ASSERT(selected_range_data->allocated == false);
+  if (actual_num_pages <= UINT32_MAX)
+  {
+    selected_list_item = mem_vmm_get_suitable_range(actual_num_pages, proc_data_ptr);
+  }
 
-  if (selected_range_data->number_of_pages != actual_num_pages)
+  if (selected_list_item == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "No free range of ", actual_num_pages, " pages\n");
+  }
+  else
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Splitting over-sized page.\n");
-    selected_list_item = mem_vmm_split_range(selected_list_item, actual_num_pages, proc_data_ptr);
     selected_range_data = (vmm_range_data *)selected_list_item->item;
 
+    // If this range is too large, split it in to pieces. Otherwise, simply mark
+    // it allocated and return it.
+    ASSERT(selected_range_data->number_of_pages >= actual_num_pages);
+    ASSERT(selected_range_data->allocated == false);
+
+    if (selected_range_data->number_of_pages != actual_num_pages)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Splitting over-sized page.\n");
+      selected_list_item = mem_vmm_split_range(selected_list_item, actual_num_pages, proc_data_ptr);
+      selected_range_data = (vmm_range_data *)selected_list_item->item;
+
+    }
+    ASSERT(selected_range_data->number_of_pages == actual_num_pages);
+    selected_range_data->allocated = true;
+    mem_vmm_stats(process_to_use)->virtual_pages += actual_num_pages;
+    result = (void *)selected_range_data->start;
   }
-  ASSERT(selected_range_data->number_of_pages == actual_num_pages);
-  selected_range_data->allocated = true;
 
   if (acquired_lock)
   {
@@ -147,7 +162,7 @@ void *mem_allocate_virtual_range(uint32_t num_pages, task_process *process_to_us
 
   KL_TRC_EXIT;
 
-  return (void *)selected_range_data->start;
+  return result;
 }
 
 /// @brief Allocate a specific range of virtual memory.
@@ -213,6 +228,7 @@ void mem_vmm_allocate_specific_range(uint64_t start_addr, uint32_t num_pages, ta
         KL_TRC_TRACE(TRC_LVL::FLOW, "Correct size found\n");
         ASSERT(!cur_data->allocated);
         cur_data->allocated = true;
+        mem_vmm_stats(process_to_use)->virtual_pages += num_pages;
       }
       else
       {
@@ -289,6 +305,7 @@ void mem_deallocate_virtual_range(void *start, uint32_t num_pages, task_process
       ASSERT(cur_range_data->allocated == true);
       ASSERT(cur_range_data->number_of_pages == actual_num_pages);
       cur_range_data->allocated = false;
+      mem_vmm_stats(process_to_use)->virtual_pages -= actual_num_pages;
 
       mem_vmm_resolve_merges(cur_list_item);
 
@@ -544,6 +561,8 @@ namespace
   /// @param num_pages The minimum number of pages required in the range.
   ///
   /// @param proc_data_ptr The data for the process to perform the allocation in.
+  ///
+  /// @return The list item of the selected range, or nullptr if there is no free range large enough.
   klib_list_item<vmm_range_data *> *mem_vmm_get_suitable_range(uint32_t num_pages, vmm_process_data *proc_data_ptr)
   {
     KL_TRC_ENTRY;
@@ -581,7 +600,6 @@ namespace
 
     KL_TRC_EXIT;
 
-    ASSERT(selected_range_item != nullptr);
     return selected_range_item;
   }
 
@@ -892,4 +910,23 @@ namespace
     proc_data_ptr->vmm_user_thread_id = 0;
     klib_synch_spinlock_unlock(proc_data_ptr->vmm_lock);
   }
+
+  /// @brief Find the accounting counters to update for an allocation.
+  ///
+  /// @param process The process the allocation is being made in, or nullptr for the kernel.
+  ///
+  /// @return The counters to update.
+  mem_process_stats *mem_vmm_stats(task_process *process)
+  {
+    mem_process_stats *result;
+
+    KL_TRC_ENTRY;
+
+    // Unlike most of the memory manager, nullptr means the kernel here, not the current process.
+    result = (process == nullptr) ? &task0_entry.stats : &process->mem_info->stats;
+
+    KL_TRC_EXIT;
+
+    return result;
+  }
 };
@@ -39,6 +39,7 @@ void mem_x64_map_virtual_page(uint64_t virt_addr,
                               task_process *context = nullptr,
                               MEM_CACHE_MODES cache_mode = MEM_WRITE_BACK);
 void mem_x64_unmap_virtual_page(uint64_t virt_addr, task_process *context);
+bool mem_x64_test_and_clear_pte_flag(void *virtual_addr, task_process *context, uint64_t flag);
 
 uint64_t mem_encode_page_table_entry(page_table_entry &pte);
 page_table_entry mem_decode_page_table_entry(uint64_t encoded);
@@ -54,6 +55,14 @@ uint64_t mem_x64_phys_addr_from_pte(uint64_t encoded);
 /// @param x The page table to inspect.
 #define PT_MARKED_PRESENT(x) ((x) & 1)
 
+/// @brief The flag set by the processor in an entry at the end of the translation tree when the page it maps is read
+/// from or written to.
+const uint64_t PT_ACCESSED_FLAG = 0x20;
+
+/// @brief The flag set by the processor in an entry at the end of the translation tree when the page it maps is
+/// written to.
+const uint64_t PT_DIRTY_FLAG = 0x40;
+
 void mem_x64_pml4_init_sys(process_x64_data &task0_data);
 void mem_x64_pml4_allocate(process_x64_data &new_proc_data);
 void mem_x64_pml4_deallocate(process_x64_data &proc_data);
@@ -220,12 +220,15 @@ void mem_x64_map_virtual_page(uint64_t virt_addr,
   void *table_phys_addr;
   page_table_entry new_entry;
   bool is_kernel_allocation;
+  mem_process_stats *stats;
 
   // Truncate the physical address to be limited by MAXPHYADDR
   ASSERT(valid_phys_bit_mask != 0);
   phys_addr = phys_addr & valid_phys_bit_mask;
 
   is_kernel_allocation = ((virt_addr & 0x8000000000000000) != 0);
+  stats = is_kernel_allocation ? &task0_entry.stats : mem_acct_get_stats(context);
+  ASSERT(stats != nullptr);
 
   virt_addr_cpy = virt_addr_cpy >> 21;
   page_dir_entry_idx = (virt_addr_cpy & 0x00000000000001FF);
@@ -249,6 +252,7 @@ void mem_x64_map_virtual_page(uint64_t virt_addr,
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "PML4 entry not present\n");
     table_phys_addr = (void *)mem_get_next_4kb_page();
+    stats->page_table_pages++;
 
     new_entry.target_addr = (uint64_t)table_phys_addr;
     new_entry.present = true;
@@ -294,6 +298,7 @@ void mem_x64_map_virtual_page(uint64_t virt_addr,
     KL_TRC_TRACE(TRC_LVL::FLOW, "PDPT entry not present\n");
 
     table_phys_addr = (void *)mem_get_next_4kb_page();
+    stats->page_table_pages++;
 
     new_entry.target_addr = (uint64_t)table_phys_addr;
     new_entry.present = true;
@@ -637,6 +642,94 @@ void *mem_get_phys_addr(void *virtual_addr, task_process *context)
   return return_addr_found ? reinterpret_cast<void *>(phys_addr) : nullptr;
 }
 
+/// @brief Determine whether the processor has set a flag in the page table entry for a page, and reset the flag.
+///
+/// @param virtual_addr The virtual address to check. Need not point at a page boundary.
+///
+/// @param context The process context to do this check in. If nullptr is supplied, use the current context.
+///
+/// @param flag The flag to test, either PT_ACCESSED_FLAG or PT_DIRTY_FLAG.
+///
+/// @return True if the flag was set, false if not or if the page is not mapped at all.
+bool mem_x64_test_and_clear_pte_flag(void *virtual_addr, task_process *context, uint64_t flag)
+{
+  KL_TRC_ENTRY;
+
+  uint64_t virt_addr_cpy;
+  uint64_t pml4_entry_idx;
+  uint64_t page_dir_ptr_entry_idx;
+  uint64_t page_dir_entry_idx;
+  uint64_t *table_addr = get_pml4_table_addr(context);
+  uint64_t *encoded_entry;
+  void *table_phys_addr;
+  bool was_set = false;
+
+  virt_addr_cpy = ((uint64_t)virtual_addr) - (((uint64_t)virtual_addr) % MEM_PAGE_SIZE);
+
+  virt_addr_cpy = virt_addr_cpy >> 21;
+  page_dir_entry_idx = (virt_addr_cpy & 0x00000000000001FF);
+  virt_addr_cpy = virt_addr_cpy >> 9;
+  page_dir_ptr_entry_idx = (virt_addr_cpy & 0x00000000000001FF);
+  virt_addr_cpy = virt_addr_cpy >> 9;
+  pml4_entry_idx = (virt_addr_cpy & 0x00000000000001FF);
+
+  encoded_entry = table_addr + pml4_entry_idx;
+  if (PT_MARKED_PRESENT(*encoded_entry))
+  {
+    table_phys_addr = (void *)mem_x64_phys_addr_from_pte(*encoded_entry);
+    mem_set_working_page_dir((uint64_t)table_phys_addr);
+    table_addr = (uint64_t *)working_table_virtual_addr;
+    encoded_entry = table_addr + page_dir_ptr_entry_idx;
+    if (PT_MARKED_PRESENT(*encoded_entry))
+    {
+      table_phys_addr = (void *)mem_x64_phys_addr_from_pte(*encoded_entry);
+      mem_set_working_page_dir((uint64_t)table_phys_addr);
+      table_addr = (uint64_t *)working_table_virtual_addr;
+      encoded_entry = table_addr + page_dir_entry_idx;
+
+      if (PT_MARKED_PRESENT(*encoded_entry) && ((*encoded_entry & flag) != 0))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Flag is set\n");
+        was_set = true;
+        *encoded_entry = *encoded_entry & ~flag;
+
+        // This only affects the TLB of this processor, which may not even be running the process in question.
+        mem_invalidate_page_table(((uint64_t)virtual_addr) - (((uint64_t)virtual_addr) % MEM_PAGE_SIZE));
+      }
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", was_set, "\n");
+  KL_TRC_EXIT;
+
+  return was_set;
+}
+
+/// @brief Determine whether a page has been written to since it was mapped or last checked, and reset the flag.
+///
+/// @param virtual_addr The virtual address to check. Need not point at a page boundary.
+///
+/// @param context The process context to do this check in. If nullptr is supplied, use the current context.
+///
+/// @return True if the page backing virtual_addr has been written to, false if not or if it is not mapped at all.
+bool mem_test_and_clear_dirty(void *virtual_addr, task_process *context)
+{
+  return mem_x64_test_and_clear_pte_flag(virtual_addr, context, PT_DIRTY_FLAG);
+}
+
+/// @brief Determine whether a page has been read from or written to since it was mapped or last checked, and reset
+///        the flag.
+///
+/// @param virtual_addr The virtual address to check. Need not point at a page boundary.
+///
+/// @param context The process context to do this check in. If nullptr is supplied, use the current context.
+///
+/// @return True if the page backing virtual_addr has been accessed, false if not or if it is not mapped at all.
+bool mem_test_and_clear_accessed(void *virtual_addr, task_process *context)
+{
+  return mem_x64_test_and_clear_pte_flag(virtual_addr, context, PT_ACCESSED_FLAG);
+}
+
 /// @brief Get the virtual address of the PML4 table for the currently running process.
 ///
 /// Get the PML4 table address for the selected process, or the currently running process if context = NULL. The only
@@ -21,7 +21,7 @@ object_manager::object_manager()
 {
   KL_TRC_ENTRY;
 
-  klib_synch_spinlock_init(om_main_lock);
+  klib_synch_rwlock_init(om_main_lock);
 
   KL_TRC_EXIT;
 }
@@ -71,9 +71,9 @@ void object_manager::correlate_object(object_data &object, GEN_HANDLE handle)
   ASSERT(new_object->object_ptr);
   new_object->handle = handle;
 
-  klib_synch_spinlock_lock(om_main_lock);
+  klib_synch_rwlock_lock_write(om_main_lock);
   object_store.insert({handle, new_object});
-  klib_synch_spinlock_unlock(om_main_lock);
+  klib_synch_rwlock_unlock_write(om_main_lock);
 
   KL_TRC_EXIT;
 }
@@ -91,9 +91,9 @@ std::shared_ptr<object_data> object_manager::retrieve_object(GEN_HANDLE handle)
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Looking for handle ", handle, "\n");
 
-  klib_synch_spinlock_lock(om_main_lock);
+  klib_synch_rwlock_lock_read(om_main_lock);
   found_object = this->int_retrieve_object(handle);
-  klib_synch_spinlock_unlock(om_main_lock);
+  klib_synch_rwlock_unlock_read(om_main_lock);
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Found object data: ", found_object, "\n");
   KL_TRC_EXIT;
@@ -160,10 +160,10 @@ void object_manager::decorrelate_object(GEN_HANDLE handle)
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Removing object with handle ", handle, "\n");
 
-  klib_synch_spinlock_lock(om_main_lock);
+  klib_synch_rwlock_lock_write(om_main_lock);
   found_object = this->int_retrieve_object(handle);
   object_store.erase(handle);
-  klib_synch_spinlock_unlock(om_main_lock);
+  klib_synch_rwlock_unlock_write(om_main_lock);
 
   KL_TRC_EXIT;
 }
@@ -171,8 +171,8 @@ void object_manager::decorrelate_object(GEN_HANDLE handle)
 /// @brief Retrieve all object data from OM
 ///
 /// This function is internal to OM. It retrieves the underlying data structure storing a given object in OM. This
-/// function contains no locking - **appropriate serialisation MUST be used**, only one function can call this one at
-/// a time.
+/// function contains no locking - **appropriate serialisation MUST be used**. The caller must hold om_main_lock, for
+/// reading at least.
 ///
 /// This function does not check that the handle is valid in this thread, that is up to the caller.
 ///
@@ -208,3 +208,22 @@ void object_manager::remove_all_objects()
 
   KL_TRC_EXIT;
 }
+
+/// @brief How many objects are stored in this OM instance?
+///
+/// @return The number of handles currently correlated with objects.
+uint64_t object_manager::num_objects()
+{
+  uint64_t result;
+
+  KL_TRC_ENTRY;
+
+  klib_synch_rwlock_lock_read(om_main_lock);
+  result = object_store.size();
+  klib_synch_rwlock_unlock_read(om_main_lock);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Number of objects: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
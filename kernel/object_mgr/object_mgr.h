@@ -28,10 +28,13 @@ public:
 
   void remove_all_objects();
 
+  uint64_t num_objects();
+
 private:
   std::map<GEN_HANDLE, std::shared_ptr<object_data>> object_store; ///< Stores pointers to all managed objects.
 
-  kernel_spinlock om_main_lock{0}; ///< Synchronising lock.
+  /// Synchronising lock. Lookups only read the object store, so they can run in parallel.
+  kernel_rwlock om_main_lock{0};
 
   std::shared_ptr<object_data> int_retrieve_object(GEN_HANDLE handle);
 };
@@ -2,16 +2,80 @@
 /// @brief Implement futexes in the Azalea kernel.
 ///
 /// See the Linux futex and robust futex documentation for a fuller description of how futexes work.
+///
+/// Threads waiting on futexes are kept in a single global hash table. Each bucket of the table has its own lock and an
+/// intrusive list of the threads waiting on any futex that hashes to that bucket, in the order they started waiting.
+/// Waiting on or waking a futex only takes the lock of its own bucket and doesn't allocate any memory. Threads are
+/// woken in the order they started waiting. Wake operations only wake as many threads as they are asked to, so that,
+/// for example, releasing a lock only wakes the one thread that will take it next rather than all of its waiters.
+///
+/// Futexes are identified by a futex_key. Private futexes are identified by their process and virtual address, so they
+/// are unaffected by their page being swapped out and back in at a different physical address. Shared futexes are
+/// identified by their physical address, so that processes mapping the same memory at different addresses find the
+/// same futex. The page containing a shared futex is pinned while any thread waits on it, and while an operation is
+/// using its key, so that it can't be swapped out or freed and its physical address doesn't change.
+///
+/// A futex's value is read or changed while holding bucket locks, when the page fault handler can't wait for its page
+/// to be read in. So, as in Linux, the page is first brought into memory without any locks held, and is pinned until
+/// the value has been used. If the page is swapped out again before it is pinned, it is brought back in and pinned
+/// again.
+//
+// Known defects:
+// - If all processes unmap a shared page while threads are waiting on a futex in it, those threads can't be woken
+//   until they are destroyed. The pinned page isn't freed until then.
+// - If another thread unmaps a futex's page while an operation is using its value, the kernel faults. Pinning stops
+//   the page being swapped out or freed, but not unmapped.
 
 //#define ENABLE_TRACING
 
 #include "futexes.h"
 #include "processor/processor.h"
+#include "mem/page_cache.h"
 #include "klib/klib.h"
 
-#include <map>
-#include <vector>
-#include <algorithm>
+namespace
+{
+  /// @brief The number of buckets in the futex hash table. Must be a power of two.
+  const uint32_t FUTEX_HASH_BUCKETS = 256;
+
+  /// @brief One bucket of the futex hash table.
+  ///
+  /// Each bucket fills its own cache lines, so that processors using futexes in different buckets don't contend.
+  struct alignas(PROC_CACHE_LINE_SIZE) futex_bucket
+  {
+    /// Protects waiters, and the futex_wait_key of each thread in waiters.
+    kernel_spinlock lock{0};
+
+    /// The threads waiting on any futex in this bucket, in the order they started waiting.
+    klib_list<task_thread *> waiters{nullptr, nullptr};
+  };
+
+  /// The futex hash table.
+  futex_bucket futex_table[FUTEX_HASH_BUCKETS];
+
+  bool pin_futex_page(volatile int32_t *futex, uint64_t &phys_page);
+  bool make_key(volatile int32_t *futex, bool shared, futex_key &key);
+  void add_key_ref(const futex_key &key);
+  void release_key(const futex_key &key);
+  futex_bucket &bucket_for(const futex_key &key);
+  bool keys_equal(const futex_key &a, const futex_key &b);
+  void lock_bucket_pair(futex_bucket &a, futex_bucket &b);
+  void unlock_bucket_pair(futex_bucket &a, futex_bucket &b);
+  uint32_t wake_waiters(futex_bucket &bucket, const futex_key &key, int32_t max_wake);
+  uint32_t move_waiters(futex_bucket &from_bucket,
+                        const futex_key &from_key,
+                        futex_bucket &to_bucket,
+                        const futex_key &to_key,
+                        int32_t max_move);
+  bool decode_wake_op(uint32_t encoded_op,
+                      uint32_t &op,
+                      bool &arg_is_shift,
+                      int32_t &op_arg,
+                      uint32_t &cmp,
+                      int32_t &cmp_arg);
+  int32_t apply_atomic_op(volatile int32_t *futex, uint32_t op, int32_t op_arg);
+  bool compare_values(int32_t value, uint32_t cmp, int32_t cmp_arg);
+}
 
 /// @brief Wait for the requested futex.
 ///
@@ -19,110 +83,850 @@
 ///
 /// @param req_value The value of the desired futex state given in the system call.
 ///
-/// @return A suitable error code.
-ERR_CODE futex_wait(volatile int32_t *futex, int32_t req_value)
+/// @param shared Whether the futex may be shared with other processes. The futex must be in mapped memory.
+///
+/// @return ERR_CODE::INVALID_PARAM if the futex's page can't be brought into memory, ERR_CODE::NO_ERROR otherwise.
+ERR_CODE futex_wait(volatile int32_t *futex, int32_t req_value, bool shared)
 {
   ERR_CODE result{ERR_CODE::NO_ERROR};
-  uint64_t futex_addr_l{reinterpret_cast<uint64_t>(futex)};
   task_thread *cur_thread = task_get_cur_thread();
   ASSERT(cur_thread);
-  std::shared_ptr<task_process> cur_process{cur_thread->parent_process};
-  ASSERT(cur_process);
+  futex_key key;
+  uint64_t phys_page;
 
   KL_TRC_ENTRY;
 
-  if (*futex == req_value)
+  if (!pin_futex_page(futex, phys_page))
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Need to wait\n");
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Futex not in memory\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (!make_key(futex, shared, key))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Futex not in memory\n");
+    mem_map_unpin_page(phys_page);
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    futex_bucket &bucket = bucket_for(key);
+
+    // Check the futex's value while holding the bucket lock. A thread that changes the value and then wakes the futex
+    // must take the same lock to do so, so either the change is seen here or the wake finds this thread waiting.
+    klib_synch_spinlock_lock(bucket.lock);
+
+    if (*futex == req_value)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Need to wait\n");
+
+      // This sequence of continuing execution even after calling stop_thread() is similar to that used for mutexes
+      // and semaphores.
+      task_continue_this_thread();
+
+      // The key's reference passes to the futex table, and is released when this thread stops waiting.
+      cur_thread->futex_wait_key = key;
+      klib_list_add_tail(&bucket.waiters, &cur_thread->futex_wait_item);
+      cur_thread->stop_thread();
 
-    // This sequence of continuing execution even after calling stop_thread() is similar to that used for mutexes and
-    // semaphores.
-    klib_synch_spinlock_lock(cur_process->map_ops_lock);
-    task_continue_this_thread();
+      klib_synch_spinlock_unlock(bucket.lock);
+      mem_map_unpin_page(phys_page);
 
-    if(!map_contains(cur_process->futex_map, futex_addr_l))
+      task_resume_scheduling();
+      task_yield();
+    }
+    else
     {
-      cur_process->futex_map.insert({futex_addr_l, std::vector<task_thread *>()});
+      KL_TRC_TRACE(TRC_LVL::FLOW, "No need to wait\n");
+      klib_synch_spinlock_unlock(bucket.lock);
+      mem_map_unpin_page(phys_page);
+      release_key(key);
     }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Wake threads waiting on the requested futex.
+///
+/// @param futex The futex to wake.
+///
+/// @param max_wake The maximum number of threads to wake. As in Linux, at least one thread is woken even if this is
+///                 zero or less.
+///
+/// @param shared Whether the futex may be shared with other processes. The futex must be in mapped memory.
+///
+/// @return ERR_CODE::NO_ERROR if any threads were woken, ERR_CODE::NOT_FOUND if no threads were waiting, or
+///         ERR_CODE::INVALID_PARAM if the futex is shared and its page can't be brought into memory.
+ERR_CODE futex_wake(volatile int32_t *futex, int32_t max_wake, bool shared)
+{
+  ERR_CODE result{ERR_CODE::NO_ERROR};
+  futex_key key;
+  uint32_t woken;
+
+  KL_TRC_ENTRY;
+
+  if (max_wake < 1)
+  {
+    max_wake = 1;
+  }
+
+  if (!make_key(futex, shared, key))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Futex not in memory\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    futex_bucket &bucket = bucket_for(key);
 
-    std::vector<task_thread *> &v = cur_process->futex_map[futex_addr_l];
-    v.push_back(cur_thread);
+    klib_synch_spinlock_lock(bucket.lock);
+    woken = wake_waiters(bucket, key, max_wake);
+    klib_synch_spinlock_unlock(bucket.lock);
 
-    cur_thread->stop_thread();
-    klib_synch_spinlock_unlock(cur_process->map_ops_lock);
+    release_key(key);
 
-    if (*futex != req_value)
+    if (woken == 0)
     {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "Wake this thread, just in case\n");
-      klib_synch_spinlock_lock(cur_process->map_ops_lock);
-      std::vector<task_thread *>::iterator it = std::find(v.begin(), v.end(), cur_thread);
+      KL_TRC_TRACE(TRC_LVL::FLOW, "No threads waiting\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+  }
 
-      if (it != v.end())
-      {
-        KL_TRC_TRACE(TRC_LVL::FLOW, "Thread hasn't been woken externally\n");
-        v.erase(it);
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
 
-        if (v.empty())
-        {
-          KL_TRC_TRACE(TRC_LVL::FLOW, "No more waits on this mutex\n");
-          cur_process->futex_map.erase(futex_addr_l);
-        }
+  return result;
+}
+
+/// @brief Wake some threads waiting on one futex, and move some of the rest to wait on another futex instead.
+///
+/// This allows, for example, a condition variable to be broadcast by waking one thread and moving the rest to wait on
+/// the associated mutex, rather than waking them all to contend for the mutex.
+///
+/// @param futex The futex whose waiters should be woken or moved.
+///
+/// @param max_wake The maximum number of threads to wake. May be zero.
+///
+/// @param max_requeue The maximum number of threads to move to futex_2 after waking threads. May be zero.
+///
+/// @param futex_2 The futex to move threads to.
+///
+/// @param compare If true, only carry out the operation if futex still contains cmp_value.
+///
+/// @param cmp_value The value futex is expected to contain, if compare is true.
+///
+/// @param shared Whether the futexes may be shared with other processes. Both futexes must be in mapped memory.
+///
+/// @return ERR_CODE::NO_ERROR if any threads were woken or moved, ERR_CODE::NOT_FOUND if no threads were waiting,
+///         ERR_CODE::SYNC_VALUE_CHANGED if compare was true and futex didn't contain cmp_value, or
+///         ERR_CODE::INVALID_PARAM if the futexes are shared, or compare is true, and one of the pages needed can't be
+///         brought into memory.
+ERR_CODE futex_requeue(volatile int32_t *futex,
+                       int32_t max_wake,
+                       int32_t max_requeue,
+                       volatile int32_t *futex_2,
+                       bool compare,
+                       int32_t cmp_value,
+                       bool shared)
+{
+  ERR_CODE result{ERR_CODE::NO_ERROR};
+  futex_key key;
+  futex_key key_2;
+  bool have_key;
+  bool have_key_2;
+  bool have_page;
+  uint64_t phys_page;
+  uint32_t woken = 0;
+  uint32_t moved = 0;
+
+  KL_TRC_ENTRY;
+
+  // The value of futex is only needed if it is to be compared.
+  have_page = compare && pin_futex_page(futex, phys_page);
+  have_key = make_key(futex, shared, key);
+  have_key_2 = make_key(futex_2, shared, key_2);
+
+  if (compare && !have_page)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Futex not in memory\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (!have_key || !have_key_2)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Futex not in memory\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    futex_bucket &bucket = bucket_for(key);
+    futex_bucket &bucket_2 = bucket_for(key_2);
+
+    lock_bucket_pair(bucket, bucket_2);
+
+    if (compare && (*futex != cmp_value))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Futex value has changed\n");
+      result = ERR_CODE::SYNC_VALUE_CHANGED;
+    }
+    else
+    {
+      woken = wake_waiters(bucket, key, max_wake);
+      if (!keys_equal(key, key_2))
+      {
+        moved = move_waiters(bucket, key, bucket_2, key_2, max_requeue);
       }
 
-      klib_synch_spinlock_unlock(cur_process->map_ops_lock);
-      cur_thread->start_thread();
+      if ((woken == 0) && (moved == 0))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "No threads waiting\n");
+        result = ERR_CODE::NOT_FOUND;
+      }
     }
 
-    task_resume_scheduling();
-    task_yield();
+    unlock_bucket_pair(bucket, bucket_2);
+  }
+
+  if (have_page)
+  {
+    mem_map_unpin_page(phys_page);
+  }
+  if (have_key)
+  {
+    release_key(key);
+  }
+  if (have_key_2)
+  {
+    release_key(key_2);
   }
-  // Else no need to wait
 
+  KL_TRC_TRACE(TRC_LVL::FLOW, "Woken: ", woken, ", moved: ", moved, "\n");
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
   KL_TRC_EXIT;
 
   return result;
 }
 
-/// @brief Wake the requested futex
+/// @brief Change the value of one futex, then wake threads waiting on it and another futex.
 ///
-/// @param futex The futex to wake.
+/// The operation encoded in encoded_op is applied atomically to futex_2. Then up to max_wake threads waiting on futex
+/// are woken, and, if the old value of futex_2 satisfies the comparison encoded in encoded_op, up to max_wake_2
+/// threads waiting on futex_2 are woken too. See FUTEX_WAKE_OP_ENCODE for the encoding.
+///
+/// @param futex The first futex to wake.
+///
+/// @param max_wake The maximum number of threads waiting on futex to wake.
+///
+/// @param futex_2 The futex to change, and maybe wake.
+///
+/// @param max_wake_2 The maximum number of threads waiting on futex_2 to wake, if the comparison holds.
+///
+/// @param encoded_op The operation and comparison to carry out on futex_2.
 ///
-/// @return A suitable error code.
-ERR_CODE futex_wake(volatile int32_t *futex)
+/// @param shared Whether the futexes may be shared with other processes. Both futexes must be in mapped memory.
+///
+/// @return ERR_CODE::NO_ERROR if the operation was carried out, even if no threads were woken, or
+///         ERR_CODE::INVALID_PARAM if encoded_op isn't valid, if futex_2's page can't be brought into memory, or if the
+///         futexes are shared and futex's page can't be brought into memory.
+ERR_CODE futex_wake_op(volatile int32_t *futex,
+                       int32_t max_wake,
+                       volatile int32_t *futex_2,
+                       int32_t max_wake_2,
+                       uint32_t encoded_op,
+                       bool shared)
 {
   ERR_CODE result{ERR_CODE::NO_ERROR};
-  uint64_t futex_addr_l{reinterpret_cast<uint64_t>(futex)};
-  task_thread *cur_thread = task_get_cur_thread();
-  ASSERT(cur_thread);
-  std::shared_ptr<task_process> cur_process{cur_thread->parent_process};
-  ASSERT(cur_process);
+  futex_key key;
+  futex_key key_2;
+  bool have_key;
+  bool have_key_2;
+  uint32_t op;
+  bool arg_is_shift;
+  int32_t op_arg;
+  uint32_t cmp;
+  int32_t cmp_arg;
+  int32_t old_value;
+  bool have_page_2;
+  uint64_t phys_page_2;
 
   KL_TRC_ENTRY;
 
-  klib_synch_spinlock_lock(cur_process->map_ops_lock);
+  have_page_2 = pin_futex_page(futex_2, phys_page_2);
+  have_key = make_key(futex, shared, key);
+  have_key_2 = make_key(futex_2, shared, key_2);
 
-  if (map_contains(cur_process->futex_map, futex_addr_l))
+  if (!decode_wake_op(encoded_op, op, arg_is_shift, op_arg, cmp, cmp_arg))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid operation\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (!have_page_2 || !have_key || !have_key_2)
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Found physical address, wake any sleepers\n");
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Futex not in memory\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    futex_bucket &bucket = bucket_for(key);
+    futex_bucket &bucket_2 = bucket_for(key_2);
 
-    for(task_thread *sleeper : cur_process->futex_map[futex_addr_l])
+    if (arg_is_shift)
     {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "Wake thread with address: ", sleeper, "\n");
-      sleeper->start_thread();
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Argument is a shift\n");
+      op_arg = static_cast<int32_t>(1U << (op_arg & 31));
     }
-    cur_process->futex_map.erase(futex_addr_l);
+
+    lock_bucket_pair(bucket, bucket_2);
+
+    old_value = apply_atomic_op(futex_2, op, op_arg);
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Old value of second futex: ", old_value, "\n");
+
+    wake_waiters(bucket, key, max_wake);
+    if (compare_values(old_value, cmp, cmp_arg))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Comparison holds, wake second futex\n");
+      wake_waiters(bucket_2, key_2, max_wake_2);
+    }
+
+    unlock_bucket_pair(bucket, bucket_2);
   }
-  else
+
+  if (have_page_2)
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Didn't find physical address\n");
-    result = ERR_CODE::NOT_FOUND;
+    mem_map_unpin_page(phys_page_2);
+  }
+  if (have_key)
+  {
+    release_key(key);
+  }
+  if (have_key_2)
+  {
+    release_key(key_2);
   }
-
-  klib_synch_spinlock_unlock(cur_process->map_ops_lock);
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
   KL_TRC_EXIT;
 
   return result;
 }
+
+/// @brief Stop a thread waiting on a futex, without waking it.
+///
+/// This is used when a thread is destroyed, so that it isn't left in the futex table.
+///
+/// @param thread The thread to remove from the futex table. It need not be waiting on a futex.
+void futex_cancel_wait(task_thread *thread)
+{
+  KL_TRC_ENTRY;
+
+  futex_key key;
+  bool done = false;
+
+  ASSERT(thread != nullptr);
+
+  while (!done)
+  {
+    // A requeue may move the thread to another bucket before this thread gets the lock, in which case try again.
+    key = thread->futex_wait_key;
+    futex_bucket &bucket = bucket_for(key);
+
+    klib_synch_spinlock_lock(bucket.lock);
+    if (!klib_list_item_is_in_any_list(&thread->futex_wait_item))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Not waiting on a futex\n");
+      done = true;
+    }
+    else if (keys_equal(thread->futex_wait_key, key))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Remove from futex table\n");
+      klib_list_remove(&thread->futex_wait_item);
+      release_key(key);
+      done = true;
+    }
+    klib_synch_spinlock_unlock(bucket.lock);
+  }
+
+  KL_TRC_EXIT;
+}
+
+namespace
+{
+  /// @brief Work out the key identifying a futex.
+  ///
+  /// The key of a shared futex holds a pin on the futex's page, so that the page keeps its physical address while the
+  /// key is in use. Each key made by this function must be released by release_key(), unless it is handed to a thread
+  /// waiting in the futex table.
+  ///
+  /// @param futex The address of the futex in the current process. Must be in mapped memory.
+  ///
+  /// @param shared Whether the futex may be shared with other processes.
+  ///
+  /// @param[out] key The futex's key.
+  ///
+  /// @return True if the key was made. False if the futex is shared and its page can't be brought into memory.
+  bool make_key(volatile int32_t *futex, bool shared, futex_key &key)
+  {
+    KL_TRC_ENTRY;
+
+    bool result = true;
+    void *futex_v = reinterpret_cast<void *>(const_cast<int32_t *>(futex));
+    uint64_t phys_page;
+
+    if (shared)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Shared futex\n");
+      key.process = nullptr;
+
+      if (!pin_futex_page(futex, phys_page))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Page not present\n");
+        result = false;
+      }
+      else
+      {
+        key.address = phys_page + (reinterpret_cast<uint64_t>(futex_v) % MEM_PAGE_SIZE);
+      }
+    }
+    else
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Private futex\n");
+      key.process = task_get_cur_thread()->parent_process.get();
+      key.address = reinterpret_cast<uint64_t>(futex_v);
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Key: ", key.process, ", ", key.address, ", result: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+
+  /// @brief Bring the page containing a futex into memory, and pin it there.
+  ///
+  /// This may block while the page is read in, so it must be called without any locks held. The page can't then be
+  /// swapped out or freed, so the futex's value can be used while holding a bucket lock.
+  ///
+  /// @param futex The address of the futex in the current process. Must be 4-byte aligned, so that it doesn't cross
+  ///              into the next page.
+  ///
+  /// @param[out] phys_page The physical page now containing the futex. Release it with mem_map_unpin_page().
+  ///
+  /// @return True if the page was pinned. False if the futex isn't in mapped memory, or its page couldn't be read in.
+  bool pin_futex_page(volatile int32_t *futex, uint64_t &phys_page)
+  {
+    KL_TRC_ENTRY;
+
+    bool result = false;
+    bool done = false;
+    bool faulted_in = false;
+    void *futex_v = reinterpret_cast<void *>(const_cast<int32_t *>(futex));
+    uint64_t futex_addr = reinterpret_cast<uint64_t>(futex_v);
+    task_process *process = task_get_cur_thread()->parent_process.get();
+    uint64_t phys_addr;
+
+    ASSERT((futex_addr % sizeof(int32_t)) == 0);
+
+    while (!done)
+    {
+      phys_addr = reinterpret_cast<uint64_t>(mem_get_phys_addr(futex_v));
+      phys_page = phys_addr & ~(MEM_PAGE_SIZE - 1);
+
+      if ((phys_addr != 0) && mem_map_pin_page(phys_page))
+      {
+        // The page may have been swapped out or unmapped until it was pinned, so check that it still backs the futex.
+        if (reinterpret_cast<uint64_t>(mem_get_phys_addr(futex_v)) == phys_addr)
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Page pinned\n");
+          result = true;
+          done = true;
+        }
+        else
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Page moved before being pinned, try again\n");
+          mem_map_unpin_page(phys_page);
+          faulted_in = false;
+        }
+      }
+      else if (faulted_in)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Page still not present after fault-in, so not mapped\n");
+        done = true;
+      }
+      else
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Page not present, fault it in\n");
+        faulted_in = true;
+        if ((mem_page_cache_fault_in(futex_addr, process) != ERR_CODE::NO_ERROR) ||
+            (mem_swap_fault_in(futex_addr, process) != ERR_CODE::NO_ERROR))
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Failed to fault in page\n");
+          done = true;
+        }
+      }
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, ", page: ", phys_page, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+
+  /// @brief Take another reference to a key, for a thread moved to wait on it.
+  ///
+  /// @param key A key made by make_key(), which has not yet been released.
+  void add_key_ref(const futex_key &key)
+  {
+    bool pinned;
+
+    KL_TRC_ENTRY;
+
+    if (key.process == nullptr)
+    {
+      // The caller's reference keeps the page in use, so this can't fail.
+      pinned = mem_map_pin_page(key.address & ~(MEM_PAGE_SIZE - 1));
+      ASSERT(pinned);
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Release a key made by make_key() or add_key_ref().
+  ///
+  /// @param key The key to release.
+  void release_key(const futex_key &key)
+  {
+    KL_TRC_ENTRY;
+
+    if (key.process == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Unpin shared futex page\n");
+      mem_map_unpin_page(key.address & ~(MEM_PAGE_SIZE - 1));
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Find the bucket of the futex table that a futex belongs in.
+  ///
+  /// @param key The futex's key.
+  ///
+  /// @return The bucket for the futex.
+  futex_bucket &bucket_for(const futex_key &key)
+  {
+    uint64_t hash;
+
+    // Futexes are 4-byte aligned, so the bottom two bits of the address carry no information. Multiplying by a large
+    // odd constant mixes the rest into the top bits, which select the bucket.
+    hash = (reinterpret_cast<uint64_t>(key.process) ^ (key.address >> 2)) * 0x9E3779B97F4A7C15ULL;
+
+    return futex_table[hash >> 56];
+  }
+
+  /// @brief Do two keys identify the same futex?
+  ///
+  /// @param a The first key.
+  ///
+  /// @param b The second key.
+  ///
+  /// @return True if the keys are the same, false otherwise.
+  bool keys_equal(const futex_key &a, const futex_key &b)
+  {
+    return (a.process == b.process) && (a.address == b.address);
+  }
+
+  /// @brief Lock two buckets of the futex table, which may be the same bucket.
+  ///
+  /// The buckets are always locked in the order they appear in the table, so that two threads locking the same pair
+  /// can't deadlock.
+  ///
+  /// @param a The first bucket to lock.
+  ///
+  /// @param b The second bucket to lock.
+  void lock_bucket_pair(futex_bucket &a, futex_bucket &b)
+  {
+    KL_TRC_ENTRY;
+
+    if (&a == &b)
+    {
+      klib_synch_spinlock_lock(a.lock);
+    }
+    else if (&a < &b)
+    {
+      klib_synch_spinlock_lock(a.lock);
+      klib_synch_spinlock_lock(b.lock);
+    }
+    else
+    {
+      klib_synch_spinlock_lock(b.lock);
+      klib_synch_spinlock_lock(a.lock);
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Unlock two buckets locked by lock_bucket_pair().
+  ///
+  /// @param a The first bucket to unlock.
+  ///
+  /// @param b The second bucket to unlock.
+  void unlock_bucket_pair(futex_bucket &a, futex_bucket &b)
+  {
+    KL_TRC_ENTRY;
+
+    klib_synch_spinlock_unlock(a.lock);
+    if (&a != &b)
+    {
+      klib_synch_spinlock_unlock(b.lock);
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Wake threads waiting on a futex, in the order they started waiting.
+  ///
+  /// The caller must hold the bucket's lock.
+  ///
+  /// @param bucket The bucket containing the futex.
+  ///
+  /// @param key The futex's key.
+  ///
+  /// @param max_wake The maximum number of threads to wake.
+  ///
+  /// @return The number of threads woken.
+  uint32_t wake_waiters(futex_bucket &bucket, const futex_key &key, int32_t max_wake)
+  {
+    KL_TRC_ENTRY;
+
+    uint32_t woken = 0;
+    klib_list_item<task_thread *> *item;
+    klib_list_item<task_thread *> *next;
+    task_thread *sleeper;
+
+    ASSERT(klib_synch_spinlock_is_locked(bucket.lock));
+
+    for (item = bucket.waiters.head; (item != nullptr) && (max_wake > 0); item = next)
+    {
+      next = item->next;
+      sleeper = item->item;
+
+      if (keys_equal(sleeper->futex_wait_key, key))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Wake thread with address: ", sleeper, "\n");
+        klib_list_remove(item);
+        release_key(sleeper->futex_wait_key);
+        sleeper->parent_process->futex_wakeups++;
+        sleeper->start_thread();
+
+        woken++;
+        max_wake--;
+      }
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Woken: ", woken, "\n");
+    KL_TRC_EXIT;
+
+    return woken;
+  }
+
+  /// @brief Move threads waiting on one futex to wait on another, in the order they started waiting.
+  ///
+  /// The moved threads are queued behind any threads already waiting on the other futex. The caller must hold the
+  /// locks of both buckets.
+  ///
+  /// @param from_bucket The bucket containing the futex to move threads from.
+  ///
+  /// @param from_key The key of the futex to move threads from.
+  ///
+  /// @param to_bucket The bucket containing the futex to move threads to. May be the same as from_bucket.
+  ///
+  /// @param to_key The key of the futex to move threads to. Must be different to from_key.
+  ///
+  /// @param max_move The maximum number of threads to move.
+  ///
+  /// @return The number of threads moved.
+  uint32_t move_waiters(futex_bucket &from_bucket,
+                        const futex_key &from_key,
+                        futex_bucket &to_bucket,
+                        const futex_key &to_key,
+                        int32_t max_move)
+  {
+    KL_TRC_ENTRY;
+
+    uint32_t moved = 0;
+    klib_list_item<task_thread *> *item;
+    klib_list_item<task_thread *> *next;
+    task_thread *sleeper;
+
+    ASSERT(klib_synch_spinlock_is_locked(from_bucket.lock));
+    ASSERT(klib_synch_spinlock_is_locked(to_bucket.lock));
+    ASSERT(!keys_equal(from_key, to_key));
+
+    // If both futexes are in the same bucket, moved threads are added to the end of the list being walked. They no
+    // longer match from_key, so they are skipped if they are reached again.
+    for (item = from_bucket.waiters.head; (item != nullptr) && (max_move > 0); item = next)
+    {
+      next = item->next;
+      sleeper = item->item;
+
+      if (keys_equal(sleeper->futex_wait_key, from_key))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Move thread with address: ", sleeper, "\n");
+        klib_list_remove(item);
+        add_key_ref(to_key);
+        release_key(sleeper->futex_wait_key);
+        sleeper->futex_wait_key = to_key;
+        klib_list_add_tail(&to_bucket.waiters, item);
+
+        moved++;
+        max_move--;
+      }
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Moved: ", moved, "\n");
+    KL_TRC_EXIT;
+
+    return moved;
+  }
+
+  /// @brief Split an encoded FUTEX_WAKE_OP operation into its parts.
+  ///
+  /// @param encoded_op The operation, encoded as by FUTEX_WAKE_OP_ENCODE.
+  ///
+  /// @param[out] op The atomic operation to apply, one of FUTEX_ATOMIC_OP.
+  ///
+  /// @param[out] arg_is_shift Whether op_arg is a shift count, rather than the argument itself.
+  ///
+  /// @param[out] op_arg The argument to the atomic operation, sign extended.
+  ///
+  /// @param[out] cmp The comparison to make, one of FUTEX_ATOMIC_CMP.
+  ///
+  /// @param[out] cmp_arg The value to compare against, sign extended.
+  ///
+  /// @return True if the operation and comparison are both valid, false otherwise.
+  bool decode_wake_op(uint32_t encoded_op,
+                      uint32_t &op,
+                      bool &arg_is_shift,
+                      int32_t &op_arg,
+                      uint32_t &cmp,
+                      int32_t &cmp_arg)
+  {
+    KL_TRC_ENTRY;
+
+    bool result;
+
+    op = (encoded_op >> 28) & 0x7;
+    arg_is_shift = ((encoded_op >> 28) & FUTEX_ATOMIC_OP_ARG_SHIFT) != 0;
+    cmp = (encoded_op >> 24) & 0xF;
+
+    // Shift the 12-bit arguments to the top of the word and back again to sign extend them.
+    op_arg = static_cast<int32_t>(encoded_op << 8) >> 20;
+    cmp_arg = static_cast<int32_t>(encoded_op << 20) >> 20;
+
+    result = (op <= static_cast<uint32_t>(FUTEX_ATOMIC_OP::XOR)) &&
+             (cmp <= static_cast<uint32_t>(FUTEX_ATOMIC_CMP::GE));
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Op: ", op, ", arg: ", op_arg, ", cmp: ", cmp, ", arg: ", cmp_arg, "\n");
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+
+  /// @brief Atomically apply an operation to a futex.
+  ///
+  /// @param futex The futex to change.
+  ///
+  /// @param op The operation to apply, one of FUTEX_ATOMIC_OP. Must be valid.
+  ///
+  /// @param op_arg The argument to the operation.
+  ///
+  /// @return The value of the futex before the operation.
+  int32_t apply_atomic_op(volatile int32_t *futex, uint32_t op, int32_t op_arg)
+  {
+    KL_TRC_ENTRY;
+
+    int32_t old_value = 0;
+
+    switch (static_cast<FUTEX_ATOMIC_OP>(op))
+    {
+    case FUTEX_ATOMIC_OP::SET:
+      old_value = __atomic_exchange_n(futex, op_arg, __ATOMIC_SEQ_CST);
+      break;
+
+    case FUTEX_ATOMIC_OP::ADD:
+      old_value = __atomic_fetch_add(futex, op_arg, __ATOMIC_SEQ_CST);
+      break;
+
+    case FUTEX_ATOMIC_OP::OR:
+      old_value = __atomic_fetch_or(futex, op_arg, __ATOMIC_SEQ_CST);
+      break;
+
+    case FUTEX_ATOMIC_OP::ANDN:
+      old_value = __atomic_fetch_and(futex, ~op_arg, __ATOMIC_SEQ_CST);
+      break;
+
+    case FUTEX_ATOMIC_OP::XOR:
+      old_value = __atomic_fetch_xor(futex, op_arg, __ATOMIC_SEQ_CST);
+      break;
+
+    default:
+      panic("Invalid futex operation");
+    }
+
+    KL_TRC_EXIT;
+
+    return old_value;
+  }
+
+  /// @brief Carry out a FUTEX_WAKE_OP comparison.
+  ///
+  /// @param value The value to compare.
+  ///
+  /// @param cmp The comparison to make, one of FUTEX_ATOMIC_CMP. Must be valid.
+  ///
+  /// @param cmp_arg The value to compare against.
+  ///
+  /// @return The result of the comparison.
+  bool compare_values(int32_t value, uint32_t cmp, int32_t cmp_arg)
+  {
+    KL_TRC_ENTRY;
+
+    bool result = false;
+
+    switch (static_cast<FUTEX_ATOMIC_CMP>(cmp))
+    {
+    case FUTEX_ATOMIC_CMP::EQ:
+      result = (value == cmp_arg);
+      break;
+
+    case FUTEX_ATOMIC_CMP::NE:
+      result = (value != cmp_arg);
+      break;
+
+    case FUTEX_ATOMIC_CMP::LT:
+      result = (value < cmp_arg);
+      break;
+
+    case FUTEX_ATOMIC_CMP::LE:
+      result = (value <= cmp_arg);
+      break;
+
+    case FUTEX_ATOMIC_CMP::GT:
+      result = (value > cmp_arg);
+      break;
+
+    case FUTEX_ATOMIC_CMP::GE:
+      result = (value >= cmp_arg);
+      break;
+
+    default:
+      panic("Invalid futex comparison");
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+}
@@ -7,6 +7,38 @@
 
 #include "stdint.h"
 #include "user_interfaces/error_codes.h"
+#include "user_interfaces/kernel_types.h"
 
-ERR_CODE futex_wait(volatile int32_t *futex, int32_t req_value);
-ERR_CODE futex_wake(volatile int32_t *futex);
+class task_process;
+class task_thread;
+
+/// @brief Identifies a futex in the global futex table.
+///
+/// Futexes private to a process are identified by the process and their virtual address. Futexes shared between
+/// processes might be mapped at different virtual addresses in each process, so they are identified by their physical
+/// address instead - that is, the physical page plus the offset within it.
+struct futex_key
+{
+  /// For a private futex, the process it belongs to. For a shared futex, nullptr.
+  task_process *process;
+
+  /// For a private futex, its virtual address. For a shared futex, its physical address.
+  uint64_t address;
+};
+
+ERR_CODE futex_wait(volatile int32_t *futex, int32_t req_value, bool shared);
+ERR_CODE futex_wake(volatile int32_t *futex, int32_t max_wake, bool shared);
+ERR_CODE futex_requeue(volatile int32_t *futex,
+                       int32_t max_wake,
+                       int32_t max_requeue,
+                       volatile int32_t *futex_2,
+                       bool compare,
+                       int32_t cmp_value,
+                       bool shared);
+ERR_CODE futex_wake_op(volatile int32_t *futex,
+                       int32_t max_wake,
+                       volatile int32_t *futex_2,
+                       int32_t max_wake_2,
+                       uint32_t encoded_op,
+                       bool shared);
+void futex_cancel_wait(task_thread *thread);
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include "processor.h"
 
 class proc_fs_root_branch;
@@ -15,8 +16,6 @@ class proc_fs_root_branch;
 struct task_x64_saved_stack
 {
   // Parts relating to the task. These fields are saved by the kernel.
-  uint8_t fx_state[512]; ///< Storage space used by the fxsave64/fxrstor64 instructions
-
   uint64_t r15; ///< Register R15
   uint64_t r14; ///< Register R14
   uint64_t r13; ///< Register R13
@@ -42,7 +41,7 @@ struct task_x64_saved_stack
 };
 #pragma pack ( pop )
 
-static_assert(sizeof(task_x64_saved_stack) == 672, "Stack save structure size changed.");
+static_assert(sizeof(task_x64_saved_stack) == 160, "Stack save structure size changed.");
 
 /// @brief The execution context for a thread on x64.
 ///
@@ -59,12 +58,11 @@ struct task_x64_exec_context
   /// assembly language code.
   void *syscall_stack;
 
-  /// Space for saving the user mode process's stack while running a system call. Note: This value is used referenced
-  /// by offset in assembly language code.
-  void *user_mode_stack;
+  /// Save area for the thread's extended state - the x87, SSE and (if enabled) AVX registers. This is 64-byte aligned
+  /// and proc_x64_ext_state_size bytes long. Note: This value is used referenced by offset in assembly language code.
+  void *ext_state;
 
-  /// The thread that this context belongs to. The address of this context is saved in the kernel GS, so this pointer
-  /// can be used to retrieve the thread data.
+  /// The thread that this context belongs to.
   task_thread *owner_thread;
 
   /// The stack of the process. This field is filled in whenever the process is subject to an interrupt, so it is
@@ -74,15 +72,22 @@ struct task_x64_exec_context
   /// Value of FS Base for the process
   uint64_t fs_base;
 
-  /// Value of GS Base for the process
+  /// Value of GS Base for the process while it runs in user mode. In kernel mode, GS points at the per-processor data.
   uint64_t gs_base;
 
   /// The original value of syscall_stack, to be used when the process exits to delete the stack (in case
   /// syscall_stack ever changes)
   void *orig_syscall_stack;
+
+  /// The allocation containing ext_state, which may begin a little before it in order to align ext_state.
+  void *ext_state_alloc;
 };
 #pragma pack ( pop )
 
+static_assert(offsetof(task_x64_exec_context, syscall_stack) == 8,
+              "syscall_stack is referenced by offset in assembly code");
+static_assert(offsetof(task_x64_exec_context, ext_state) == 16, "ext_state is referenced by offset in assembly code");
+
 
 /// @brief Stores details about an individual interrupt handler.
 ///
@@ -121,6 +126,9 @@ extern "C" task_x64_exec_context *task_int_swap_task(uint64_t stack_addr, uint64
 
 void task_install_task_switcher();
 void task_platform_init();
+void task_platform_set_next_tick(uint64_t delay_ns);
+void task_platform_wake_proc(uint32_t proc_id);
+void task_platform_idle();
 
 // Interrupt handling:
 // -------------------
@@ -132,10 +140,9 @@ void proc_tidyup_thread();
 
 std::shared_ptr<task_process> task_create_system_process();
 
-void task_thread_cycle_add(task_thread *new_thread);
-void task_thread_cycle_remove(task_thread *thread);
-void task_thread_cycle_lock();
-void task_thread_cycle_unlock();
+void task_sched_init_thread(task_thread *thread);
+void task_sched_add_runnable(task_thread *thread);
+void task_sched_remove_thread(task_thread *thread);
 void task_idle_thread_cycle();
 
 // These are documented elsewhere
@@ -6,12 +6,14 @@
 #include <stdint.h>
 
 #include "klib/data_structures/lists.h"
+#include "klib/data_structures/heaps.h"
 #include "klib/synch/kernel_locks.h"
 #include "mem/mem.h"
 #include "object_mgr/object_mgr.h"
 #include "system_tree/system_tree_leaf.h"
 #include "processor/synch_objects.h"
 #include "processor/work_queue.h"
+#include "processor/futexes.h"
 
 #include "devices/device_interface.h"
 
@@ -22,6 +24,10 @@
 /// @brief Definition of a possible entry point:
 typedef void (* ENTRY_PROC)();
 
+/// The size of a cache line. Data that different processors write often is kept in separate cache lines, so that the
+/// processors don't contend for them.
+#define PROC_CACHE_LINE_SIZE 64
+
 // Forward declare task_thread since task_process and task_thread refer to each other in a cycle.
 class task_thread;
 
@@ -85,10 +91,6 @@ public:
   /// Store handles and the objects they correlate to.
   object_manager proc_handles;
 
-  kernel_spinlock map_ops_lock{0}; ///< Lock protecting the futex map, below.
-
-  std::map<uint64_t, std::vector<task_thread *>> futex_map; ///< Map of all futexes waiting in this process.
-
   uint64_t exit_code{0}; ///< Code provided when the process is exiting.
 
   OPER_STATUS proc_status{OPER_STATUS::OK}; ///< Current process status. Only OK, STOPPED and FAILED are valid.
@@ -112,6 +114,19 @@ public:
   /// destroy the process while this flag is set then the attempt is ignored - this means pointers in the defunct
   /// process list will always be valid.
   bool in_dead_list{false};
+
+  /// The total number of deadlines missed by this process's threads in the deadline scheduling class.
+  std::atomic<uint64_t> deadline_misses{0};
+
+  /// The number of times a processor switched to one of this process's threads from another thread of this process,
+  /// so the address space didn't need to be changed.
+  std::atomic<uint64_t> same_process_switches{0};
+
+  /// The number of times a processor switched to one of this process's threads from a thread of a different process.
+  std::atomic<uint64_t> cross_process_switches{0};
+
+  /// The number of times one of this process's threads was woken from waiting on a futex.
+  std::atomic<uint64_t> futex_wakeups{0};
 };
 
 /// @brief Class to hold information about a thread.
@@ -137,34 +152,101 @@ public:
   bool stop_thread();
   void destroy_thread();
 
-  /// A pointer to the next thread. In normal operation, these form a cycle of threads, and the task manager is able
-  /// to manipulate this cycle without breaking the chain.
-  task_thread *next_thread;
+  // The scheduler reads or writes the fields from here to parent_process every time it considers this thread, so they
+  // are kept together at the start of a cache line, away from the fields that are rarely used.
+
+  /// An entry in the run queue of the processor given by queue_proc, keyed by vruntime. Only the task manager should
+  /// access this field.
+  alignas(PROC_CACHE_LINE_SIZE) klib_heap_item<task_thread *> run_queue_item;
 
   /// A lock used by the task manager to claim ownership of this thread. It has several meanings:
-  /// - The task manager might be about to manipulate the thread cycle, so the scheduler should avoid scheduling this
-  ///   thread
+  /// - The task manager might be about to destroy this thread, so the scheduler should avoid scheduling it
   /// - The scheduler might be running this thread, in which case no other processor should run it as well
   kernel_spinlock cycle_lock;
 
   /// Is the thread running? It will only be considered for execution if so.
   volatile bool permit_running;
 
-  /// This thread's parent process. The process defines the address space, permissions, etc.
-  std::shared_ptr<task_process> parent_process;
+  /// The priority level this thread is scheduled at. This is the higher of base_priority and inherited_priority, and is
+  /// only changed by the task manager.
+  THREAD_PRIORITY priority{THREAD_PRIORITY::NORMAL};
 
-  /// An entry for the parent's thread list.
-  klib_list_item<std::shared_ptr<task_thread>> *process_list_item;
+  /// The thread's nice value, which weights its share of the processor compared to other threads at the same priority
+  /// level. Use task_set_thread_priority() to change it.
+  int8_t nice{0};
+
+  /// The processor whose run queue this thread joins when it is runnable. This is only changed while the lock of that
+  /// run queue is held and the thread is not in the queue. Only the task manager should access this field.
+  uint32_t queue_proc;
+
+  /// The amount of processor time this thread has used, in nanoseconds scaled by the weight given by its nice value.
+  /// The scheduler runs the thread with the lowest virtual runtime at each priority level. Only the task manager should
+  /// access this field.
+  uint64_t vruntime{0};
+
+  /// The system timer value when this thread was last scheduled on to a processor. Only the task manager should access
+  /// this field.
+  uint64_t slice_start_time{0};
+
+  /// The processors this thread may run on. Bit n is set if the thread may run on processor n. Use
+  /// task_set_thread_affinity() to change it.
+  std::atomic<uint64_t> affinity{THREAD_AFFINITY_ALL};
+
+  /// If this value is set to non-zero, and the thread is sleeping, and the system timer is greater than this value,
+  /// then the scheduler will wake this thread and start it running again. This is an absolute value in nanoseconds.
+  /// Starting the thread by any other means clears it.
+  uint64_t wake_thread_after{0};
 
   /// A pointer to the thread's execution context. This is processor specific, so no specific structure can
   /// be pointed to. Only processor-specific code should access this field.
   void *execution_context;
 
+  /// This thread's parent process. The process defines the address space, permissions, etc.
+  std::shared_ptr<task_process> parent_process;
+
+  /// An entry in the sleep queue of the processor given by sleep_proc, keyed by wake_thread_after. Only the task
+  /// manager should access this field.
+  klib_heap_item<task_thread *> sleep_queue_item;
+
+  /// The processor whose sleep queue this thread was most recently added to. Only the task manager should access this
+  /// field.
+  uint32_t sleep_proc;
+
+  /// An entry for the parent's thread list.
+  klib_list_item<std::shared_ptr<task_thread>> *process_list_item;
+
   /// This item is used to associate the thread with the list of threads waiting for a mutex, semaphore or other
   /// synchronization primitive. The list itself is owned by that primitive, but this item must be initialized with the
   /// rest of this structure.
   klib_list_item<std::shared_ptr<task_thread>> *synch_list_item;
 
+  /// This item is used to queue the thread on a klib_mutex it is waiting for. It points at this thread without holding
+  /// a reference, since the thread can't be destroyed while it is waiting without also leaving the queue.
+  klib_list_item<task_thread *> mutex_wait_item;
+
+  /// This item is used to queue the thread in the futex table while it waits on a futex. Like mutex_wait_item, it
+  /// doesn't hold a reference to the thread.
+  klib_list_item<task_thread *> futex_wait_item;
+
+  /// The futex this thread is waiting on, while futex_wait_item is in a list. Only changed while holding the lock of
+  /// the table bucket containing futex_wait_item.
+  futex_key futex_wait_key{nullptr, 0};
+
+  /// The priority level this thread was given by task_set_thread_priority().
+  THREAD_PRIORITY base_priority{THREAD_PRIORITY::NORMAL};
+
+  /// The highest priority level of the threads waiting for klib_mutexes that this thread owns, including any priority
+  /// they have inherited themselves. Use task_set_inherited_priority() to change it.
+  THREAD_PRIORITY inherited_priority{THREAD_PRIORITY::BATCH};
+
+  /// The klib_mutex this thread is sleeping while waiting for, if any. Protected by the mutexes' priority inheritance
+  /// lock.
+  klib_mutex *pi_blocked_on{nullptr};
+
+  /// The klib_mutexes owned by this thread that other threads are waiting for, made of their klib_mutex::pi_item
+  /// fields. Protected by the mutexes' priority inheritance lock.
+  klib_list<klib_mutex *> pi_held_mutexes{nullptr, nullptr};
+
   /// Has the thread been destroyed? Various operations are not permitted on a destroyed thread. This object will
   /// continue to exist until all references to it have been released.
   bool thread_destroyed;
@@ -175,9 +257,39 @@ public:
   /// work item completes.
   bool is_worker_thread;
 
-  /// If this value is set to non-zero, and the thread is sleeping, and the system timer is greater than this value,
-  /// then the scheduler will wake this thread and start it running again. This is an absolute value in nanoseconds.
-  uint64_t wake_thread_after{0};
+  /// @brief Parameters and state used if this thread is in the deadline scheduling class.
+  ///
+  /// Threads in the deadline class are run ahead of all other threads, in order of their absolute deadline. The thread
+  /// is in the deadline class if period is non-zero. Use task_set_thread_deadline() to change the parameters. Only the
+  /// task manager should access these fields, except for misses which may be read by anyone.
+  struct
+  {
+    /// The processor time the thread may use in each period, in nanoseconds.
+    uint64_t runtime{0};
+
+    /// How long after the start of each period the thread must have had its runtime by, in nanoseconds.
+    uint64_t rel_deadline{0};
+
+    /// The length of each period, in nanoseconds. Zero if the thread isn't in the deadline class.
+    uint64_t period{0};
+
+    /// The system timer value by which the thread must have had the rest of its runtime for the current period.
+    uint64_t abs_deadline{0};
+
+    /// The runtime remaining in the current period, in nanoseconds.
+    uint64_t remaining{0};
+
+    /// Has the thread used all of its runtime for this period, or missed the deadline? If so, it may not run again
+    /// until its next period begins.
+    bool throttled{false};
+
+    /// The number of periods in which the thread missed its deadline.
+    std::atomic<uint64_t> misses{0};
+  } dl;
+
+  /// If this thread is suspended waiting for part of a mapped file to be read into RAM, this is the address that it
+  /// faulted on. Only the page cache should access this field.
+  uint64_t page_fault_addr{0};
 
   /// The number of TLS slots provided per thread in the kernel.
   static const uint8_t MAX_TLS_KEY = 16;
@@ -242,6 +354,11 @@ void proc_stop_all_procs();
 void proc_stop_interrupts();
 void proc_start_interrupts();
 
+// Stop interrupts on this processor, and later return them to the state they were in beforehand. Unlike the functions
+// above, these may be nested.
+uint64_t proc_save_and_stop_interrupts();
+void proc_restore_interrupts(uint64_t saved_flags);
+
 // Initialise the task management system.
 std::shared_ptr<task_process> task_init();
 void task_gen_init();
@@ -258,6 +375,14 @@ task_thread *task_get_cur_thread();
 // Force a reschedule on this processor.
 void task_yield();
 
+bool task_thread_is_running(task_thread *thread);
+
+// Change how a thread is scheduled.
+ERR_CODE task_set_thread_priority(task_thread *thread, THREAD_PRIORITY priority, int8_t nice);
+void task_set_inherited_priority(task_thread *thread, THREAD_PRIORITY priority);
+ERR_CODE task_set_thread_deadline(task_thread *thread, uint64_t runtime, uint64_t deadline, uint64_t period);
+ERR_CODE task_set_thread_affinity(task_thread *thread, uint64_t affinity);
+
 // Multiple processor control functions
 uint32_t proc_mp_proc_count();
 uint32_t proc_mp_this_proc_id();
@@ -5,11 +5,65 @@
 /// the address space and permissions of all threads that are associated with it.
 ///
 /// The task manager is responsible for managing the creation and destruction of threads, as well as for scheduling
-/// them onto the processor. This is done in a very crude, round robin kind of way.
+/// them onto the processor.
 ///
-/// The threads (as a task_thread object) point at each other via task_thread::next_thread, in a cycle. The processors
-/// move around the cycle until they find a thread that is permitted to run (i.e. not suspended) and not locked (by
-/// task_thread::cycle_lock). Being locked means that another processor is about to execute it.
+/// Each processor has a run queue containing the threads that are ready to run on it. Threads join a queue when they
+/// are started, or when their timeslice ends and they are still permitted to run. Threads that are waiting or sleeping
+/// are not in any run queue, so the scheduler never looks at them.
+///
+/// Each run queue is split by priority level (see THREAD_PRIORITY), and a runnable thread at a higher level is always
+/// chosen ahead of those at lower levels. Within a level, threads share the processor fairly. Each thread has a
+/// virtual runtime - the processor time it has used, scaled down for threads with a low nice value and up for threads
+/// with a high one. The threads at each level are kept in a heap ordered by virtual runtime, and the scheduler runs
+/// the thread that has had the least. A thread that has been asleep rejoins with its virtual runtime raised to a
+/// little below the smallest in the queue, so that it runs promptly without being able to monopolise the processor.
+///
+/// A thread's level is normally the one it was given, but a thread that owns a klib_mutex runs at least at the level
+/// of the threads waiting for it (priority inheritance). Otherwise, a low priority owner could be kept from running by
+/// medium priority threads indefinitely, and a high priority thread waiting for it with it.
+///
+/// The scheduler takes the first thread from its own queue that is permitted to run and not locked (by
+/// task_thread::cycle_lock). Being locked means that another processor is executing it. Threads that were stopped
+/// after being queued are removed from the queue when the scheduler comes across them, rather than when they are
+/// stopped.
+///
+/// Threads in the deadline class are run ahead of all of these. Each declares the processor time it needs in each
+/// period, and the time after the start of each period by which it needs it. They are kept in a separate heap in each
+/// run queue, ordered by absolute deadline, so the thread with the earliest deadline always runs first. A thread that
+/// uses all of its time for the period, or misses its deadline, is throttled - moved to a heap of threads waiting for
+/// their next period - so it can't take time from other threads. New deadline threads are only admitted if the total
+/// processor time asked for by all deadline threads fits within the system's processors.
+///
+/// If a processor's own run queue is empty it steals a thread from the run queue of another processor, and that
+/// thread then stays with its new processor. When a thread is woken it normally returns to the queue of the processor
+/// it last ran on, unless that queue is longer than the shortest queue by more than one thread.
+///
+/// Each thread has an affinity mask giving the processors it may run on. A thread only joins the run queue of a
+/// processor in its mask, and processors don't steal threads that aren't allowed to run on them. If the mask changes
+/// so that a thread's processor is no longer allowed, the thread is moved to an allowed processor the next time that
+/// its old processor's scheduler comes across it.
+///
+/// There is no fixed scheduler tick. After choosing a thread, each processor arranges for the scheduler to run again
+/// only when it next needs to - when the timeslice ends if other threads are waiting in its run queue, when the next
+/// sleeping thread is due to wake, or when a deadline thread's runtime or throttling ends. If none of these apply, for
+/// example because the processor is idle or has only one thread to run, the tick is stopped altogether. A processor
+/// that adds a thread to the run queue of a processor whose tick is stopped signals that processor so that it runs its
+/// scheduler, and idle processors are signalled when there are threads waiting elsewhere that they could steal.
+///
+/// When a thread is woken, it is added straight to a run queue. If it ought to run ahead of the thread currently
+/// running on that queue's processor - because that processor is idle, the woken thread is in a higher class or
+/// priority level, or it has had noticeably less processor time - the processor is made to run its scheduler at once.
+/// If that is the calling processor, this hands it straight over to the woken thread.
+///
+/// Switching between two threads of the same process doesn't need the address space to be changed, which is much
+/// cheaper than switching between processes. So, when a processor takes a thread from its own queue, it prefers a
+/// thread belonging to the process it is already running over the thread with the least virtual runtime, as long as
+/// the difference in their virtual runtimes is small. Each process counts how many times its threads were switched to
+/// from the same process and from other processes.
+///
+/// Threads sleeping until a certain time are kept in a sleep queue belonging to the processor they last ran on. This is
+/// a heap ordered by the time they should be woken, so at each tick the processor only needs to look at the top of its
+/// own heap to find the threads that are due.
 ///
 /// Notice that much of the code in this file is contained within functions, rather than being delegated to the classes
 /// of the relevant objects. This is simply because of how this code comes from very early on in the project - it may
@@ -20,6 +74,17 @@
 //   waiting thread to have to wait until the object is destroyed until it gets signalled, rather than being
 //   signalled at the initial destruction.
 // - It is possible to create a thread just as the process is being destroyed.
+// - Sleeping threads are only woken at a scheduler tick, so they may sleep for up to one tick longer than requested.
+// - A high priority thread that never blocks will starve all threads of lower priority on its processor, although
+//   they may be stolen by other processors.
+// - A thread in the deadline class that waits for a klib_mutex only raises the owner to the highest priority level,
+//   not into the deadline class.
+// - Admission control for deadline threads considers the system as a whole. Threads are not spread between the
+//   processors according to their needs, so one processor may be asked for more time than it can give while another
+//   is idle. Work stealing makes up for this to some extent.
+// - While a thread has called task_continue_this_thread(), its processor falls back to a fixed tick.
+// - Affinity masks only have room for 64 processors. Any further processors only run threads that may run anywhere.
+// - A processor looking for work to steal gives up on a queue after skipping a few threads that can't run on it.
 
 //#define ENABLE_TRACING
 
@@ -27,6 +92,7 @@
 #include "processor.h"
 #include "processor-int.h"
 #include "mem/mem.h"
+#include "mem/page_cache.h"
 #include "object_mgr/object_mgr.h"
 #include "system_tree/system_tree.h"
 #include "system_tree/fs/proc/proc_fs.h"
@@ -51,24 +117,124 @@
 namespace
 {
 
-  // The threads each processor is currently running. After initialisation, this points to an array of size equal to
-  // the number of processors.
-  task_thread **current_threads = nullptr;
+  // The number of different values of THREAD_PRIORITY.
+  const uint32_t task_priority_levels = 3;
+
+  // How far below the queue's minimum virtual runtime a woken thread may be placed, in nanoseconds. This lets threads
+  // that sleep often, like interactive ones, run soon after they are woken.
+  const uint64_t task_sleeper_credit = 3000000;
+
+  // A woken thread only preempts a thread at the same priority level if its virtual runtime is lower by more than this
+  // many nanoseconds. Without this margin, threads that wake often would preempt each other constantly.
+  const uint64_t task_wakeup_granularity = 1000000;
+
+  // A thread belonging to the process that a processor is already running is chosen ahead of the thread with the
+  // least virtual runtime, if its own virtual runtime is no more than this many nanoseconds greater.
+  const uint64_t task_same_process_bonus = 500000;
+
+  // How long a processor waits before running its scheduler when it needs to do so immediately, in nanoseconds.
+  const uint64_t task_resched_delay_ns = 1;
+
+  // The weights given to threads with each nice value, starting at THREAD_NICE_MIN. Each step in nice value changes a
+  // thread's share of the processor by about 10% compared to a thread at the next value. A nice value of zero has the
+  // weight task_nice_0_weight.
+  const uint64_t task_nice_weights[] =
+    { 88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+      9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+      1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+      110, 87, 70, 56, 45, 36, 29, 23, 18, 15 };
+  const uint64_t task_nice_0_weight = 1024;
+
+  static_assert((sizeof(task_nice_weights) / sizeof(uint64_t)) == (THREAD_NICE_MAX - THREAD_NICE_MIN + 1),
+                "Nice weights table is the wrong size");
+
+  // The longest period allowed for a deadline thread, in nanoseconds. This keeps the calculations in
+  // add_to_run_queue() within 64 bits.
+  const uint64_t task_max_deadline_period = 1000000000;
+
+  // Bandwidths of deadline threads - the proportion of a processor they use - are stored as fixed point numbers with
+  // this many fractional bits.
+  const uint64_t task_dl_bw_shift = 20;
+
+  // The percentage of each processor's time that may be given to deadline threads.
+  const uint64_t task_dl_bw_percent = 95;
+
+  // Protects deadline_bw_used.
+  kernel_spinlock deadline_bw_lock;
+
+  // The total bandwidth admitted for all deadline threads.
+  uint64_t deadline_bw_used = 0;
+
+  // The most threads that the scheduler will skip over in one queue because they're running on another processor.
+  const uint32_t task_max_skipped_threads = 8;
+
+  /// @brief The threads waiting to run on a single processor.
+  struct task_run_queue
+  {
+    /// Protects threads.
+    kernel_spinlock lock;
+
+    /// The threads waiting to run on this processor at each priority level, keyed by virtual runtime. Threads that
+    /// have been stopped since they were added remain in the queue until the scheduler comes across them.
+    klib_heap<task_thread *> threads[task_priority_levels];
+
+    /// Threads in the deadline class that are waiting to run, keyed by absolute deadline. These are run before any
+    /// threads in the normal priority levels.
+    klib_heap<task_thread *> deadline_threads;
+
+    /// Threads in the deadline class that have used all their runtime for this period, keyed by the time the next
+    /// period starts.
+    klib_heap<task_thread *> throttled_threads;
+
+    /// The number of threads in the queue. This is read without holding the lock when deciding which processor to
+    /// place a thread on, so it is only a hint.
+    std::atomic<uint64_t> length;
+
+    /// The virtual runtime of the thread most recently taken from this queue. Used to place threads that are new to
+    /// the queue fairly amongst the others.
+    uint64_t min_vruntime;
+
+    /// Has this queue's processor stopped its scheduler tick? If so, it must be signalled if a thread is added to the
+    /// queue. Protected by lock.
+    bool tick_stopped;
+  };
+
+  /// @brief The threads sleeping until a specific time, that last ran on a single processor.
+  struct task_sleep_queue
+  {
+    /// Protects threads.
+    kernel_spinlock lock;
+
+    /// The sleeping threads, keyed by the time they should be woken.
+    klib_heap<task_thread *> threads;
+  };
+
+  /// @brief The scheduler's state for a single processor.
+  ///
+  /// Each processor writes its own record every time it schedules, and other processors lock its queues to add
+  /// threads to them. So records, and the queues within them, start on separate cache lines. Otherwise processors
+  /// would contend for lines holding data that they don't share.
+  struct alignas(PROC_CACHE_LINE_SIZE) task_proc_record
+  {
+    /// The thread this processor is currently running.
+    task_thread *current_thread;
+
+    /// This processor's idle thread, which is created during initialisation.
+    task_thread *idle_thread;
 
-  // Should the processor continue running this thread without considering other threads? After initialisation, this
-  // points to an array of bools equal in size to the number of processors.
-  static bool *continue_this_thread = nullptr;
+    /// Should the processor continue running this thread without considering other threads?
+    bool continue_this_thread;
 
-  // Idle threads for each processor. These are created during initialisation, and after initialisation this is an
-  // array of pointers equal in size to the number of processors.
-  task_thread **idle_threads = nullptr;
+    /// The threads waiting to run on this processor.
+    alignas(PROC_CACHE_LINE_SIZE) task_run_queue run_queue;
 
-  // A pointer to an arbitrary thread within the cycle of threads. It doesn't really matter which thread this points
-  // to, the CPUs can just cycle through the cycle to find the one they want.
-  task_thread *start_of_thread_cycle = nullptr;
+    /// The sleeping threads that last ran on this processor.
+    alignas(PROC_CACHE_LINE_SIZE) task_sleep_queue sleep_queue;
+  };
 
-  // Protects the thread cycle from two threads making simultaneous changes.
-  kernel_spinlock thread_cycle_lock;
+  // The scheduler's state for each processor. After initialisation, this points to an array of size equal to the
+  // number of processors.
+  task_proc_record *proc_records = nullptr;
 
 #ifdef AZALEA_SCHED_TIME_DIAGS
   uint64_t *timing_buffer = nullptr;
@@ -86,6 +252,31 @@ namespace
 
   uint64_t current_dump_count{0};
 #endif
+
+  void add_to_run_queue(task_thread *thread, bool balance_load);
+  void insert_into_run_queue(task_run_queue &queue, task_thread *thread);
+  void remove_from_run_queue(task_run_queue &queue, task_thread *thread);
+  void charge_thread(task_thread *thread, uint64_t time_now);
+  void replenish_deadline_threads(uint32_t proc_id, uint64_t time_now);
+  uint64_t deadline_bandwidth(uint64_t runtime, uint64_t period);
+  task_thread *take_from_run_queue(uint32_t queue_proc, uint32_t proc_id, task_thread *current);
+  task_thread *take_same_process_thread(task_run_queue &queue,
+                                        task_thread *chosen,
+                                        uint32_t proc_id,
+                                        task_thread *current);
+  uint64_t move_vruntime(uint64_t vruntime, uint32_t old_proc, uint32_t new_proc);
+  uint32_t least_loaded_run_queue(task_thread *thread);
+  bool thread_may_run_on(task_thread *thread, uint32_t proc_id);
+  void add_sleeping_thread(task_thread *thread, uint32_t proc_id);
+  void remove_sleeping_thread(task_thread *thread);
+  void wake_sleeping_threads(uint32_t proc_id, uint64_t time_now);
+  void program_next_tick(uint32_t proc_id, task_thread *next_thread, uint64_t time_now);
+  void kick_processor(uint32_t proc_id, bool now);
+  bool should_preempt(task_thread *thread, uint32_t proc_id);
+  void kick_idle_processor(uint32_t busy_proc);
+  uint64_t lock_out_scheduler();
+  void unlock_scheduler(uint64_t saved_flags);
+  void update_thread_priority(task_thread *thread);
 }
 
 /// @brief Initialise and start the task management subsystem
@@ -123,7 +314,6 @@ void task_gen_init()
 
   uint32_t number_of_procs = proc_mp_proc_count();
 
-  klib_synch_spinlock_init(thread_cycle_lock);
 
   std::shared_ptr<proc_fs_root_branch> proc_fs_root_ptr;
   proc_fs_root_ptr = std::make_shared<proc_fs_root_branch>();
@@ -135,18 +325,32 @@ void task_gen_init()
 
   KL_TRC_TRACE(TRC_LVL::FLOW, "Creating per-process info\n");
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Number of processors", number_of_procs);
-  current_threads = new task_thread *[number_of_procs];
-  continue_this_thread = new bool[number_of_procs];
-  idle_threads = new task_thread *[number_of_procs];
+  proc_records = new task_proc_record[number_of_procs];
   klib_list_initialize(&dead_thread_list);
   dead_processes = nullptr;
+  klib_synch_spinlock_init(deadline_bw_lock);
+  deadline_bw_used = 0;
 
   for (uint32_t i = 0; i < number_of_procs; i++)
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Initialising processor ", i, "\n");
-    current_threads[i] = nullptr;
-    continue_this_thread[i] = false;
-    idle_threads[i] = nullptr;
+    proc_records[i].current_thread = nullptr;
+    proc_records[i].continue_this_thread = false;
+    proc_records[i].idle_thread = nullptr;
+    proc_records[i].run_queue.tick_stopped = false;
+
+    klib_synch_spinlock_init(proc_records[i].run_queue.lock);
+    for (uint32_t j = 0; j < task_priority_levels; j++)
+    {
+      klib_heap_initialize(&proc_records[i].run_queue.threads[j]);
+    }
+    klib_heap_initialize(&proc_records[i].run_queue.deadline_threads);
+    klib_heap_initialize(&proc_records[i].run_queue.throttled_threads);
+    proc_records[i].run_queue.length = 0;
+    proc_records[i].run_queue.min_vruntime = 0;
+
+    klib_synch_spinlock_init(proc_records[i].sleep_queue.lock);
+    klib_heap_initialize(&proc_records[i].sleep_queue.threads);
   }
 
 #ifdef AZALEA_SCHED_TIME_DIAGS
@@ -159,7 +363,8 @@ void task_gen_init()
 
 /// @brief Create a process to contain system-critical threads
 ///
-/// This process contains idle threads for each processor, and a thread to handle the IRQ slowpath procedure.
+/// This process contains idle threads for each processor, a thread to handle the IRQ slowpath procedure, and a thread
+/// to read pages of mapped files.
 ///
 /// @return The system process created here.
 std::shared_ptr<task_process> task_create_system_process()
@@ -169,6 +374,9 @@ std::shared_ptr<task_process> task_create_system_process()
   uint32_t number_of_procs = proc_mp_proc_count();
   std::shared_ptr<task_thread> new_idle_thread;
   std::shared_ptr<task_thread> irq_slowpath_thread;
+  std::shared_ptr<task_thread> work_queue_thread;
+  std::shared_ptr<task_thread> pager_thread;
+  std::shared_ptr<task_thread> swap_scanner_thread;
   std::shared_ptr<task_process> system_process;
   mem_process_info *task0_mem_info;
 
@@ -177,9 +385,24 @@ std::shared_ptr<task_process> task_create_system_process()
 
   KL_TRC_TRACE(TRC_LVL::FLOW, "Creating system process\n");
   system_process = task_process::create(proc_interrupt_slowpath_thread, true, task0_mem_info);
-  task_thread::create(proc_tidyup_thread, system_process);
-  task_thread::create(work::work_queue_thread, system_process);
   ASSERT(system_process != nullptr);
+  irq_slowpath_thread = system_process->child_threads.head->item;
+  task_thread::create(proc_tidyup_thread, system_process);
+  work_queue_thread = task_thread::create(work::work_queue_thread, system_process);
+  pager_thread = task_thread::create(mem_page_cache_pager_thread, system_process);
+  swap_scanner_thread = task_thread::create(mem_swap_scanner_thread, system_process);
+
+  // Other threads are waiting for the results of interrupts, work items and page reads, so handle them promptly.
+  // Compressing idle pages can happen whenever there's nothing better to do.
+  task_set_thread_priority(irq_slowpath_thread.get(), THREAD_PRIORITY::HIGH, 0);
+  task_set_thread_priority(work_queue_thread.get(), THREAD_PRIORITY::HIGH, 0);
+  task_set_thread_priority(pager_thread.get(), THREAD_PRIORITY::HIGH, 0);
+  task_set_thread_priority(swap_scanner_thread.get(), THREAD_PRIORITY::BATCH, 0);
+
+  // IRQs are delivered to the first processor, so keep the slowpath thread there where the interrupt handlers' data is
+  // likely to be in the cache already.
+  task_set_thread_affinity(irq_slowpath_thread.get(), 1);
+
   system_process->start_process();
 
   for (uint32_t i = 0; i < number_of_procs; i++)
@@ -189,8 +412,10 @@ std::shared_ptr<task_process> task_create_system_process()
     new_idle_thread = task_thread::create(task_idle_thread_cycle, system_process);
     new_idle_thread->stop_thread();
     ASSERT(new_idle_thread != nullptr);
-    idle_threads[i] = new_idle_thread.get();
-    task_thread_cycle_remove(idle_threads[i]);
+    proc_records[i].idle_thread = new_idle_thread.get();
+
+    // Idle threads are only run when there's nothing else to do, so they never join a run queue.
+    task_sched_remove_thread(proc_records[i].idle_thread);
   }
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "System process: ", system_process, "\n");
@@ -219,25 +444,27 @@ void task_start_tasking()
 /// responsible for actually scheduling it - **NOTE** This code assumes that the thread is scheduled, the caller must
 /// not simply abandon it.
 ///
-/// The scheduling algorithm is very simply, and pays no attention to demand, CPU load, caching niceties or anything
-/// else. The threads are linked in a cycle via task_thread::next_thread, and the CPUs move through this cycle. If they
-/// are executing the thread, they gain a lock on task_thread::cycle_lock to indicate this. A CPU looking through the
-/// cycle will skip over all threads currently locked or which are suspended (via task_thread::permit_running)
+/// The current thread is first charged for the time it has run. If it is still permitted to run it goes back in to its
+/// run queue, and if it is sleeping until a specific time it joins this CPU's sleep queue. Any threads in the sleep
+/// queue whose time has come are then woken. Finally, the CPU takes the highest priority runnable thread with the
+/// lowest virtual runtime from its own run queue, or steals one from another processor's queue if its own is empty. If
+/// they are executing the thread, CPUs hold a lock on task_thread::cycle_lock to indicate this.
 ///
-/// If a CPU cannot find a valid thread, it will execute an idle thread (stored in idle_threads) which effectively put
-/// the processor to sleep via a HLT-loop.
+/// If a CPU cannot find a valid thread, it will execute its idle thread (stored in its task_proc_record) which puts the
+/// processor to sleep via task_platform_idle().
 ///
 /// @return The thread that the caller **MUST** begin executing.
 task_thread *task_get_next_thread()
 {
   task_thread *next_thread = nullptr;
-  task_thread *start_thread = nullptr;
+  task_thread *current_thread;
   uint32_t proc_id;
-  bool found_thread;
+  uint32_t proc_count;
   uint64_t schedule_start_time; // The system's high precision timer value at the start of this schedule.
   KL_TRC_ENTRY;
 
   proc_id = proc_mp_this_proc_id();
+  proc_count = proc_mp_proc_count();
   schedule_start_time = time_get_system_timer_count(true);
 
 #ifdef AZALEA_SCHED_TIME_DIAGS
@@ -260,8 +487,7 @@ task_thread *task_get_next_thread()
 
 #endif
 
-  ASSERT(continue_this_thread != nullptr);
-  ASSERT(current_threads != nullptr);
+  ASSERT(proc_records != nullptr);
 
 #ifdef AZALEA_SCHED_PERIODIC_DUMP
 
@@ -270,28 +496,18 @@ task_thread *task_get_next_thread()
     if (current_dump_count == max_dump_count)
     {
       kl_trc_trace(TRC_LVL::FLOW, "BEGIN TASK MANAGER DUMP\n");
-      for (uint16_t i = 0; i < proc_mp_proc_count(); i++)
+      for (uint16_t i = 0; i < proc_count; i++)
       {
         kl_trc_trace(TRC_LVL::FLOW, "Proc: ", i,
-                                    ". Thr addr: ", current_threads[i],
+                                    ". Thr addr: ", proc_records[i].current_thread,
                                     ". RIP: ",
-                reinterpret_cast<task_x64_exec_context *>(current_threads[i]->execution_context)->saved_stack.proc_rip,
+                reinterpret_cast<task_x64_exec_context *>(proc_records[i].current_thread->execution_context)
+                  ->saved_stack.proc_rip,
+                                    ". Queue length: ", proc_records[i].run_queue.length,
+                                    ". Min vruntime: ", proc_records[i].run_queue.min_vruntime,
                                     "\n");
       }
 
-      task_thread *c{start_of_thread_cycle};
-      do
-      {
-        kl_trc_trace(TRC_LVL::FLOW, "Thread: ", c,
-                                    ". RIP: ",
-                                 reinterpret_cast<task_x64_exec_context *>(c->execution_context)->saved_stack.proc_rip,
-                                    ". Awake? ", c->permit_running,
-                                    "\n");
-
-        c = c->next_thread;
-      } while (c != start_of_thread_cycle);
-
-
       kl_trc_trace(TRC_LVL::FLOW, "COMPLETE\n");
 
       current_dump_count = 0;
@@ -304,110 +520,76 @@ task_thread *task_get_next_thread()
 
 #endif
 
-  if (continue_this_thread[proc_id])
+  current_thread = proc_records[proc_id].current_thread;
+
+  if (proc_records[proc_id].continue_this_thread)
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Requested to continue current thread\n");
-    next_thread = current_threads[proc_id];
+    next_thread = current_thread;
     ASSERT(next_thread != nullptr);
+
+    // The thread that asked to continue may hold one of the scheduler's locks, so simply keep ticking at the normal
+    // rate until it's finished.
+    task_platform_set_next_tick(time_task_mgr_int_period_ns);
   }
   else
   {
-    if (current_threads[proc_id] == idle_threads[proc_id])
-    {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "Currently on an idle thread, attempt to find non-idle thread\n");
-      ASSERT(start_of_thread_cycle != nullptr);
-      next_thread = start_of_thread_cycle;
-    }
-    else if (current_threads[proc_id] == nullptr)
-    {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "No threads running previously, start at the beginning\n");
-      ASSERT(start_of_thread_cycle != nullptr);
-      next_thread = start_of_thread_cycle;
-    }
-    else
-    {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "Try next thread.\n");
-      next_thread = current_threads[proc_id]->next_thread;
-      ASSERT(next_thread != nullptr);
-    }
-
-    start_thread = next_thread;
-    ASSERT(start_thread != nullptr);
-    found_thread = false;
-    do
+    if ((current_thread != nullptr) && (current_thread != proc_records[proc_id].idle_thread))
     {
-      KL_TRC_TRACE(TRC_LVL::EXTRA, "Considering thread", (uint64_t)next_thread, "\n");
+      charge_thread(current_thread, schedule_start_time);
 
-      // If the thread is sleeping, it might be time to wake up. I don't think there's any harm in not locking this
-      // operation, only one instance of the schedule will be able to lock it to run anyway.
-      if ((!next_thread->permit_running) &&
-          (next_thread->wake_thread_after != 0) &&
-          (next_thread->wake_thread_after < schedule_start_time))
+      if (current_thread->permit_running)
       {
-        KL_TRC_TRACE(TRC_LVL::FLOW, "Waking thread after sleep\n");
-        KL_TRC_TRACE(TRC_LVL::FLOW, "Schedule started at: ", schedule_start_time, "\n");
-        KL_TRC_TRACE(TRC_LVL::FLOW, "Wake requested at: ", next_thread->wake_thread_after, "\n");
-        next_thread->wake_thread_after = 0;
-        next_thread->permit_running = true;
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Return current thread to its run queue\n");
+        add_to_run_queue(current_thread, false);
       }
-
-      if ((next_thread->permit_running) && (next_thread->cycle_lock != 1))
+      else if ((current_thread->wake_thread_after != 0) && (!current_thread->thread_destroyed))
       {
-        KL_TRC_TRACE(TRC_LVL::FLOW, "Trying to lock for ourselves... ");
-        if (klib_synch_spinlock_try_lock(next_thread->cycle_lock))
-        {
-          // Having locked it, double check that it's still OK to run, otherwise release it and carry on.
-          if (next_thread->permit_running)
-          {
-            KL_TRC_TRACE(TRC_LVL::FLOW, "SUCCESS!\n");
-            found_thread = true;
-            break;
-          }
-          else
-          {
-            KL_TRC_TRACE(TRC_LVL::FLOW, "Had to release it again\n");
-            klib_synch_spinlock_unlock(next_thread->cycle_lock);
-          }
-        }
-        else
-        {
-          KL_TRC_TRACE(TRC_LVL::FLOW, "Not this time, continue\n");
-        }
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Current thread is sleeping until ", current_thread->wake_thread_after, "\n");
+        add_sleeping_thread(current_thread, proc_id);
       }
+    }
 
-      next_thread = next_thread->next_thread;
-      ASSERT(next_thread != nullptr)
-    } while (next_thread != start_thread);
+    wake_sleeping_threads(proc_id, schedule_start_time);
+    replenish_deadline_threads(proc_id, schedule_start_time);
 
-    if (found_thread)
+    next_thread = take_from_run_queue(proc_id, proc_id, current_thread);
+
+    for (uint32_t i = 1; (next_thread == nullptr) && (i < proc_count); i++)
     {
-      KL_TRC_TRACE(TRC_LVL::EXTRA, "The next thread to execute is live thread", (uint64_t)next_thread, "\n");
-      if ((next_thread != current_threads[proc_id]) && (current_threads[proc_id] != nullptr))
-      {
-        KL_TRC_TRACE(TRC_LVL::FLOW, "Unlocking old thread\n");
-        klib_synch_spinlock_unlock(current_threads[proc_id]->cycle_lock);
-      }
+      KL_TRC_TRACE(TRC_LVL::EXTRA, "Try to steal a thread from processor ", (proc_id + i) % proc_count, "\n");
+      next_thread = take_from_run_queue((proc_id + i) % proc_count, proc_id, current_thread);
+    }
+
+    if (next_thread == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "No thread found, switch to idle thread\n");
+      next_thread = proc_records[proc_id].idle_thread;
     }
     else
     {
-      if ((current_threads[proc_id] != nullptr) && (current_threads[proc_id]->permit_running))
+      next_thread->slice_start_time = schedule_start_time;
+    }
+
+    if ((next_thread != current_thread) && (current_thread != nullptr))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Unlocking old thread\n");
+      klib_synch_spinlock_unlock(current_thread->cycle_lock);
+
+      if (next_thread->parent_process == current_thread->parent_process)
       {
-        KL_TRC_TRACE(TRC_LVL::FLOW, "Stick with our current thread\n");
-        next_thread = current_threads[proc_id];
+        next_thread->parent_process->same_process_switches++;
       }
       else
       {
-        KL_TRC_TRACE(TRC_LVL::FLOW, "No thread found, switch to idle thread\n");
-        if (current_threads[proc_id] != nullptr)
-        {
-          klib_synch_spinlock_unlock(current_threads[proc_id]->cycle_lock);
-        }
-        next_thread = idle_threads[proc_id];
+        next_thread->parent_process->cross_process_switches++;
       }
     }
+
+    program_next_tick(proc_id, next_thread, schedule_start_time);
   }
 
-  current_threads[proc_id] = next_thread;
+  proc_records[proc_id].current_thread = next_thread;
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Next thread (addr)", (uint64_t)next_thread, "\n");
   KL_TRC_EXIT;
@@ -424,7 +606,7 @@ void task_continue_this_thread()
 {
   KL_TRC_ENTRY;
 
-  continue_this_thread[proc_mp_this_proc_id()] = true;
+  proc_records[proc_mp_this_proc_id()].continue_this_thread = true;
 
   KL_TRC_EXIT;
 }
@@ -434,151 +616,403 @@ void task_resume_scheduling()
 {
   KL_TRC_ENTRY;
 
-  continue_this_thread[proc_mp_this_proc_id()] = false;
+  proc_records[proc_mp_this_proc_id()].continue_this_thread = false;
 
   KL_TRC_EXIT;
 }
 
+/// @brief Is a thread currently executing on a processor?
+///
+/// The result may be out of date as soon as it is returned, so it is only a hint - for example, to decide whether a
+/// lock holder is likely to release the lock soon.
+///
+/// The thread itself is never read, so it is safe to call this for a thread that may have been destroyed since the
+/// caller last looked at it - the answer for a freed thread will simply be false.
+///
+/// @param thread The thread to check.
+///
+/// @return True if a processor is executing the thread, false otherwise.
+bool task_thread_is_running(task_thread *thread)
+{
+  bool result = false;
+
+  ASSERT(thread != nullptr);
+  ASSERT(proc_records != nullptr);
+
+  for (uint32_t i = 0; i < proc_mp_proc_count(); i++)
+  {
+    if (proc_records[i].current_thread == thread)
+    {
+      result = true;
+      break;
+    }
+  }
+
+  return result;
+}
+
 #ifdef AZALEA_TEST_CODE
 void test_only_reset_task_mgr()
 {
   KL_TRC_ENTRY;
 
   std::shared_ptr<task_process> system_proc;
-  task_thread *idle_thread_to_del;
 
-  if (idle_threads[0] != nullptr)
+  if (proc_records[0].idle_thread != nullptr)
   {
-    system_proc = idle_threads[0]->parent_process;
+    system_proc = proc_records[0].idle_thread->parent_process;
   }
 
-  for (uint32_t i = 0; i < proc_mp_proc_count(); i++)
+  if (system_proc != nullptr)
   {
-    if (idle_threads[i] != nullptr)
-    {
-      idle_thread_to_del = idle_threads[i];
-      task_thread_cycle_add(idle_thread_to_del);
-    }
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Destroying system proc\n");
+    system_proc->destroy_process(0);
   }
 
-  KL_TRC_TRACE(TRC_LVL::FLOW, "All idle threads destroyed\n");
+  delete[] proc_records;
+  proc_records = nullptr;
 
-  if (system_proc != nullptr)
+  system_tree()->delete_child("\\proc");
+
+  KL_TRC_EXIT;
+}
+#endif
+
+/// @brief Make a thread available to the scheduler.
+///
+/// The thread is removed from its sleep queue, if it is in one, and added to a run queue. Normally this is
+/// the queue of the processor the thread last ran on, but if that queue is noticeably longer than the shortest one,
+/// the thread is moved to the shortest queue instead. Adding a thread that is already queued has no effect.
+///
+/// @param thread The thread to add. task_thread::permit_running should already be set.
+void task_sched_add_runnable(task_thread *thread)
+{
+  uint64_t saved_flags;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(thread != nullptr);
+  ASSERT(proc_records != nullptr);
+
+  saved_flags = lock_out_scheduler();
+
+  remove_sleeping_thread(thread);
+  add_to_run_queue(thread, true);
+
+  unlock_scheduler(saved_flags);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Remove a thread from the scheduler's run queues and sleep queues
+///
+/// This will cause it to not be considered for execution any more, until it is added again by
+/// task_sched_add_runnable(). It is safe to call this for a thread that is not in any of the scheduler's lists. If the
+/// thread is in the deadline class, it leaves it and the processor time reserved for it is released.
+///
+/// @param thread The thread to remove.
+void task_sched_remove_thread(task_thread *thread)
+{
+  uint64_t saved_flags;
+  bool removed = false;
+  uint32_t queue_proc;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(thread != nullptr);
+  ASSERT(proc_records != nullptr);
+
+  saved_flags = lock_out_scheduler();
+
+  // The sleep queue must be dealt with first - a thread woken from it is added to a run queue while the sleep queue
+  // lock is held.
+  remove_sleeping_thread(thread);
+
+  if (thread->dl.period != 0)
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Destroying system proc\n");
-    system_proc->destroy_process(0);
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Release deadline bandwidth\n");
+    klib_synch_spinlock_lock(deadline_bw_lock);
+    deadline_bw_used -= deadline_bandwidth(thread->dl.runtime, thread->dl.period);
+    thread->dl.period = 0;
+    klib_synch_spinlock_unlock(deadline_bw_lock);
   }
 
-  delete[] current_threads;
-  delete[] continue_this_thread;
-  delete[] idle_threads;
+  while (!removed)
+  {
+    queue_proc = thread->queue_proc;
+    klib_synch_spinlock_lock(proc_records[queue_proc].run_queue.lock);
 
-  current_threads = nullptr;
-  continue_this_thread = nullptr;
-  idle_threads = nullptr;
-  start_of_thread_cycle = nullptr;
+    // If the thread was moved to another queue while we waited for the lock, try again with the new queue.
+    if (thread->queue_proc == queue_proc)
+    {
+      if (klib_heap_item_is_in_any_heap(&thread->run_queue_item))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Remove from run queue ", queue_proc, "\n");
+        remove_from_run_queue(proc_records[queue_proc].run_queue, thread);
+      }
+      removed = true;
+    }
 
-  thread_cycle_lock = 0;
+    klib_synch_spinlock_unlock(proc_records[queue_proc].run_queue.lock);
+  }
 
-  system_tree()->delete_child("\\proc");
+  unlock_scheduler(saved_flags);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Set up the scheduler's fields in a newly created thread.
+///
+/// The thread starts out belonging to the calling processor's queues, with a virtual runtime equal to the smallest in
+/// that processor's run queue, so that it neither jumps ahead of nor lags far behind the threads already there.
+///
+/// @param thread The thread being created.
+void task_sched_init_thread(task_thread *thread)
+{
+  KL_TRC_ENTRY;
+
+  ASSERT(thread != nullptr);
+
+  klib_heap_item_initialize(&thread->run_queue_item);
+  thread->run_queue_item.item = thread;
+  klib_heap_item_initialize(&thread->sleep_queue_item);
+  thread->sleep_queue_item.item = thread;
+
+  thread->queue_proc = proc_mp_this_proc_id();
+  thread->sleep_proc = thread->queue_proc;
+
+  // The run queues won't exist yet if the task manager hasn't been initialised.
+  if (proc_records != nullptr)
+  {
+    thread->vruntime = proc_records[thread->queue_proc].run_queue.min_vruntime;
+  }
 
   KL_TRC_EXIT;
 }
-#endif
 
-/// @brief Add a new thread to the cycle of all threads
+/// @brief Change the scheduling priority of a thread.
+///
+/// @param thread The thread to change.
+///
+/// @param priority The new priority level. Threads at higher levels are always run in preference to those at lower
+///                 levels.
 ///
-/// All threads are joined in a cycle by task_thread::next_thread. Add new_thread to this cycle.
+/// @param nice The new nice value, between THREAD_NICE_MIN and THREAD_NICE_MAX. Threads with lower values receive a
+///             larger share of the processor than other threads at the same priority level.
 ///
-/// @param new_thread The new thread to add.
-void task_thread_cycle_add(task_thread *new_thread)
+/// @return ERR_CODE::INVALID_PARAM if either value is out of range, ERR_CODE::NO_ERROR otherwise.
+ERR_CODE task_set_thread_priority(task_thread *thread, THREAD_PRIORITY priority, int8_t nice)
 {
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+
   KL_TRC_ENTRY;
-  // We don't need to lock for the scheduler - the cycle is always in a consistent state as far as it's concerned,
-  // but we do need to prevent two threads being added at once, since that might cause one or the other to be lost.
-  task_thread_cycle_lock();
 
-  if (start_of_thread_cycle == nullptr)
+  if ((thread == nullptr) ||
+      (static_cast<uint32_t>(priority) >= task_priority_levels) ||
+      (nice < THREAD_NICE_MIN) ||
+      (nice > THREAD_NICE_MAX))
   {
-    start_of_thread_cycle = new_thread;
-    start_of_thread_cycle->next_thread = new_thread;
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid parameters\n");
+    result = ERR_CODE::INVALID_PARAM;
   }
   else
   {
-    new_thread->next_thread = start_of_thread_cycle->next_thread;
-    start_of_thread_cycle->next_thread = new_thread;
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Set priority ", static_cast<uint32_t>(priority), ", nice ", nice, "\n");
+    thread->base_priority = priority;
+    thread->nice = nice;
+    update_thread_priority(thread);
   }
 
-  task_thread_cycle_unlock();
   KL_TRC_EXIT;
+  return result;
 }
 
-/// @brief Remove a thread from the thread cycle
+/// @brief Change the priority level a thread has inherited from the threads waiting for it.
 ///
-/// This will cause it to not be considered for execution any more.
+/// A thread is scheduled at the higher of its own priority level and its inherited level, so that a low priority
+/// thread holding a mutex that a high priority thread is waiting for runs as soon as the high priority thread would
+/// have. This is used by the klib_mutex code, and other code shouldn't normally need it.
 ///
-/// @param thread The thread to remove.
-void task_thread_cycle_remove(task_thread *thread)
+/// @param thread The thread to change.
+///
+/// @param priority The inherited priority level. THREAD_PRIORITY::BATCH if the thread has inherited nothing.
+void task_set_inherited_priority(task_thread *thread, THREAD_PRIORITY priority)
 {
   KL_TRC_ENTRY;
 
-  task_thread *search_thread;
+  ASSERT(thread != nullptr);
+  ASSERT(static_cast<uint32_t>(priority) < task_priority_levels);
+
+  KL_TRC_TRACE(TRC_LVL::FLOW, "Inherit priority ", static_cast<uint32_t>(priority), "\n");
+  thread->inherited_priority = priority;
+  update_thread_priority(thread);
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Place a thread in, or remove it from, the deadline scheduling class.
+///
+/// Threads in the deadline class are run ahead of all other threads. So long as it stays runnable, the thread receives
+/// runtime nanoseconds of processor time within deadline nanoseconds of the start of each period. The request is only
+/// accepted if the total processor time reserved by deadline threads still fits within the system's processors.
+///
+/// The new parameters take effect immediately, starting a new period. If the thread is waiting in a run queue, it is
+/// moved to the correct place in that queue, and its processor is made to run its scheduler if the thread ought to run
+/// ahead of the thread running there now.
+///
+/// @param thread The thread to change.
+///
+/// @param runtime The processor time needed in each period, in nanoseconds. Zero to leave the deadline class and
+///                return to the thread's normal priority level.
+///
+/// @param deadline How long after the start of each period the runtime must have been received by, in nanoseconds.
+///                 Must be at least runtime.
+///
+/// @param period The length of each period, in nanoseconds. Must be at least deadline.
+///
+/// @return ERR_CODE::INVALID_PARAM if the times are not valid. ERR_CODE::OUT_OF_RESOURCE if there is not enough
+///         processor time available. ERR_CODE::NO_ERROR otherwise.
+ERR_CODE task_set_thread_deadline(task_thread *thread, uint64_t runtime, uint64_t deadline, uint64_t period)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  uint64_t old_bw = 0;
+  uint64_t new_bw = 0;
+  uint64_t bw_limit;
+  uint64_t saved_flags;
+  bool updated = false;
+  bool queued;
+  bool preempt = false;
+  uint32_t queue_proc;
 
-  task_thread_cycle_lock();
+  KL_TRC_ENTRY;
 
-  // Special case here - we're deleting the last thread.
-  if (thread->next_thread == thread)
+  if ((thread == nullptr) ||
+      ((runtime != 0) && ((runtime > deadline) || (deadline > period) || (period > task_max_deadline_period))))
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Deleting the last thread\n");
-    start_of_thread_cycle = nullptr;
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid parameters\n");
+    result = ERR_CODE::INVALID_PARAM;
   }
   else
   {
-    if (start_of_thread_cycle == thread)
+    bw_limit = (proc_mp_proc_count() * task_dl_bw_percent << task_dl_bw_shift) / 100;
+    if (runtime != 0)
+    {
+      new_bw = deadline_bandwidth(runtime, period);
+    }
+
+    saved_flags = lock_out_scheduler();
+    klib_synch_spinlock_lock(deadline_bw_lock);
+
+    if (thread->dl.period != 0)
     {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "Moving start of thread cycle out of the way of the dead thread\n");
-      start_of_thread_cycle = thread->next_thread;
+      old_bw = deadline_bandwidth(thread->dl.runtime, thread->dl.period);
     }
 
-    search_thread = start_of_thread_cycle;
-    while (search_thread->next_thread != thread)
+    if ((deadline_bw_used - old_bw + new_bw) > bw_limit)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Not enough processor time available\n");
+      result = ERR_CODE::OUT_OF_RESOURCE;
+    }
+    else
     {
-      search_thread = search_thread->next_thread;
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Set runtime ", runtime, ", deadline ", deadline, ", period ", period, "\n");
+      deadline_bw_used = deadline_bw_used - old_bw + new_bw;
 
-      if (search_thread == start_of_thread_cycle)
+      // The scheduler reads the deadline parameters with the run queue lock held, and a queued thread's position
+      // depends on them, so it must leave its queue while they change.
+      while (!updated)
       {
-        // If this isn't true then the thread officially didn't exist to start with.
-        ASSERT(search_thread->next_thread == thread);
+        queue_proc = thread->queue_proc;
+        klib_synch_spinlock_lock(proc_records[queue_proc].run_queue.lock);
+
+        // If the thread was moved to another queue while we waited for the lock, try again with the new queue.
+        if (thread->queue_proc == queue_proc)
+        {
+          queued = klib_heap_item_is_in_any_heap(&thread->run_queue_item);
+          if (queued)
+          {
+            KL_TRC_TRACE(TRC_LVL::FLOW, "Remove from run queue ", queue_proc, " while updating\n");
+            remove_from_run_queue(proc_records[queue_proc].run_queue, thread);
+          }
+
+          thread->dl.runtime = runtime;
+          thread->dl.rel_deadline = deadline;
+          thread->dl.remaining = runtime;
+          thread->dl.abs_deadline = time_get_system_timer_count(true) + deadline;
+          thread->dl.throttled = false;
+          thread->dl.period = (runtime != 0) ? period : 0;
+
+          if (queued)
+          {
+            insert_into_run_queue(proc_records[queue_proc].run_queue, thread);
+            preempt = should_preempt(thread, queue_proc);
+          }
+          updated = true;
+        }
+
+        klib_synch_spinlock_unlock(proc_records[queue_proc].run_queue.lock);
       }
     }
 
-    search_thread->next_thread = search_thread->next_thread->next_thread;
+    klib_synch_spinlock_unlock(deadline_bw_lock);
+
+    if (preempt)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Signal processor ", queue_proc, " to preempt\n");
+      kick_processor(queue_proc, true);
+    }
+
+    unlock_scheduler(saved_flags);
   }
 
-  task_thread_cycle_unlock();
   KL_TRC_EXIT;
+  return result;
 }
 
-/// @brief Lock the thread cycle
+/// @brief Change the processors a thread may run on.
+///
+/// If the thread is running on a processor that it is no longer allowed on, it moves at the end of its current
+/// timeslice.
+///
+/// @param thread The thread to change.
 ///
-/// This is used when editing the thread cycle, to ensure constant consistency.
-void task_thread_cycle_lock()
+/// @param affinity The new affinity mask. Bit n is set if the thread may run on processor n. Use THREAD_AFFINITY_ALL to
+///                 allow the thread to run anywhere.
+///
+/// @return ERR_CODE::INVALID_PARAM if the mask doesn't include any of the system's processors, ERR_CODE::NO_ERROR
+///         otherwise.
+ERR_CODE task_set_thread_affinity(task_thread *thread, uint64_t affinity)
 {
-  KL_TRC_ENTRY;
-
-  klib_synch_spinlock_lock(thread_cycle_lock);
-
-  KL_TRC_EXIT;
-}
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  uint32_t proc_count = proc_mp_proc_count();
+  uint64_t valid_procs = (proc_count >= 64) ? THREAD_AFFINITY_ALL : ((1ULL << proc_count) - 1);
 
-/// @brief Unlock the thread cycle
-void task_thread_cycle_unlock()
-{
   KL_TRC_ENTRY;
 
-  klib_synch_spinlock_unlock(thread_cycle_lock);
+  if ((thread == nullptr) || ((affinity & valid_procs) == 0))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid parameters\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Set affinity ", affinity, "\n");
+    thread->affinity = affinity;
+
+    // A thread running on a processor whose tick is stopped could keep running there indefinitely, so make sure that
+    // processor's scheduler runs soon.
+    for (uint32_t i = 0; i < proc_count; i++)
+    {
+      if ((proc_records[i].current_thread == thread) && !thread_may_run_on(thread, i))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Move thread off processor ", i, "\n");
+        kick_processor(i, true);
+      }
+    }
+  }
 
   KL_TRC_EXIT;
+  return result;
 }
 
 /// @brief The idle thread's code
@@ -588,10 +1022,985 @@ void task_idle_thread_cycle()
 {
   while(1)
   {
-#ifndef _MSVC_LANG
-    asm("hlt");
-#else
-    __halt();
-#endif
+    task_platform_idle();
+  }
+}
+
+namespace
+{
+  /// @brief Add a thread to its run queue, if it isn't already queued.
+  ///
+  /// The caller must have called lock_out_scheduler(), unless it is the scheduler.
+  ///
+  /// @param thread The thread to add.
+  ///
+  /// @param balance_load If true, the thread is moved to the shortest run queue if its own queue is longer by more than
+  ///                     one thread. This should be set when the thread is being woken, rather than being returned to
+  ///                     its queue at the end of a timeslice, and also causes the thread's virtual runtime to be
+  ///                     brought up close to the rest of the queue.
+  void add_to_run_queue(task_thread *thread, bool balance_load)
+  {
+    bool queued = false;
+    bool waking = balance_load;
+    bool wake_target = false;
+    bool preempt = false;
+    bool others_waiting = false;
+    uint32_t queue_proc;
+    uint32_t target_proc;
+    uint64_t min_vruntime;
+    uint64_t time_now;
+
+    KL_TRC_ENTRY;
+
+    while (!queued)
+    {
+      queue_proc = thread->queue_proc;
+      klib_synch_spinlock_lock(proc_records[queue_proc].run_queue.lock);
+
+      // If the thread was moved to another queue while we waited for the lock, try again with the new queue.
+      if (thread->queue_proc == queue_proc)
+      {
+        if (klib_heap_item_is_in_any_heap(&thread->run_queue_item))
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Thread already queued\n");
+          queued = true;
+        }
+        else
+        {
+          if (balance_load || !thread_may_run_on(thread, queue_proc))
+          {
+            target_proc = least_loaded_run_queue(thread);
+            if (!thread_may_run_on(thread, queue_proc) ||
+                ((proc_records[target_proc].run_queue.length + 1) < proc_records[queue_proc].run_queue.length))
+            {
+              KL_TRC_TRACE(TRC_LVL::FLOW, "Move thread from queue ", queue_proc, " to ", target_proc, "\n");
+              thread->queue_proc = target_proc;
+              thread->vruntime = move_vruntime(thread->vruntime, queue_proc, target_proc);
+            }
+            balance_load = false;
+          }
+
+          if (thread->queue_proc == queue_proc)
+          {
+            if (waking && (thread->dl.period != 0) && !thread->dl.throttled)
+            {
+              // If the thread can't use the rest of this period's runtime before its deadline without exceeding its
+              // share of the processor, it starts a new period now instead.
+              time_now = time_get_system_timer_count(true);
+              if ((time_now >= thread->dl.abs_deadline) ||
+                  ((thread->dl.remaining * thread->dl.period) >
+                   ((thread->dl.abs_deadline - time_now) * thread->dl.runtime)))
+              {
+                KL_TRC_TRACE(TRC_LVL::FLOW, "Start new deadline period\n");
+                thread->dl.abs_deadline = time_now + thread->dl.rel_deadline;
+                thread->dl.remaining = thread->dl.runtime;
+              }
+            }
+            else if (waking)
+            {
+              // Don't let a thread that has been asleep for a long time build up credit, otherwise it could hold on to
+              // the processor for as long as it had been asleep.
+              min_vruntime = proc_records[queue_proc].run_queue.min_vruntime;
+              if (min_vruntime < task_sleeper_credit)
+              {
+                min_vruntime = 0;
+              }
+              else
+              {
+                min_vruntime -= task_sleeper_credit;
+              }
+
+              if (thread->vruntime < min_vruntime)
+              {
+                KL_TRC_TRACE(TRC_LVL::FLOW, "Raise woken thread's vruntime to ", min_vruntime, "\n");
+                thread->vruntime = min_vruntime;
+              }
+            }
+
+            insert_into_run_queue(proc_records[queue_proc].run_queue, thread);
+            queued = true;
+
+            wake_target = proc_records[queue_proc].run_queue.tick_stopped;
+            proc_records[queue_proc].run_queue.tick_stopped = false;
+            others_waiting = (proc_records[queue_proc].run_queue.length > 1);
+            preempt = waking && should_preempt(thread, queue_proc);
+          }
+        }
+      }
+
+      klib_synch_spinlock_unlock(proc_records[queue_proc].run_queue.lock);
+    }
+
+    if (wake_target || preempt)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Signal processor ", queue_proc, " - tick stopped: ", wake_target,
+                                  ", preempt: ", preempt, "\n");
+      kick_processor(queue_proc, preempt);
+    }
+    else if (others_waiting)
+    {
+      kick_idle_processor(queue_proc);
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Insert a thread in to a run queue, at the correct priority level and position.
+  ///
+  /// The lock for the queue must be held.
+  ///
+  /// @param queue The queue to add the thread to.
+  ///
+  /// @param thread The thread to add.
+  void insert_into_run_queue(task_run_queue &queue, task_thread *thread)
+  {
+    uint32_t level;
+
+    KL_TRC_ENTRY;
+
+    if (thread->dl.throttled)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Thread throttled until next period\n");
+      klib_heap_insert(&queue.throttled_threads,
+                       &thread->run_queue_item,
+                       thread->dl.abs_deadline - thread->dl.rel_deadline + thread->dl.period);
+    }
+    else if (thread->dl.period != 0)
+    {
+      klib_heap_insert(&queue.deadline_threads, &thread->run_queue_item, thread->dl.abs_deadline);
+    }
+    else
+    {
+      level = static_cast<uint32_t>(thread->priority);
+      ASSERT(level < task_priority_levels);
+      klib_heap_insert(&queue.threads[level], &thread->run_queue_item, thread->vruntime);
+    }
+    queue.length++;
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Remove a thread from a run queue.
+  ///
+  /// The lock for the queue must be held.
+  ///
+  /// @param queue The queue containing the thread.
+  ///
+  /// @param thread The thread to remove.
+  void remove_from_run_queue(task_run_queue &queue, task_thread *thread)
+  {
+    KL_TRC_ENTRY;
+
+    ASSERT(((thread->run_queue_item.heap_obj >= &queue.threads[0]) &&
+            (thread->run_queue_item.heap_obj < &queue.threads[task_priority_levels])) ||
+           (thread->run_queue_item.heap_obj == &queue.deadline_threads) ||
+           (thread->run_queue_item.heap_obj == &queue.throttled_threads));
+    klib_heap_remove(&thread->run_queue_item);
+    queue.length--;
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Account for the time a thread has just spent running.
+  ///
+  /// For most threads, the time is added to the thread's virtual runtime. The time is scaled by the thread's weight, so
+  /// that threads with a low nice value accumulate virtual runtime slowly and so get a larger share of the processor.
+  ///
+  /// Threads in the deadline class have the time taken from their remaining runtime instead. If that is used up, or
+  /// the deadline has passed, the thread is throttled until its next period.
+  ///
+  /// @param thread The thread that has been running since task_thread::slice_start_time.
+  ///
+  /// @param time_now The current system timer value.
+  void charge_thread(task_thread *thread, uint64_t time_now)
+  {
+    uint64_t elapsed = 0;
+    uint64_t charge;
+
+    KL_TRC_ENTRY;
+
+    ASSERT((thread->nice >= THREAD_NICE_MIN) && (thread->nice <= THREAD_NICE_MAX));
+
+    if (time_now > thread->slice_start_time)
+    {
+      elapsed = time_now - thread->slice_start_time;
+    }
+
+    if (thread->dl.period != 0)
+    {
+      thread->dl.remaining = (elapsed < thread->dl.remaining) ? (thread->dl.remaining - elapsed) : 0;
+
+      if (time_now > thread->dl.abs_deadline)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Thread ", thread, " missed its deadline\n");
+        thread->dl.misses++;
+        thread->parent_process->deadline_misses++;
+        thread->dl.throttled = true;
+      }
+      else if (thread->dl.remaining == 0)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Thread ", thread, " used all its runtime\n");
+        thread->dl.throttled = true;
+      }
+
+      KL_TRC_EXIT;
+      return;
+    }
+
+    charge = (elapsed * task_nice_0_weight) / task_nice_weights[thread->nice - THREAD_NICE_MIN];
+
+    // Always charge something, so that threads which yield before the timer has moved still take turns.
+    if (charge == 0)
+    {
+      charge = 1;
+    }
+
+    thread->vruntime += charge;
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Thread ", thread, " vruntime now ", thread->vruntime, "\n");
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Take the best thread that can run from a run queue.
+  ///
+  /// The priority levels are searched from highest to lowest, and within each level threads are considered in order of
+  /// virtual runtime. Threads that have been stopped since they were queued are removed from the queue. Threads that
+  /// are locked by another processor are left where they are, although only a few of these are skipped before the
+  /// scheduler gives up on the level. The thread that is returned is locked for the calling processor and becomes part
+  /// of that processor's run queue when it is next added to one.
+  ///
+  /// @param queue_proc The processor whose queue should be examined. If this isn't the calling processor, then the
+  ///                   thread is being stolen and the queue is skipped if it is empty or busy.
+  ///
+  /// @param proc_id The calling processor.
+  ///
+  /// @param current The thread the calling processor is running at the moment. Its cycle lock is already held.
+  ///
+  /// @return The thread to run, or nullptr if there were no suitable threads in the queue.
+  task_thread *take_from_run_queue(uint32_t queue_proc, uint32_t proc_id, task_thread *current)
+  {
+    task_run_queue &queue = proc_records[queue_proc].run_queue;
+    klib_heap_item<task_thread *> *item;
+    task_thread *candidate;
+    task_thread *result = nullptr;
+    task_thread *skipped[task_max_skipped_threads];
+    uint32_t num_skipped;
+    task_thread *misplaced[task_max_skipped_threads];
+    uint32_t num_misplaced = 0;
+    klib_heap<task_thread *> *heaps[] = { &queue.deadline_threads,
+                                         &queue.threads[0],
+                                         &queue.threads[1],
+                                         &queue.threads[2] };
+
+    KL_TRC_ENTRY;
+
+    if (queue_proc == proc_id)
+    {
+      klib_synch_spinlock_lock(queue.lock);
+    }
+    else if ((queue.length == 0) || !klib_synch_spinlock_try_lock(queue.lock))
+    {
+      KL_TRC_TRACE(TRC_LVL::EXTRA, "Nothing to steal\n");
+      KL_TRC_EXIT;
+      return nullptr;
+    }
+
+    static_assert((sizeof(heaps) / sizeof(heaps[0])) == (task_priority_levels + 1), "Not all levels are searched");
+
+    for (klib_heap<task_thread *> *heap : heaps)
+    {
+      if (result != nullptr)
+      {
+        break;
+      }
+
+      num_skipped = 0;
+      item = klib_heap_peek_min(heap);
+
+      while ((item != nullptr) && (result == nullptr) && (num_skipped < task_max_skipped_threads))
+      {
+        candidate = item->item;
+        KL_TRC_TRACE(TRC_LVL::EXTRA, "Considering thread ", candidate, "\n");
+        remove_from_run_queue(queue, candidate);
+
+        if (!candidate->permit_running)
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Drop stopped thread from queue\n");
+        }
+        else if (!thread_may_run_on(candidate, proc_id))
+        {
+          if ((queue_proc == proc_id) && (num_misplaced < task_max_skipped_threads))
+          {
+            // The thread's affinity has changed since it was queued. It can be moved once this queue is unlocked.
+            KL_TRC_TRACE(TRC_LVL::FLOW, "Thread no longer allowed on this processor\n");
+            misplaced[num_misplaced] = candidate;
+            num_misplaced++;
+          }
+          else
+          {
+            KL_TRC_TRACE(TRC_LVL::EXTRA, "Thread not allowed on this processor\n");
+            skipped[num_skipped] = candidate;
+            num_skipped++;
+          }
+        }
+        else if ((candidate == current) || klib_synch_spinlock_try_lock(candidate->cycle_lock))
+        {
+          // Having locked it, double check that it's still OK to run. If not, it is dropped from the queue as above.
+          if (candidate->permit_running)
+          {
+            KL_TRC_TRACE(TRC_LVL::FLOW, "Found thread ", candidate, "\n");
+            result = candidate;
+          }
+          else if (candidate != current)
+          {
+            KL_TRC_TRACE(TRC_LVL::FLOW, "Had to release it again\n");
+            klib_synch_spinlock_unlock(candidate->cycle_lock);
+          }
+        }
+        else
+        {
+          KL_TRC_TRACE(TRC_LVL::EXTRA, "Thread is running elsewhere\n");
+          skipped[num_skipped] = candidate;
+          num_skipped++;
+        }
+
+        item = klib_heap_peek_min(heap);
+      }
+
+      // Threads running on other processors go back in to the queue, so they can be scheduled here later.
+      for (uint32_t i = 0; i < num_skipped; i++)
+      {
+        insert_into_run_queue(queue, skipped[i]);
+      }
+    }
+
+    if ((result != nullptr) && (queue_proc == proc_id) && (result->dl.period == 0))
+    {
+      candidate = take_same_process_thread(queue, result, proc_id, current);
+      if (candidate != nullptr)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Run thread ", candidate, " from the same process instead\n");
+        ASSERT(result != current);
+        klib_synch_spinlock_unlock(result->cycle_lock);
+        insert_into_run_queue(queue, result);
+        result = candidate;
+      }
+    }
+
+    if (result != nullptr)
+    {
+      if (result->dl.period != 0)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Deadline threads have no virtual runtime to update\n");
+      }
+      else if (queue_proc == proc_id)
+      {
+        // Only this processor updates its own queue's minimum virtual runtime, so it can be read elsewhere without
+        // holding the lock.
+        if (result->vruntime > queue.min_vruntime)
+        {
+          queue.min_vruntime = result->vruntime;
+        }
+      }
+      else
+      {
+        result->vruntime = move_vruntime(result->vruntime, queue_proc, proc_id);
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Stolen thread's vruntime now ", result->vruntime, "\n");
+      }
+
+      result->queue_proc = proc_id;
+    }
+
+    klib_synch_spinlock_unlock(queue.lock);
+
+    for (uint32_t i = 0; i < num_misplaced; i++)
+    {
+      add_to_run_queue(misplaced[i], false);
+    }
+
+    KL_TRC_EXIT;
+    return result;
+  }
+
+  /// @brief Look for a thread of the process this processor is running, to run instead of the scheduler's choice.
+  ///
+  /// Only threads at the same priority level as the chosen thread whose virtual runtime is within
+  /// task_same_process_bonus of the chosen thread's are considered, so this costs little fairness. The chosen thread
+  /// keeps its place in the queue, so it can't be passed over indefinitely. The current thread itself isn't considered,
+  /// it has just had its timeslice.
+  ///
+  /// The caller must hold the queue's lock.
+  ///
+  /// @param queue The calling processor's run queue.
+  ///
+  /// @param chosen The thread the scheduler would otherwise run. It has already been removed from the queue.
+  ///
+  /// @param proc_id The calling processor.
+  ///
+  /// @param current The thread the calling processor is running at the moment. Its cycle lock is already held.
+  ///
+  /// @return A thread to run instead of chosen, which has been removed from the queue and locked, or nullptr if there
+  ///         is no suitable thread.
+  task_thread *take_same_process_thread(task_run_queue &queue,
+                                        task_thread *chosen,
+                                        uint32_t proc_id,
+                                        task_thread *current)
+  {
+    klib_heap<task_thread *> *heap = &queue.threads[static_cast<uint32_t>(chosen->priority)];
+    klib_heap_item<task_thread *> *item;
+    task_thread *candidate;
+    task_thread *result = nullptr;
+    task_thread *skipped[task_max_skipped_threads];
+    uint32_t num_skipped = 0;
+
+    KL_TRC_ENTRY;
+
+    if ((current == nullptr) ||
+        (current == proc_records[proc_id].idle_thread) ||
+        (chosen->parent_process == current->parent_process))
+    {
+      KL_TRC_TRACE(TRC_LVL::EXTRA, "No need to look\n");
+      KL_TRC_EXIT;
+      return nullptr;
+    }
+
+    item = klib_heap_peek_min(heap);
+    while ((item != nullptr) &&
+           (result == nullptr) &&
+           (item->key <= (chosen->vruntime + task_same_process_bonus)) &&
+           (num_skipped < task_max_skipped_threads))
+    {
+      candidate = item->item;
+      remove_from_run_queue(queue, candidate);
+
+      if (!candidate->permit_running)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Drop stopped thread from queue\n");
+      }
+      else if ((candidate != current) &&
+               (candidate->parent_process == current->parent_process) &&
+               thread_may_run_on(candidate, proc_id) &&
+               klib_synch_spinlock_try_lock(candidate->cycle_lock))
+      {
+        // As in take_from_run_queue(), double check that it's still OK to run. If not, it is dropped from the queue.
+        if (candidate->permit_running)
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Found thread ", candidate, "\n");
+          result = candidate;
+        }
+        else
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Had to release it again\n");
+          klib_synch_spinlock_unlock(candidate->cycle_lock);
+        }
+      }
+      else
+      {
+        skipped[num_skipped] = candidate;
+        num_skipped++;
+      }
+
+      item = klib_heap_peek_min(heap);
+    }
+
+    for (uint32_t i = 0; i < num_skipped; i++)
+    {
+      insert_into_run_queue(queue, skipped[i]);
+    }
+
+    KL_TRC_EXIT;
+    return result;
+  }
+
+  /// @brief Return throttled deadline threads whose new period has started to the deadline part of the run queue.
+  ///
+  /// Throttled threads that have been stopped in the meantime are dropped from the queue instead.
+  ///
+  /// @param proc_id The processor whose run queue should be examined.
+  ///
+  /// @param time_now The current system timer value.
+  void replenish_deadline_threads(uint32_t proc_id, uint64_t time_now)
+  {
+    task_run_queue &queue = proc_records[proc_id].run_queue;
+    klib_heap_item<task_thread *> *item;
+    task_thread *thread;
+    uint64_t period_start;
+
+    KL_TRC_ENTRY;
+
+    klib_synch_spinlock_lock(queue.lock);
+
+    item = klib_heap_peek_min(&queue.throttled_threads);
+    while ((item != nullptr) && (item->key <= time_now))
+    {
+      thread = item->item;
+      period_start = item->key;
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Replenish thread ", thread, "\n");
+
+      remove_from_run_queue(queue, thread);
+
+      // If the thread has been throttled for more than a whole period, there's no sense in giving it a deadline that
+      // has already passed.
+      if (period_start < time_now)
+      {
+        period_start = time_now;
+      }
+      thread->dl.throttled = false;
+      thread->dl.abs_deadline = period_start + thread->dl.rel_deadline;
+      thread->dl.remaining = thread->dl.runtime;
+
+      if (thread->permit_running)
+      {
+        insert_into_run_queue(queue, thread);
+      }
+
+      item = klib_heap_peek_min(&queue.throttled_threads);
+    }
+
+    klib_synch_spinlock_unlock(queue.lock);
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Calculate the proportion of a processor used by a deadline thread.
+  ///
+  /// @param runtime The thread's runtime in each period.
+  ///
+  /// @param period The thread's period. Must not be zero.
+  ///
+  /// @return The proportion of a processor needed, as a fixed point number with task_dl_bw_shift fractional bits.
+  uint64_t deadline_bandwidth(uint64_t runtime, uint64_t period)
+  {
+    ASSERT(period != 0);
+    return (runtime << task_dl_bw_shift) / period;
+  }
+
+  /// @brief Convert a virtual runtime from one run queue's terms to another's.
+  ///
+  /// Virtual runtimes on different processors aren't comparable, so a thread moving between queues keeps its position
+  /// relative to the minimum virtual runtime of the queue it came from. The minimums are read without holding the
+  /// queues' locks, so the result is approximate.
+  ///
+  /// @param vruntime The virtual runtime in terms of the old queue.
+  ///
+  /// @param old_proc The processor whose queue the thread is leaving.
+  ///
+  /// @param new_proc The processor whose queue the thread is joining.
+  ///
+  /// @return The virtual runtime in terms of the new queue.
+  uint64_t move_vruntime(uint64_t vruntime, uint32_t old_proc, uint32_t new_proc)
+  {
+    uint64_t old_min = proc_records[old_proc].run_queue.min_vruntime;
+    uint64_t new_min = proc_records[new_proc].run_queue.min_vruntime;
+
+    return (vruntime > old_min) ? (vruntime - old_min + new_min) : new_min;
+  }
+
+  /// @brief Find the processor with the shortest run queue, out of those a thread may run on.
+  ///
+  /// The queue lengths are read without locking, so the result may be out of date by the time it is used.
+  ///
+  /// @param thread The thread looking for a queue to join. Its affinity mask must allow at least one processor.
+  ///
+  /// @return The ID of the processor with the shortest run queue.
+  uint32_t least_loaded_run_queue(task_thread *thread)
+  {
+    uint32_t result = 0;
+    bool found = false;
+    uint32_t proc_count = proc_mp_proc_count();
+
+    for (uint32_t i = 0; i < proc_count; i++)
+    {
+      if (thread_may_run_on(thread, i) &&
+          (!found || (proc_records[i].run_queue.length < proc_records[result].run_queue.length)))
+      {
+        result = i;
+        found = true;
+      }
+    }
+
+    ASSERT(found);
+
+    return result;
+  }
+
+  /// @brief Is a thread allowed to run on a given processor?
+  ///
+  /// @param thread The thread to check.
+  ///
+  /// @param proc_id The processor to check.
+  ///
+  /// @return True if the thread's affinity mask allows it to run on the processor, false otherwise.
+  bool thread_may_run_on(task_thread *thread, uint32_t proc_id)
+  {
+    uint64_t affinity = thread->affinity;
+
+    if (proc_id >= 64)
+    {
+      return (affinity == THREAD_AFFINITY_ALL);
+    }
+
+    return ((affinity & (1ULL << proc_id)) != 0);
+  }
+
+  /// @brief Add a thread to a processor's sleep queue.
+  ///
+  /// Only the scheduler calls this function, for the thread it is about to stop running.
+  ///
+  /// @param thread The thread to add. Its task_thread::wake_thread_after field must be set.
+  ///
+  /// @param proc_id The processor whose sleep queue the thread should join.
+  void add_sleeping_thread(task_thread *thread, uint32_t proc_id)
+  {
+    KL_TRC_ENTRY;
+
+    klib_synch_spinlock_lock(proc_records[proc_id].sleep_queue.lock);
+
+    ASSERT(!klib_heap_item_is_in_any_heap(&thread->sleep_queue_item));
+    thread->sleep_proc = proc_id;
+    klib_heap_insert(&proc_records[proc_id].sleep_queue.threads, &thread->sleep_queue_item, thread->wake_thread_after);
+
+    klib_synch_spinlock_unlock(proc_records[proc_id].sleep_queue.lock);
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Remove a thread from its sleep queue, if it is in one, and cancel its wake up time.
+  ///
+  /// The caller must have called lock_out_scheduler().
+  ///
+  /// @param thread The thread to remove.
+  void remove_sleeping_thread(task_thread *thread)
+  {
+    bool removed = false;
+    uint32_t sleep_proc;
+
+    KL_TRC_ENTRY;
+
+    while (!removed)
+    {
+      sleep_proc = thread->sleep_proc;
+      klib_synch_spinlock_lock(proc_records[sleep_proc].sleep_queue.lock);
+
+      // If the thread joined another processor's sleep queue while we waited for the lock, try again with that queue.
+      if (thread->sleep_proc == sleep_proc)
+      {
+        if (klib_heap_item_is_in_any_heap(&thread->sleep_queue_item))
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Cancel thread's sleep\n");
+          ASSERT(thread->sleep_queue_item.heap_obj == &proc_records[sleep_proc].sleep_queue.threads);
+          klib_heap_remove(&thread->sleep_queue_item);
+        }
+        thread->wake_thread_after = 0;
+        removed = true;
+      }
+
+      klib_synch_spinlock_unlock(proc_records[sleep_proc].sleep_queue.lock);
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Start all threads in a processor's sleep queue whose wake up time has passed.
+  ///
+  /// @param proc_id The processor whose sleep queue should be examined.
+  ///
+  /// @param time_now The current system timer value.
+  void wake_sleeping_threads(uint32_t proc_id, uint64_t time_now)
+  {
+    task_sleep_queue &queue = proc_records[proc_id].sleep_queue;
+    klib_heap_item<task_thread *> *item;
+    task_thread *thread;
+
+    KL_TRC_ENTRY;
+
+    klib_synch_spinlock_lock(queue.lock);
+
+    item = klib_heap_peek_min(&queue.threads);
+    while ((item != nullptr) && (item->key < time_now))
+    {
+      thread = item->item;
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Waking thread ", thread, " requested at: ", item->key, "\n");
+
+      klib_heap_remove(item);
+      thread->wake_thread_after = 0;
+
+      // Adding to the run queue happens with the sleep queue locked, so that a thread being destroyed can't be added
+      // to a run queue after task_sched_remove_thread() has dealt with it.
+      if (!thread->thread_destroyed)
+      {
+        thread->permit_running = true;
+        add_to_run_queue(thread, true);
+      }
+
+      item = klib_heap_peek_min(&queue.threads);
+    }
+
+    klib_synch_spinlock_unlock(queue.lock);
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Arrange for the scheduler to run again on this processor when it next needs to.
+  ///
+  /// @param proc_id The calling processor.
+  ///
+  /// @param next_thread The thread that the processor is about to run.
+  ///
+  /// @param time_now The current system timer value.
+  void program_next_tick(uint32_t proc_id, task_thread *next_thread, uint64_t time_now)
+  {
+    uint64_t next_event = ~0ULL;
+    uint64_t delay = 0;
+    bool need_slice = false;
+    klib_heap_item<task_thread *> *item;
+
+    KL_TRC_ENTRY;
+
+    klib_synch_spinlock_lock(proc_records[proc_id].sleep_queue.lock);
+    item = klib_heap_peek_min(&proc_records[proc_id].sleep_queue.threads);
+    if (item != nullptr)
+    {
+      // Sleeping threads are woken once the time is strictly greater than their wake up time.
+      next_event = item->key + 1;
+    }
+    klib_synch_spinlock_unlock(proc_records[proc_id].sleep_queue.lock);
+
+    klib_synch_spinlock_lock(proc_records[proc_id].run_queue.lock);
+    need_slice = !klib_heap_is_empty(&proc_records[proc_id].run_queue.deadline_threads);
+    for (uint32_t i = 0; i < task_priority_levels; i++)
+    {
+      need_slice = need_slice || !klib_heap_is_empty(&proc_records[proc_id].run_queue.threads[i]);
+    }
+
+    item = klib_heap_peek_min(&proc_records[proc_id].run_queue.throttled_threads);
+    if ((item != nullptr) && (item->key < next_event))
+    {
+      next_event = item->key;
+    }
+
+    proc_records[proc_id].run_queue.tick_stopped = !need_slice;
+    klib_synch_spinlock_unlock(proc_records[proc_id].run_queue.lock);
+
+    if (need_slice && ((time_now + time_task_mgr_int_period_ns) < next_event))
+    {
+      KL_TRC_TRACE(TRC_LVL::EXTRA, "Other threads waiting\n");
+      next_event = time_now + time_task_mgr_int_period_ns;
+    }
+
+    if ((next_thread->dl.period != 0) && ((time_now + next_thread->dl.remaining) < next_event))
+    {
+      KL_TRC_TRACE(TRC_LVL::EXTRA, "Deadline thread's runtime ends first\n");
+      next_event = time_now + next_thread->dl.remaining;
+    }
+
+    if (next_event != ~0ULL)
+    {
+      delay = (next_event > time_now) ? (next_event - time_now) : 1;
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Next tick in ", delay, " ns (0 = stopped)\n");
+    task_platform_set_next_tick(delay);
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Make a processor run its scheduler soon, so that it notices a change to its run queue.
+  ///
+  /// @param proc_id The processor to signal. If this is the calling processor, then its tick is reprogrammed instead,
+  ///                since either the scheduler is running already or it has been locked out.
+  ///
+  /// @param now If true, the scheduler should run as soon as possible. Otherwise, if this is the calling processor, it
+  ///            runs at the end of a normal timeslice.
+  void kick_processor(uint32_t proc_id, bool now)
+  {
+    KL_TRC_ENTRY;
+
+    if (proc_id == proc_mp_this_proc_id())
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Reprogram own tick, now: ", now, "\n");
+      task_platform_set_next_tick(now ? task_resched_delay_ns : time_task_mgr_int_period_ns);
+    }
+    else
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Signal processor ", proc_id, "\n");
+      task_platform_wake_proc(proc_id);
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Should a newly woken thread take over from the thread running on a processor straight away?
+  ///
+  /// The running thread's details are read without any locks, so the answer is only a hint.
+  ///
+  /// @param thread The thread that has just been woken.
+  ///
+  /// @param proc_id The processor whose run queue the thread has joined.
+  ///
+  /// @return True if the processor should run its scheduler immediately, false if the woken thread can wait its turn.
+  bool should_preempt(task_thread *thread, uint32_t proc_id)
+  {
+    task_thread *running = proc_records[proc_id].current_thread;
+    bool result;
+
+    KL_TRC_ENTRY;
+
+    if ((running == nullptr) || (running == proc_records[proc_id].idle_thread))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Processor is idle\n");
+      result = true;
+    }
+    else if (thread->dl.period != 0)
+    {
+      result = (running->dl.period == 0) || (thread->dl.abs_deadline < running->dl.abs_deadline);
+    }
+    else if (running->dl.period != 0)
+    {
+      result = false;
+    }
+    else if (thread->priority != running->priority)
+    {
+      result = (static_cast<uint32_t>(thread->priority) < static_cast<uint32_t>(running->priority));
+    }
+    else
+    {
+      result = ((thread->vruntime + task_wakeup_granularity) < running->vruntime);
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Preempt: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+
+  /// @brief Signal an idle processor whose tick is stopped, so that it can steal a waiting thread.
+  ///
+  /// At most one processor is signalled. The processors' states are read without locking, so an idle processor may be
+  /// missed, in which case it will notice the waiting thread at its next tick.
+  ///
+  /// @param busy_proc The processor whose run queue has threads waiting in it.
+  void kick_idle_processor(uint32_t busy_proc)
+  {
+    uint32_t proc_count = proc_mp_proc_count();
+    bool kick = false;
+
+    KL_TRC_ENTRY;
+
+    for (uint32_t i = 0; i < proc_count; i++)
+    {
+      if ((i != busy_proc) &&
+          proc_records[i].run_queue.tick_stopped &&
+          (proc_records[i].current_thread == proc_records[i].idle_thread))
+      {
+        if (klib_synch_spinlock_try_lock(proc_records[i].run_queue.lock))
+        {
+          kick = proc_records[i].run_queue.tick_stopped;
+          proc_records[i].run_queue.tick_stopped = false;
+          klib_synch_spinlock_unlock(proc_records[i].run_queue.lock);
+        }
+
+        if (kick)
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Wake idle processor ", i, "\n");
+          kick_processor(i, true);
+          break;
+        }
+      }
+    }
+
+    KL_TRC_EXIT;
+  }
+
+  /// @brief Stop the scheduler running on this processor while the scheduler's locks are held.
+  ///
+  /// The scheduler spins on its locks from the timer interrupt, so it must not interrupt code on the same processor
+  /// that holds one of them. Interrupts are disabled, which also stops the calling thread being moved to another
+  /// processor while it holds a lock.
+  ///
+  /// @return The processor flags from before this call, which must be passed to unlock_scheduler().
+  uint64_t lock_out_scheduler()
+  {
+    return proc_save_and_stop_interrupts();
+  }
+
+  /// @brief Undo the effect of lock_out_scheduler().
+  ///
+  /// @param saved_flags The value returned by lock_out_scheduler().
+  void unlock_scheduler(uint64_t saved_flags)
+  {
+    proc_restore_interrupts(saved_flags);
+  }
+
+  /// @brief Schedule a thread at the higher of its own and its inherited priority levels.
+  ///
+  /// If the thread is waiting in a run queue, it is moved to its new level straight away, and its processor is made to
+  /// run its scheduler if the thread ought to run ahead of the thread running there now.
+  ///
+  /// @param thread The thread to update.
+  void update_thread_priority(task_thread *thread)
+  {
+    uint64_t saved_flags;
+    bool updated = false;
+    bool preempt = false;
+    uint32_t queue_proc;
+    THREAD_PRIORITY new_priority;
+
+    KL_TRC_ENTRY;
+
+    // Lower values are higher priorities.
+    new_priority = thread->base_priority;
+    if (static_cast<uint32_t>(thread->inherited_priority) < static_cast<uint32_t>(new_priority))
+    {
+      new_priority = thread->inherited_priority;
+    }
+
+    if (proc_records == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Task manager not yet initialised\n");
+      thread->priority = new_priority;
+    }
+    else
+    {
+      saved_flags = lock_out_scheduler();
+
+      while (!updated)
+      {
+        queue_proc = thread->queue_proc;
+        klib_synch_spinlock_lock(proc_records[queue_proc].run_queue.lock);
+
+        // If the thread was moved to another queue while we waited for the lock, try again with the new queue.
+        if (thread->queue_proc == queue_proc)
+        {
+          if ((thread->priority != new_priority) &&
+              (thread->dl.period == 0) &&
+              klib_heap_item_is_in_any_heap(&thread->run_queue_item))
+          {
+            KL_TRC_TRACE(TRC_LVL::FLOW, "Move to level ", static_cast<uint32_t>(new_priority), "\n");
+            remove_from_run_queue(proc_records[queue_proc].run_queue, thread);
+            thread->priority = new_priority;
+            insert_into_run_queue(proc_records[queue_proc].run_queue, thread);
+            preempt = should_preempt(thread, queue_proc);
+          }
+          else
+          {
+            thread->priority = new_priority;
+          }
+          updated = true;
+        }
+
+        klib_synch_spinlock_unlock(proc_records[queue_proc].run_queue.lock);
+      }
+
+      if (preempt)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Signal processor ", queue_proc, " to preempt\n");
+        kick_processor(queue_proc, true);
+      }
+
+      unlock_scheduler(saved_flags);
+    }
+
+    KL_TRC_EXIT;
   }
 }
@@ -8,6 +8,13 @@
 #include "processor-int.h"
 #include "object_mgr/object_mgr.h"
 
+namespace
+{
+  /// The kernel heap charged to a process for each of its threads - the thread object and its two list items.
+  const int64_t task_thread_heap_charge =
+    sizeof(task_thread) + (2 * sizeof(klib_list_item<std::shared_ptr<task_thread>>));
+}
+
 /// @brief Create a new thread.
 ///
 /// Creates a new thread as part of `parent`, starting at entry_point. The thread remains suspended until it is
@@ -40,6 +47,14 @@ task_thread::task_thread(ENTRY_PROC entry_point,
                               ", for entry point: ", reinterpret_cast<void *>(entry_point), "\n");
   this->process_list_item = new klib_list_item<std::shared_ptr<task_thread>>();
   this->synch_list_item = new klib_list_item<std::shared_ptr<task_thread>>();
+  klib_list_item_initialize(&this->mutex_wait_item);
+  this->mutex_wait_item.item = this;
+  klib_list_item_initialize(&this->futex_wait_item);
+  this->futex_wait_item.item = this;
+  mem_acct_charge_kernel_heap(parent_process.get(), task_thread_heap_charge);
+
+  // The scheduler's fields must always be valid, since destroying the thread removes it from the scheduler.
+  task_sched_init_thread(this);
 
   if (!parent_process->being_destroyed)
   {
@@ -50,7 +65,6 @@ task_thread::task_thread(ENTRY_PROC entry_point,
     klib_list_item_initialize(this->synch_list_item);
 
     klib_synch_spinlock_init(this->cycle_lock);
-    task_thread_cycle_add(this);
   }
   else
   {
@@ -101,6 +115,7 @@ task_thread::~task_thread()
   task_int_delete_exec_context(this);
   delete this->process_list_item;
   delete this->synch_list_item;
+  mem_acct_charge_kernel_heap(this->parent_process.get(), -task_thread_heap_charge);
   this->parent_process = nullptr;
 
   KL_TRC_EXIT;
@@ -129,7 +144,7 @@ void task_thread::destroy_thread()
       KL_TRC_TRACE(TRC_LVL::FLOW, "Destroy another thread...\n");
       this->stop_thread();
       klib_synch_spinlock_lock(this->cycle_lock);
-      task_thread_cycle_remove(this);
+      task_sched_remove_thread(this);
     }
 
     if (this->parent_process->in_dead_list)
@@ -154,12 +169,15 @@ void task_thread::destroy_thread()
       klib_list_remove(this->synch_list_item);
     }
 
+    klib_synch_mutex_cancel_wait(this);
+    futex_cancel_wait(this);
+
     if (destroying_this_thread)
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "Abandoning this thread.");
 
       task_continue_this_thread();
-      task_thread_cycle_remove(this);
+      task_sched_remove_thread(this);
       this->stop_thread();
       klib_list_add_tail(&dead_thread_list, this->synch_list_item);
       task_resume_scheduling();
@@ -178,8 +196,9 @@ void task_thread::destroy_thread()
 
 /// @brief Give this thread a chance to execute
 ///
-/// Flag this thread as being runnable, so that the scheduler will schedule it. It may not start immediately, as the
-/// scheduler will execute threads in order, but it will execute at some point in the future.
+/// Flag this thread as being runnable, and add it to a run queue so that the scheduler will schedule it. It may not
+/// start immediately, as the scheduler will execute threads in order, but it will execute at some point in the future.
+/// If the thread was sleeping, its wake up time is cancelled.
 ///
 /// @return True if the thread was flagged to run, or was running already. False if not - the thread is being
 ///         destroyed.
@@ -192,6 +211,7 @@ bool task_thread::start_thread()
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Flag thread to run.\n");
     this->permit_running = true;
+    task_sched_add_runnable(this);
     result = true;
   }
 
@@ -202,7 +222,7 @@ bool task_thread::start_thread()
 /// @brief Stop this thread
 ///
 /// Stop this thread from executing. It will continue until the end of this timeslice if it is currently running on any
-/// CPU.
+/// CPU. If it is waiting in a run queue, the scheduler removes it when it next comes across it.
 ///
 /// @return True - to indicate the thread was flagged to be stopped.
 bool task_thread::stop_thread()
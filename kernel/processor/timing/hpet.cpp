@@ -139,6 +139,19 @@ void time_hpet_init()
   KL_TRC_EXIT;
 }
 
+/// @brief Stop the periodic scheduler interrupt generated by timer 0.
+///
+/// Once each processor can generate its own scheduler interrupts, the HPET's periodic interrupt is no longer needed.
+void time_hpet_stop_periodic_timer()
+{
+  KL_TRC_ENTRY;
+
+  ASSERT(hpet_inited);
+  time_hpet_clear_flag(hpet_config->timer_cfg[0].cfg_and_caps, hpet_tmr_enable);
+
+  KL_TRC_EXIT;
+}
+
 /// @brief Set the specified flag in a HPET register without affecting the rest.
 ///
 /// @param hpet_reg The register to set the value in
@@ -47,7 +47,8 @@ void time_gen_init()
 
 /// @brief Sleep the current process for the specified period.
 ///
-/// Allows other processes to take over on this processor.
+/// Allows other processes to take over on this processor. The thread joins this processor's sleep queue when it is
+/// descheduled, and the scheduler starts it again at the first tick after its wake up time.
 ///
 /// @param wait_in_ns The number of nanoseconds to sleep the current process for.
 void time_sleep_process(uint64_t wait_in_ns)
@@ -61,7 +62,7 @@ void time_sleep_process(uint64_t wait_in_ns)
   uint64_t cur_time = time_get_system_timer_count(true);
   t->wake_thread_after = cur_time + wait_in_ns;
   KL_TRC_TRACE(TRC_LVL::FLOW, "Wake after time: ", t->wake_thread_after, "\n");
-  t->permit_running = false;
+  t->stop_thread();
   task_yield();
 
   KL_TRC_EXIT;
@@ -256,7 +256,7 @@ void message_receiver::begin_processing_msgs()
 
   // This doesn't guarantee that we're the thread owning the lock, but over time if there's a bug then we should hit
   // this assert by statistics.
-  ASSERT(receiver_queue_lock != 0);
+  ASSERT(klib_synch_spinlock_is_locked(receiver_queue_lock));
 
   klib_synch_spinlock_lock(queue_lock);
   is_in_receiver_queue = false;
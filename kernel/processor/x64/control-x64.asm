@@ -102,3 +102,28 @@ asm_proc_enable_fp_math:
   finit
 
   ret
+
+; Allow the RDFSBASE, WRFSBASE, RDGSBASE and WRGSBASE instructions to be used, in both kernel and user mode.
+GLOBAL asm_proc_enable_fsgsbase
+asm_proc_enable_fsgsbase:
+  mov rax, cr4
+  bts rax, 16
+  mov cr4, rax
+
+  ret
+
+; Enable the XSAVE family of instructions, and select the state components that they manage. Parameters:
+; 1 - RDI - The value to write to XCR0.
+GLOBAL asm_proc_enable_xsave
+asm_proc_enable_xsave:
+  mov rax, cr4
+  bts rax, 18
+  mov cr4, rax
+
+  mov rax, rdi
+  mov rdx, rdi
+  shr rdx, 32
+  xor rcx, rcx
+  xsetbv
+
+  ret
@@ -24,6 +24,13 @@ asm_proc_load_gdt:
 
 _lgdt_jump:
 
+  ; Loading GS can clear its base address, which points at the per-processor
+  ; data, so keep hold of it.
+  mov ecx, 0xC0000101 ; IA32_GS_BASE
+  rdmsr
+  mov r8, rax
+  mov r9, rdx
+
   ; Fill in the remaining segments. A lot of these are ignored in 64-bit mode,
   ; but it does no harm...
   mov ax, 0x10      ; 0x10 is the offset in the GDT to our data segment
@@ -34,6 +41,10 @@ _lgdt_jump:
   mov fs, ax
   mov gs, ax
 
+  mov rax, r8
+  mov rdx, r9
+  wrmsr
+
   ; Because we pushed RSP after adding RAX to the stack, the stack that IRET
   ; has restored still has RAX on it. Pop it out.
   pop rax
@@ -8,7 +8,9 @@ EXTERN proc_handle_interrupt
 ; Call the page fault handler.
 GLOBAL asm_proc_page_fault_handler
 EXTERN proc_page_fault_handler
+EXTERN asm_task_switch_interrupt_noirq
 asm_proc_page_fault_handler:
+    SWAPGS_IF_USER_MODE 16
     pushf
     push rax
     push rbx
@@ -37,6 +39,9 @@ asm_proc_page_fault_handler:
 
     RESTORE_ORIG_STACK
 
+    ; Stash the result in place of the error code, so it survives restoring the registers.
+    mov [rsp + 128], rax
+
     pop r15
     pop r14
     pop r13
@@ -52,10 +57,24 @@ asm_proc_page_fault_handler:
     pop rcx
     pop rbx
     pop rax
+
+    ; If the faulting thread has been suspended, switch to a different thread. The faulting instruction is retried when
+    ; the thread is next scheduled. The comparison's effect on flags doesn't matter, they're about to be restored.
+    cmp qword [rsp + 8], 0
+    jne page_fault_switch_task
+
     popf
     add rsp, 8
+    SWAPGS_IF_USER_MODE 8
     iretq
 
+page_fault_switch_task:
+    ; The task switching code swaps GS itself, so undo the swap done on entry.
+    popf
+    add rsp, 8
+    SWAPGS_IF_USER_MODE 8
+    jmp asm_task_switch_interrupt_noirq
+
 ; Define the IRQ handlers
 EXTERN proc_handle_irq
 GLOBAL asm_proc_handle_irq_0
@@ -140,7 +159,7 @@ asm_proc_debug_fault_handler:
 GLOBAL asm_proc_nmi_int_handler
 EXTERN proc_mp_x64_receive_signal_int
 asm_proc_nmi_int_handler:
-    DEF_EXCEPTION_HANDLER proc_mp_x64_receive_signal_int, 0
+    DEF_NMI_HANDLER proc_mp_x64_receive_signal_int
 
 ; Exception 3
 GLOBAL asm_proc_brkpt_trap_handler
@@ -2,6 +2,7 @@
 %define X64_INTERRUPT_DEFS
 
 EXTERN end_of_irq_ack_fn
+EXTERN proc_x64_nmi_load_per_cpu
 
 GLOBAL end_of_irq_ack_fn_wrapper
 end_of_irq_ack_fn_wrapper:
@@ -10,6 +11,19 @@ end_of_irq_ack_fn_wrapper:
   ret
 
 
+IA32_GS_BASE equ 0xC0000101
+
+; While the kernel runs, GS must point at this processor's per-processor data. User mode code has its own GS base, so
+; swap the two if the interrupted code was running in user mode - which is the case if the RPL of the saved CS is not
+; zero. The parameter gives the offset of the saved CS from RSP. Use this on entry to and exit from every interrupt
+; handler. Only the flags are changed, and the flags are restored by IRETQ anyway.
+%macro SWAPGS_IF_USER_MODE 1
+    test qword [rsp + %1], 3
+    jz %%done
+    swapgs
+%%done:
+%endmacro
+
 ; Move the stack pointer sufficiently to save the FPU state. Make sure that the stack pointer is aligned on a 16-byte
 ; boundary before and after this, so that the C code can assume a 16-byte stack alignment. Save the original,
 ; pre-FPU-save stack pointer in R12, since this must be preserved by C-code.
@@ -30,6 +44,7 @@ end_of_irq_ack_fn_wrapper:
 
 ; A default handler for interrupts. Simply calls a named function with the numerical argument given.
 %macro DEF_INT_HANDLER 2
+    SWAPGS_IF_USER_MODE 8
     pushf
     push rax
     push rbx
@@ -72,11 +87,13 @@ end_of_irq_ack_fn_wrapper:
     pop rbx
     pop rax
     popf
+    SWAPGS_IF_USER_MODE 8
     iretq
 %endmacro
 
 ; A default handler for interrupts. Simply calls a named function with the numerical argument given.
 %macro DEF_EXCEPTION_HANDLER 2
+    SWAPGS_IF_USER_MODE 8
     pushf
     push rax
     push rbx
@@ -122,10 +139,12 @@ end_of_irq_ack_fn_wrapper:
     pop rbx
     pop rax
     popf
+    SWAPGS_IF_USER_MODE 8
     iretq
 %endmacro
 
 %macro DEF_ERR_CODE_INT_HANDLER 1
+    SWAPGS_IF_USER_MODE 16
     pushf
     push rax
     push rbx
@@ -170,10 +189,12 @@ end_of_irq_ack_fn_wrapper:
     pop rbx
     pop rax
     popf
+    SWAPGS_IF_USER_MODE 16
     iretq
 %endmacro
 
 %macro DEF_IRQ_HANDLER 2
+    SWAPGS_IF_USER_MODE 8
     pushf
     push rax
     push rbx
@@ -216,8 +237,69 @@ end_of_irq_ack_fn_wrapper:
     pop rbx
     pop rax
     popf
+    SWAPGS_IF_USER_MODE 8
     iretq
 %endmacro
 
 
+; A handler for NMIs. These can arrive at any point - including in kernel mode before GS has been swapped - so the
+; normal test of the interrupted CS isn't enough to know what GS holds. Instead, save the GS base and point it at this
+; processor's data explicitly, then put the saved value back before returning. R13 and R14 are preserved by C code,
+; so they hold the saved base.
+%macro DEF_NMI_HANDLER 1
+    pushf
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    mov ecx, IA32_GS_BASE
+    rdmsr
+    mov r13, rax
+    mov r14, rdx
+
+    ALIGN_STACK_AND_SAVE
+
+    call proc_x64_nmi_load_per_cpu
+    call %1
+
+    call end_of_irq_ack_fn_wrapper
+
+    mov ecx, IA32_GS_BASE
+    mov rax, r13
+    mov rdx, r14
+    wrmsr
+
+    RESTORE_ORIG_STACK
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    popf
+    iretq
+%endmacro
+
 %endif
\ No newline at end of file
@@ -145,6 +145,7 @@ void proc_mp_init()
       proc_info_block[procs_saved].platform_data.ist_2_addr = proc_allocate_stack(true);
       proc_info_block[procs_saved].platform_data.ist_3_addr = proc_allocate_stack(true);
       proc_info_block[procs_saved].platform_data.ist_4_addr = proc_allocate_stack(true);
+      proc_info_block[procs_saved].platform_data.per_cpu = nullptr;
 
       KL_TRC_TRACE(TRC_LVL::EXTRA, "Our processor ID", procs_saved, "\n");
       KL_TRC_TRACE(TRC_LVL::EXTRA, "ACPI proc ID", (uint64_t)lapic_table->ProcessorId, "\n");
@@ -196,13 +197,16 @@ void proc_mp_init()
     KL_TRC_TRACE(TRC_LVL::FLOW, "Looking at processor ", i, "\n");
     if (proc_info_block[i].platform_data.lapic_id == proc_x64_apic_get_local_id() )
     {
-      // This is the current processor. We know it is running.
+      // This is the current processor. We know it is running, and it already has per-processor data.
       KL_TRC_TRACE(TRC_LVL::FLOW, "Current processor!\n");
       proc_info_block[i].processor_running = true;
+      proc_info_block[i].platform_data.per_cpu = proc_x64_this_per_cpu();
+      proc_info_block[i].platform_data.per_cpu->proc_id = i;
     }
     else
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "Boot processor\n");
+      proc_info_block[i].platform_data.per_cpu = new proc_x64_per_cpu;
       asm_next_startup_stack = reinterpret_cast<uint64_t>(proc_info_block[i].platform_data.kernel_stack_addr);
 
       // Boot that processor. To do this, send an INIT IPI, wait for 10ms, then send the STARTUP IPI. Make sure it
@@ -249,23 +253,23 @@ void proc_mp_init()
 void proc_mp_ap_startup()
 {
   asm_proc_enable_fp_math();
+  proc_x64_configure_ext_state();
+  proc_x64_configure_fsgsbase();
 
-  KL_TRC_ENTRY;
-
-  uint32_t proc_num = proc_mp_this_proc_id();
-
+  // This processor's per-processor data has to be found the slow way, but once GS points at it that is never needed
+  // again. The data also says that no thread is running yet.
+  uint32_t proc_num = proc_mp_x64_find_this_proc_id();
   ASSERT(proc_num != 0);
+  proc_x64_init_per_cpu(proc_info_block[proc_num].platform_data.per_cpu, proc_num);
 
-  // Set the current task to 0, since tasking isn't started yet and we don't want to accidentally believe we're running
-  // a thread that doesn't exist.
-  proc_write_msr(PROC_X64_MSRS::IA32_KERNEL_GS_BASE, 0);
+  KL_TRC_ENTRY;
 
   // Perform generic setup tasks - the names should be self explanatory.
   asm_proc_install_idt();
   mem_x64_pat_init();
   asm_syscall_x64_prepare();
   asm_proc_load_gdt();
-  proc_load_tss(proc_mp_this_proc_id());
+  proc_load_tss(proc_num);
   proc_conf_local_int_controller();
 
   KL_TRC_TRACE(TRC_LVL::FLOW, "Proc num ", proc_num, " started\n");
@@ -283,10 +287,26 @@ void proc_mp_ap_startup()
 
 /// @brief Return the ID number of this processor
 ///
-/// Until multi-processing is supported, this will always return 0.
+/// The ID is kept in this processor's per-processor data, so this is a single load through GS.
 ///
 /// @return The integer ID number of the processor this function executes on.
 uint32_t proc_mp_this_proc_id()
+{
+  uint64_t proc_id;
+
+  static_assert(offsetof(proc_x64_per_cpu, proc_id) == 8, "Update the offset below");
+  asm volatile("mov %%gs:8, %0" : "=r"(proc_id));
+
+  return static_cast<uint32_t>(proc_id);
+}
+
+/// @brief Find the ID number of this processor by looking up its local APIC ID.
+///
+/// This is much slower than proc_mp_this_proc_id(), but doesn't rely on GS pointing at the per-processor data. So it
+/// is used while starting processors, and by the NMI handler.
+///
+/// @return The integer ID number of the processor this function executes on.
+uint32_t proc_mp_x64_find_this_proc_id()
 {
   bool apic_id_found = false;
   uint32_t lapic_id;
@@ -300,7 +320,6 @@ uint32_t proc_mp_this_proc_id()
 
   if (processor_count > 0)
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Checking processor IDs\n");
     for (int i = 0; i < processor_count; i++)
     {
       if (lapic_id == proc_info_block[i].platform_data.lapic_id)
@@ -313,7 +332,7 @@ uint32_t proc_mp_this_proc_id()
   }
   else
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Not fully init'd, assume processor 0\n");
+    // Not fully initialised yet, so this must be the BSP.
     apic_id_found = true;
     proc_id = 0;
   }
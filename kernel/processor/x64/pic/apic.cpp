@@ -8,16 +8,23 @@
 #include "pic.h"
 #include "processor/x64/processor-x64.h"
 #include "processor/x64/processor-x64-int.h"
+#include "processor/timing/timing.h"
 
 /// @cond
 const uint64_t APIC_ENABLED = 0x0000000000000800;
 const uint8_t APIC_SPURIOUS_INT_VECTOR = 127;
 const uint32_t APIC_SIV_FLAGS = 0x100;
 const uint64_t icr_delivery_status = 0x1000;
+const uint32_t APIC_TIMER_DIVIDE_16 = 0x3;
+const uint32_t APIC_LVT_MASKED = 0x10000;
+const uint64_t APIC_TIMER_CALIBRATE_NS = 10000000;
 /// @endcond
 
 static apic_registers **local_apics = nullptr; ///< Array containing details of local APICs by processor ID.
 
+/// The rate of each processor's local APIC timer, in ticks per millisecond. Zero if the timer hasn't been calibrated.
+static uint64_t *apic_timer_ticks_per_ms = nullptr;
+
 /// @brief Prepare the system to use APICs on all its processors
 ///
 /// @param num_procs How many processors are installed in the system?
@@ -26,9 +33,11 @@ void proc_x64_configure_sys_apic_mode(uint32_t num_procs)
   KL_TRC_ENTRY;
 
   local_apics = new apic_registers *[num_procs];
+  apic_timer_ticks_per_ms = new uint64_t[num_procs];
   for (int i = 0; i < num_procs; i++)
   {
     local_apics[i] = nullptr;
+    apic_timer_ticks_per_ms[i] = 0;
   }
 
   KL_TRC_EXIT;
@@ -60,6 +69,7 @@ void proc_x64_configure_local_apic()
   uint64_t offset;
   uint32_t this_proc_id = proc_mp_this_proc_id();
   void *virtual_page;
+  uint64_t elapsed_ticks;
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Configuring APIC for processor", this_proc_id, "\n");
 
@@ -89,6 +99,72 @@ void proc_x64_configure_local_apic()
   // stored in the APIC registers is how they are addressed for interrupt routing. Make sure they match up.
   ASSERT(proc_x64_apic_get_local_id() == ((local_apics[this_proc_id]->local_apic_id & 0xFF000000) >> 24));
 
+  // Measure the speed of the APIC timer against the system timer, so that the scheduler can use it for one-shot
+  // interrupts. The timer's interrupt is masked while doing this, and the timer is left stopped.
+  local_apics[this_proc_id]->divide_config = APIC_TIMER_DIVIDE_16;
+  local_apics[this_proc_id]->lvt_timer = APIC_LVT_MASKED;
+  local_apics[this_proc_id]->initial_count = 0xFFFFFFFF;
+  time_stall_process(APIC_TIMER_CALIBRATE_NS);
+  elapsed_ticks = 0xFFFFFFFF - local_apics[this_proc_id]->current_count;
+  local_apics[this_proc_id]->initial_count = 0;
+
+  apic_timer_ticks_per_ms[this_proc_id] = (elapsed_ticks * 1000000) / APIC_TIMER_CALIBRATE_NS;
+  KL_TRC_TRACE(TRC_LVL::FLOW, "APIC timer ticks per ms: ", apic_timer_ticks_per_ms[this_proc_id], "\n");
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Can this processor's local APIC timer be used to generate scheduler interrupts?
+///
+/// @return True if the timer has been calibrated, false otherwise.
+bool proc_x64_apic_timer_available()
+{
+  return (apic_timer_ticks_per_ms != nullptr) && (apic_timer_ticks_per_ms[proc_mp_this_proc_id()] != 0);
+}
+
+/// @brief Program this processor's local APIC timer to fire once after a delay.
+///
+/// Any previously programmed delay is cancelled. proc_x64_apic_timer_available() must return true before this is
+/// called.
+///
+/// @param delay_ns How long to wait before firing, in nanoseconds. If zero, the timer is stopped. The longest possible
+///                 delay depends on the speed of the timer, and longer delays are shortened to fit.
+///
+/// @param vector The interrupt to raise when the timer fires.
+void proc_x64_apic_set_timer(uint64_t delay_ns, uint8_t vector)
+{
+  uint32_t this_proc_id = proc_mp_this_proc_id();
+  uint64_t count;
+
+  KL_TRC_ENTRY;
+
+  ASSERT(apic_timer_ticks_per_ms[this_proc_id] != 0);
+
+  if (delay_ns == 0)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Stop timer\n");
+    local_apics[this_proc_id]->initial_count = 0;
+  }
+  else
+  {
+    // Divide first, so that long delays can't overflow.
+    count = ((delay_ns / 1000) * apic_timer_ticks_per_ms[this_proc_id]) / 1000;
+    if (count == 0)
+    {
+      count = 1;
+    }
+    else if (count > 0xFFFFFFFF)
+    {
+      count = 0xFFFFFFFF;
+    }
+
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Fire after ", count, " ticks\n");
+
+    // Leaving the mode bits clear selects one-shot mode.
+    local_apics[this_proc_id]->lvt_timer = vector;
+    local_apics[this_proc_id]->initial_count = static_cast<uint32_t>(count);
+  }
+
   KL_TRC_EXIT;
 }
 
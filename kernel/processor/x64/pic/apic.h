@@ -12,6 +12,8 @@ void proc_x64_configure_sys_apic_mode(uint32_t num_procs);
 void proc_x64_configure_local_apic_mode();
 void proc_x64_configure_local_apic();
 unsigned char proc_x64_apic_get_local_id();
+bool proc_x64_apic_timer_available();
+void proc_x64_apic_set_timer(uint64_t delay_ns, uint8_t vector);
 
 /// @brief Handle a spurious interrupt generated by the PICs
 ///
@@ -112,7 +114,7 @@ struct apic_registers
   uint32_t lvt_error __attribute__ ((aligned (16))); // Offset 0x370: LVT Error Status (RW)
 
   uint32_t initial_count __attribute__ ((aligned (16))); // Offset 0x380: Timer's initial count register (RW)
-  uint32_t current_count __attribute__ ((aligned (16))); // Offset 0x390: Timer's current count register (RO)
+  volatile uint32_t current_count __attribute__ ((aligned (16))); // Offset 0x390: Timer's current count register (RO)
 
   uint32_t reserved_4[16] __attribute__ ((aligned (16)));
 
@@ -9,6 +9,8 @@
 #include "processor/x64/processor-x64-int.h"
 #include "processor/x64/proc_interrupt_handlers-x64.h"
 #include "klib/klib.h"
+#include "mem/page_cache.h"
+#include "syscall/syscall_kernel-int.h"
 
 namespace
 {
@@ -350,21 +352,54 @@ void proc_security_fault_handler(uint64_t rip, uint64_t rsp, uint64_t err_code,
 
 /// @brief Handles page faults
 ///
-/// Proper docs to follow when the system makes actual use of page faults.
+/// Faults caused by accessing a not-present page in the user mode part of the address space are offered to the page
+/// cache, since they may be caused by accessing a mapped file, and then to the swap store, since they may be caused by
+/// accessing a page that has been swapped out. This includes faults caused by the kernel, for example while it copies
+/// a buffer given to a system call, but the kernel may be holding locks so it is never suspended while the page is
+/// made ready. System calls use syscall_fault_in_buffer() to avoid this. All other page faults cause a panic.
 ///
 /// @param fault_code See the Intel manual for more
 /// @param fault_addr See the Intel manual for more
 /// @param fault_instruction See the Intel manual for more
 /// @param rsp Address of the stack in the thread where this interrupt was generated
 /// @param k_rsp Address of the stack of the interrupt handler
-void proc_page_fault_handler(uint64_t fault_code,
-                             uint64_t fault_addr,
-                             uint64_t fault_instruction,
-                             uint64_t rsp,
-                             uint64_t k_rsp)
+///
+/// @return 0 if the faulting instruction should be retried immediately, non-zero if the faulting thread has been
+///         suspended and the caller should switch to a different thread.
+uint64_t proc_page_fault_handler(uint64_t fault_code,
+                                 uint64_t fault_addr,
+                                 uint64_t fault_instruction,
+                                 uint64_t rsp,
+                                 uint64_t k_rsp)
 {
   KL_TRC_ENTRY;
   static bool in_page_fault = false;
+  task_thread *cur_thread = task_get_cur_thread();
+  MEM_FAULT_RESULT fault_result = MEM_FAULT_RESULT::NOT_HANDLED;
+  bool user_mode_fault = ((fault_code & 0x04) != 0);
+
+  // Bit 0 is set for protection violations, bit 2 is set for faults in user mode.
+  if ((cur_thread != nullptr) &&
+      ((fault_code & 0x01) == 0) &&
+      (user_mode_fault || SYSCALL_IS_UM_ADDRESS(fault_addr)))
+  {
+    fault_result = mem_page_cache_handle_fault(fault_addr, cur_thread, user_mode_fault);
+    if (fault_result == MEM_FAULT_RESULT::NOT_HANDLED)
+    {
+      fault_result = mem_swap_handle_fault(fault_addr, cur_thread, user_mode_fault);
+    }
+  }
+
+  if (fault_result == MEM_FAULT_RESULT::RESOLVED)
+  {
+    KL_TRC_EXIT;
+    return 0;
+  }
+  else if (fault_result == MEM_FAULT_RESULT::THREAD_SUSPENDED)
+  {
+    KL_TRC_EXIT;
+    return 1;
+  }
 
   if (!in_page_fault)
   {
@@ -382,4 +417,6 @@ void proc_page_fault_handler(uint64_t fault_code,
   }
   KL_TRC_EXIT;
   panic("Page fault!", true, k_rsp, fault_instruction, rsp);
+
+  return 0;
 }
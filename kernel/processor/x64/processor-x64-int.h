@@ -4,6 +4,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include "processor-x64.h"
 
 enum class PROC_IPI_MSGS;
@@ -50,6 +51,30 @@ extern "C" void asm_proc_write_port(const uint64_t port_id, const uint64_t value
 ///
 extern "C" void asm_proc_enable_fp_math();
 
+/// @brief Enable the XSAVE family of instructions on this processor.
+///
+/// @param xcr0 The state components to be managed by XSAVE, to be written to XCR0.
+extern "C" void asm_proc_enable_xsave(uint64_t xcr0);
+
+/// @brief The instructions used to save and restore a thread's extended (x87, SSE and AVX) state.
+///
+/// The values are also used in task_manager-low-x64.asm.
+enum class PROC_X64_EXT_STATE_MODE : uint64_t
+{
+  FXSAVE = 0, ///< FXSAVE64/FXRSTOR64, covering x87 and SSE state only.
+  XSAVE = 1, ///< XSAVE64/XRSTOR64.
+  XSAVEOPT = 2, ///< XSAVEOPT64/XRSTOR64, which skips state that hasn't been modified since it was restored.
+};
+
+extern "C" PROC_X64_EXT_STATE_MODE proc_x64_ext_state_mode;
+extern uint64_t proc_x64_ext_state_size;
+void proc_x64_configure_ext_state();
+
+/// @brief Allow the RDFSBASE, WRFSBASE, RDGSBASE and WRGSBASE instructions to be used on this processor.
+///
+extern "C" void asm_proc_enable_fsgsbase();
+void proc_x64_configure_fsgsbase();
+
 // GDT Control
 #define TSS_DESC_LEN 16 ///< Length of a single TSS descriptor
 extern "C" void asm_proc_load_gdt(); ///< Load the system GDT onto this processor
@@ -80,3 +105,55 @@ extern uint8_t interrupt_descriptor_table[NUM_INTERRUPTS * IDT_ENTRY_LEN];
 void proc_mp_x64_signal_proc(uint32_t proc_id, PROC_IPI_MSGS msg, bool must_complete);
 extern "C" void proc_mp_x64_receive_signal_int();
 extern "C" void proc_mp_ap_startup();
+uint32_t proc_mp_x64_find_this_proc_id();
+
+// Per-processor data
+
+struct task_x64_exec_context;
+
+/// @brief Data belonging to a single processor, reached through the GS base.
+///
+/// Whenever a processor runs kernel code, its GS base points at its own copy of this structure, so that the current
+/// processor and thread can be found with a single load. User mode threads have their own GS base, so every entry to
+/// and exit from the kernel swaps the two using SWAPGS. While the kernel runs, the user mode value is held in
+/// IA32_KERNEL_GS_BASE.
+///
+/// The offsets of the fields are used in assembly language code, so the layout must not change. Each processor writes
+/// its own data on every task switch, so the data is kept in its own cache line.
+struct alignas(PROC_CACHE_LINE_SIZE) proc_x64_per_cpu
+{
+  /// The address of this structure, so that it can be found by reading GS:0.
+  proc_x64_per_cpu *self;
+
+  /// The ID of this processor.
+  uint64_t proc_id;
+
+  /// The thread running on this processor, or nullptr if tasking hasn't started yet.
+  task_thread *current_thread;
+
+  /// The execution context of current_thread, or nullptr if tasking hasn't started yet.
+  task_x64_exec_context *exec_context;
+
+  /// Space for the system call entry code to keep the user mode stack pointer while it switches to the kernel stack.
+  uint64_t user_rsp_scratch;
+};
+
+static_assert(offsetof(proc_x64_per_cpu, proc_id) == 8, "proc_id is referenced by offset in assembly code");
+static_assert(offsetof(proc_x64_per_cpu, exec_context) == 24, "exec_context is referenced by offset in assembly code");
+static_assert(offsetof(proc_x64_per_cpu, user_rsp_scratch) == 32,
+              "user_rsp_scratch is referenced by offset in assembly code");
+
+void proc_x64_init_per_cpu(proc_x64_per_cpu *per_cpu, uint32_t proc_id);
+extern "C" void proc_x64_nmi_load_per_cpu();
+
+/// @brief Return this processor's per-processor data.
+///
+/// @return The per-processor data of the processor this function executes on.
+inline proc_x64_per_cpu *proc_x64_this_per_cpu()
+{
+  proc_x64_per_cpu *per_cpu;
+
+  asm volatile("mov %%gs:0, %0" : "=r"(per_cpu));
+
+  return per_cpu;
+}
@@ -12,6 +12,36 @@
 #include "processor/x64/pic/pic.h"
 #include "mem/x64/mem-x64-int.h"
 
+namespace
+{
+  // Bits of XCR0 for the state components the kernel saves and restores when switching threads.
+  const uint64_t XCR0_X87 = 1;
+  const uint64_t XCR0_SSE = 2;
+  const uint64_t XCR0_AVX = 4;
+
+  // The value written to XCR0 on each processor, if XSAVE is in use.
+  uint64_t proc_x64_xcr0 = 0;
+
+  // Has the first processor decided how extended state will be saved yet?
+  bool ext_state_configured = false;
+
+  // Can the FS and GS base addresses be accessed using RDFSBASE and friends, rather than MSRs? Decided by the first
+  // processor to call proc_x64_configure_fsgsbase().
+  bool fsgsbase_available = false;
+
+  // Has the first processor checked for FSGSBASE support yet?
+  bool fsgsbase_configured = false;
+
+  // The per-processor data of the BSP. This is needed before the memory manager is running, so it can't be allocated.
+  proc_x64_per_cpu bsp_per_cpu;
+}
+
+/// How extended processor state is saved and restored when switching threads.
+PROC_X64_EXT_STATE_MODE proc_x64_ext_state_mode = PROC_X64_EXT_STATE_MODE::FXSAVE;
+
+/// The number of bytes needed to save a thread's extended state.
+uint64_t proc_x64_ext_state_size = 512;
+
 /// @brief Initialise the first processor.
 ///
 /// Does as much initialisation of the BSP as possible. We leave some of the harder stuff, like configuring the APIC
@@ -28,10 +58,11 @@ void proc_gen_init()
 
   // Enable the floating point units as well as SSE.
   asm_proc_enable_fp_math();
+  proc_x64_configure_ext_state();
+  proc_x64_configure_fsgsbase();
 
-  // Set the current task to 0, since tasking isn't started yet and we don't want to accidentally believe we're running
-  // a thread that doesn't exist.
-  proc_write_msr(PROC_X64_MSRS::IA32_KERNEL_GS_BASE, 0);
+  // Point GS at this processor's data, which says that no thread is running yet. The BSP is always processor 0.
+  proc_x64_init_per_cpu(&bsp_per_cpu, 0);
 
   // Fill in the GDT, and select an appropriate set of segments. The TSS descriptor and segment will
   // come later.
@@ -46,6 +77,197 @@ void proc_gen_init()
   // Further processor setup, including configuring PICs/APICs, continues after the memory mamanger is up.
 }
 
+/// @brief Decide how threads' extended state will be saved, and configure this processor accordingly.
+///
+/// The first call, on the BSP, chooses the best available method: XSAVEOPT if possible, otherwise XSAVE, otherwise
+/// FXSAVE. If XSAVE is available, AVX state is included if the processor supports it. Later calls, on the APs, apply
+/// the same choice. This must be called before any threads are created.
+///
+/// Don't do any tracing in this function, since it is called before tracing is safe on the BSP.
+void proc_x64_configure_ext_state()
+{
+  uint64_t ebx_eax;
+  uint64_t edx_ecx;
+  uint64_t supported;
+
+  if (!ext_state_configured)
+  {
+    ext_state_configured = true;
+
+    asm_proc_read_cpuid(1, 0, &ebx_eax, &edx_ecx);
+    if ((edx_ecx & (1ULL << 26)) != 0)
+    {
+      // CPUID leaf 0xD, subleaf 0 gives the supported components of XCR0 in EAX.
+      asm_proc_read_cpuid(0xD, 0, &ebx_eax, &edx_ecx);
+      supported = ebx_eax & 0xFFFFFFFF;
+      proc_x64_xcr0 = supported & (XCR0_X87 | XCR0_SSE | XCR0_AVX);
+
+      // Once XCR0 is set, EBX gives the size of the save area needed for the enabled components. Subleaf 1 says whether
+      // XSAVEOPT is supported.
+      asm_proc_enable_xsave(proc_x64_xcr0);
+      asm_proc_read_cpuid(0xD, 0, &ebx_eax, &edx_ecx);
+      proc_x64_ext_state_size = ebx_eax >> 32;
+
+      asm_proc_read_cpuid(0xD, 1, &ebx_eax, &edx_ecx);
+      proc_x64_ext_state_mode = ((ebx_eax & 1) != 0) ? PROC_X64_EXT_STATE_MODE::XSAVEOPT :
+                                                       PROC_X64_EXT_STATE_MODE::XSAVE;
+    }
+  }
+  else if (proc_x64_ext_state_mode != PROC_X64_EXT_STATE_MODE::FXSAVE)
+  {
+    asm_proc_enable_xsave(proc_x64_xcr0);
+  }
+}
+
+/// @brief Enable the FSGSBASE instructions on this processor, if they are supported.
+///
+/// The first call, on the BSP, checks whether the instructions are supported. Later calls, on the APs, enable them if
+/// so. Once enabled, user mode threads may also use them to change their own FS and GS base addresses.
+///
+/// Don't do any tracing in this function, since it is called before tracing is safe on the BSP.
+void proc_x64_configure_fsgsbase()
+{
+  uint64_t ebx_eax;
+  uint64_t edx_ecx;
+
+  if (!fsgsbase_configured)
+  {
+    fsgsbase_configured = true;
+
+    // CPUID leaf 7 reports FSGSBASE support in bit 0 of EBX.
+    asm_proc_read_cpuid(7, 0, &ebx_eax, &edx_ecx);
+    fsgsbase_available = (((ebx_eax >> 32) & 1) != 0);
+  }
+
+  if (fsgsbase_available)
+  {
+    asm_proc_enable_fsgsbase();
+  }
+}
+
+/// @brief Read the base address of FS on this processor.
+///
+/// This is called on every task switch, so it uses RDFSBASE if possible, which is much faster than reading the MSR.
+///
+/// @return The base address of FS.
+uint64_t proc_x64_read_fs_base()
+{
+  uint64_t value;
+
+  if (fsgsbase_available)
+  {
+    asm volatile("rdfsbase %0" : "=r"(value));
+  }
+  else
+  {
+    value = asm_proc_read_msr(static_cast<uint64_t>(PROC_X64_MSRS::IA32_FS_BASE));
+  }
+
+  return value;
+}
+
+/// @brief Set the base address of FS on this processor.
+///
+/// This is called on every task switch, so it uses WRFSBASE if possible, which is much faster than writing the MSR.
+///
+/// @param value The new base address. Must be canonical.
+void proc_x64_write_fs_base(uint64_t value)
+{
+  if (fsgsbase_available)
+  {
+    asm volatile("wrfsbase %0" : : "r"(value));
+  }
+  else
+  {
+    asm_proc_write_msr(static_cast<uint64_t>(PROC_X64_MSRS::IA32_FS_BASE), value);
+  }
+}
+
+/// @brief Read the user mode base address of GS on this processor.
+///
+/// While the kernel runs, GS points at the per-processor data and the user mode value is kept in IA32_KERNEL_GS_BASE.
+/// If possible, the two are exchanged and RDGSBASE is used instead of reading the MSR, since that is much faster.
+/// Interrupts must be disabled, so that nothing can run while the bases are exchanged.
+///
+/// @return The base address GS will have when this processor next returns to user mode.
+uint64_t proc_x64_read_user_gs_base()
+{
+  uint64_t value;
+
+  if (fsgsbase_available)
+  {
+    asm volatile("swapgs; rdgsbase %0; swapgs" : "=r"(value));
+  }
+  else
+  {
+    value = asm_proc_read_msr(static_cast<uint64_t>(PROC_X64_MSRS::IA32_KERNEL_GS_BASE));
+  }
+
+  return value;
+}
+
+/// @brief Set the user mode base address of GS on this processor.
+///
+/// As with proc_x64_read_user_gs_base(), interrupts must be disabled.
+///
+/// @param value The base address GS will have when this processor next returns to user mode. Must be canonical.
+void proc_x64_write_user_gs_base(uint64_t value)
+{
+  if (fsgsbase_available)
+  {
+    asm volatile("swapgs; wrgsbase %0; swapgs" : : "r"(value));
+  }
+  else
+  {
+    asm_proc_write_msr(static_cast<uint64_t>(PROC_X64_MSRS::IA32_KERNEL_GS_BASE), value);
+  }
+}
+
+/// @brief Fill in a processor's per-processor data and point this processor's GS base at it.
+///
+/// Must be called on the processor that owns the data, before it calls proc_mp_this_proc_id() or task_get_cur_thread().
+///
+/// Don't do any tracing in this function, since it is called before tracing is safe on the BSP.
+///
+/// @param per_cpu The per-processor data to use. Must not be nullptr.
+///
+/// @param proc_id The ID of this processor.
+void proc_x64_init_per_cpu(proc_x64_per_cpu *per_cpu, uint32_t proc_id)
+{
+  per_cpu->self = per_cpu;
+  per_cpu->proc_id = proc_id;
+  per_cpu->current_thread = nullptr;
+  per_cpu->exec_context = nullptr;
+  per_cpu->user_rsp_scratch = 0;
+
+  asm_proc_write_msr(static_cast<uint64_t>(PROC_X64_MSRS::IA32_GS_BASE), reinterpret_cast<uint64_t>(per_cpu));
+  asm_proc_write_msr(static_cast<uint64_t>(PROC_X64_MSRS::IA32_KERNEL_GS_BASE), 0);
+}
+
+/// @brief Point GS at this processor's per-processor data, without relying on the current value of GS.
+///
+/// NMIs can arrive at any point, including just after entering or just before leaving the kernel, when GS still has
+/// its user mode value. So the NMI handler saves GS and calls this function to find the per-processor data the slow
+/// way, by looking up the local APIC ID.
+void proc_x64_nmi_load_per_cpu()
+{
+  uint32_t proc_id;
+  proc_x64_per_cpu *per_cpu;
+
+  if (processor_count == 0)
+  {
+    // Until the other processors are known about, only the BSP is running.
+    per_cpu = &bsp_per_cpu;
+  }
+  else
+  {
+    proc_id = proc_mp_x64_find_this_proc_id();
+    per_cpu = proc_info_block[proc_id].platform_data.per_cpu;
+  }
+
+  asm_proc_write_msr(static_cast<uint64_t>(PROC_X64_MSRS::IA32_GS_BASE), reinterpret_cast<uint64_t>(per_cpu));
+}
+
 /// @brief Cause this processor to enter the halted state.
 void proc_stop_this_proc()
 {
@@ -69,6 +291,30 @@ void proc_start_interrupts()
   asm_proc_start_interrupts();
 }
 
+/// @brief Stop interrupts on this processor, remembering whether they were enabled.
+///
+/// @return The contents of RFLAGS before interrupts were stopped, to be passed to proc_restore_interrupts().
+uint64_t proc_save_and_stop_interrupts()
+{
+  uint64_t flags;
+
+  asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+
+  return flags;
+}
+
+/// @brief Restart interrupts on this processor if they were running before proc_save_and_stop_interrupts().
+///
+/// @param saved_flags The value returned by proc_save_and_stop_interrupts().
+void proc_restore_interrupts(uint64_t saved_flags)
+{
+  // Bit 9 of RFLAGS is the interrupt enable flag.
+  if ((saved_flags & 0x200) != 0)
+  {
+    asm volatile("sti" : : : "memory");
+  }
+}
+
 /// @brief Read from a processor I/O port.
 ///
 /// @param port_id The port to read from
@@ -5,6 +5,8 @@
 
 #include "processor/processor.h"
 
+struct proc_x64_per_cpu;
+
 /// @brief Processor information block - x64
 ///
 /// Contains information the system will use to manage x64 processors.
@@ -28,6 +30,9 @@ struct processor_info_x64
 
   /// Starting address of the stack used for interrupts handled by interrupt stack table entry 4.
   void *ist_4_addr;
+
+  /// This processor's per-processor data, which its GS base points at while it runs kernel code.
+  proc_x64_per_cpu *per_cpu;
 };
 
 typedef processor_info_generic<processor_info_x64> processor_info; ///< Processor info block on x64
@@ -71,6 +76,11 @@ enum class PROC_X64_MSRS : uint64_t
 uint64_t proc_read_msr(PROC_X64_MSRS msr);
 void proc_write_msr(PROC_X64_MSRS msr, uint64_t value);
 
+uint64_t proc_x64_read_fs_base();
+void proc_x64_write_fs_base(uint64_t value);
+uint64_t proc_x64_read_user_gs_base();
+void proc_x64_write_user_gs_base(uint64_t value);
+
 /// @brief Execute the CPUID instruction on this CPU.
 ///
 /// Parameter values can be found in the Intel documentation
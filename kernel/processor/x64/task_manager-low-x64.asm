@@ -7,15 +7,99 @@ task_switch_lock:
 EXTERN task_int_swap_task
 EXTERN klib_synch_spinlock_lock
 EXTERN klib_synch_spinlock_unlock
+EXTERN proc_x64_ext_state_mode
 GLOBAL asm_task_switch_interrupt_irq
 GLOBAL asm_task_switch_interrupt_noirq
 extern end_of_irq_ack_fn
 
+; Values of proc_x64_ext_state_mode. These must match PROC_X64_EXT_STATE_MODE in processor-x64-int.h
+EXT_STATE_FXSAVE equ 0
+EXT_STATE_XSAVE equ 1
+EXT_STATE_XSAVEOPT equ 2
+
+; The offset of task_x64_exec_context::ext_state.
+EXEC_CONTEXT_EXT_STATE equ 16
+
+; The offset of proc_x64_per_cpu::exec_context. This must match processor-x64-int.h
+PER_CPU_EXEC_CONTEXT equ 24
+
+; Switch GS to the per-processor data if the interrupted thread was in user mode, or back again if the thread being
+; returned to is. The saved CS is the second item of the interrupt frame, which is at the top of the stack.
+%macro SWAPGS_IF_USER_MODE 0
+    test qword [rsp + 8], 3
+    jz %%done
+    swapgs
+%%done:
+%endmacro
+
+; Save the outgoing thread's extended state (x87, SSE and, if enabled, AVX registers) directly in to its execution
+; context. The context's address is kept in this processor's per-processor data - if that is zero then no thread is
+; running yet, so there's nothing to save. XSAVEOPT doesn't write state components that haven't been modified since
+; they were last restored, so threads that don't use them cost very little to save. Clobbers RAX, RBX, RCX, RDX and
+; R8.
+%macro SAVE_EXT_STATE 0
+    mov rax, [gs:PER_CPU_EXEC_CONTEXT]
+    test rax, rax
+    jz %%done
+
+    mov rbx, [rax + EXEC_CONTEXT_EXT_STATE]
+    mov eax, 0xFFFFFFFF
+    mov edx, 0xFFFFFFFF
+    mov r8, proc_x64_ext_state_mode
+    mov r8, [r8]
+    cmp r8, EXT_STATE_XSAVEOPT
+    je %%xsaveopt
+    cmp r8, EXT_STATE_XSAVE
+    je %%xsave
+
+    fxsave64 [rbx]
+    jmp %%done
+
+%%xsave:
+    xsave64 [rbx]
+    jmp %%done
+
+%%xsaveopt:
+    xsaveopt64 [rbx]
+
+%%done:
+%endmacro
+
+; Restore the incoming thread's extended state from the save area pointed to by RBX. Clobbers RAX, RDX and R8.
+%macro RESTORE_EXT_STATE 0
+    mov eax, 0xFFFFFFFF
+    mov edx, 0xFFFFFFFF
+    mov r8, proc_x64_ext_state_mode
+    mov r8, [r8]
+    cmp r8, EXT_STATE_FXSAVE
+    je %%fxrstor
+
+    xrstor64 [rbx]
+    jmp %%done
+
+%%fxrstor:
+    fxrstor64 [rbx]
+
+%%done:
+%endmacro
+
+; Load the incoming thread's page tables, whose address is in RAX, unless they are loaded already. Writing CR3 flushes
+; the TLB, which is worth avoiding when switching between threads of the same process. Clobbers RCX.
+%macro LOAD_CR3 0
+    mov rcx, cr3
+    cmp rax, rcx
+    je %%done
+    mov cr3, rax
+
+%%done:
+%endmacro
+
 ; Note that throughout this code, the manipulations of the stack must match those in task_int_create_exec_context, or
 ; the process will crash as soon as it is started!
 ;
 ; This function should be kept the same as asm_task_switch_interrupt_noirq, below.
 asm_task_switch_interrupt_irq:
+    SWAPGS_IF_USER_MODE
     push rax
     push rbx
     push rcx
@@ -32,31 +116,30 @@ asm_task_switch_interrupt_irq:
     push r14
     push r15
 
+    ; This must be done before calling any C code, since that might use the SSE registers.
+    SAVE_EXT_STATE
+
     mov rdi, task_switch_lock
     call klib_synch_spinlock_lock
 
     ; Save the execution pointer as a parameter for task_int_swap_task.
     mov rsi, cr3
 
-    ; Move the stack pointer down a bunch. The processor aligns the stack to 16-bytes before beginning the interrupt
-    ; instruction, then adds five pushes. We've added a further 15, so the stack is still 16-byte aligned.
-    sub rsp, 512
-    fxsave64 [rsp]
-
-    ; Save the stack pointer as a parameter for task_int_swap_task.
+    ; Save the stack pointer as a parameter for task_int_swap_task. The processor aligns the stack to 16-bytes before
+    ; beginning the interrupt instruction, then adds five pushes. We've added a further 15, so the stack is still
+    ; 16-byte aligned.
     mov rdi, rsp
 
     ; Execute the task swap.
     call task_int_swap_task
 
     ; From the returned execution context structure, compute the correct value of CR3 and restore it. CR3 is the first
-    ; element of the structure.
+    ; element of the structure. Keep hold of the extended state save area as well.
+    mov rbx, [rax + EXEC_CONTEXT_EXT_STATE]
     mov rax, [rax]
-    mov cr3, rax
+    LOAD_CR3
 
-    ; Restore the FX state and put the stack back to the correct place.
-    fxrstor64 [rsp]
-    add rsp, 512
+    RESTORE_EXT_STATE
 
     ; Task switching complete, release the lock.
     mov rdi, task_switch_lock
@@ -84,11 +167,13 @@ asm_task_switch_interrupt_irq:
     pop rcx
     pop rbx
     pop rax
+    SWAPGS_IF_USER_MODE
     iretq
 
 ; An identical copy of asm_task_switch_interrupt_irq without the IRQ acknowledgement. This function should be kept the
 ; same as the above function
 asm_task_switch_interrupt_noirq:
+    SWAPGS_IF_USER_MODE
     push rax
     push rbx
     push rcx
@@ -105,31 +190,30 @@ asm_task_switch_interrupt_noirq:
     push r14
     push r15
 
+    ; This must be done before calling any C code, since that might use the SSE registers.
+    SAVE_EXT_STATE
+
     mov rdi, task_switch_lock
     call klib_synch_spinlock_lock
 
     ; Save the execution pointer as a parameter for task_int_swap_task.
     mov rsi, cr3
 
-    ; Move the stack pointer down a bunch. The processor aligns the stack to 16-bytes before beginning the interrupt
-    ; instruction, then adds five pushes. We've added a further 15, so the stack is still 16-byte aligned.
-    sub rsp, 512
-    fxsave64 [rsp]
-
-    ; Save the stack pointer as a parameter for task_int_swap_task.
+    ; Save the stack pointer as a parameter for task_int_swap_task. The processor aligns the stack to 16-bytes before
+    ; beginning the interrupt instruction, then adds five pushes. We've added a further 15, so the stack is still
+    ; 16-byte aligned.
     mov rdi, rsp
 
     ; Execute the task swap.
     call task_int_swap_task
 
     ; From the returned execution context structure, compute the correct value of CR3 and restore it. CR3 is the first
-    ; element of the structure.
+    ; element of the structure. Keep hold of the extended state save area as well.
+    mov rbx, [rax + EXEC_CONTEXT_EXT_STATE]
     mov rax, [rax]
-    mov cr3, rax
+    LOAD_CR3
 
-    ; Restore the FX state and put the stack back to the correct place.
-    fxrstor64 [rsp]
-    add rsp, 512
+    RESTORE_EXT_STATE
 
     ; Task switching complete, release the lock.
     mov rdi, task_switch_lock
@@ -151,4 +235,5 @@ asm_task_switch_interrupt_noirq:
     pop rbx
     pop rax
 
+    SWAPGS_IF_USER_MODE
     iretq
@@ -13,6 +13,8 @@
 #include "processor/x64/proc_interrupt_handlers-x64.h"
 #include "mem/x64/mem-x64-int.h"
 #include "processor/x64/pic/pic.h"
+#include "processor/x64/pic/apic.h"
+#include "processor/timing/hpet.h"
 
 namespace
 {
@@ -27,6 +29,48 @@ namespace
   // Setting one const equal to another of a different size seems to confuse the linker...!
   const uint32_t TM_INTERRUPT_NUM = 32; //(const uint32_t) PROC_IRQ_BASE;
   const uint32_t TM_INT_INTERRUPT_NUM = 48; ///< A copy of the task mananger interrupt without the IRQ acknowledgement.
+
+  // The XSAVE instructions need their save area to be aligned to this many bytes.
+  const uint64_t EXT_STATE_ALIGN = 64;
+
+  // Offsets and initial values of the x87 control word and MXCSR within the legacy region of the extended state save
+  // area. These mask all floating point exceptions, as FINIT and the power-on state do.
+  const uint64_t EXT_STATE_FCW_OFFSET = 0;
+  const uint16_t EXT_STATE_FCW_DEFAULT = 0x037F;
+  const uint64_t EXT_STATE_MXCSR_OFFSET = 24;
+  const uint32_t EXT_STATE_MXCSR_DEFAULT = 0x1F80;
+
+  // Is the HPET still generating the periodic scheduler interrupt? This is the case until processor 0 first programs
+  // its own APIC timer, or forever if the APIC timers can't be used.
+  bool hpet_tick_running = true;
+
+  // The states of a processor's idle wake line. See task_platform_idle().
+  const uint64_t IDLE_LINE_RUNNING = 0; ///< The processor isn't waiting in MWAIT.
+  const uint64_t IDLE_LINE_WAITING = 1; ///< The processor is, or is about to be, waiting in MWAIT.
+  const uint64_t IDLE_LINE_WAKE = 2; ///< Another processor wants this processor to run its scheduler.
+
+  /// @brief A cache line watched by an idle processor.
+  ///
+  /// Writing to the line wakes the processor from MWAIT, so other processors can use it instead of sending an IPI. It
+  /// fills a whole cache line so that unrelated writes don't wake the processor. A cache line is assumed to be the
+  /// size of the region watched by MONITOR.
+  struct idle_wake_line
+  {
+    /// One of the IDLE_LINE_ constants.
+    std::atomic<uint64_t> state;
+
+    /// Unused.
+    uint8_t padding[PROC_CACHE_LINE_SIZE - sizeof(std::atomic<uint64_t>)];
+  };
+  static_assert(sizeof(idle_wake_line) == PROC_CACHE_LINE_SIZE, "Idle wake lines must fill a cache line");
+
+  bool mwait_idle_supported();
+
+  // Do idle processors wait using MONITOR and MWAIT, rather than HLT?
+  bool mwait_idle_available = false;
+
+  // One idle wake line per processor, aligned to a cache line boundary. Only allocated if mwait_idle_available is set.
+  idle_wake_line *idle_wake_lines = nullptr;
 }
 
 /// @brief Create a new x64 execution context
@@ -71,7 +115,16 @@ void *task_int_create_exec_context(ENTRY_PROC entry_point, task_thread *new_thre
   KL_TRC_TRACE(TRC_LVL::EXTRA, "CR3: ", new_context->cr3_value, "\n");
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Parameter - RDI: ", param, "\n");
 
-  memset(new_context->saved_stack.fx_state, 0, sizeof(new_context->saved_stack.fx_state));
+  // The extended state is saved and restored directly from this area by the task switcher. An area of zeroes, other
+  // than the control registers, has a valid header that sets every XSAVE component to its initial state.
+  new_context->ext_state_alloc = kmalloc(proc_x64_ext_state_size + EXT_STATE_ALIGN - 1);
+  new_context->ext_state = reinterpret_cast<void *>(
+    (reinterpret_cast<uint64_t>(new_context->ext_state_alloc) + EXT_STATE_ALIGN - 1) & ~(EXT_STATE_ALIGN - 1));
+  memset(new_context->ext_state, 0, proc_x64_ext_state_size);
+  *reinterpret_cast<uint16_t *>(reinterpret_cast<uint8_t *>(new_context->ext_state) + EXT_STATE_FCW_OFFSET) =
+    EXT_STATE_FCW_DEFAULT;
+  *reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(new_context->ext_state) + EXT_STATE_MXCSR_OFFSET) =
+    EXT_STATE_MXCSR_DEFAULT;
 
   new_context->saved_stack.r15 = 0;
   new_context->saved_stack.r14 = 0;
@@ -147,6 +200,7 @@ void *task_int_create_exec_context(ENTRY_PROC entry_point, task_thread *new_thre
     if (new_context->saved_stack.proc_rsp == 0)
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "No space for a new stack\n");
+      kfree(new_context->ext_state_alloc);
       delete new_context;
       new_context = nullptr;
     }
@@ -183,6 +237,7 @@ void task_int_delete_exec_context(task_thread *old_thread)
     proc_deallocate_stack(reinterpret_cast<void *>(old_context->saved_stack.proc_rsp));
   }
 
+  kfree(old_context->ext_state_alloc);
   delete old_context;
   old_thread->execution_context = nullptr;
 
@@ -258,7 +313,9 @@ task_x64_exec_context *task_int_swap_task(uint64_t stack_addr, uint64_t cr3_valu
   task_x64_exec_context *current_context;
   task_x64_exec_context *next_context;
   task_thread *next_thread;
+  proc_x64_per_cpu *per_cpu;
   void *stack_ptr = reinterpret_cast<void *>(stack_addr);
+  static bool first_tick = true;
 
   KL_TRC_ENTRY;
 
@@ -271,8 +328,8 @@ task_x64_exec_context *task_int_swap_task(uint64_t stack_addr, uint64_t cr3_valu
 
     memcpy(&(current_context->saved_stack), stack_ptr, sizeof(task_x64_saved_stack));
 
-    current_context->fs_base = proc_read_msr(PROC_X64_MSRS::IA32_FS_BASE);
-    current_context->gs_base = proc_read_msr(PROC_X64_MSRS::IA32_GS_BASE);
+    current_context->fs_base = proc_x64_read_fs_base();
+    current_context->gs_base = proc_x64_read_user_gs_base();
 
 #ifdef TASK_SWAP_SANITY_CHECKS
     ASSERT((reinterpret_cast<uint64_t>(current_context->cr3_value) & 0xFFFFFFFF00000000) == 0);
@@ -310,20 +367,24 @@ task_x64_exec_context *task_int_swap_task(uint64_t stack_addr, uint64_t cr3_valu
   // corresponding to the task we want to switch to.
   memcpy(stack_ptr, &(next_context->saved_stack), sizeof(task_x64_saved_stack));
 
-  // Save the thread context's address in IA32_KERNEL_GS_BASE in order that the processor can uniquely identify the
-  // thread without having to look in a list (which is subject to threads moving between processors whilst looking in
-  // the list.
-  proc_write_msr(PROC_X64_MSRS::IA32_KERNEL_GS_BASE, reinterpret_cast<uint64_t>(next_thread->execution_context));
-
-  // We also need to make sure the base values of FS and GS are set as needed.
-  proc_write_msr(PROC_X64_MSRS::IA32_FS_BASE, next_context->fs_base);
-  proc_write_msr(PROC_X64_MSRS::IA32_GS_BASE, next_context->gs_base);
-
-  // Only processor 0 directly receives timer interrupts. In order to trigger scheduling on all other processors, send
-  // them an IPI for the correct vector.
-  if (proc_mp_this_proc_id() == 0)
+  // Record the new thread in this processor's data, so that it can be found without having to look in a list (which
+  // is subject to threads moving between processors whilst looking in the list).
+  per_cpu = proc_x64_this_per_cpu();
+  per_cpu->current_thread = next_thread;
+  per_cpu->exec_context = next_context;
+
+  // We also need to make sure the base values of FS and GS are set as needed. GS only takes its new value when the
+  // switch code returns to user mode.
+  proc_x64_write_fs_base(next_context->fs_base);
+  proc_x64_write_user_gs_base(next_context->gs_base);
+
+  // While the HPET drives scheduling, only processor 0 directly receives timer interrupts. In order to trigger
+  // scheduling on all other processors, send them an IPI for the correct vector. Once the APIC timers take over, this
+  // is sent one last time so the other processors start programming their own timers.
+  if ((proc_mp_this_proc_id() == 0) && (hpet_tick_running || first_tick))
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Sending broadcast IPI\n");
+    first_tick = false;
     proc_send_ipi(0, PROC_IPI_SHORT_TARGET::ALL_EXCL_SELF, PROC_IPI_INTERRUPT::FIXED, TM_INTERRUPT_NUM, false);
   }
 
@@ -355,8 +416,122 @@ void task_platform_init()
 {
   KL_TRC_ENTRY;
 
+  void *lines_alloc;
+
   proc_init_tss();
 
+  if (mwait_idle_supported())
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Idle processors will use MWAIT\n");
+    lines_alloc = kmalloc((sizeof(idle_wake_line) * processor_count) + PROC_CACHE_LINE_SIZE - 1);
+    idle_wake_lines = reinterpret_cast<idle_wake_line *>(
+      (reinterpret_cast<uint64_t>(lines_alloc) + PROC_CACHE_LINE_SIZE - 1) & ~(PROC_CACHE_LINE_SIZE - 1));
+
+    for (uint32_t i = 0; i < processor_count; i++)
+    {
+      idle_wake_lines[i].state = IDLE_LINE_RUNNING;
+    }
+
+    mwait_idle_available = true;
+  }
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Wait on this processor's idle thread until there might be something else to do.
+///
+/// If possible, the processor uses MWAIT to wait for either an interrupt or a write to its idle wake line. Processors
+/// calling task_platform_wake_proc() write to the line instead of sending an IPI if they see this processor waiting,
+/// and the scheduler is then invoked from here. Interrupts are disabled while the line says the processor is waiting,
+/// so that no other thread can be scheduled here in the meantime - MWAIT is asked to treat interrupts as wake events
+/// anyway, and they are handled once the line has been reset.
+///
+/// Otherwise, the processor halts until the next interrupt.
+///
+/// Don't do any tracing in this function, it is called continuously while the processor is idle.
+void task_platform_idle()
+{
+  idle_wake_line *line;
+  uint64_t old_state;
+
+  if (!mwait_idle_available)
+  {
+    asm volatile("hlt");
+    return;
+  }
+
+  line = &idle_wake_lines[proc_mp_this_proc_id()];
+
+  asm volatile("cli");
+  line->state = IDLE_LINE_WAITING;
+  asm volatile("monitor" : : "a"(line), "c"(0), "d"(0));
+
+  // If the line was written before MONITOR took effect, MWAIT wouldn't notice - so check first.
+  if (line->state == IDLE_LINE_WAITING)
+  {
+    asm volatile("mwait" : : "a"(0), "c"(1));
+  }
+
+  old_state = line->state.exchange(IDLE_LINE_RUNNING);
+  asm volatile("sti");
+
+  if (old_state == IDLE_LINE_WAKE)
+  {
+    task_yield();
+  }
+}
+
+/// @brief Arrange for the scheduler to run again on this processor after a delay.
+///
+/// If the processor's local APIC timer can be used, it is programmed to fire once. The first time processor 0 does
+/// this, the HPET's periodic interrupt is stopped. If the APIC timer can't be used, the HPET keeps interrupting at a
+/// fixed rate and this function has no effect.
+///
+/// @param delay_ns How long to wait before running the scheduler, in nanoseconds. If zero, the scheduler won't run
+///                 again until this processor is signalled by task_platform_wake_proc().
+void task_platform_set_next_tick(uint64_t delay_ns)
+{
+  KL_TRC_ENTRY;
+
+  if (proc_x64_apic_timer_available())
+  {
+    proc_x64_apic_set_timer(delay_ns, TM_INTERRUPT_NUM);
+
+    if (hpet_tick_running && (proc_mp_this_proc_id() == 0))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Stop HPET periodic interrupt\n");
+      time_hpet_stop_periodic_timer();
+      hpet_tick_running = false;
+    }
+  }
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Make another processor run its scheduler as soon as possible.
+///
+/// @param proc_id The processor to signal.
+void task_platform_wake_proc(uint32_t proc_id)
+{
+  KL_TRC_ENTRY;
+
+  ASSERT(proc_id < processor_count);
+
+  if (mwait_idle_available && (idle_wake_lines[proc_id].state.exchange(IDLE_LINE_WAKE) == IDLE_LINE_WAITING))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Processor ", proc_id, " woken through its idle wake line\n");
+  }
+  else
+  {
+    // The processor is running another thread, or is halted - either way, only an interrupt will do. If the wake line
+    // was left set, it is ignored the next time the processor becomes idle.
+    proc_send_ipi(proc_info_block[proc_id].platform_data.lapic_id,
+                  PROC_IPI_SHORT_TARGET::NONE,
+                  PROC_IPI_INTERRUPT::FIXED,
+                  TM_INTERRUPT_NUM,
+                  false);
+  }
+
   KL_TRC_EXIT;
 }
 
@@ -377,27 +552,51 @@ void task_yield()
 
 /// @brief Return pointer to the currently executing thread
 ///
+/// The thread is kept in this processor's per-processor data, so this is a single load through GS.
+///
 /// @return The task_thread object of the executing thread on this processor, or NULL if we haven't got that far yet.
 task_thread *task_get_cur_thread()
 {
-  KL_TRC_ENTRY;
-
   task_thread *ret_thread;
-  task_x64_exec_context *context;
 
-  context = reinterpret_cast<task_x64_exec_context *>(proc_read_msr(PROC_X64_MSRS::IA32_KERNEL_GS_BASE));
-  if (context == nullptr)
-  {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "No running thread\n");
-    ret_thread = nullptr;
-  }
-  else
+  static_assert(offsetof(proc_x64_per_cpu, current_thread) == 16, "Update the offset below");
+  asm volatile("mov %%gs:16, %0" : "=r"(ret_thread));
+
+  return ret_thread;
+}
+
+namespace
+{
+  /// @brief Can idle processors wait using MONITOR and MWAIT?
+  ///
+  /// As well as the instructions themselves, MWAIT must be able to wake for interrupts while they are disabled.
+  ///
+  /// @return True if MWAIT can be used by task_platform_idle(), false otherwise.
+  bool mwait_idle_supported()
   {
-    ret_thread = context->owner_thread;
-  }
+    uint64_t ebx_eax;
+    uint64_t edx_ecx;
+    bool result = false;
 
-  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", ret_thread, "\n");
-  KL_TRC_EXIT;
+    KL_TRC_ENTRY;
 
-  return ret_thread;
+    // CPUID leaf 1 reports MONITOR and MWAIT support in bit 3 of ECX.
+    asm_proc_read_cpuid(1, 0, &ebx_eax, &edx_ecx);
+    if ((edx_ecx & (1ULL << 3)) != 0)
+    {
+      // Leaf 5 describes MWAIT's extensions, if it exists. Bit 0 of ECX says the extensions are described, bit 1 that
+      // interrupts can be treated as wake events.
+      asm_proc_read_cpuid(0, 0, &ebx_eax, &edx_ecx);
+      if ((ebx_eax & 0xFFFFFFFF) >= 5)
+      {
+        asm_proc_read_cpuid(5, 0, &ebx_eax, &edx_ecx);
+        result = ((edx_ecx & 3) == 3);
+      }
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "MWAIT idle supported: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
 }
@@ -15,6 +15,11 @@
 
 #include <map>
 
+namespace
+{
+  bool futex_address_valid(volatile int32_t *futex);
+}
+
 /// @brief Provides futexes in a similar manner to Linux
 ///
 /// Full details of supported operations can be found in the Linux futex documentation. Note that Azalea does not
@@ -25,16 +30,21 @@
 ///
 /// @param futex Address of the futex to operate on.
 ///
-/// @param op Operation to carry out on futex.
+/// @param op Operation to carry out on futex, optionally combined with FUTEX_SHARED_FLAG if the futexes are in memory
+///           shared with other processes.
 ///
-/// @param req_value The requested value of futex to wait for, if applicable
+/// @param req_value For FUTEX_WAIT, the requested value of futex to wait for. For the other operations, the maximum
+///                  number of threads waiting on futex to wake.
 ///
-/// @param timeout_ns The amount of time to wait for the operation to complete, in ns, if applicable. (Not currently
-///                   supported)
+/// @param timeout_ns For FUTEX_WAIT, the amount of time to wait for the operation to complete, in ns. (Not currently
+///                   supported.) For FUTEX_REQUEUE and FUTEX_CMP_REQUEUE, the maximum number of threads to move from
+///                   futex to futex_2, and for FUTEX_WAKE_OP the maximum number of threads waiting on futex_2 to wake.
+///                   As in Linux, this parameter doubles as a second count.
 ///
-/// @param futex_2 Where needed, the address of a second futex (not used in Azalea yet)
+/// @param futex_2 Where needed, the address of a second futex.
 ///
-/// @param v3 Where needed, another value for the futex op (not used in Azalea yet)
+/// @param v3 For FUTEX_CMP_REQUEUE, the value futex must contain for the operation to go ahead. For FUTEX_WAKE_OP,
+///           the operation to carry out on futex_2, as encoded by FUTEX_WAKE_OP_ENCODE.
 ///
 /// @return A suitable error code. Examples include:
 ///
@@ -44,7 +54,9 @@
 ///
 ///         - ERR_CODE::INVALID_PARAM if one or more parameters didn't make sense
 ///
-///         - ERR_CODE::NOT_FOUND if the futex didn't already exist but was supposed to.
+///         - ERR_CODE::NOT_FOUND if no threads were waiting on futex to be woken or moved.
+///
+///         - ERR_CODE::SYNC_VALUE_CHANGED if futex didn't contain v3 for FUTEX_CMP_REQUEUE.
 ERR_CODE syscall_futex_op(volatile int32_t *futex,
                           FUTEX_OP op,
                           int32_t req_value,
@@ -53,41 +65,59 @@ ERR_CODE syscall_futex_op(volatile int32_t *futex,
                           uint32_t v3)
 {
   ERR_CODE result{ERR_CODE::NO_ERROR};
-  int32_t cur_value;
+  bool needs_futex_2;
+  bool shared;
 
   KL_TRC_ENTRY;
 
-  if (!SYSCALL_IS_UM_ADDRESS(const_cast<int32_t *>(futex)))
+  shared = (static_cast<uint32_t>(op) & FUTEX_SHARED_FLAG) != 0;
+  op = static_cast<FUTEX_OP>(static_cast<uint32_t>(op) & ~FUTEX_SHARED_FLAG);
+
+  needs_futex_2 = (op == FUTEX_OP::FUTEX_REQUEUE) ||
+                  (op == FUTEX_OP::FUTEX_CMP_REQUEUE) ||
+                  (op == FUTEX_OP::FUTEX_WAKE_OP);
+
+  if (!futex_address_valid(futex) || (needs_futex_2 && !futex_address_valid(futex_2)))
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid futex address\n");
     result = ERR_CODE::INVALID_PARAM;
   }
-
-  cur_value = *futex;
-  void *futex_v = reinterpret_cast<void *>(const_cast<int32_t *>(futex));
-
-  if (!mem_get_phys_addr(futex_v))
+  else if (needs_futex_2 && ((req_value < 0) || (timeout_ns > INT32_MAX)))
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Not a mapped physical address\n");
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid count\n");
     result = ERR_CODE::INVALID_PARAM;
   }
-
-  if (result == ERR_CODE::NO_ERROR)
+  else
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "No failures so far, attempt op\n");
 
     switch (op)
     {
     case FUTEX_OP::FUTEX_WAIT:
-      result = futex_wait(futex, req_value);
+      result = futex_wait(futex, req_value, shared);
       break;
 
     case FUTEX_OP::FUTEX_WAKE:
-      result = futex_wake(futex);
+      result = futex_wake(futex, req_value, shared);
       break;
 
     case FUTEX_OP::FUTEX_REQUEUE:
-      INCOMPLETE_CODE("Requeue futex");
+      result = futex_requeue(futex, req_value, static_cast<int32_t>(timeout_ns), futex_2, false, 0, shared);
+      break;
+
+    case FUTEX_OP::FUTEX_CMP_REQUEUE:
+      result = futex_requeue(futex,
+                             req_value,
+                             static_cast<int32_t>(timeout_ns),
+                             futex_2,
+                             true,
+                             static_cast<int32_t>(v3),
+                             shared);
+      break;
+
+    case FUTEX_OP::FUTEX_WAKE_OP:
+      result = futex_wake_op(futex, req_value, futex_2, static_cast<int32_t>(timeout_ns), v3, shared);
+      break;
 
     default:
       KL_TRC_TRACE(TRC_LVL::FLOW, "Unknown operation\n");
@@ -101,3 +131,38 @@ ERR_CODE syscall_futex_op(volatile int32_t *futex,
 
   return result;
 }
+
+namespace
+{
+  /// @brief Is the given address usable as a futex?
+  ///
+  /// Futexes must be 4-byte aligned, as in Linux, so that a futex never straddles two pages. Whether the futex is in
+  /// mapped memory is checked by the futex operations themselves, since its page may need to be read or swapped in.
+  ///
+  /// @param futex The address to check.
+  ///
+  /// @return True if the address is a suitably aligned user mode address, false otherwise.
+  bool futex_address_valid(volatile int32_t *futex)
+  {
+    KL_TRC_ENTRY;
+
+    bool result = true;
+    void *futex_v = reinterpret_cast<void *>(const_cast<int32_t *>(futex));
+
+    if (!SYSCALL_IS_UM_ADDRESS(futex_v))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Not a user mode address\n");
+      result = false;
+    }
+    else if ((reinterpret_cast<uint64_t>(futex_v) % sizeof(int32_t)) != 0)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Futex not aligned\n");
+      result = false;
+    }
+
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+    KL_TRC_EXIT;
+
+    return result;
+  }
+}
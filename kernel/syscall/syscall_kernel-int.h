@@ -23,3 +23,5 @@ bool syscall_v_is_um_address(const void *addr);
 /// @return True if x->(x+y) falls entirely within user space, false otherwise
 #define SYSCALL_IS_UM_BUFFER(x, y) syscall_v_is_um_buffer(reinterpret_cast<const void *>((x)), (y))
 bool syscall_v_is_um_buffer(const void *base, uint64_t length);
+
+ERR_CODE syscall_fault_in_buffer(const void *base, uint64_t length);
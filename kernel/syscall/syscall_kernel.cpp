@@ -79,6 +79,24 @@ const void *syscall_pointers[] =
 
       // Other syscalls:
       (void *)syscall_yield,
+
+      // Shared memory sections:
+      (void *)syscall_create_section,
+      (void *)syscall_map_section,
+
+      // Mapped files:
+      (void *)syscall_map_file,
+      (void *)syscall_sync_file_mapping,
+      (void *)syscall_unmap_file,
+
+      // Memory accounting:
+      (void *)syscall_set_mem_limits,
+
+      // Scheduling:
+      (void *)syscall_set_thread_priority,
+      (void *)syscall_set_thread_deadline,
+      (void *)syscall_set_thread_affinity,
+      (void *)syscall_get_thread_affinity,
     };
 
 /// @brief The number of known system calls.
@@ -130,8 +148,9 @@ ERR_CODE syscall_debug_output(const char *msg, uint64_t length)
 /// Threads generally define their thread-local storage relative to either FS or GS. It is difficult for them to set
 /// the base address of those registers in user-mode, so this system call allows the kernel to do it on their behalf.
 ///
-/// It should be noted that modern x64 processors allow user mode threads to do this via WRGSBASE (etc.) but QEMU
-/// doesn't support these instructions, so we can't enable it in Azalea yet.
+/// On x64 processors that support the FSGSBASE instructions, the kernel enables them, so user mode threads may use
+/// WRFSBASE and WRGSBASE directly instead of this call. Those instructions aren't available on all processors (QEMU
+/// doesn't support them without KVM, for example), so check CPUID leaf 7 before relying on them.
 ///
 /// @param reg Which register to set.
 ///
@@ -155,12 +174,16 @@ ERR_CODE syscall_thread_set_tls_base(TLS_REGISTERS reg, uint64_t value)
     {
     case TLS_REGISTERS::FS:
       KL_TRC_TRACE(TRC_LVL::FLOW, "Setting FS base to ", value, "\n");
-      proc_write_msr (PROC_X64_MSRS::IA32_FS_BASE, value);
+      proc_x64_write_fs_base(value);
       break;
 
     case TLS_REGISTERS::GS:
+      // GS points at the per-processor data while in the kernel, so it is the user mode value that is written. This
+      // must not be interrupted part way through.
       KL_TRC_TRACE(TRC_LVL::FLOW, "Writing GS base to ", value, "\n");
-      proc_write_msr (PROC_X64_MSRS::IA32_GS_BASE, value);
+      proc_stop_interrupts();
+      proc_x64_write_user_gs_base(value);
+      proc_start_interrupts();
       break;
 
     default:
@@ -8,8 +8,13 @@
 #include "syscall/syscall_kernel.h"
 #include "syscall/syscall_kernel-int.h"
 #include "mem/mem.h"
+#include "mem/page_cache.h"
 #include "object_mgr/object_mgr.h"
 #include "processor/processor.h"
+#include "system_tree/system_tree.h"
+#include "system_tree/fs/mem/mem_fs.h"
+
+#include <string>
 
 // Known defects:
 // - It isn't possible to deallocate virtual memory, since the kernel doesn't really track the allocations properly
@@ -19,10 +24,17 @@
 // - The way that VMM requires power-of-two sizes might cause trouble one day.
 // - mem_vmm_allocate_specific_range can trigger an ASSERT if a duplicate allocation is made.
 // - There's no locking to ensure consistency between processes.
+// - Any process with a handle to another process may raise that process's memory limits.
+
+namespace
+{
+  bool limit_not_raised(uint64_t old_limit, uint64_t new_limit);
+}
 
 /// @brief Back a virtual address range in the calling process with physical RAM.
 ///
-/// This function will allocate physical RAM to back this allocation.
+/// This function will allocate physical RAM to back this allocation. Pages allocated this way may later be compressed
+/// into the swap store if the process doesn't use them for a while.
 ///
 /// @param pages The number of pages to allocate.
 ///
@@ -33,7 +45,8 @@
 ///
 /// @return ERR_CODE::NO_ERROR if the allocated succeeded. ERR_CODE::INVALID_PARAM if the length is zero, or
 ///         `map_addr` does not point to a valid memory range. ERR_CODE::INVALID_OP if this virtual address range is
-///         already mapped. ERR_CODE::OUT_OF_RESOURCE if the system has run out of physical memory.
+///         already mapped. ERR_CODE::OUT_OF_RESOURCE if the system has run out of physical memory, or the allocation
+///         would exceed the limits set for this process.
 ERR_CODE syscall_allocate_backing_memory(uint64_t pages, void **map_addr)
 {
   ERR_CODE result = ERR_CODE::UNKNOWN;
@@ -55,6 +68,11 @@ ERR_CODE syscall_allocate_backing_memory(uint64_t pages, void **map_addr)
     KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid params\n");
     result = ERR_CODE::INVALID_PARAM;
   }
+  else if (!mem_acct_within_limits(nullptr, (*map_addr == nullptr) ? pages : 0, pages))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Allocation would exceed process limits\n");
+    result = ERR_CODE::OUT_OF_RESOURCE;
+  }
   else
   {
     result = ERR_CODE::NO_ERROR;
@@ -68,13 +86,18 @@ ERR_CODE syscall_allocate_backing_memory(uint64_t pages, void **map_addr)
       *map_addr = mem_allocate_virtual_range(pages, cur_thread->parent_process.get());
 
       KL_TRC_TRACE(TRC_LVL::FLOW, "Proposed space: ", *map_addr, "\n");
+      if (*map_addr == nullptr)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "No room in the process's address space\n");
+        result = ERR_CODE::OUT_OF_RESOURCE;
+      }
     }
 
     map_addr_start = reinterpret_cast<uint64_t>(*map_addr);
     map_addr_end = map_addr_start + (pages * MEM_PAGE_SIZE);
     cur_map_addr = map_addr_start;
 
-    for (int i = 0; i < pages; i++, cur_map_addr += MEM_PAGE_SIZE)
+    for (int i = 0; (i < pages) && (result == ERR_CODE::NO_ERROR); i++, cur_map_addr += MEM_PAGE_SIZE)
     {
       if (mem_get_phys_addr(reinterpret_cast<void *>(cur_map_addr)) != nullptr)
       {
@@ -99,6 +122,7 @@ ERR_CODE syscall_allocate_backing_memory(uint64_t pages, void **map_addr)
         else
         {
           mem_map_range(phys_page, reinterpret_cast<void *>(cur_map_addr), 1);
+          mem_swap_track_range(task_get_cur_thread()->parent_process.get(), reinterpret_cast<void *>(cur_map_addr), 1);
         }
       }
     }
@@ -143,6 +167,7 @@ ERR_CODE syscall_release_backing_memory(void *dealloc_ptr)
     else
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "Unmap that space\n");
+      mem_swap_release_range(task_get_cur_thread()->parent_process.get(), dealloc_ptr, num_pages);
       mem_unmap_range(dealloc_ptr, num_pages, nullptr, true);
     }
   }
@@ -178,7 +203,8 @@ ERR_CODE syscall_release_backing_memory(void *dealloc_ptr)
 ///
 /// @return ERR_CODE::INVALID_PARAM if either process handle or memory address is invalid or if the mapping length is
 ///         not a multiple of the page size. ERR_CODE::INVALID_OP if the memory is already mapped in the receiving
-///         process. ERR_CODE::NO_ERROR if the mapping succeeded.
+///         process. ERR_CODE::OUT_OF_RESOURCE if the mapping would exceed the limits of the receiving process.
+///         ERR_CODE::NO_ERROR if the mapping succeeded.
 ERR_CODE syscall_map_memory(GEN_HANDLE proc_mapping_in,
                             void *map_addr,
                             uint64_t length,
@@ -240,6 +266,11 @@ ERR_CODE syscall_map_memory(GEN_HANDLE proc_mapping_in,
       KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid handles\n");
       result = ERR_CODE::INVALID_PARAM;
     }
+    else if (!mem_acct_within_limits(receiving_proc.get(), length / MEM_PAGE_SIZE, length / MEM_PAGE_SIZE))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Mapping would exceed receiving process limits\n");
+      result = ERR_CODE::OUT_OF_RESOURCE;
+    }
     else
     {
       for (int i = 0;
@@ -291,3 +322,378 @@ ERR_CODE syscall_unmap_memory()
 
   return ERR_CODE::INVALID_OP;
 }
+
+/// @brief Create a new shared memory section in the System Tree and retrieve a handle for it.
+///
+/// The section can subsequently be opened by any process using syscall_open_handle() and mapped into that process
+/// using syscall_map_section(). All processes mapping the section share the same physical RAM.
+///
+/// @param path The position in the System Tree to store the new section.
+///
+/// @param path_len The length of the path string.
+///
+/// @param pages The number of pages of RAM to allocate for the section.
+///
+/// @param[out] handle The handle of the newly created section. If a section isn't created, this is left untouched.
+///
+/// @return ERR_CODE::INVALID_PARAM if any parameter is invalid, ERR_CODE::INVALID_OP if the calling thread can't be
+///         identified, any error code returned by the System Tree if the section couldn't be stored in it, or
+///         ERR_CODE::NO_ERROR if the section was created successfully.
+ERR_CODE syscall_create_section(const char *path, uint64_t path_len, uint64_t pages, GEN_HANDLE *handle)
+{
+  ERR_CODE result = ERR_CODE::UNKNOWN;
+  std::shared_ptr<mem_fs_section> section;
+  task_thread *cur_thread = task_get_cur_thread();
+
+  KL_TRC_ENTRY;
+
+  if ((path == nullptr) ||
+      !SYSCALL_IS_UM_BUFFER(path, path_len) ||
+      (path_len == 0) ||
+      (pages == 0) ||
+      (pages > mem_fs_max_section_pages) ||
+      (handle == nullptr) ||
+      !SYSCALL_IS_UM_ADDRESS(handle))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid parameters\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    std::string req_path(path, path_len);
+    object_data new_object;
+
+    section = mem_fs_section::create(pages);
+    ASSERT(section != nullptr);
+
+    result = system_tree()->add_child(req_path, section);
+    if (result == ERR_CODE::NO_ERROR)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "New section stored\n");
+      new_object.object_ptr = section;
+      *handle = cur_thread->parent_process->proc_handles.store_object(new_object);
+
+      KL_TRC_TRACE(TRC_LVL::EXTRA, "Correlated to handle ", *handle, "\n");
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Map a shared memory section into the calling process.
+///
+/// The whole section is mapped at an address chosen by the kernel. The mapping can be removed by passing the returned
+/// address to syscall_release_backing_memory() - the RAM backing the section is not released until the section has
+/// been deleted from the System Tree and all processes have removed their mappings.
+///
+/// @param section_handle Handle to a section previously created by syscall_create_section().
+///
+/// @param[out] map_addr The address in the calling process where the section has been mapped.
+///
+/// @return ERR_CODE::INVALID_PARAM if map_addr is invalid, ERR_CODE::NOT_FOUND if the handle is invalid,
+///         ERR_CODE::WRONG_TYPE if the handle doesn't refer to a section, ERR_CODE::INVALID_OP if the calling thread
+///         can't be identified, ERR_CODE::OUT_OF_RESOURCE if the mapping would exceed the limits of the calling
+///         process, ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_map_section(GEN_HANDLE section_handle, void **map_addr)
+{
+  ERR_CODE result = ERR_CODE::UNKNOWN;
+  std::shared_ptr<IHandledObject> obj;
+  std::shared_ptr<mem_fs_section> section;
+  task_thread *cur_thread = task_get_cur_thread();
+  void *new_addr = nullptr;
+
+  KL_TRC_ENTRY;
+
+  if ((map_addr == nullptr) || !SYSCALL_IS_UM_ADDRESS(map_addr))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid map_addr\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    obj = cur_thread->parent_process->proc_handles.retrieve_handled_object(section_handle);
+    if (obj == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Handle not found\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+    else
+    {
+      section = std::dynamic_pointer_cast<mem_fs_section>(obj);
+      if (section == nullptr)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Handle isn't a section\n");
+        result = ERR_CODE::WRONG_TYPE;
+      }
+      else if (!mem_acct_within_limits(cur_thread->parent_process.get(),
+                                       section->get_num_pages(),
+                                       section->get_num_pages()))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Mapping would exceed process limits\n");
+        result = ERR_CODE::OUT_OF_RESOURCE;
+      }
+      else
+      {
+        result = section->map_into_process(cur_thread->parent_process.get(), new_addr);
+        if (result == ERR_CODE::NO_ERROR)
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Mapped section at ", new_addr, "\n");
+          *map_addr = new_addr;
+        }
+      }
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Map part of a file into the address space of the calling process.
+///
+/// The file is mapped at an address chosen by the kernel. Pages are read from the file when they are first accessed,
+/// and changes are written back to the file by syscall_sync_file_mapping(), syscall_unmap_file(), or when the process
+/// exits. All processes mapping the same file share the same physical RAM.
+///
+/// @param file_handle Handle to the file to map.
+///
+/// @param offset The offset within the file to begin mapping from. Must be a multiple of MEM_PAGE_SIZE.
+///
+/// @param length The number of bytes to map. This is rounded up to a whole number of pages, which must not extend
+///               beyond the page containing the end of the file.
+///
+/// @param[out] map_addr The address in the calling process where the file has been mapped.
+///
+/// @return ERR_CODE::INVALID_PARAM if any parameter is invalid, ERR_CODE::NOT_FOUND if the handle is invalid,
+///         ERR_CODE::WRONG_TYPE if the handle doesn't refer to a file, ERR_CODE::INVALID_OP if the calling thread
+///         can't be identified, ERR_CODE::OUT_OF_RESOURCE if the mapping would exceed the limits of the calling
+///         process or there is no room for it, ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_map_file(GEN_HANDLE file_handle, uint64_t offset, uint64_t length, void **map_addr)
+{
+  ERR_CODE result = ERR_CODE::UNKNOWN;
+  std::shared_ptr<IHandledObject> obj;
+  std::shared_ptr<IBasicFile> file;
+  task_thread *cur_thread = task_get_cur_thread();
+  uint64_t num_pages;
+  void *new_addr = nullptr;
+
+  KL_TRC_ENTRY;
+
+  // Written this way so that it can't overflow.
+  num_pages = (length / MEM_PAGE_SIZE) + (((length % MEM_PAGE_SIZE) != 0) ? 1 : 0);
+
+  if ((map_addr == nullptr) ||
+      !SYSCALL_IS_UM_ADDRESS(map_addr) ||
+      (length == 0) ||
+      (num_pages > UINT32_MAX) ||
+      ((offset % MEM_PAGE_SIZE) != 0))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid parameters\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    obj = cur_thread->parent_process->proc_handles.retrieve_handled_object(file_handle);
+    if (obj == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Handle not found\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+    else
+    {
+      file = std::dynamic_pointer_cast<IBasicFile>(obj);
+      if (file == nullptr)
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Handle isn't a file\n");
+        result = ERR_CODE::WRONG_TYPE;
+      }
+      else if (!mem_acct_within_limits(cur_thread->parent_process.get(), num_pages, 0))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "Mapping would exceed process limits\n");
+        result = ERR_CODE::OUT_OF_RESOURCE;
+      }
+      else
+      {
+        result = mem_map_file(file, offset, num_pages, cur_thread->parent_process.get(), new_addr);
+        if (result == ERR_CODE::NO_ERROR)
+        {
+          KL_TRC_TRACE(TRC_LVL::FLOW, "Mapped file at ", new_addr, "\n");
+          *map_addr = new_addr;
+        }
+      }
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Write any changes made to a mapped file back to the file.
+///
+/// @param map_addr The address of the mapping, as returned by syscall_map_file().
+///
+/// @return ERR_CODE::NOT_FOUND if there is no mapped file at map_addr, ERR_CODE::INVALID_OP if the calling thread can't
+///         be identified, any error returned while writing the file, or ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_sync_file_mapping(void *map_addr)
+{
+  ERR_CODE result;
+  task_thread *cur_thread = task_get_cur_thread();
+
+  KL_TRC_ENTRY;
+
+  if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    result = mem_sync_file_mapping(map_addr, cur_thread->parent_process.get());
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Remove a mapped file from the calling process, writing back any changes first.
+///
+/// @param map_addr The address of the mapping, as returned by syscall_map_file().
+///
+/// @return ERR_CODE::NOT_FOUND if there is no mapped file at map_addr, ERR_CODE::INVALID_OP if the calling thread can't
+///         be identified, or ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_unmap_file(void *map_addr)
+{
+  ERR_CODE result;
+  task_thread *cur_thread = task_get_cur_thread();
+
+  KL_TRC_ENTRY;
+
+  if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    result = mem_unmap_file(map_addr, cur_thread->parent_process.get());
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Limit the amount of memory a process may use.
+///
+/// Once a limit is reached, system calls that would allocate more memory fail with ERR_CODE::OUT_OF_RESOURCE. The
+/// current usage of a process can be read from its branch in the \\proc tree.
+///
+/// A process may only tighten its own limits - otherwise the limits could simply be removed by the process they are
+/// meant to constrain. Limits can be raised or removed through a handle to another process, such as one that the
+/// caller started.
+///
+/// @param proc_handle Handle to the process to limit. A value of zero indicates this process.
+///
+/// @param max_virtual_pages The maximum number of pages of virtual address space the process may reserve. Zero means
+///                          no limit.
+///
+/// @param max_resident_pages The maximum number of pages of physical RAM that may be mapped into the process. Zero
+///                           means no limit.
+///
+/// @return ERR_CODE::NOT_FOUND if the process handle is invalid, ERR_CODE::INVALID_OP if the calling thread can't be
+///         identified or it tries to raise its own process's limits, ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_set_mem_limits(GEN_HANDLE proc_handle, uint64_t max_virtual_pages, uint64_t max_resident_pages)
+{
+  ERR_CODE result = ERR_CODE::UNKNOWN;
+  std::shared_ptr<task_process> proc_obj;
+  task_thread *cur_thread = task_get_cur_thread();
+  mem_process_stats *stats;
+
+  KL_TRC_ENTRY;
+
+  if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    if (proc_handle != 0)
+    {
+      proc_obj = std::dynamic_pointer_cast<task_process>(
+        cur_thread->parent_process->proc_handles.retrieve_handled_object(proc_handle));
+    }
+    else
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Limit this process\n");
+      proc_obj = cur_thread->parent_process;
+    }
+
+    if (proc_obj == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Process not found\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+    else
+    {
+      stats = mem_acct_get_stats(proc_obj.get());
+      if ((proc_obj == cur_thread->parent_process) &&
+          (stats != nullptr) &&
+          (!limit_not_raised(stats->virtual_limit_pages, max_virtual_pages) ||
+           !limit_not_raised(stats->resident_limit_pages, max_resident_pages)))
+      {
+        KL_TRC_TRACE(TRC_LVL::FLOW, "A process can't raise its own limits\n");
+        result = ERR_CODE::INVALID_OP;
+      }
+      else
+      {
+        mem_acct_set_limits(proc_obj.get(), max_virtual_pages, max_resident_pages);
+        result = ERR_CODE::NO_ERROR;
+      }
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+namespace
+{
+  /// @brief Is a new memory limit at least as strict as the old one?
+  ///
+  /// @param old_limit The current limit, in pages. Zero means no limit.
+  ///
+  /// @param new_limit The proposed limit, in pages. Zero means no limit.
+  ///
+  /// @return True if the new limit allows no more memory than the old one, false otherwise.
+  bool limit_not_raised(uint64_t old_limit, uint64_t new_limit)
+  {
+    return (old_limit == 0) || ((new_limit != 0) && (new_limit <= old_limit));
+  }
+}
@@ -262,7 +262,7 @@ ERR_CODE syscall_receive_message_details(uint64_t *message_id, uint64_t *message
     KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid parameter addresses\n");
     res = ERR_CODE::INVALID_PARAM;
   }
-  if (this_thread == nullptr)
+  else if (this_thread == nullptr)
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Unknown originating thread\n");
     res = ERR_CODE::UNKNOWN;
@@ -278,6 +278,16 @@ ERR_CODE syscall_receive_message_details(uint64_t *message_id, uint64_t *message
     res = ERR_CODE::SYNC_MSG_NOT_ACCEPTED;
   }
   else
+  {
+    // The details are written with the message lock held, so they must be in RAM beforehand.
+    res = syscall_fault_in_buffer(message_id, sizeof(uint64_t));
+    if (res == ERR_CODE::NO_ERROR)
+    {
+      res = syscall_fault_in_buffer(message_len, sizeof(uint64_t));
+    }
+  }
+
+  if (res == ERR_CODE::NO_ERROR)
   {
     klib_synch_spinlock_lock(this_thread->parent_process->messaging.message_lock);
 
@@ -345,6 +355,12 @@ ERR_CODE syscall_receive_message_body(char *message_buffer, uint64_t buffer_size
     res = ERR_CODE::SYNC_MSG_NOT_ACCEPTED;
   }
   else
+  {
+    // The message is copied with the message lock held, so the buffer must be in RAM beforehand.
+    res = syscall_fault_in_buffer(message_buffer, buffer_size);
+  }
+
+  if (res == ERR_CODE::NO_ERROR)
   {
     klib_synch_spinlock_lock(this_thread->parent_process->messaging.message_lock);
 
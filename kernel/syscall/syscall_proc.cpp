@@ -513,3 +513,197 @@ void syscall_exit_thread()
   panic("Reached end of syscall_exit_thread!");
   KL_TRC_EXIT;
 }
+
+/// @brief Set the scheduling priority of a thread.
+///
+/// @param thread_handle A handle to the thread to change.
+///
+/// @param priority The priority level to schedule the thread at.
+///
+/// @param nice The thread's nice value, between THREAD_NICE_MIN and THREAD_NICE_MAX. Lower values give the thread a
+///             larger share of the processor, compared to other threads at the same priority level.
+///
+/// @return ERR_CODE::NOT_FOUND if the handle does not refer to a valid thread. ERR_CODE::INVALID_PARAM if the priority
+///         or nice value is out of range. ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_set_thread_priority(GEN_HANDLE thread_handle, THREAD_PRIORITY priority, int8_t nice)
+{
+  KL_TRC_ENTRY;
+
+  ERR_CODE result = ERR_CODE::UNKNOWN;
+  std::shared_ptr<task_thread> thread_obj;
+  task_thread *cur_thread = task_get_cur_thread();
+
+  if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    thread_obj = std::dynamic_pointer_cast<task_thread>(
+      cur_thread->parent_process->proc_handles.retrieve_handled_object(thread_handle));
+
+    if (thread_obj == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Wrong object type\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+    else
+    {
+      result = task_set_thread_priority(thread_obj.get(), priority, nice);
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Place a thread in, or remove it from, the deadline scheduling class.
+///
+/// Threads in the deadline class run ahead of all other threads. In each period, the thread is guaranteed to receive
+/// runtime_ns of processor time before deadline_ns has passed, so long as it is runnable throughout.
+///
+/// @param thread_handle A handle to the thread to change.
+///
+/// @param runtime_ns The processor time the thread needs in each period. Zero to return the thread to its normal
+///                   priority level.
+///
+/// @param deadline_ns How long after the start of each period the thread must have received its runtime by.
+///
+/// @param period_ns The length of each period.
+///
+/// @return ERR_CODE::NOT_FOUND if the handle does not refer to a valid thread. ERR_CODE::INVALID_PARAM if the times
+///         are not valid. ERR_CODE::OUT_OF_RESOURCE if there is not enough processor time available to meet the
+///         request. ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_set_thread_deadline(GEN_HANDLE thread_handle,
+                                     uint64_t runtime_ns,
+                                     uint64_t deadline_ns,
+                                     uint64_t period_ns)
+{
+  KL_TRC_ENTRY;
+
+  ERR_CODE result = ERR_CODE::UNKNOWN;
+  std::shared_ptr<task_thread> thread_obj;
+  task_thread *cur_thread = task_get_cur_thread();
+
+  if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    thread_obj = std::dynamic_pointer_cast<task_thread>(
+      cur_thread->parent_process->proc_handles.retrieve_handled_object(thread_handle));
+
+    if (thread_obj == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Wrong object type\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+    else
+    {
+      result = task_set_thread_deadline(thread_obj.get(), runtime_ns, deadline_ns, period_ns);
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Set the processors a thread may run on.
+///
+/// @param thread_handle A handle to the thread to change.
+///
+/// @param affinity The new affinity mask. Bit n is set if the thread may run on processor n. THREAD_AFFINITY_ALL
+///                 allows the thread to run anywhere.
+///
+/// @return ERR_CODE::NOT_FOUND if the handle does not refer to a valid thread. ERR_CODE::INVALID_PARAM if the mask
+///         doesn't include any of the system's processors. ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_set_thread_affinity(GEN_HANDLE thread_handle, uint64_t affinity)
+{
+  KL_TRC_ENTRY;
+
+  ERR_CODE result = ERR_CODE::UNKNOWN;
+  std::shared_ptr<task_thread> thread_obj;
+  task_thread *cur_thread = task_get_cur_thread();
+
+  if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else
+  {
+    thread_obj = std::dynamic_pointer_cast<task_thread>(
+      cur_thread->parent_process->proc_handles.retrieve_handled_object(thread_handle));
+
+    if (thread_obj == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Wrong object type\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+    else
+    {
+      result = task_set_thread_affinity(thread_obj.get(), affinity);
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Get the processors a thread may run on.
+///
+/// @param thread_handle A handle to the thread to examine.
+///
+/// @param[out] affinity The thread's affinity mask. Bit n is set if the thread may run on processor n.
+///
+/// @return ERR_CODE::NOT_FOUND if the handle does not refer to a valid thread. ERR_CODE::INVALID_PARAM if affinity is
+///         not a valid pointer. ERR_CODE::NO_ERROR otherwise.
+ERR_CODE syscall_get_thread_affinity(GEN_HANDLE thread_handle, uint64_t *affinity)
+{
+  KL_TRC_ENTRY;
+
+  ERR_CODE result = ERR_CODE::UNKNOWN;
+  std::shared_ptr<task_thread> thread_obj;
+  task_thread *cur_thread = task_get_cur_thread();
+
+  if (cur_thread == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Couldn't identify current thread\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+  else if ((affinity == nullptr) || !SYSCALL_IS_UM_ADDRESS(affinity))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Invalid output pointer\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    thread_obj = std::dynamic_pointer_cast<task_thread>(
+      cur_thread->parent_process->proc_handles.retrieve_handled_object(thread_handle));
+
+    if (thread_obj == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Wrong object type\n");
+      result = ERR_CODE::NOT_FOUND;
+    }
+    else
+    {
+      *affinity = thread_obj->affinity;
+      result = ERR_CODE::NO_ERROR;
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
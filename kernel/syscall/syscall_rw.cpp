@@ -105,16 +105,26 @@ ERR_CODE syscall_read_handle(GEN_HANDLE handle,
         KL_TRC_TRACE(TRC_LVL::EXTRA, "Buffer: ", buffer, "\n");
         KL_TRC_TRACE(TRC_LVL::EXTRA, "Buffer size: ", buffer_size, "\n");
 
-        result = file->read_bytes(start_offset + object->data.seek_position,
-                                  bytes_to_read,
-                                  buffer,
-                                  buffer_size,
-                                  *bytes_read);
+        // The file may hold locks while it copies into the buffer, so the buffer must be in RAM beforehand.
+        result = syscall_fault_in_buffer(buffer, bytes_to_read);
+        if (result == ERR_CODE::NO_ERROR)
+        {
+          result = syscall_fault_in_buffer(bytes_read, sizeof(uint64_t));
+        }
+
+        if (result == ERR_CODE::NO_ERROR)
+        {
+          result = file->read_bytes(start_offset + object->data.seek_position,
+                                    bytes_to_read,
+                                    buffer,
+                                    buffer_size,
+                                    *bytes_read);
 
-        // There's no need to do locking on this field because handles are per-thread.
-        object->data.seek_position += *bytes_read;
+          // There's no need to do locking on this field because handles are per-thread.
+          object->data.seek_position += *bytes_read;
 
-        KL_TRC_TRACE(TRC_LVL::FLOW, "bytes read: ", *bytes_read, "\n");
+          KL_TRC_TRACE(TRC_LVL::FLOW, "bytes read: ", *bytes_read, "\n");
+        }
       }
     }
     else
@@ -209,16 +219,27 @@ ERR_CODE syscall_write_handle(GEN_HANDLE handle,
           bytes_to_write = buffer_size;
         }
         KL_TRC_TRACE(TRC_LVL::FLOW, "Going to attempt a write on file: ", file.get(), "\n");
-        result = file->write_bytes(start_offset + obj->data.seek_position,
-                                    bytes_to_write,
-                                    buffer,
-                                    buffer_size,
-                                    *bytes_written);
 
-        // There's no need to do locking on this field because handles are per-thread.
-        obj->data.seek_position += *bytes_written;
+        // The file may hold locks while it copies from the buffer, so the buffer must be in RAM beforehand.
+        result = syscall_fault_in_buffer(buffer, bytes_to_write);
+        if (result == ERR_CODE::NO_ERROR)
+        {
+          result = syscall_fault_in_buffer(bytes_written, sizeof(uint64_t));
+        }
 
-        KL_TRC_TRACE(TRC_LVL::FLOW, "bytes written: ", *bytes_written, "\n");
+        if (result == ERR_CODE::NO_ERROR)
+        {
+          result = file->write_bytes(start_offset + obj->data.seek_position,
+                                      bytes_to_write,
+                                      buffer,
+                                      buffer_size,
+                                      *bytes_written);
+
+          // There's no need to do locking on this field because handles are per-thread.
+          obj->data.seek_position += *bytes_written;
+
+          KL_TRC_TRACE(TRC_LVL::FLOW, "bytes written: ", *bytes_written, "\n");
+        }
       }
     }
     else
@@ -5,6 +5,9 @@
 
 #include "klib/klib.h"
 #include "syscall_kernel-int.h"
+#include "mem/mem.h"
+#include "mem/page_cache.h"
+#include "processor/processor.h"
 
 /// @brief Is addr a user-mode address or not?
 ///
@@ -35,3 +38,51 @@ bool syscall_v_is_um_buffer(const void *base, uint64_t length)
          (!(base_l & 0x8000000000000000ULL)) &&
          (!((base_l + length) & 0x8000000000000000ULL));
 }
+
+/// @brief Bring all pages of a user mode buffer into RAM, ready for the kernel to access them.
+///
+/// The page fault handler can't suspend a thread that faults in kernel mode, since it may be holding locks, so it can't
+/// read in a page of a mapped file or wait for a page to be swapped. System calls that pass a buffer on to code that
+/// may take locks while accessing it should call this function first, while they don't hold any locks themselves.
+///
+/// @param base The base address of the buffer.
+///
+/// @param length The length of the buffer.
+///
+/// @return ERR_CODE::INVALID_PARAM if the buffer isn't entirely in user space, ERR_CODE::NO_ERROR if all pages of the
+///         buffer that can be brought into RAM now are, or a suitable error code if a page couldn't be read or swapped
+///         in.
+ERR_CODE syscall_fault_in_buffer(const void *base, uint64_t length)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  uint64_t addr = reinterpret_cast<uint64_t>(base);
+  uint64_t end_addr = addr + length;
+  task_thread *cur_thread = task_get_cur_thread();
+
+  KL_TRC_ENTRY;
+
+  if (!syscall_v_is_um_buffer(base, length))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Buffer not in user space\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    ASSERT(cur_thread != nullptr);
+
+    addr = addr - (addr % MEM_PAGE_SIZE);
+    for (; (addr < end_addr) && (result == ERR_CODE::NO_ERROR); addr += MEM_PAGE_SIZE)
+    {
+      result = mem_page_cache_fault_in(addr, cur_thread->parent_process.get());
+      if (result == ERR_CODE::NO_ERROR)
+      {
+        result = mem_swap_fault_in(addr, cur_thread->parent_process.get());
+      }
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
@@ -12,6 +12,7 @@ asm_syscall_x64_prepare:
   ; 2: Load the default kernel mode CS and SS into the appropriate MSR.
   ; 3: Load the default user mode CS and SS into the appropriate MSR.
   ; 4: Load the syscall instruction pointer into the appropriate MSR.
+  ; 5: Set the flags to be cleared on entry to the system call handler.
 
   ; 1: Set the SCE bit to enabled. It is bit 0 of EFER (0xC0000080)
   mov ecx, 0xC0000080
@@ -43,8 +44,23 @@ asm_syscall_x64_prepare:
   shr rdx, 32
   wrmsr
 
+  ; 5: Clear IF (bit 9) and DF (bit 10) on entry, using IA32_FMASK. Interrupts must be off until SWAPGS has run, or an
+  ; interrupt handler would find the user's GS base while running in kernel mode. The C calling convention needs DF
+  ; to be clear.
+  mov ecx, 0xC0000084 ; IA32_FMASK
+  mov eax, 0x00000600
+  xor edx, edx
+  wrmsr
+
   ret
 
+; Offsets of fields in proc_x64_per_cpu. These must match processor-x64-int.h
+PER_CPU_EXEC_CONTEXT equ 24
+PER_CPU_USER_RSP_SCRATCH equ 32
+
+; The offset of task_x64_exec_context::syscall_stack.
+EXEC_CONTEXT_SYSCALL_STACK equ 8
+
 ; The system call interface!
 ; There is no guarantee of any register remaining unchanged.
 ; System call number comes by RAX.
@@ -53,14 +69,19 @@ EXTERN syscall_x64_kernel_syscall
 EXTERN syscall_pointers
 EXTERN syscall_max_idx
 asm_syscall_x64_syscall:
-  ; Stop interrupts while we're fiddling with the stack, to avoid bad corruptions.
+  ; Interrupts are already disabled, since IA32_FMASK clears IF. This is just a reminder that they must stay that way
+  ; while we're fiddling with GS and the stack.
   cli
 
-  ; Swap to this thread's kernel stack.
-  swapgs
-  mov [gs:16], rsp
-  mov rsp, [gs:8]
+  ; Point GS at this processor's data, and use it to swap to this thread's kernel stack. GS is left pointing at the
+  ; per-processor data until the system call returns. The user mode stack pointer is kept on the kernel stack, since
+  ; the thread might move to a different processor before then. The extra 8 bytes keep the FPU save area aligned.
   swapgs
+  mov [gs:PER_CPU_USER_RSP_SCRATCH], rsp
+  mov rsp, [gs:PER_CPU_EXEC_CONTEXT]
+  mov rsp, [rsp + EXEC_CONTEXT_SYSCALL_STACK]
+  push qword [gs:PER_CPU_USER_RSP_SCRATCH]
+  sub rsp, 8
 
   ; Save the registers that the calling convention says must be preserved
   push rbx
@@ -122,8 +143,8 @@ asm_syscall_x64_syscall:
   pop rbp
   pop rbx
 
-  swapgs
-  mov rsp, [gs:16]
+  add rsp, 8
+  pop rsp
   swapgs
 
   ; Carry on! Manually encode a "64-bit operands" (REX.W) prefix because:
@@ -74,4 +74,22 @@ GENERIC_SYSCALL 40, syscall_get_system_clock,
 GENERIC_SYSCALL 41, syscall_sleep_thread
 
 ; Other syscalls:
-GENERIC_SYSCALL 42, syscall_yield
+GENERIC_SYSCALL 42, syscall_yield,
+
+; Shared memory sections:
+GENERIC_SYSCALL 43, syscall_create_section,
+GENERIC_SYSCALL 44, syscall_map_section,
+
+; Mapped files:
+GENERIC_SYSCALL 45, syscall_map_file,
+GENERIC_SYSCALL 46, syscall_sync_file_mapping,
+GENERIC_SYSCALL 47, syscall_unmap_file,
+
+; Memory accounting:
+GENERIC_SYSCALL 48, syscall_set_mem_limits
+
+; Scheduling:
+GENERIC_SYSCALL 49, syscall_set_thread_priority
+GENERIC_SYSCALL 50, syscall_set_thread_deadline
+GENERIC_SYSCALL 51, syscall_set_thread_affinity
+GENERIC_SYSCALL 52, syscall_get_thread_affinity
@@ -10,6 +10,11 @@
 
 #include <memory>
 
+class task_process;
+
+/// The maximum number of pages that may be allocated to a single shared memory section.
+const uint64_t mem_fs_max_section_pages = 256;
+
 /// @brief Branch of a simple in-memory filesystem.
 ///
 class mem_fs_branch: public system_tree_simple_branch, public std::enable_shared_from_this<mem_fs_branch>
@@ -59,3 +64,44 @@ protected:
   void _no_lock_set_file_size(uint64_t file_size);
 };
 
+
+/// @brief A fixed-size shared memory section.
+///
+/// Sections are backed by whole pages of physical RAM that are mapped into the kernel when the section is created.
+/// Any process that can open the section can map those same physical pages into its own address space, so data can be
+/// exchanged between processes without copying. The physical pages are reference counted by the memory manager, so
+/// they remain valid until the section has been destroyed *and* every process mapping has been removed.
+///
+/// Sections can also be read and written like normal files, but they cannot be resized.
+class mem_fs_section: public IBasicFile, public ISystemTreeLeaf
+{
+protected:
+  mem_fs_section(uint64_t num_pages);
+
+public:
+  static std::shared_ptr<mem_fs_section> create(uint64_t num_pages);
+  virtual ~mem_fs_section();
+
+  virtual ERR_CODE read_bytes(uint64_t start,
+                              uint64_t length,
+                              uint8_t *buffer,
+                              uint64_t buffer_length,
+                              uint64_t &bytes_read) override;
+
+  virtual ERR_CODE write_bytes(uint64_t start,
+                                uint64_t length,
+                                const uint8_t *buffer,
+                                uint64_t buffer_length,
+                                uint64_t &bytes_written) override;
+
+  virtual ERR_CODE get_file_size(uint64_t &file_size) override;
+  virtual ERR_CODE set_file_size(uint64_t file_size) override;
+
+  virtual ERR_CODE map_into_process(task_process *process, void *&map_addr);
+  uint64_t get_num_pages();
+
+protected:
+  uint64_t _num_pages; ///< The number of pages of RAM backing this section.
+  uint8_t *_kernel_addr; ///< The address of the section's RAM within kernel space.
+  std::unique_ptr<void *[]> _phys_pages; ///< The physical address of each page backing this section.
+};
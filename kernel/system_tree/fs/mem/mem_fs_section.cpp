@@ -0,0 +1,273 @@
+/// @file
+/// @brief Implements shared memory sections for the in-memory file system.
+///
+/// A section is a fixed number of pages of physical RAM which can be mapped into any number of processes at once.
+/// Sections are stored in the System Tree like any other leaf, so processes can find them by name.
+
+// Known defects:
+// - Sections can only be mapped at an address chosen by the kernel, since mem_vmm_allocate_specific_range() ASSERTs
+//   if the requested range is already in use.
+// - There's no way to map only part of a section.
+
+//#define ENABLE_TRACING
+
+#include <string.h>
+
+#include "klib/klib.h"
+#include "mem_fs.h"
+#include "mem/mem.h"
+#include "processor/processor.h"
+
+#include <memory>
+
+/// @brief Standard constructor
+///
+/// Sections should be created using the 'create' static member.
+///
+/// @param num_pages The number of pages of RAM to allocate for this section.
+mem_fs_section::mem_fs_section(uint64_t num_pages) :
+  _num_pages(num_pages),
+  _kernel_addr(nullptr),
+  _phys_pages(new void *[num_pages])
+{
+  KL_TRC_ENTRY;
+
+  ASSERT(num_pages != 0);
+
+  // Allocating the pages in kernel space means the kernel holds one reference to each physical page for as long as
+  // the section exists. Each process mapping adds another, so the pages are not released until the last user is done.
+  _kernel_addr = reinterpret_cast<uint8_t *>(mem_allocate_pages(num_pages));
+  ASSERT(_kernel_addr != nullptr);
+  memset(_kernel_addr, 0, num_pages * MEM_PAGE_SIZE);
+
+  for (uint64_t i = 0; i < num_pages; i++)
+  {
+    _phys_pages[i] = mem_get_phys_addr(_kernel_addr + (i * MEM_PAGE_SIZE));
+    KL_TRC_TRACE(TRC_LVL::EXTRA, "Page ", i, " at physical address ", _phys_pages[i], "\n");
+  }
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Create a new shared memory section.
+///
+/// @param num_pages The number of pages of RAM to allocate for this section. Must not be zero.
+///
+/// @return Shared pointer to a new section, or nullptr if num_pages is zero.
+std::shared_ptr<mem_fs_section> mem_fs_section::create(uint64_t num_pages)
+{
+  std::shared_ptr<mem_fs_section> result;
+
+  KL_TRC_ENTRY;
+
+  if (num_pages != 0)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Create section with ", num_pages, " pages\n");
+    result = std::shared_ptr<mem_fs_section>(new mem_fs_section(num_pages));
+  }
+
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Destroy this section.
+///
+/// The kernel's mapping of the section is removed. Physical pages that are still mapped by other processes will only be
+/// released when those processes unmap them.
+mem_fs_section::~mem_fs_section()
+{
+  KL_TRC_ENTRY;
+
+  mem_deallocate_pages(_kernel_addr, _num_pages);
+  _kernel_addr = nullptr;
+
+  KL_TRC_EXIT;
+}
+
+ERR_CODE mem_fs_section::read_bytes(uint64_t start,
+                                    uint64_t length,
+                                    uint8_t *buffer,
+                                    uint64_t buffer_length,
+                                    uint64_t &bytes_read)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  uint64_t section_size = _num_pages * MEM_PAGE_SIZE;
+
+  KL_TRC_ENTRY;
+
+  if (buffer == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "buffer is nullptr\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (start >= section_size)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Start address outside range\n");
+    bytes_read = 0;
+  }
+  else
+  {
+    if ((start + length) > section_size)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Truncating read\n");
+      length = section_size - start;
+    }
+
+    if (length > buffer_length)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Filling buffer\n");
+      length = buffer_length;
+    }
+
+    // No lock is taken - the section can be written to at any time by any process that has it mapped anyway.
+    memcpy(buffer, _kernel_addr + start, length);
+    bytes_read = length;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+ERR_CODE mem_fs_section::write_bytes(uint64_t start,
+                                     uint64_t length,
+                                     const uint8_t *buffer,
+                                     uint64_t buffer_length,
+                                     uint64_t &bytes_written)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  uint64_t section_size = _num_pages * MEM_PAGE_SIZE;
+
+  KL_TRC_ENTRY;
+
+  if (buffer == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "buffer is nullptr\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (start >= section_size)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Start address outside range\n");
+    result = ERR_CODE::OUT_OF_RANGE;
+    bytes_written = 0;
+  }
+  else
+  {
+    if (buffer_length < length)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Resetting length to buffer length\n");
+      length = buffer_length;
+    }
+
+    if ((start + length) > section_size)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Truncating write\n");
+      length = section_size - start;
+    }
+
+    memcpy(_kernel_addr + start, buffer, length);
+    bytes_written = length;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+ERR_CODE mem_fs_section::get_file_size(uint64_t &file_size)
+{
+  KL_TRC_ENTRY;
+
+  file_size = _num_pages * MEM_PAGE_SIZE;
+
+  KL_TRC_EXIT;
+
+  return ERR_CODE::NO_ERROR;
+}
+
+/// @brief Sections cannot be resized.
+///
+/// @param file_size The requested size of the section.
+///
+/// @return ERR_CODE::NO_ERROR if file_size is the current size of the section, ERR_CODE::INVALID_OP otherwise.
+ERR_CODE mem_fs_section::set_file_size(uint64_t file_size)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+
+  KL_TRC_ENTRY;
+
+  if (file_size != (_num_pages * MEM_PAGE_SIZE))
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Sections have a fixed size\n");
+    result = ERR_CODE::INVALID_OP;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Map this section into the address space of a process.
+///
+/// The whole of the section is mapped into a newly allocated virtual address range in the process. The mapping can
+/// later be removed by unmapping that range in the normal way - for example, by syscall_release_backing_memory().
+///
+/// @param process The process to map the section in to. Must not be nullptr.
+///
+/// @param[out] map_addr The address in process where the section has been mapped.
+///
+/// @return ERR_CODE::INVALID_PARAM if process is nullptr, ERR_CODE::OUT_OF_RESOURCE if there is no room for the
+///         section in the process's address space, ERR_CODE::NO_ERROR otherwise.
+ERR_CODE mem_fs_section::map_into_process(task_process *process, void *&map_addr)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  uint8_t *cur_virt_addr;
+
+  KL_TRC_ENTRY;
+
+  if (process == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "No process given\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    map_addr = mem_allocate_virtual_range(_num_pages, process);
+    if (map_addr == nullptr)
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "No room in the process's address space\n");
+      result = ERR_CODE::OUT_OF_RESOURCE;
+    }
+    else
+    {
+      KL_TRC_TRACE(TRC_LVL::EXTRA, "Mapping section at ", map_addr, "\n");
+
+      // The physical pages are not guaranteed to be contiguous, so map them one at a time.
+      cur_virt_addr = reinterpret_cast<uint8_t *>(map_addr);
+      for (uint64_t i = 0; i < _num_pages; i++, cur_virt_addr += MEM_PAGE_SIZE)
+      {
+        mem_map_range(_phys_pages[i], cur_virt_addr, 1, process);
+      }
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Return the number of pages of RAM backing this section.
+///
+/// @return The number of pages in this section.
+uint64_t mem_fs_section::get_num_pages()
+{
+  KL_TRC_ENTRY;
+  KL_TRC_EXIT;
+
+  return _num_pages;
+}
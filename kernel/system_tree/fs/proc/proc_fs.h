@@ -17,8 +17,8 @@
 
 /// @brief System Tree object for the root of the 'proc' tree.
 ///
-/// The proc tree contains dynamic information in a similar way to the Linux equivalent. At present, this is only data
-/// relating to running processes.
+/// The proc tree contains dynamic information in a similar way to the Linux equivalent. At present, this is data
+/// relating to running processes, and lock contention statistics if the kernel is built with KERNEL_LOCKSTAT.
 class proc_fs_root_branch: public system_tree_simple_branch, public std::enable_shared_from_this<proc_fs_root_branch>
 {
 public:
@@ -39,6 +39,64 @@ public:
     virtual ~proc_fs_simple_leaf();
   };
 
+  /// @brief The values that can be reported by proc_fs_counter_leaf.
+  enum class PROC_COUNTER
+  {
+    MEM_VIRTUAL, ///< Bytes of virtual address space reserved.
+    MEM_RESIDENT, ///< Bytes of physical RAM mapped.
+    MEM_PAGE_TABLES, ///< Number of page table pages.
+    MEM_KERNEL_HEAP, ///< Bytes of kernel heap allocated on behalf of the process.
+    MEM_SWAPPED, ///< Bytes of the process's memory held compressed in the swap store, before compression.
+    MEM_LIMIT_VIRTUAL, ///< Limit on virtual address space in bytes, or zero for no limit.
+    MEM_LIMIT_RESIDENT, ///< Limit on physical RAM in bytes, or zero for no limit.
+    HANDLES, ///< Number of open handles.
+    DEADLINE_MISSES, ///< Number of deadlines missed by threads in the deadline scheduling class.
+    SWITCHES_SAME_PROCESS, ///< Number of switches to this process's threads from threads of the same process.
+    SWITCHES_CROSS_PROCESS, ///< Number of switches to this process's threads from threads of other processes.
+    FUTEX_WAKEUPS, ///< Number of times this process's threads were woken from waiting on futexes.
+  };
+
+  /// @brief A read-only leaf that reports the current value of one of a process's counters as a decimal string.
+  ///
+  class proc_fs_counter_leaf : public IReadable, public ISystemTreeLeaf
+  {
+  public:
+    proc_fs_counter_leaf(std::shared_ptr<task_process> related_proc, PROC_COUNTER counter);
+    virtual ~proc_fs_counter_leaf();
+
+    virtual ERR_CODE read_bytes(uint64_t start,
+                                uint64_t length,
+                                uint8_t *buffer,
+                                uint64_t buffer_length,
+                                uint64_t &bytes_read) override;
+
+    uint64_t get_value();
+
+  protected:
+    std::weak_ptr<task_process> _related_proc; ///< The process this leaf reports on.
+    PROC_COUNTER _counter; ///< The counter this leaf reports.
+  };
+
+#ifdef KERNEL_LOCKSTAT
+  /// @brief A read-only leaf that reports lock contention statistics as a text table.
+  ///
+  /// The table has one row per lock acquisition site, with the sites that have spent the most time waiting first.
+  class proc_fs_lockstat_leaf : public IReadable, public ISystemTreeLeaf
+  {
+  public:
+    proc_fs_lockstat_leaf();
+    virtual ~proc_fs_lockstat_leaf();
+
+    virtual ERR_CODE read_bytes(uint64_t start,
+                                uint64_t length,
+                                uint8_t *buffer,
+                                uint64_t buffer_length,
+                                uint64_t &bytes_read) override;
+
+    std::string get_table();
+  };
+#endif
+
   /// @brief Branch representing a single running process.
   ///
   class proc_fs_proc_branch : public system_tree_simple_branch
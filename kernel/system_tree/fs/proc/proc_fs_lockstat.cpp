@@ -0,0 +1,185 @@
+/// @file
+/// @brief Implementation of the lock contention statistics leaf of a 'proc'-like filesystem.
+///
+/// The leaf is only present if the kernel is built with KERNEL_LOCKSTAT defined.
+//
+// Known defects:
+// - The table is regenerated on each read, so reading it in several parts might give inconsistent results if locks
+//   are acquired in between.
+
+//#define ENABLE_TRACING
+
+#ifdef KERNEL_LOCKSTAT
+
+#include "klib/klib.h"
+#include "klib/synch/kernel_lockstat.h"
+#include "system_tree/fs/proc/proc_fs.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <memory>
+
+using namespace std;
+
+namespace
+{
+  /// The longest that a single row of the table can be.
+  const uint64_t ROW_BUFFER_LENGTH = 160;
+
+  const char *kind_name(LOCKSTAT_KIND kind);
+}
+
+proc_fs_root_branch::proc_fs_lockstat_leaf::proc_fs_lockstat_leaf()
+{
+  KL_TRC_ENTRY;
+  KL_TRC_EXIT;
+}
+
+proc_fs_root_branch::proc_fs_lockstat_leaf::~proc_fs_lockstat_leaf()
+{
+  KL_TRC_ENTRY;
+  KL_TRC_EXIT;
+}
+
+/// @brief Read the lock statistics table, as text.
+///
+/// Parameters and return values are as for IReadable::read_bytes().
+ERR_CODE proc_fs_root_branch::proc_fs_lockstat_leaf::read_bytes(uint64_t start,
+                                                                uint64_t length,
+                                                                uint8_t *buffer,
+                                                                uint64_t buffer_length,
+                                                                uint64_t &bytes_read)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  std::string table;
+
+  KL_TRC_ENTRY;
+
+  if (buffer == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "No buffer\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else
+  {
+    table = get_table();
+
+    if (start >= table.length())
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Read beyond end of table\n");
+      bytes_read = 0;
+    }
+    else
+    {
+      if ((start + length) > table.length())
+      {
+        length = table.length() - start;
+      }
+      if (length > buffer_length)
+      {
+        length = buffer_length;
+      }
+
+      memcpy(buffer, table.c_str() + start, length);
+      bytes_read = length;
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Generate the lock statistics table.
+///
+/// The table has a header line, followed by one line per acquisition site, with the sites that have waited longest
+/// first. Sites are given as addresses, which can be looked up in the kernel's map file.
+///
+/// @return The table, as a string.
+std::string proc_fs_root_branch::proc_fs_lockstat_leaf::get_table()
+{
+  std::unique_ptr<klib_lockstat_entry[]> entries = std::make_unique<klib_lockstat_entry[]>(LOCKSTAT_MAX_SITES);
+  uint64_t count;
+  char row[ROW_BUFFER_LENGTH];
+  std::string table;
+
+  KL_TRC_ENTRY;
+
+  count = klib_lockstat_snapshot(entries.get(), LOCKSTAT_MAX_SITES);
+
+  snprintf(row,
+           ROW_BUFFER_LENGTH,
+           "%-18s %-8s %12s %12s %16s %16s %16s\n",
+           "site",
+           "kind",
+           "acquisitions",
+           "contended",
+           "wait_cycles",
+           "hold_cycles",
+           "max_hold_cycles");
+  table = row;
+
+  for (uint64_t i = 0; i < count; i++)
+  {
+    snprintf(row,
+             ROW_BUFFER_LENGTH,
+             "%-18p %-8s %12lu %12lu %16lu %16lu %16lu\n",
+             entries[i].site,
+             kind_name(entries[i].kind),
+             entries[i].acquisitions,
+             entries[i].contentions,
+             entries[i].wait_cycles,
+             entries[i].hold_cycles,
+             entries[i].max_hold_cycles);
+    table += row;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Rows: ", count, "\n");
+  KL_TRC_EXIT;
+
+  return table;
+}
+
+namespace
+{
+  /// @brief Give the name of a kind of lock, for the table.
+  ///
+  /// @param kind The kind of lock.
+  ///
+  /// @return The name. No more than 8 characters long.
+  const char *kind_name(LOCKSTAT_KIND kind)
+  {
+    const char *result;
+
+    switch (kind)
+    {
+      case LOCKSTAT_KIND::SPINLOCK:
+        result = "spinlock";
+        break;
+
+      case LOCKSTAT_KIND::MUTEX:
+        result = "mutex";
+        break;
+
+      case LOCKSTAT_KIND::MCS:
+        result = "mcs";
+        break;
+
+      case LOCKSTAT_KIND::RW_READ:
+        result = "rw-read";
+        break;
+
+      case LOCKSTAT_KIND::RW_WRITE:
+        result = "rw-write";
+        break;
+
+      default:
+        result = "unknown";
+    }
+
+    return result;
+  }
+}
+
+#endif
@@ -12,6 +12,29 @@
 
 using namespace std;
 
+namespace
+{
+  /// @brief Names and meanings of the counter leaves created in each process branch.
+  const struct
+  {
+    const char *name; ///< The name of the leaf.
+    proc_fs_root_branch::PROC_COUNTER counter; ///< The counter it reports.
+  } counter_leaves[] = {
+    { "mem_virtual", proc_fs_root_branch::PROC_COUNTER::MEM_VIRTUAL },
+    { "mem_resident", proc_fs_root_branch::PROC_COUNTER::MEM_RESIDENT },
+    { "mem_page_tables", proc_fs_root_branch::PROC_COUNTER::MEM_PAGE_TABLES },
+    { "mem_kernel_heap", proc_fs_root_branch::PROC_COUNTER::MEM_KERNEL_HEAP },
+    { "mem_swapped", proc_fs_root_branch::PROC_COUNTER::MEM_SWAPPED },
+    { "mem_limit_virtual", proc_fs_root_branch::PROC_COUNTER::MEM_LIMIT_VIRTUAL },
+    { "mem_limit_resident", proc_fs_root_branch::PROC_COUNTER::MEM_LIMIT_RESIDENT },
+    { "handles", proc_fs_root_branch::PROC_COUNTER::HANDLES },
+    { "deadline_misses", proc_fs_root_branch::PROC_COUNTER::DEADLINE_MISSES },
+    { "switches_same_process", proc_fs_root_branch::PROC_COUNTER::SWITCHES_SAME_PROCESS },
+    { "switches_cross_process", proc_fs_root_branch::PROC_COUNTER::SWITCHES_CROSS_PROCESS },
+    { "futex_wakeups", proc_fs_root_branch::PROC_COUNTER::FUTEX_WAKEUPS },
+  };
+}
+
 /// @brief Default constructor
 ///
 /// This object should be created using the static create() function.
@@ -41,6 +64,12 @@ proc_fs_root_branch::proc_fs_proc_branch::proc_fs_proc_branch(std::shared_ptr<ta
   ec = system_tree_simple_branch::add_child("id", _id_file);
   ASSERT(ec == ERR_CODE::NO_ERROR);
 
+  for (auto &leaf : counter_leaves)
+  {
+    ec = system_tree_simple_branch::add_child(leaf.name, make_shared<proc_fs_counter_leaf>(related_proc, leaf.counter));
+    ASSERT(ec == ERR_CODE::NO_ERROR);
+  }
+
   KL_TRC_EXIT;
 }
 
@@ -62,5 +91,154 @@ proc_fs_root_branch::proc_fs_proc_branch::~proc_fs_proc_branch()
 
   system_tree_simple_branch::delete_child("id");
 
+  for (auto &leaf : counter_leaves)
+  {
+    system_tree_simple_branch::delete_child(leaf.name);
+  }
+
+  KL_TRC_EXIT;
+}
+
+/// @brief Standard constructor.
+///
+/// @param related_proc The process to report on.
+///
+/// @param counter The counter to report.
+proc_fs_root_branch::proc_fs_counter_leaf::proc_fs_counter_leaf(std::shared_ptr<task_process> related_proc,
+                                                                PROC_COUNTER counter) :
+  _related_proc(related_proc), _counter(counter)
+{
+  KL_TRC_ENTRY;
+  KL_TRC_EXIT;
+}
+
+proc_fs_root_branch::proc_fs_counter_leaf::~proc_fs_counter_leaf()
+{
+  KL_TRC_ENTRY;
+  KL_TRC_EXIT;
+}
+
+/// @brief Read the current value of the counter, as a null-terminated decimal string.
+///
+/// Parameters and return values are as for IReadable::read_bytes().
+ERR_CODE proc_fs_root_branch::proc_fs_counter_leaf::read_bytes(uint64_t start,
+                                                               uint64_t length,
+                                                               uint8_t *buffer,
+                                                               uint64_t buffer_length,
+                                                               uint64_t &bytes_read)
+{
+  ERR_CODE result = ERR_CODE::NO_ERROR;
+  char value_buffer[22];
+  uint64_t strl;
+
+  KL_TRC_ENTRY;
+
+  snprintf(value_buffer, 22, "%lu", get_value());
+  strl = strnlen(value_buffer, 22) + 1;
+
+  if (buffer == nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "No buffer\n");
+    result = ERR_CODE::INVALID_PARAM;
+  }
+  else if (start >= strl)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Read beyond end of value\n");
+    bytes_read = 0;
+  }
+  else
+  {
+    if ((start + length) > strl)
+    {
+      length = strl - start;
+    }
+    if (length > buffer_length)
+    {
+      length = buffer_length;
+    }
+
+    memcpy(buffer, value_buffer + start, length);
+    bytes_read = length;
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", result, "\n");
+  KL_TRC_EXIT;
+
+  return result;
+}
+
+/// @brief Retrieve the current value of the counter.
+///
+/// @return The current value of the counter, or zero if the process no longer exists.
+uint64_t proc_fs_root_branch::proc_fs_counter_leaf::get_value()
+{
+  uint64_t result = 0;
+  std::shared_ptr<task_process> proc = _related_proc.lock();
+  mem_process_stats *stats = nullptr;
+
+  KL_TRC_ENTRY;
+
+  if (proc != nullptr)
+  {
+    stats = mem_acct_get_stats(proc.get());
+  }
+
+  if (stats != nullptr)
+  {
+    switch (_counter)
+    {
+      case PROC_COUNTER::MEM_VIRTUAL:
+        result = stats->virtual_pages * MEM_PAGE_SIZE;
+        break;
+
+      case PROC_COUNTER::MEM_RESIDENT:
+        result = stats->resident_pages * MEM_PAGE_SIZE;
+        break;
+
+      case PROC_COUNTER::MEM_PAGE_TABLES:
+        result = stats->page_table_pages;
+        break;
+
+      case PROC_COUNTER::MEM_KERNEL_HEAP:
+        result = stats->kernel_heap_bytes;
+        break;
+
+      case PROC_COUNTER::MEM_SWAPPED:
+        result = stats->swapped_pages * MEM_PAGE_SIZE;
+        break;
+
+      case PROC_COUNTER::MEM_LIMIT_VIRTUAL:
+        result = stats->virtual_limit_pages * MEM_PAGE_SIZE;
+        break;
+
+      case PROC_COUNTER::MEM_LIMIT_RESIDENT:
+        result = stats->resident_limit_pages * MEM_PAGE_SIZE;
+        break;
+
+      case PROC_COUNTER::HANDLES:
+        result = proc->proc_handles.num_objects();
+        break;
+
+      case PROC_COUNTER::DEADLINE_MISSES:
+        result = proc->deadline_misses;
+        break;
+
+      case PROC_COUNTER::SWITCHES_SAME_PROCESS:
+        result = proc->same_process_switches;
+        break;
+
+      case PROC_COUNTER::SWITCHES_CROSS_PROCESS:
+        result = proc->cross_process_switches;
+        break;
+
+      case PROC_COUNTER::FUTEX_WAKEUPS:
+        result = proc->futex_wakeups;
+        break;
+    }
+  }
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Value: ", result, "\n");
   KL_TRC_EXIT;
+
+  return result;
 }
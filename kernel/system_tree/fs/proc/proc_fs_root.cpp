@@ -17,6 +17,11 @@ proc_fs_root_branch::proc_fs_root_branch() :
 {
   KL_TRC_ENTRY;
 
+#ifdef KERNEL_LOCKSTAT
+  ERR_CODE ec = system_tree_simple_branch::add_child("lockstat", std::make_shared<proc_fs_lockstat_leaf>());
+  ASSERT(ec == ERR_CODE::NO_ERROR);
+#endif
+
   KL_TRC_EXIT;
 }
 
@@ -34,6 +39,7 @@ ERR_CODE proc_fs_root_branch::add_child(const std::string &name, std::shared_ptr
   std::string first_part;
   std::string second_part;
   std::shared_ptr<ISystemTreeBranch> child_branch;
+  std::shared_ptr<ISystemTreeLeaf> direct_child;
 
   ERR_CODE result;
   KL_TRC_ENTRY;
@@ -44,14 +50,15 @@ ERR_CODE proc_fs_root_branch::add_child(const std::string &name, std::shared_ptr
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Attempt to add child to existing branch\n");
 
-    if (!map_contains(this->children, first_part))
+    direct_child = get_direct_child(first_part);
+    if (!direct_child)
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "Child branch not found anyway\n");
       result = ERR_CODE::NOT_FOUND;
     }
     else
     {
-      child_branch = std::dynamic_pointer_cast<ISystemTreeBranch>(this->children.find(first_part)->second);
+      child_branch = std::dynamic_pointer_cast<ISystemTreeBranch>(direct_child);
       if (child_branch != nullptr)
       {
         KL_TRC_TRACE(TRC_LVL::FLOW, "Try to add child to branch\n");
@@ -74,8 +74,8 @@ std::shared_ptr<ISystemTreeBranch> proc_fs_root_branch::proc_fs_zero_proxy_branc
 
   // This is an if-statement because it's possible that I've forgotten a window condition somewhere. The panic will do
   // for now.
-  ASSERT(map_contains(parent_branch->children, branch_name));
-  leaf = parent_branch->children[branch_name];
+  leaf = parent_branch->get_direct_child(branch_name);
+  ASSERT(leaf);
 
   cur_proc_branch = std::dynamic_pointer_cast<ISystemTreeBranch>(leaf);
   ASSERT(cur_proc_branch);
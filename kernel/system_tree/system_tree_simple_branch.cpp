@@ -5,13 +5,21 @@
 
 #include <string>
 #include "klib/klib.h"
+#include "klib/synch/kernel_rcu.h"
 #include "system_tree/system_tree_simple_branch.h"
 
+namespace
+{
+  // Tracks lookups in all simple branches, so that replaced child maps can be freed safely.
+  klib_rcu_domain system_tree_rcu;
+}
+
 system_tree_simple_branch::system_tree_simple_branch()
 {
   KL_TRC_ENTRY;
 
   klib_synch_spinlock_init(child_tree_lock);
+  children = new child_map();
 
   KL_TRC_EXIT;
 }
@@ -20,6 +28,9 @@ system_tree_simple_branch::~system_tree_simple_branch()
 {
   KL_TRC_ENTRY;
 
+  // Nothing else can be looking at this branch while it is being destroyed.
+  delete children.load();
+
   KL_TRC_EXIT;
 }
 
@@ -37,11 +48,10 @@ ERR_CODE system_tree_simple_branch::get_child(const std::string &name,
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Looking for child with name ", name, "to store in ", &child, "\n");
 
   this->split_name(name, our_part, child_part);
-  klib_synch_spinlock_lock(child_tree_lock);
-  if (map_contains(children, our_part))
+  direct_child = get_direct_child(our_part);
+  if (direct_child)
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Retrieve direct child\n");
-    direct_child = children.find(our_part)->second;
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Retrieved direct child\n");
 
     if (child_part != "")
     {
@@ -70,7 +80,6 @@ ERR_CODE system_tree_simple_branch::get_child(const std::string &name,
     KL_TRC_TRACE(TRC_LVL::FLOW, "Not a child of ours...\n");
     ret_code = ERR_CODE::NOT_FOUND;
   }
-  klib_synch_spinlock_unlock(child_tree_lock);
 
   KL_TRC_EXIT;
 
@@ -85,11 +94,13 @@ ERR_CODE system_tree_simple_branch::add_child (const std::string &name, std::sha
   std::string next_branch_name;
   std::string continuation_name;
   std::shared_ptr<ISystemTreeBranch> child_branch;
+  std::shared_ptr<ISystemTreeLeaf> direct_child;
+  child_map *old_children = nullptr;
+  child_map *new_children;
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Adding leaf with name ", name, " and address ", child.get(), "\n");
   split_pos = name.find("\\");
 
-  klib_synch_spinlock_lock(child_tree_lock);
   if (child == nullptr)
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Can't add null leaf\n");
@@ -107,14 +118,15 @@ ERR_CODE system_tree_simple_branch::add_child (const std::string &name, std::sha
 
     KL_TRC_TRACE(TRC_LVL::FLOW, "Looking for ", continuation_name, " in ", next_branch_name, "\n");
 
-    if (!map_contains(this->children, next_branch_name))
+    direct_child = get_direct_child(next_branch_name);
+    if (!direct_child)
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "Child branch not found anyway\n");
       rt = ERR_CODE::NOT_FOUND;
     }
     else
     {
-      child_branch = std::dynamic_pointer_cast<ISystemTreeBranch>(this->children.find(next_branch_name)->second);
+      child_branch = std::dynamic_pointer_cast<ISystemTreeBranch>(direct_child);
       if (child_branch != nullptr)
       {
         KL_TRC_TRACE(TRC_LVL::FLOW, "Try to add child to branch\n");
@@ -127,16 +139,25 @@ ERR_CODE system_tree_simple_branch::add_child (const std::string &name, std::sha
       }
     }
   }
-  else if (map_contains(children, name))
-  {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Already got a child of that name\n");
-    rt = ERR_CODE::ALREADY_EXISTS;
-  }
   else
   {
-    this->children.insert({name, child});
+    klib_synch_spinlock_lock(child_tree_lock);
+    if (map_contains(*children.load(), name))
+    {
+      KL_TRC_TRACE(TRC_LVL::FLOW, "Already got a child of that name\n");
+      rt = ERR_CODE::ALREADY_EXISTS;
+    }
+    else
+    {
+      old_children = children.load();
+      new_children = new child_map(*old_children);
+      new_children->insert({name, child});
+      children.store(new_children, std::memory_order_release);
+    }
+    klib_synch_spinlock_unlock(child_tree_lock);
+
+    retire_children(old_children);
   }
-  klib_synch_spinlock_unlock(child_tree_lock);
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", rt, "\n");
 
@@ -204,13 +225,14 @@ ERR_CODE system_tree_simple_branch::rename_child(const std::string &old_name, co
   std::string child_branch;
   std::string grandchild_old_name;
   std::string grandchild_new_name;
+  child_map *old_children = nullptr;
+  child_map *new_children;
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Renaming leaf with name ", old_name, " to ", &new_name, "\n");
 
   old_dir_split = old_name.find("\\");
   new_dir_split = new_name.find("\\");
 
-  klib_synch_spinlock_lock(child_tree_lock);
   if ((old_dir_split != std::string::npos) && (old_dir_split == new_dir_split))
   {
     child_branch = old_name.substr(0, old_dir_split);
@@ -225,11 +247,6 @@ ERR_CODE system_tree_simple_branch::rename_child(const std::string &old_name, co
       KL_TRC_TRACE(TRC_LVL::FLOW, "Can't move between two different child branches\n");
       rt = ERR_CODE::INVALID_OP;
     }
-    else if (!map_contains(this->children, child_branch))
-    {
-      KL_TRC_TRACE(TRC_LVL::FLOW, "The child does not exist\n");
-      rt = ERR_CODE::NOT_FOUND;
-    }
     else
     {
       grandchild_old_name = old_name.substr(old_dir_split + 1, std::string::npos);
@@ -255,20 +272,26 @@ ERR_CODE system_tree_simple_branch::rename_child(const std::string &old_name, co
   }
   else
   {
-    if (map_contains(children, old_name))
+    klib_synch_spinlock_lock(child_tree_lock);
+    if (map_contains(*children.load(), old_name))
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "Doing the rename\n");
-      l = this->children.find(old_name)->second;
-      this->children.erase(old_name);
-      this->children.insert({new_name, l});
+      old_children = children.load();
+      new_children = new child_map(*old_children);
+      l = new_children->find(old_name)->second;
+      new_children->erase(old_name);
+      new_children->insert({new_name, l});
+      children.store(new_children, std::memory_order_release);
     }
     else
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "Not found!\n");
       rt = ERR_CODE::NOT_FOUND;
     }
+    klib_synch_spinlock_unlock(child_tree_lock);
+
+    retire_children(old_children);
   }
-  klib_synch_spinlock_unlock(child_tree_lock);
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", rt, "\n");
   KL_TRC_EXIT;
@@ -284,16 +307,21 @@ ERR_CODE system_tree_simple_branch::delete_child(const std::string &name)
   std::string our_branch;
   std::string grandchild;
   std::shared_ptr<ISystemTreeBranch> branch;
+  child_map *old_children = nullptr;
+  child_map *new_children;
 
   split_pos = name.find("\\");
 
-  klib_synch_spinlock_lock(child_tree_lock);
   if (split_pos == std::string::npos)
   {
-    if (map_contains(children, name))
+    klib_synch_spinlock_lock(child_tree_lock);
+    if (map_contains(*children.load(), name))
     {
       KL_TRC_TRACE(TRC_LVL::FLOW, "Deleting a direct child\n");
-      children.erase(name);
+      old_children = children.load();
+      new_children = new child_map(*old_children);
+      new_children->erase(name);
+      children.store(new_children, std::memory_order_release);
       rt = ERR_CODE::NO_ERROR;
     }
     else
@@ -301,6 +329,10 @@ ERR_CODE system_tree_simple_branch::delete_child(const std::string &name)
       KL_TRC_TRACE(TRC_LVL::FLOW, "Not found\n");
       rt = ERR_CODE::NOT_FOUND;
     }
+    klib_synch_spinlock_unlock(child_tree_lock);
+
+    // The deleted child is only released once lookups that might have found it are finished.
+    retire_children(old_children);
   }
   else
   {
@@ -318,7 +350,6 @@ ERR_CODE system_tree_simple_branch::delete_child(const std::string &name)
       rt = ERR_CODE::NOT_FOUND;
     }
   }
-  klib_synch_spinlock_unlock(child_tree_lock);
 
   KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", rt, "\n");
   KL_TRC_EXIT;
@@ -337,12 +368,10 @@ std::shared_ptr<ISystemTreeBranch> system_tree_simple_branch::get_child_branch(c
   std::shared_ptr<ISystemTreeLeaf> direct_child;
   KL_TRC_ENTRY;
 
-  // Don't lock here. This function should only be called internally, and thus should be lock-aware already.
-  if (map_contains(children, name))
+  direct_child = get_direct_child(name);
+  if (direct_child)
   {
-    KL_TRC_TRACE(TRC_LVL::FLOW, "Retrieve child object\n");
-    direct_child = children.find(name)->second;
-
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Retrieved child object\n");
     child = std::dynamic_pointer_cast<ISystemTreeBranch>(direct_child);
   }
 
@@ -351,12 +380,21 @@ std::shared_ptr<ISystemTreeBranch> system_tree_simple_branch::get_child_branch(c
 
   return child;
 }
+
 std::pair<ERR_CODE, uint64_t> system_tree_simple_branch::num_children()
 {
+  uint64_t token;
+  uint64_t count;
+
   KL_TRC_ENTRY;
+
+  token = klib_rcu_read_lock(system_tree_rcu);
+  count = children.load(std::memory_order_acquire)->size();
+  klib_rcu_read_unlock(system_tree_rcu, token);
+
   KL_TRC_EXIT;
 
-  return {ERR_CODE::NO_ERROR, children.size() };
+  return {ERR_CODE::NO_ERROR, count };
 }
 
 std::pair<ERR_CODE, std::vector<std::string>>
@@ -368,15 +406,18 @@ system_tree_simple_branch::enum_children(std::string start_from, uint64_t max_co
 
   KL_TRC_ENTRY;
 
+  // Building the list allocates memory, which may wait, so this isn't done in a read-side section. Holding the lock
+  // stops the map being replaced, and so freed, instead.
   klib_synch_spinlock_lock(child_tree_lock);
-  auto it = children.begin();
+  child_map *cur_children = children.load();
+  auto it = cur_children->begin();
   if (start_from != "")
   {
     KL_TRC_TRACE(TRC_LVL::FLOW, "Use given name for start point\n");
-    it = children.lower_bound(start_from);
+    it = cur_children->lower_bound(start_from);
   }
 
-  while (((max_count == 0) || (max_count > cur_count)) && (it != children.end()))
+  while (((max_count == 0) || (max_count > cur_count)) && (it != cur_children->end()))
   {
     std::string name{it->first};
     child_list.push_back(std::move(name));
@@ -391,3 +432,53 @@ system_tree_simple_branch::enum_children(std::string start_from, uint64_t max_co
 
   return { result, std::move(child_list) };
 }
+
+/// @brief Find a direct child of this branch, without taking any locks.
+///
+/// @param name The name of the child to find. This must not contain a path separator.
+///
+/// @return The child, or nullptr if there is no child with that name.
+std::shared_ptr<ISystemTreeLeaf> system_tree_simple_branch::get_direct_child(const std::string &name)
+{
+  std::shared_ptr<ISystemTreeLeaf> child;
+  child_map *cur_children;
+  uint64_t token;
+
+  KL_TRC_ENTRY;
+
+  // Copying the pointer out of the map takes a reference to the child, so it remains valid after the read-side section
+  // ends even if the map is freed.
+  token = klib_rcu_read_lock(system_tree_rcu);
+  cur_children = children.load(std::memory_order_acquire);
+  auto it = cur_children->find(name);
+  if (it != cur_children->end())
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Found child\n");
+    child = it->second;
+  }
+  klib_rcu_read_unlock(system_tree_rcu, token);
+
+  KL_TRC_TRACE(TRC_LVL::EXTRA, "Result: ", child.get(), "\n");
+  KL_TRC_EXIT;
+
+  return child;
+}
+
+/// @brief Free a child map that has been replaced, once no lookups can still be using it.
+///
+/// This waits for lookups to finish, so it must not be called while holding child_tree_lock.
+///
+/// @param old_children The replaced map. If nullptr, nothing happens.
+void system_tree_simple_branch::retire_children(child_map *old_children)
+{
+  KL_TRC_ENTRY;
+
+  if (old_children != nullptr)
+  {
+    KL_TRC_TRACE(TRC_LVL::FLOW, "Wait for lookups, then free ", old_children, "\n");
+    klib_rcu_synchronize(system_tree_rcu);
+    delete old_children;
+  }
+
+  KL_TRC_EXIT;
+}
@@ -7,11 +7,16 @@
 #include <map>
 #include <vector>
 #include <memory>
+#include <atomic>
 
 #include "klib/klib.h"
 #include "system_tree/system_tree_branch.h"
 
 /// @brief A simple System Tree Branch class that can be used as a basis for others.
+///
+/// Lookups don't take any locks. The children of the branch are kept in a map that is never changed once published.
+/// Instead, changes are made to a copy of the map, which then replaces the original. The old map is freed once no
+/// lookups can still be using it, which is tracked using the system tree's RCU domain.
 class system_tree_simple_branch : public ISystemTreeBranch
 {
 public:
@@ -28,8 +33,17 @@ public:
     enum_children(std::string start_from, uint64_t max_count) override;
 
 protected:
-  /// Stores the child leaves of this branch.
-  std::map<std::string, std::shared_ptr<ISystemTreeLeaf>> children;
+  /// The type of the map storing the children of a branch.
+  typedef std::map<std::string, std::shared_ptr<ISystemTreeLeaf>> child_map;
+
+  /// @brief Stores the child leaves of this branch.
+  ///
+  /// The map this points to must not be changed. Only look it up while inside a read-side section of the system tree's
+  /// RCU domain, or while holding child_tree_lock.
+  std::atomic<child_map *> children;
+
+  std::shared_ptr<ISystemTreeLeaf> get_direct_child(const std::string &name);
+  void retire_children(child_map *old_children);
 
   /// @brief Create a child on this branch.
   ///
@@ -59,6 +73,6 @@ protected:
   /// @return The branch object, if name represents a branch. False otherwise.
   virtual std::shared_ptr<ISystemTreeBranch> get_child_branch(const std::string &name);
 
-  /// @brief Lock protecting operations on this branch.
+  /// @brief Lock serialising changes to this branch. Lookups don't need it.
   kernel_spinlock child_tree_lock;
 };
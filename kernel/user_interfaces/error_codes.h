@@ -115,6 +115,12 @@ enum AZALEA_ENUM_CLASS ERR_CODE_T
    *  The operation timed out
    */
   TIMED_OUT = 19,
+
+  /**
+   *  The value of a synchronization object changed before the operation could be carried out. The operation may be
+   *  retried.
+   */
+  SYNC_VALUE_CHANGED = 20,
 };
 
 /**
@@ -137,8 +137,10 @@ struct ssm_output
 enum AZALEA_ENUM_CLASS FUTEX_OP_T
 {
   FUTEX_WAIT = 0, /**< Wait on this futex */
-  FUTEX_WAKE = 1, /**< Wake all waiters for this futex */
-  FUTEX_REQUEUE = 2, /**< Requeue a number of waiters on one futex to another futex */
+  FUTEX_WAKE = 1, /**< Wake up to req_value waiters for this futex, in the order they started waiting */
+  FUTEX_REQUEUE = 2, /**< Wake up to req_value waiters on one futex, then move up to timeout_ns more to another */
+  FUTEX_CMP_REQUEUE = 3, /**< As FUTEX_REQUEUE, but only if the first futex still contains v3 */
+  FUTEX_WAKE_OP = 4, /**< Change the second futex as encoded in v3, then wake waiters on one or both futexes */
 };
 
 /**
@@ -147,4 +149,80 @@ AZALEA_RENAME_ENUM(FUTEX_OP);
 /**
  * @endcond */
 
+/** Combine with a FUTEX_OP for futexes in memory shared between processes. Without it, a futex is private to the
+ *  calling process, which is cheaper and safe in memory that may be swapped out. */
+#define FUTEX_SHARED_FLAG 128
+
+/**
+ * @brief Atomic operations that FUTEX_WAKE_OP can carry out on its second futex.
+ */
+enum AZALEA_ENUM_CLASS FUTEX_ATOMIC_OP_T
+{
+  ENUM_TAG(FUTEX_ATOMIC_, SET) = 0, /**< Set the futex to the argument */
+  ENUM_TAG(FUTEX_ATOMIC_, ADD) = 1, /**< Add the argument to the futex */
+  ENUM_TAG(FUTEX_ATOMIC_, OR) = 2, /**< Bitwise OR the argument into the futex */
+  ENUM_TAG(FUTEX_ATOMIC_, ANDN) = 3, /**< Clear the bits of the argument in the futex */
+  ENUM_TAG(FUTEX_ATOMIC_, XOR) = 4, /**< Bitwise XOR the argument into the futex */
+};
+
+/**
+ * @cond */
+AZALEA_RENAME_ENUM(FUTEX_ATOMIC_OP);
+/**
+ * @endcond */
+
+/** Combine with a FUTEX_ATOMIC_OP to use 1 << argument as the argument. */
+#define FUTEX_ATOMIC_OP_ARG_SHIFT 8
+
+/**
+ * @brief Comparisons that FUTEX_WAKE_OP can make against the old value of its second futex.
+ */
+enum AZALEA_ENUM_CLASS FUTEX_ATOMIC_CMP_T
+{
+  ENUM_TAG(FUTEX_CMP_, EQ) = 0, /**< Old value equals the argument */
+  ENUM_TAG(FUTEX_CMP_, NE) = 1, /**< Old value doesn't equal the argument */
+  ENUM_TAG(FUTEX_CMP_, LT) = 2, /**< Old value is less than the argument */
+  ENUM_TAG(FUTEX_CMP_, LE) = 3, /**< Old value is less than or equal to the argument */
+  ENUM_TAG(FUTEX_CMP_, GT) = 4, /**< Old value is greater than the argument */
+  ENUM_TAG(FUTEX_CMP_, GE) = 5, /**< Old value is greater than or equal to the argument */
+};
+
+/**
+ * @cond */
+AZALEA_RENAME_ENUM(FUTEX_ATOMIC_CMP);
+/**
+ * @endcond */
+
+/** Encode the v3 parameter of FUTEX_WAKE_OP, in the same layout as Linux. op is a FUTEX_ATOMIC_OP, optionally combined
+ *  with FUTEX_ATOMIC_OP_ARG_SHIFT, and cmp is a FUTEX_ATOMIC_CMP. The two arguments are signed 12-bit values. */
+#define FUTEX_WAKE_OP_ENCODE(op, op_arg, cmp, cmp_arg) \
+  ((((uint32_t)(op) & 0xF) << 28) | (((uint32_t)(cmp) & 0xF) << 24) | \
+   (((uint32_t)(op_arg) & 0xFFF) << 12) | ((uint32_t)(cmp_arg) & 0xFFF))
+
+/**
+ * @brief Scheduling priority levels for threads.
+ *
+ * A runnable thread is always scheduled ahead of runnable threads at lower priority levels. Threads at the same level
+ * share the processor fairly, weighted by their nice values.
+ */
+enum AZALEA_ENUM_CLASS THREAD_PRIORITY_T
+{
+  ENUM_TAG(THREAD_PRIORITY, HIGH) = 0, /**< Latency-sensitive threads, such as those handling user input. */
+  ENUM_TAG(THREAD_PRIORITY, NORMAL) = 1, /**< The default for all threads. */
+  ENUM_TAG(THREAD_PRIORITY, BATCH) = 2, /**< Background work that only runs when nothing else needs the processor. */
+};
+
+/**
+ * @cond */
+AZALEA_RENAME_ENUM(THREAD_PRIORITY);
+/**
+ * @endcond */
+
+#define THREAD_NICE_MIN -20 /**< The lowest nice value, which gives a thread the largest share of the processor. */
+#define THREAD_NICE_MAX 19 /**< The highest nice value, which gives a thread the smallest share of the processor. */
+
+/** An affinity mask allowing a thread to run on any processor. Bit n of an affinity mask is set if the thread may run
+ *  on processor n. */
+#define THREAD_AFFINITY_ALL 0xFFFFFFFFFFFFFFFFULL
+
 #endif
@@ -82,6 +82,13 @@ ERR_CODE syscall_destroy_thread(GEN_HANDLE thread_handle);
 void syscall_exit_thread();
 
 ERR_CODE syscall_thread_set_tls_base(TLS_REGISTERS reg, uint64_t value);
+ERR_CODE syscall_set_thread_priority(GEN_HANDLE thread_handle, THREAD_PRIORITY priority, int8_t nice);
+ERR_CODE syscall_set_thread_deadline(GEN_HANDLE thread_handle,
+                                     uint64_t runtime_ns,
+                                     uint64_t deadline_ns,
+                                     uint64_t period_ns);
+ERR_CODE syscall_set_thread_affinity(GEN_HANDLE thread_handle, uint64_t affinity);
+ERR_CODE syscall_get_thread_affinity(GEN_HANDLE thread_handle, uint64_t *affinity);
 
 /* Memory allocation / deallocation */
 ERR_CODE syscall_allocate_backing_memory(uint64_t pages, void **map_addr);
@@ -95,6 +102,18 @@ ERR_CODE syscall_map_memory(GEN_HANDLE proc_mapping_in,
                             void *extant_addr);
 ERR_CODE syscall_unmap_memory();
 
+/* Shared memory sections */
+ERR_CODE syscall_create_section(const char *path, uint64_t path_len, uint64_t pages, GEN_HANDLE *handle);
+ERR_CODE syscall_map_section(GEN_HANDLE section_handle, void **map_addr);
+
+/* Mapped files */
+ERR_CODE syscall_map_file(GEN_HANDLE file_handle, uint64_t offset, uint64_t length, void **map_addr);
+ERR_CODE syscall_sync_file_mapping(void *map_addr);
+ERR_CODE syscall_unmap_file(void *map_addr);
+
+/* Memory accounting */
+ERR_CODE syscall_set_mem_limits(GEN_HANDLE proc_handle, uint64_t max_virtual_pages, uint64_t max_resident_pages);
+
 /* Thread synchronization */
 ERR_CODE syscall_wait_for_object(GEN_HANDLE wait_object_handle, uint64_t max_wait);
 ERR_CODE syscall_futex_op(volatile int32_t *futex,
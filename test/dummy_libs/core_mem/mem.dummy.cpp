@@ -68,6 +68,18 @@ void *mem_get_phys_addr(void *virtual_addr, task_process *context)
   return nullptr;
 }
 
+bool mem_test_and_clear_dirty(void *virtual_addr, task_process *context)
+{
+  // Nothing is ever really mapped in the test code, so nothing can be dirty.
+  return false;
+}
+
+bool mem_test_and_clear_accessed(void *virtual_addr, task_process *context)
+{
+  // As above, nothing can have been accessed.
+  return false;
+}
+
 bool mem_is_valid_virt_addr(uint64_t virtual_addr)
 {
   // It's reasonable to assume 'yes' in the test code, because all allocations ultimately come from the OS.
@@ -18,16 +18,41 @@ namespace
 {
   uint64_t fake_ptr_target = 5;
   task_thread *fake_cur_thread{nullptr};
+  uint32_t fake_proc_count{1};
+  uint32_t fake_proc_id{0};
+  uint64_t fake_next_tick{0};
+  uint32_t fake_wakes{0};
+
+  // Per-processor records of ticks and signals, for tests that simulate several processors.
+  const uint32_t fake_max_procs = 64;
+  uint64_t fake_proc_ticks[fake_max_procs];
+  bool fake_proc_tick_set[fake_max_procs];
+  bool fake_proc_kicked[fake_max_procs];
 }
 
 uint32_t proc_mp_proc_count()
 {
-  return 1;
+  return fake_proc_count;
 }
 
 uint32_t proc_mp_this_proc_id()
 {
-  return 0;
+  return fake_proc_id;
+}
+
+void test_only_set_proc_count(uint32_t count)
+{
+  fake_proc_count = count;
+}
+
+void test_only_set_proc_id(uint32_t proc_id)
+{
+  fake_proc_id = proc_id;
+}
+
+void proc_mp_signal_all_processors(PROC_IPI_MSGS msg, bool exclude_self, bool wait_for_complete)
+{
+  // The other processors in the test code are not real, and nothing is really mapped, so there is nothing to signal.
 }
 
 void task_platform_init()
@@ -52,6 +77,71 @@ void task_install_task_switcher()
   // Nothing to do.
 }
 
+void task_platform_set_next_tick(uint64_t delay_ns)
+{
+  fake_next_tick = delay_ns;
+
+  if (fake_proc_id < fake_max_procs)
+  {
+    fake_proc_ticks[fake_proc_id] = delay_ns;
+    fake_proc_tick_set[fake_proc_id] = true;
+  }
+}
+
+uint64_t test_only_get_next_tick()
+{
+  return fake_next_tick;
+}
+
+void task_platform_wake_proc(uint32_t proc_id)
+{
+  fake_wakes++;
+
+  if (proc_id < fake_max_procs)
+  {
+    fake_proc_kicked[proc_id] = true;
+  }
+}
+
+uint32_t test_only_get_proc_wakes()
+{
+  return fake_wakes;
+}
+
+// Has the given processor programmed its tick since the last call? If so, delay_ns is set to the programmed delay.
+bool test_only_take_proc_tick(uint32_t proc_id, uint64_t &delay_ns)
+{
+  bool result = false;
+
+  if ((proc_id < fake_max_procs) && fake_proc_tick_set[proc_id])
+  {
+    delay_ns = fake_proc_ticks[proc_id];
+    fake_proc_tick_set[proc_id] = false;
+    result = true;
+  }
+
+  return result;
+}
+
+// Has the given processor been signalled by another processor since the last call?
+bool test_only_take_proc_kick(uint32_t proc_id)
+{
+  bool result = false;
+
+  if (proc_id < fake_max_procs)
+  {
+    result = fake_proc_kicked[proc_id];
+    fake_proc_kicked[proc_id] = false;
+  }
+
+  return result;
+}
+
+void task_platform_idle()
+{
+  // Idle threads are never actually executed in the tests.
+}
+
 task_thread *task_get_cur_thread()
 {
   return fake_cur_thread;
@@ -75,11 +165,32 @@ void dummy_thread_fn()
   // Doesn't do anything.
 }
 
+uint64_t proc_save_and_stop_interrupts()
+{
+  // There are no real interrupts in the test code, so just pretend they were enabled.
+  return 0x200;
+}
+
+void proc_restore_interrupts(uint64_t saved_flags)
+{
+  // Nothing to do.
+}
+
 void proc_write_msr(PROC_X64_MSRS msr, uint64_t value)
 {
   panic("Can't write MSRs in test code");
 }
 
+void proc_x64_write_fs_base(uint64_t value)
+{
+  panic("Can't write FS base in test code");
+}
+
+void proc_x64_write_user_gs_base(uint64_t value)
+{
+  panic("Can't write GS base in test code");
+}
+
 void task_set_start_params(task_process * process, uint64_t argc, char **argv, char **env)
 {
   // Doesn't mean anything in the test scripts.
@@ -13,6 +13,11 @@ void time_stall_process(uint64_t wait_in_ns)
   test_spin_sleep(wait_in_ns);
 }
 
+void time_sleep_process(uint64_t wait_in_ns)
+{
+  test_spin_sleep(wait_in_ns);
+}
+
 bool time_get_current_time(time_expanded &time)
 {
   return false;
@@ -0,0 +1,115 @@
+#include <memory>
+#include <string.h>
+
+#include "klib/misc/compression.h"
+#include "test/test_core/test.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+namespace
+{
+  // Compress and then decompress a buffer, checking that the result matches the input.
+  void round_trip(const uint8_t *input, uint64_t input_len)
+  {
+    uint64_t compressed_max = input_len + (input_len / 255) + 16;
+    unique_ptr<uint8_t[]> compressed(new uint8_t[compressed_max]);
+    unique_ptr<uint8_t[]> output(new uint8_t[input_len + 1]);
+    unique_ptr<klib_lz_workspace> workspace(new klib_lz_workspace);
+    uint64_t compressed_len;
+    uint64_t output_len;
+
+    compressed_len = klib_lz_compress(input, input_len, compressed.get(), compressed_max, *workspace);
+    ASSERT_NE(compressed_len, 0);
+
+    output_len = klib_lz_decompress(compressed.get(), compressed_len, output.get(), input_len + 1);
+    ASSERT_EQ(output_len, input_len);
+    ASSERT_EQ(memcmp(input, output.get(), input_len), 0);
+  }
+}
+
+TEST(CompressionTest, ShortInputs)
+{
+  const uint8_t input[] = { 'a', 'b', 'c' };
+
+  round_trip(input, 0);
+  round_trip(input, 1);
+  round_trip(input, 3);
+}
+
+TEST(CompressionTest, RepeatedText)
+{
+  const char *text = "The quick brown fox jumps over the lazy dog. ";
+  const uint64_t text_len = strlen(text);
+  const uint64_t input_len = 10000;
+  unique_ptr<uint8_t[]> input(new uint8_t[input_len]);
+
+  for (uint64_t i = 0; i < input_len; i++)
+  {
+    input[i] = text[i % text_len];
+  }
+
+  round_trip(input.get(), input_len);
+}
+
+TEST(CompressionTest, ZeroPageCompressesWell)
+{
+  const uint64_t page_len = 2 * 1024 * 1024;
+  unique_ptr<uint8_t[]> input(new uint8_t[page_len]);
+  unique_ptr<uint8_t[]> compressed(new uint8_t[page_len / 64]);
+  unique_ptr<klib_lz_workspace> workspace(new klib_lz_workspace);
+  uint64_t compressed_len;
+
+  memset(input.get(), 0, page_len);
+  input[page_len / 2] = 1;
+
+  compressed_len = klib_lz_compress(input.get(), page_len, compressed.get(), page_len / 64, *workspace);
+  ASSERT_NE(compressed_len, 0);
+  ASSERT_LT(compressed_len, page_len / 64);
+
+  round_trip(input.get(), page_len);
+}
+
+TEST(CompressionTest, IncompressibleData)
+{
+  const uint64_t input_len = 65536;
+  unique_ptr<uint8_t[]> input(new uint8_t[input_len]);
+  unique_ptr<uint8_t[]> compressed(new uint8_t[input_len]);
+  unique_ptr<klib_lz_workspace> workspace(new klib_lz_workspace);
+  uint32_t seed = 12345;
+
+  for (uint64_t i = 0; i < input_len; i++)
+  {
+    seed = (seed * 1103515245) + 12345;
+    input[i] = static_cast<uint8_t>(seed >> 16);
+  }
+
+  // Compression is abandoned if the output buffer isn't large enough...
+  ASSERT_EQ(klib_lz_compress(input.get(), input_len, compressed.get(), (input_len / 4) * 3, *workspace), 0);
+
+  // ... but succeeds given enough room.
+  round_trip(input.get(), input_len);
+}
+
+TEST(CompressionTest, CorruptData)
+{
+  uint8_t output[32];
+
+  // A match pointing before the start of the output.
+  const uint8_t bad_offset[] = { 0x10, 'a', 0x05, 0x00, 0x00 };
+  ASSERT_EQ(klib_lz_decompress(bad_offset, sizeof(bad_offset), output, sizeof(output)), 0);
+
+  // More literals than there is input.
+  const uint8_t short_literals[] = { 0x50, 'a', 'b' };
+  ASSERT_EQ(klib_lz_decompress(short_literals, sizeof(short_literals), output, sizeof(output)), 0);
+
+  // A match longer than the output buffer.
+  const uint8_t long_match[] = { 0x1F, 'a', 0x01, 0x00, 0x20, 0x00 };
+  ASSERT_EQ(klib_lz_decompress(long_match, sizeof(long_match), output, sizeof(output)), 0);
+
+  // The same match fits in a larger buffer.
+  uint8_t large_output[64];
+  ASSERT_EQ(klib_lz_decompress(long_match, sizeof(long_match), large_output, sizeof(large_output)), 52);
+  ASSERT_EQ(large_output[51], 'a');
+}
@@ -0,0 +1,90 @@
+#include "klib/data_structures/heaps.h"
+#include <iostream>
+#include "gtest/gtest.h"
+
+#include "test/test_core/test.h"
+
+using namespace std;
+
+namespace
+{
+  const uint32_t num_heap_items = 50;
+  klib_heap_item<uint32_t *> heap_items[num_heap_items];
+  uint32_t heap_values[num_heap_items];
+
+  // Remove all items from the heap, checking they come out in order, and that there are the expected number of them.
+  void drain_and_check(klib_heap<uint32_t *> &heap, uint32_t expected_count)
+  {
+    klib_heap_item<uint32_t *> *item;
+    uint64_t last_key = 0;
+    uint32_t count = 0;
+
+    while (!klib_heap_is_empty(&heap))
+    {
+      item = klib_heap_peek_min(&heap);
+      ASSERT_NE(item, nullptr);
+      ASSERT_GE(item->key, last_key);
+      ASSERT_EQ(item->key, *item->item);
+      last_key = item->key;
+
+      klib_heap_remove(item);
+      ASSERT_FALSE(klib_heap_item_is_in_any_heap(item));
+      count++;
+    }
+
+    ASSERT_EQ(count, expected_count);
+  }
+}
+
+// Add items in a scrambled order and check they are removed smallest first.
+TEST(DataStructuresTest, HeapOrdering)
+{
+  klib_heap<uint32_t *> heap;
+
+  klib_heap_initialize(&heap);
+  ASSERT_TRUE(klib_heap_is_empty(&heap));
+  ASSERT_EQ(klib_heap_peek_min(&heap), nullptr);
+
+  for (uint32_t i = 0; i < num_heap_items; i++)
+  {
+    klib_heap_item_initialize(&heap_items[i]);
+    heap_values[i] = (i * 37) % 23;
+    heap_items[i].item = &heap_values[i];
+    klib_heap_insert(&heap, &heap_items[i], heap_values[i]);
+    ASSERT_TRUE(klib_heap_item_is_in_any_heap(&heap_items[i]));
+  }
+
+  drain_and_check(heap, num_heap_items);
+}
+
+// Remove items from the middle of the heap, and check the remainder still come out in order.
+TEST(DataStructuresTest, HeapArbitraryRemoval)
+{
+  klib_heap<uint32_t *> heap;
+  uint32_t removed = 0;
+
+  klib_heap_initialize(&heap);
+
+  for (uint32_t i = 0; i < num_heap_items; i++)
+  {
+    klib_heap_item_initialize(&heap_items[i]);
+    heap_values[i] = (i * 7919) % 101;
+    heap_items[i].item = &heap_values[i];
+    klib_heap_insert(&heap, &heap_items[i], heap_values[i]);
+  }
+
+  // Removing the minimum once first gives the heap some structure, rather than being a root with many children.
+  klib_heap_remove(klib_heap_peek_min(&heap));
+  removed++;
+
+  for (uint32_t i = 0; i < num_heap_items; i += 3)
+  {
+    if (klib_heap_item_is_in_any_heap(&heap_items[i]))
+    {
+      klib_heap_remove(&heap_items[i]);
+      removed++;
+    }
+  }
+
+  drain_and_check(heap, num_heap_items - removed);
+}
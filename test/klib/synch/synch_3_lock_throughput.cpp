@@ -0,0 +1,130 @@
+// Klib-synch test script 3.
+//
+// Lock throughput of basic spinlocks and queued (MCS) spinlocks against the number of threads contending for them.
+// Each thread repeatedly takes the lock and increments a shared counter, so the count also confirms that only one
+// thread held the lock at a time. Throughput is printed rather than checked, since it depends on the host.
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include "gtest/gtest.h"
+
+#include "klib/synch/kernel_locks.h"
+#include "test/test_core/test.h"
+
+using namespace std;
+
+namespace
+{
+  const uint64_t locks_per_thread = 200000;
+
+  kernel_spinlock spin_lock;
+  kernel_mcs_lock mcs_lock;
+  volatile uint64_t counter;
+
+  void spin_thread();
+  void mcs_thread();
+  double run_threads(void (*thread_fn)(), uint32_t thread_count);
+}
+
+TEST(KlibSpinlockTest, LockThroughput)
+{
+  uint32_t max_threads = thread::hardware_concurrency();
+  double spin_rate;
+  double mcs_rate;
+
+  if (max_threads < 2)
+  {
+    max_threads = 2;
+  }
+
+  klib_synch_spinlock_init(spin_lock);
+  klib_synch_mcs_init(mcs_lock);
+
+  cout << "Threads, spinlock (Mlocks/s), MCS lock (Mlocks/s)" << endl;
+  for (uint32_t threads = 1; threads <= max_threads; threads *= 2)
+  {
+    counter = 0;
+    spin_rate = run_threads(spin_thread, threads);
+    ASSERT_EQ(counter, threads * locks_per_thread);
+    ASSERT_FALSE(klib_synch_spinlock_is_locked(spin_lock));
+
+    counter = 0;
+    mcs_rate = run_threads(mcs_thread, threads);
+    ASSERT_EQ(counter, threads * locks_per_thread);
+    ASSERT_EQ(mcs_lock, nullptr);
+
+    cout << threads << ", " << spin_rate << ", " << mcs_rate << endl;
+  }
+}
+
+TEST(KlibSpinlockTest, SpinlockUnlockWhenFree)
+{
+  kernel_spinlock lock;
+
+  // Unlocking a free lock must not leave it in a state where the next locker waits forever.
+  klib_synch_spinlock_init(lock);
+  klib_synch_spinlock_unlock(lock);
+  ASSERT_FALSE(klib_synch_spinlock_is_locked(lock));
+
+  klib_synch_spinlock_lock(lock);
+  ASSERT_TRUE(klib_synch_spinlock_is_locked(lock));
+  ASSERT_FALSE(klib_synch_spinlock_try_lock(lock));
+  klib_synch_spinlock_unlock(lock);
+  ASSERT_TRUE(klib_synch_spinlock_try_lock(lock));
+  klib_synch_spinlock_unlock(lock);
+  ASSERT_FALSE(klib_synch_spinlock_is_locked(lock));
+}
+
+namespace
+{
+  /// @brief Run some threads, all contending for the same lock, and time them.
+  ///
+  /// @param thread_fn The function for each thread to run.
+  ///
+  /// @param thread_count The number of threads to run.
+  ///
+  /// @return The total number of locks taken per second, in millions.
+  double run_threads(void (*thread_fn)(), uint32_t thread_count)
+  {
+    vector<thread> threads;
+    chrono::steady_clock::time_point start;
+    chrono::duration<double> elapsed;
+
+    start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+      threads.emplace_back(thread_fn);
+    }
+    for (thread &t : threads)
+    {
+      t.join();
+    }
+    elapsed = chrono::steady_clock::now() - start;
+
+    return (thread_count * locks_per_thread) / elapsed.count() / 1000000.0;
+  }
+
+  void spin_thread()
+  {
+    for (uint64_t i = 0; i < locks_per_thread; i++)
+    {
+      klib_synch_spinlock_lock(spin_lock);
+      counter = counter + 1;
+      klib_synch_spinlock_unlock(spin_lock);
+    }
+  }
+
+  void mcs_thread()
+  {
+    kernel_mcs_node node;
+
+    for (uint64_t i = 0; i < locks_per_thread; i++)
+    {
+      klib_synch_mcs_lock(mcs_lock, node);
+      counter = counter + 1;
+      klib_synch_mcs_unlock(mcs_lock, node);
+    }
+  }
+}
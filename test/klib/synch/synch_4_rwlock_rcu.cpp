@@ -0,0 +1,109 @@
+// Klib-synch test script 4.
+//
+// Tests of reader-writer spinlocks and of RCU grace periods.
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include "gtest/gtest.h"
+
+#include "klib/synch/kernel_locks.h"
+#include "klib/synch/kernel_rcu.h"
+#include "test/test_core/test.h"
+
+using namespace std;
+
+namespace
+{
+  kernel_rwlock rw_lock;
+  klib_rcu_domain rcu_domain;
+
+  volatile bool writer_has_lock;
+  volatile bool sync_complete;
+
+  void write_lock_thread();
+  void synchronize_thread();
+}
+
+TEST(KlibRwLockTest, ReadersShareWritersExclude)
+{
+  klib_synch_rwlock_init(rw_lock);
+  writer_has_lock = false;
+
+  // Two readers can hold the lock together.
+  klib_synch_rwlock_lock_read(rw_lock);
+  klib_synch_rwlock_lock_read(rw_lock);
+
+  // But a writer must wait for both of them.
+  thread writer(write_lock_thread);
+  this_thread::sleep_for(chrono::milliseconds(100));
+  ASSERT_FALSE(writer_has_lock);
+
+  klib_synch_rwlock_unlock_read(rw_lock);
+  this_thread::sleep_for(chrono::milliseconds(100));
+  ASSERT_FALSE(writer_has_lock);
+
+  klib_synch_rwlock_unlock_read(rw_lock);
+  writer.join();
+  ASSERT_TRUE(writer_has_lock);
+
+  // The writer released the lock before exiting, so the lock is free for anyone.
+  klib_synch_rwlock_lock_write(rw_lock);
+  klib_synch_rwlock_unlock_write(rw_lock);
+  klib_synch_rwlock_lock_read(rw_lock);
+  klib_synch_rwlock_unlock_read(rw_lock);
+  ASSERT_EQ(rw_lock, 0);
+}
+
+TEST(KlibRcuTest, SynchronizeWaitsForReaders)
+{
+  uint64_t token;
+
+  klib_rcu_init(rcu_domain);
+  sync_complete = false;
+
+  // With no readers, there's nothing to wait for.
+  klib_rcu_synchronize(rcu_domain);
+
+  token = klib_rcu_read_lock(rcu_domain);
+  thread syncer(synchronize_thread);
+  this_thread::sleep_for(chrono::milliseconds(100));
+  ASSERT_FALSE(sync_complete);
+
+  klib_rcu_read_unlock(rcu_domain, token);
+  syncer.join();
+  ASSERT_TRUE(sync_complete);
+}
+
+TEST(KlibRcuTest, ReaderChangesProcessor)
+{
+  uint64_t token;
+
+  klib_rcu_init(rcu_domain);
+
+  // A reader that finishes on a different processor to the one it started on must still be counted out.
+  test_only_set_proc_id(3);
+  token = klib_rcu_read_lock(rcu_domain);
+  test_only_set_proc_id(5);
+  klib_rcu_read_unlock(rcu_domain, token);
+  test_only_set_proc_id(0);
+
+  klib_rcu_synchronize(rcu_domain);
+  klib_rcu_synchronize(rcu_domain);
+}
+
+namespace
+{
+  void write_lock_thread()
+  {
+    klib_synch_rwlock_lock_write(rw_lock);
+    writer_has_lock = true;
+    klib_synch_rwlock_unlock_write(rw_lock);
+  }
+
+  void synchronize_thread()
+  {
+    klib_rcu_synchronize(rcu_domain);
+    sync_complete = true;
+  }
+}
@@ -0,0 +1,227 @@
+// Klib-synch test script 5.
+//
+// Tests of lock contention statistics. The test build's mutexes are not the kernel's, so only the various kinds of
+// spinlock are tested.
+
+#ifdef KERNEL_LOCKSTAT
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <string.h>
+#include "gtest/gtest.h"
+
+#include "klib/synch/kernel_locks.h"
+#include "klib/synch/kernel_lockstat.h"
+#include "system_tree/fs/proc/proc_fs.h"
+#include "test/test_core/test.h"
+
+using namespace std;
+
+namespace
+{
+  kernel_spinlock stat_lock;
+  kernel_mcs_lock stat_mcs_lock;
+  kernel_rwlock stat_rwlock;
+  volatile bool holder_has_lock;
+
+  void holding_thread();
+  const klib_lockstat_entry *find_entry(const klib_lockstat_entry *entries,
+                                        uint64_t count,
+                                        uint64_t acquisitions,
+                                        uint64_t contentions);
+}
+
+TEST(KlibLockstatTest, CountsAcquisitions)
+{
+  unique_ptr<klib_lockstat_entry[]> entries = make_unique<klib_lockstat_entry[]>(LOCKSTAT_MAX_SITES);
+  const klib_lockstat_entry *entry;
+  uint64_t count;
+
+  klib_synch_spinlock_init(stat_lock);
+  klib_lockstat_reset();
+
+  for (int i = 0; i < 100; i++)
+  {
+    klib_synch_spinlock_lock(stat_lock);
+    klib_synch_spinlock_unlock(stat_lock);
+  }
+
+  count = klib_lockstat_snapshot(entries.get(), LOCKSTAT_MAX_SITES);
+
+  // All the acquisitions came from the same place in this function, and none of them had to wait.
+  entry = find_entry(entries.get(), count, 100, 0);
+  ASSERT_NE(entry, nullptr);
+  ASSERT_EQ(entry->kind, LOCKSTAT_KIND::SPINLOCK);
+  ASSERT_EQ(entry->wait_cycles, 0);
+  ASSERT_GT(entry->hold_cycles, 0);
+  ASSERT_LE(entry->max_hold_cycles, entry->hold_cycles);
+
+  // A successful try-lock counts as well.
+  ASSERT_TRUE(klib_synch_spinlock_try_lock(stat_lock));
+  klib_synch_spinlock_unlock(stat_lock);
+  count = klib_lockstat_snapshot(entries.get(), LOCKSTAT_MAX_SITES);
+  ASSERT_NE(find_entry(entries.get(), count, 1, 0), nullptr);
+}
+
+TEST(KlibLockstatTest, CountsOtherSpinlockKinds)
+{
+  unique_ptr<klib_lockstat_entry[]> entries = make_unique<klib_lockstat_entry[]>(LOCKSTAT_MAX_SITES);
+  const klib_lockstat_entry *entry;
+  kernel_mcs_node node;
+  uint64_t count;
+
+  klib_synch_mcs_init(stat_mcs_lock);
+  klib_synch_rwlock_init(stat_rwlock);
+  klib_lockstat_reset();
+
+  for (int i = 0; i < 10; i++)
+  {
+    klib_synch_mcs_lock(stat_mcs_lock, node);
+    klib_synch_mcs_unlock(stat_mcs_lock, node);
+  }
+
+  // Two readers at once, each of which should have its hold time recorded.
+  for (int i = 0; i < 20; i++)
+  {
+    klib_synch_rwlock_lock_read(stat_rwlock);
+    klib_synch_rwlock_lock_read(stat_rwlock);
+    klib_synch_rwlock_unlock_read(stat_rwlock);
+    klib_synch_rwlock_unlock_read(stat_rwlock);
+  }
+
+  for (int i = 0; i < 30; i++)
+  {
+    klib_synch_rwlock_lock_write(stat_rwlock);
+    klib_synch_rwlock_unlock_write(stat_rwlock);
+  }
+
+  count = klib_lockstat_snapshot(entries.get(), LOCKSTAT_MAX_SITES);
+
+  entry = find_entry(entries.get(), count, 10, 0);
+  ASSERT_NE(entry, nullptr);
+  ASSERT_EQ(entry->kind, LOCKSTAT_KIND::MCS);
+  ASSERT_GT(entry->hold_cycles, 0);
+
+  entry = find_entry(entries.get(), count, 20, 0);
+  ASSERT_NE(entry, nullptr);
+  ASSERT_EQ(entry->kind, LOCKSTAT_KIND::RW_READ);
+  ASSERT_GT(entry->hold_cycles, 0);
+
+  entry = find_entry(entries.get(), count, 30, 0);
+  ASSERT_NE(entry, nullptr);
+  ASSERT_EQ(entry->kind, LOCKSTAT_KIND::RW_WRITE);
+  ASSERT_GT(entry->hold_cycles, 0);
+
+}
+
+TEST(KlibLockstatTest, ContentionIsRecordedAndSorted)
+{
+  unique_ptr<klib_lockstat_entry[]> entries = make_unique<klib_lockstat_entry[]>(LOCKSTAT_MAX_SITES);
+  const klib_lockstat_entry *entry;
+  uint64_t count;
+
+  klib_synch_spinlock_init(stat_lock);
+  klib_lockstat_reset();
+  holder_has_lock = false;
+
+  thread holder(holding_thread);
+  while (!holder_has_lock)
+  {
+    this_thread::yield();
+  }
+
+  // This has to wait for the holding thread to let go.
+  klib_synch_spinlock_lock(stat_lock);
+  klib_synch_spinlock_unlock(stat_lock);
+  holder.join();
+
+  count = klib_lockstat_snapshot(entries.get(), LOCKSTAT_MAX_SITES);
+  ASSERT_GE(count, 2);
+
+  // Having waited for the holding thread, this function's acquisition should be at the top of the table.
+  entry = find_entry(entries.get(), count, 1, 1);
+  ASSERT_EQ(entry, &entries[0]);
+  ASSERT_GT(entry->wait_cycles, 0);
+
+  // The holding thread's acquisition wasn't contended, but it was held for a long time.
+  entry = find_entry(entries.get(), count, 1, 0);
+  ASSERT_NE(entry, nullptr);
+  ASSERT_GT(entry->max_hold_cycles, 0);
+  ASSERT_EQ(entry->max_hold_cycles, entry->hold_cycles);
+
+  for (uint64_t i = 1; i < count; i++)
+  {
+    ASSERT_GE(entries[i - 1].wait_cycles, entries[i].wait_cycles);
+  }
+}
+
+TEST(KlibLockstatTest, ProcLeafGivesTable)
+{
+  proc_fs_root_branch::proc_fs_lockstat_leaf leaf;
+  std::string table;
+  char buffer[50];
+  uint64_t bytes_read;
+
+  klib_synch_spinlock_init(stat_lock);
+  klib_synch_spinlock_lock(stat_lock);
+  klib_synch_spinlock_unlock(stat_lock);
+
+  table = leaf.get_table();
+  ASSERT_EQ(table.find("site "), 0);
+  ASSERT_NE(table.find("spinlock"), std::string::npos);
+
+  // Reads take the requested part of the table.
+  memset(buffer, 0, sizeof(buffer));
+  ASSERT_EQ(leaf.read_bytes(5, 10, reinterpret_cast<uint8_t *>(buffer), sizeof(buffer), bytes_read),
+            ERR_CODE::NO_ERROR);
+  ASSERT_EQ(bytes_read, 10);
+  ASSERT_EQ(table.substr(5, 10), std::string(buffer));
+
+  ASSERT_EQ(leaf.read_bytes(1000000, 10, reinterpret_cast<uint8_t *>(buffer), sizeof(buffer), bytes_read),
+            ERR_CODE::NO_ERROR);
+  ASSERT_EQ(bytes_read, 0);
+
+  ASSERT_EQ(leaf.read_bytes(0, 10, nullptr, 0, bytes_read), ERR_CODE::INVALID_PARAM);
+}
+
+namespace
+{
+  void holding_thread()
+  {
+    klib_synch_spinlock_lock(stat_lock);
+    holder_has_lock = true;
+    this_thread::sleep_for(chrono::milliseconds(100));
+    klib_synch_spinlock_unlock(stat_lock);
+  }
+
+  /// @brief Find an entry in a lockstat snapshot with the given counts.
+  ///
+  /// @param entries The snapshot to search.
+  ///
+  /// @param count The number of entries in the snapshot.
+  ///
+  /// @param acquisitions The number of acquisitions to look for.
+  ///
+  /// @param contentions The number of contentions to look for.
+  ///
+  /// @return The first matching entry, or nullptr if none match.
+  const klib_lockstat_entry *find_entry(const klib_lockstat_entry *entries,
+                                        uint64_t count,
+                                        uint64_t acquisitions,
+                                        uint64_t contentions)
+  {
+    for (uint64_t i = 0; i < count; i++)
+    {
+      if ((entries[i].acquisitions == acquisitions) && (entries[i].contentions == contentions))
+      {
+        return &entries[i];
+      }
+    }
+
+    return nullptr;
+  }
+}
+
+#endif
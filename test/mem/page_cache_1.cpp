@@ -0,0 +1,136 @@
+#include "test/test_core/test.h"
+
+#include "mem/page_cache.h"
+#include "processor/processor.h"
+#include "system_tree/system_tree.h"
+#include "system_tree/fs/mem/mem_fs.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+// Tests of the page cache that backs mapped files. Mapping pages into processes doesn't work in the test code, so these
+// tests concentrate on reading pages in and writing them back.
+
+TEST(PageCacheTests, OneCachePerFile)
+{
+  shared_ptr<mem_fs_leaf> leaf_a = make_shared<mem_fs_leaf>(nullptr);
+  shared_ptr<mem_fs_leaf> leaf_b = make_shared<mem_fs_leaf>(nullptr);
+  shared_ptr<mem_page_cache_file> cache_a;
+  shared_ptr<mem_page_cache_file> cache_a2;
+  shared_ptr<mem_page_cache_file> cache_b;
+
+  cache_a = mem_page_cache_file::get(leaf_a);
+  cache_a2 = mem_page_cache_file::get(leaf_a);
+  cache_b = mem_page_cache_file::get(leaf_b);
+
+  ASSERT_NE(cache_a, nullptr);
+  ASSERT_EQ(cache_a, cache_a2);
+  ASSERT_NE(cache_a, cache_b);
+
+  // Once all users have finished with a cache a new one is created.
+  cache_a = nullptr;
+  cache_a2 = nullptr;
+  cache_a = mem_page_cache_file::get(leaf_a);
+  ASSERT_NE(cache_a, nullptr);
+}
+
+TEST(PageCacheTests, LoadAndWriteBack)
+{
+  shared_ptr<mem_fs_leaf> leaf = make_shared<mem_fs_leaf>(nullptr);
+  shared_ptr<mem_page_cache_file> cache;
+  mem_page_cache_page page;
+  mem_page_cache_page page_again;
+  const char *test_string = "hello";
+  char buffer[6] = { 0 };
+  uint64_t bytes_done;
+  ERR_CODE ec;
+
+  ec = leaf->write_bytes(0, 5, reinterpret_cast<const uint8_t *>(test_string), 5, bytes_done);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  cache = mem_page_cache_file::get(leaf);
+  ASSERT_FALSE(cache->find_resident_page(0, page));
+
+  ec = cache->load_page(0, page);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ASSERT_EQ(page.valid_bytes, 5);
+  ASSERT_EQ(memcmp(page.kernel_addr, test_string, 5), 0);
+  ASSERT_EQ(page.kernel_addr[5], 0);
+
+  ASSERT_TRUE(cache->find_resident_page(0, page_again));
+  ASSERT_EQ(page.kernel_addr, page_again.kernel_addr);
+
+  page.kernel_addr[0] = 'j';
+  ec = cache->write_back_page(0);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  ec = leaf->read_bytes(0, 5, reinterpret_cast<uint8_t *>(buffer), 5, bytes_done);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ASSERT_EQ(bytes_done, 5);
+  ASSERT_STREQ(buffer, "jello");
+
+  // Pages that were never loaded can't be written back.
+  ec = cache->write_back_page(1);
+  ASSERT_EQ(ec, ERR_CODE::NOT_FOUND);
+}
+
+TEST(PageCacheTests, MapInvalidParams)
+{
+  shared_ptr<mem_fs_leaf> leaf = make_shared<mem_fs_leaf>(nullptr);
+  void *map_addr = nullptr;
+  ERR_CODE ec;
+
+  ec = mem_map_file(nullptr, 0, 1, nullptr, map_addr);
+  ASSERT_EQ(ec, ERR_CODE::INVALID_PARAM);
+
+  ec = mem_map_file(leaf, 1, 1, nullptr, map_addr);
+  ASSERT_EQ(ec, ERR_CODE::INVALID_PARAM);
+
+  ec = mem_sync_file_mapping(reinterpret_cast<void *>(MEM_PAGE_SIZE), nullptr);
+  ASSERT_EQ(ec, ERR_CODE::NOT_FOUND);
+
+  ec = mem_unmap_file(reinterpret_cast<void *>(MEM_PAGE_SIZE), nullptr);
+  ASSERT_EQ(ec, ERR_CODE::NOT_FOUND);
+}
+
+TEST(PageCacheTests, MapWithinFile)
+{
+  shared_ptr<mem_fs_leaf> leaf = make_shared<mem_fs_leaf>(nullptr);
+  const char *test_string = "hello";
+  void *map_addr = nullptr;
+  uint64_t bytes_done;
+  ERR_CODE ec;
+
+  system_tree_init();
+  task_gen_init();
+
+  shared_ptr<task_process> proc = task_process::create(dummy_thread_fn);
+  ASSERT_TRUE(proc);
+
+  ec = leaf->write_bytes(0, 5, reinterpret_cast<const uint8_t *>(test_string), 5, bytes_done);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  // Mappings can't extend beyond the page containing the end of the file.
+  ec = mem_map_file(leaf, 0, 2, proc.get(), map_addr);
+  ASSERT_EQ(ec, ERR_CODE::INVALID_PARAM);
+
+  ec = mem_map_file(leaf, 2 * MEM_PAGE_SIZE, 1, proc.get(), map_addr);
+  ASSERT_EQ(ec, ERR_CODE::INVALID_PARAM);
+
+  ec = mem_map_file(leaf, 0, UINT64_MAX, proc.get(), map_addr);
+  ASSERT_EQ(ec, ERR_CODE::INVALID_PARAM);
+
+  ec = mem_map_file(leaf, 0, 1, proc.get(), map_addr);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ASSERT_NE(map_addr, nullptr);
+
+  ec = mem_unmap_file(map_addr, proc.get());
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  proc->destroy_process(0);
+  proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+}
@@ -0,0 +1,57 @@
+#include "test/test_core/test.h"
+
+#include "mem/mem.h"
+#include "processor/processor.h"
+#include "system_tree/system_tree.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+// Tests of the bookkeeping for the compressed swap store. Pages can't really be mapped in the test code, so the scanner
+// never finds anything to swap out - these tests check that pages are tracked and released correctly.
+
+TEST(SwapTests, TrackAndRelease)
+{
+  const uint64_t base_addr = 0x10000000;
+  uint64_t initial_heap;
+
+  system_tree_init();
+  task_gen_init();
+
+  shared_ptr<task_process> proc = task_process::create(dummy_thread_fn);
+  ASSERT_TRUE(proc);
+  task_thread *thread = proc->child_threads.head->item.get();
+  mem_process_stats *stats = mem_acct_get_stats(proc.get());
+  ASSERT_NE(stats, nullptr);
+
+  initial_heap = stats->kernel_heap_bytes;
+  ASSERT_EQ(mem_swap_handle_fault(base_addr, thread, true), MEM_FAULT_RESULT::NOT_HANDLED);
+
+  mem_swap_track_range(proc.get(), reinterpret_cast<void *>(base_addr), 2);
+  ASSERT_GT(stats->kernel_heap_bytes, initial_heap);
+
+  // Tracked pages that are still resident can simply be retried.
+  ASSERT_EQ(mem_swap_handle_fault(base_addr + 5, thread, true), MEM_FAULT_RESULT::RESOLVED);
+  ASSERT_EQ(mem_swap_handle_fault(base_addr + MEM_PAGE_SIZE, thread, true), MEM_FAULT_RESULT::RESOLVED);
+  ASSERT_EQ(mem_swap_handle_fault(base_addr + (2 * MEM_PAGE_SIZE), thread, true), MEM_FAULT_RESULT::NOT_HANDLED);
+
+  // Likewise, there's nothing to do to bring them into RAM before a system call uses them.
+  ASSERT_EQ(mem_swap_fault_in(base_addr + 5, proc.get()), ERR_CODE::NO_ERROR);
+  ASSERT_EQ(mem_swap_fault_in(base_addr + (2 * MEM_PAGE_SIZE), proc.get()), ERR_CODE::NO_ERROR);
+
+  mem_swap_release_range(proc.get(), reinterpret_cast<void *>(base_addr + MEM_PAGE_SIZE), 1);
+  ASSERT_EQ(mem_swap_handle_fault(base_addr, thread, true), MEM_FAULT_RESULT::RESOLVED);
+  ASSERT_EQ(mem_swap_handle_fault(base_addr + MEM_PAGE_SIZE, thread, true), MEM_FAULT_RESULT::NOT_HANDLED);
+
+  mem_swap_release_process(proc.get());
+  ASSERT_EQ(mem_swap_handle_fault(base_addr, thread, true), MEM_FAULT_RESULT::NOT_HANDLED);
+  ASSERT_EQ(stats->kernel_heap_bytes, initial_heap);
+  ASSERT_EQ(stats->swapped_pages, 0);
+
+  proc->destroy_process(0);
+  proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+}
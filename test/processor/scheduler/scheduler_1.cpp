@@ -46,7 +46,7 @@ TEST(SchedulerTest, SimpleTests)
   }
 
   // Set it to not permit running. Ensure we get a different thread - should be the idle thread.
-  thread_a->permit_running = false;
+  thread_a->stop_thread();
 
   idle_thread_a = task_get_next_thread();
   cout << "Idle thread: " << idle_thread_a << endl;
@@ -59,7 +59,7 @@ TEST(SchedulerTest, SimpleTests)
   }
 
   // Permit the first thread to run again, now we should get that repeatedly.
-  thread_a->permit_running = true;
+  thread_a->start_thread();
   for (i = 0; i < 10; i++)
   {
     ASSERT_EQ(thread_a, task_get_next_thread());
@@ -83,33 +83,41 @@ TEST(SchedulerTest, SimpleTests)
   }
 
   // Stop thread B, and check we only get thread A.
-  thread_b->permit_running = false;
+  thread_b->stop_thread();
   for (int i = 0; i < 10; i++)
   {
     ASSERT_EQ(thread_a, task_get_next_thread());
   }
 
   // Switch to thread A, and check the same.
-  thread_a->permit_running = false;
-  thread_b->permit_running = true;
+  thread_a->stop_thread();
+  thread_b->start_thread();
   for (int i = 0; i < 10; i++)
   {
     ASSERT_EQ(thread_b, task_get_next_thread());
   }
 
   // Disable both, and check we get the idle process
-  thread_a->permit_running = false;
-  thread_b->permit_running = false;
+  thread_a->stop_thread();
+  thread_b->stop_thread();
   for (int i = 0; i < 10; i++)
   {
     ASSERT_EQ(idle_thread_a, task_get_next_thread());
   }
 
-  // Set b to wake up and check the scheduler does so:
+  // Let b run, then send it to sleep. It should stay asleep until its wake up time, and then the scheduler should
+  // wake it.
+  test_set_system_timer_count(5);
+  thread_b->start_thread();
+  ASSERT_EQ(thread_b, task_get_next_thread());
+  thread_b->stop_thread();
   thread_b->wake_thread_after = 10;
+  ASSERT_EQ(idle_thread_a, task_get_next_thread());
+  ASSERT_EQ(idle_thread_a, task_get_next_thread());
+
   test_set_system_timer_count(11);
   ASSERT_EQ(thread_b, task_get_next_thread());
-  thread_b->permit_running = false;
+  thread_b->stop_thread();
 
   ASSERT_EQ(idle_thread_a, task_get_next_thread());
 
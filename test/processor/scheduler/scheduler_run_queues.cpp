@@ -0,0 +1,658 @@
+// Tests of the scheduler's per-processor run queues.
+
+#include "object_mgr/handles.h"
+#include "object_mgr/object_mgr.h"
+#include "system_tree/system_tree.h"
+#include "processor/processor.h"
+#include "processor/processor-int.h"
+#include "processor/timing/timing.h"
+#include "klib/klib.h"
+
+#include "test/test_core/test.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+// Check that an idle processor steals work from a busy one, and that the stolen thread then stays with its new
+// processor.
+TEST(SchedulerTest, WorkStealing)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  shared_ptr<task_process> proc_b;
+  task_thread *thread_a;
+  task_thread *thread_b;
+  task_thread *idle_thread_0;
+
+  test_only_set_proc_count(2);
+  test_only_set_proc_id(0);
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+
+  // Don't run any threads from the system process, it just confuses the rest of the test.
+  sys_proc->stop_process();
+
+  // Both threads are created on processor 0, so they both join its run queue.
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a = proc_a->child_threads.head->item.get();
+  proc_b = task_process::create(dummy_thread_fn);
+  thread_b = proc_b->child_threads.head->item.get();
+  proc_a->start_process();
+  proc_b->start_process();
+
+  ASSERT_EQ(thread_a, task_get_next_thread());
+
+  // Processor 1 has nothing of its own to run, so it should take thread B from processor 0.
+  test_only_set_proc_id(1);
+  ASSERT_EQ(thread_b, task_get_next_thread());
+
+  // From now on, each processor should keep running its own thread.
+  for (int i = 0; i < 10; i++)
+  {
+    test_only_set_proc_id(0);
+    ASSERT_EQ(thread_a, task_get_next_thread());
+    test_only_set_proc_id(1);
+    ASSERT_EQ(thread_b, task_get_next_thread());
+  }
+
+  // Stopping thread A leaves processor 0 with nothing to do, and thread B is busy on processor 1, so processor 0 should
+  // go idle.
+  thread_a->stop_thread();
+  test_only_set_proc_id(0);
+  idle_thread_0 = task_get_next_thread();
+  ASSERT_NE(thread_a, idle_thread_0);
+  ASSERT_NE(thread_b, idle_thread_0);
+
+  // Restarting thread A should see it run on processor 0 again.
+  thread_a->start_thread();
+  ASSERT_EQ(thread_a, task_get_next_thread());
+
+  // Unschedule everything before tidying up, otherwise destroying the threads waits forever for them to stop running.
+  proc_a->stop_process();
+  proc_b->stop_process();
+  task_get_next_thread();
+  test_only_set_proc_id(1);
+  task_get_next_thread();
+  test_only_set_proc_id(0);
+
+  proc_a->destroy_process(0);
+  proc_b->destroy_process(0);
+  proc_a = nullptr;
+  proc_b = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_set_proc_count(1);
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+// Send two threads to sleep, and check they are woken in order of their wake up times, not the order they slept in.
+TEST(SchedulerTest, SleepQueue)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  shared_ptr<task_process> proc_b;
+  task_thread *thread_a;
+  task_thread *thread_b;
+  task_thread *idle_thread;
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+  test_set_system_timer_count(100);
+
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a = proc_a->child_threads.head->item.get();
+  proc_b = task_process::create(dummy_thread_fn);
+  thread_b = proc_b->child_threads.head->item.get();
+  proc_a->start_process();
+
+  // Thread A goes to sleep first, but wakes last.
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  thread_a->stop_thread();
+  thread_a->wake_thread_after = 300;
+  proc_b->start_process();
+  ASSERT_EQ(thread_b, task_get_next_thread());
+  thread_b->stop_thread();
+  thread_b->wake_thread_after = 200;
+  idle_thread = task_get_next_thread();
+  ASSERT_NE(thread_a, idle_thread);
+  ASSERT_NE(thread_b, idle_thread);
+
+  test_set_system_timer_count(250);
+  ASSERT_EQ(thread_b, task_get_next_thread());
+  thread_b->stop_thread();
+  ASSERT_EQ(idle_thread, task_get_next_thread());
+
+  test_set_system_timer_count(350);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+
+  // Starting a sleeping thread early cancels its sleep.
+  thread_a->stop_thread();
+  thread_a->wake_thread_after = 400;
+  ASSERT_EQ(idle_thread, task_get_next_thread());
+  thread_a->start_thread();
+  ASSERT_EQ(0, thread_a->wake_thread_after);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+
+  proc_a->stop_process();
+  task_get_next_thread();
+
+  proc_a->destroy_process(0);
+  proc_b->destroy_process(0);
+  proc_a = nullptr;
+  proc_b = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+// Check that higher priority threads always run first, and that nice values share the processor in proportion to
+// their weights.
+TEST(SchedulerTest, PrioritiesAndNice)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  shared_ptr<task_process> proc_b;
+  task_thread *thread_a;
+  task_thread *thread_b;
+  task_thread *next;
+  uint64_t time_now = 1000;
+  uint32_t a_count = 0;
+  uint32_t b_count = 0;
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+  test_set_system_timer_count(time_now);
+
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a = proc_a->child_threads.head->item.get();
+  proc_b = task_process::create(dummy_thread_fn);
+  thread_b = proc_b->child_threads.head->item.get();
+
+  ASSERT_EQ(ERR_CODE::INVALID_PARAM, task_set_thread_priority(thread_a, static_cast<THREAD_PRIORITY>(3), 0));
+  ASSERT_EQ(ERR_CODE::INVALID_PARAM, task_set_thread_priority(thread_a, THREAD_PRIORITY::NORMAL, THREAD_NICE_MIN - 1));
+  ASSERT_EQ(ERR_CODE::INVALID_PARAM, task_set_thread_priority(thread_a, THREAD_PRIORITY::NORMAL, THREAD_NICE_MAX + 1));
+
+  // A high priority thread should be chosen every time, even though it keeps using up its timeslice.
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_priority(thread_b, THREAD_PRIORITY::HIGH, 0));
+  proc_a->start_process();
+  proc_b->start_process();
+  for (int i = 0; i < 10; i++)
+  {
+    time_now += 1000000;
+    test_set_system_timer_count(time_now);
+    ASSERT_EQ(thread_b, task_get_next_thread());
+  }
+
+  // At the same priority level, a thread with nice 0 should get roughly ten times as much time as one with nice 10.
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_priority(thread_b, THREAD_PRIORITY::NORMAL, 10));
+  thread_b->stop_thread();
+  thread_b->start_thread();
+  for (int i = 0; i < 1000; i++)
+  {
+    time_now += 1000000;
+    test_set_system_timer_count(time_now);
+    next = task_get_next_thread();
+    if (next == thread_a)
+    {
+      a_count++;
+    }
+    else if (next == thread_b)
+    {
+      b_count++;
+    }
+  }
+
+  ASSERT_EQ(1000, a_count + b_count);
+  ASSERT_GT(b_count, 0);
+  ASSERT_GT(a_count, b_count * 5);
+
+  proc_a->stop_process();
+  proc_b->stop_process();
+  task_get_next_thread();
+
+  proc_a->destroy_process(0);
+  proc_b->destroy_process(0);
+  proc_a = nullptr;
+  proc_b = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+// Check that deadline threads are admitted only if there's room for them, that they run ahead of all other threads,
+// and that they are throttled once they've used their runtime for the period.
+TEST(SchedulerTest, DeadlineClass)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  shared_ptr<task_process> proc_b;
+  task_thread *thread_a;
+  task_thread *thread_b;
+  const uint64_t ms = 1000000;
+  uint64_t start_time = 1000;
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+  test_set_system_timer_count(start_time);
+
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a = proc_a->child_threads.head->item.get();
+  proc_b = task_process::create(dummy_thread_fn);
+  thread_b = proc_b->child_threads.head->item.get();
+
+  // Runtime must fit within the deadline, which must fit within the period.
+  ASSERT_EQ(ERR_CODE::INVALID_PARAM, task_set_thread_deadline(thread_a, 3 * ms, 2 * ms, 10 * ms));
+  ASSERT_EQ(ERR_CODE::INVALID_PARAM, task_set_thread_deadline(thread_a, 2 * ms, 10 * ms, 5 * ms));
+
+  // There's only one processor, so two threads needing 60% of it each can't both be admitted.
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_deadline(thread_b, 6 * ms, 10 * ms, 10 * ms));
+  ASSERT_EQ(ERR_CODE::OUT_OF_RESOURCE, task_set_thread_deadline(thread_a, 6 * ms, 10 * ms, 10 * ms));
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_deadline(thread_b, 0, 0, 0));
+
+  // Thread A needs 2ms in every 10ms. Thread B is high priority, but should still only run once A is throttled.
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_deadline(thread_a, 2 * ms, 10 * ms, 10 * ms));
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_priority(thread_b, THREAD_PRIORITY::HIGH, 0));
+  proc_b->start_process();
+  proc_a->start_process();
+
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  test_set_system_timer_count(start_time + 1 * ms);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  test_set_system_timer_count(start_time + 2 * ms);
+  ASSERT_EQ(thread_b, task_get_next_thread());
+  test_set_system_timer_count(start_time + 6 * ms);
+  ASSERT_EQ(thread_b, task_get_next_thread());
+
+  // The next period starts 10ms after the first.
+  test_set_system_timer_count(start_time + 10 * ms);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  ASSERT_EQ(0, thread_a->dl.misses);
+
+  // Letting thread A run past its deadline without having its runtime counts as a miss. Its next period has already
+  // started by then, so it carries on running.
+  test_set_system_timer_count(start_time + 10 * ms + 1000);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  test_set_system_timer_count(start_time + 21 * ms);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  ASSERT_EQ(1, thread_a->dl.misses);
+  ASSERT_EQ(1, proc_a->deadline_misses);
+
+  // Thread B is waiting in the run queue. Moving it in to the deadline class with an earlier deadline than thread A's
+  // should let it run straight away.
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_deadline(thread_b, 1 * ms, 2 * ms, 10 * ms));
+  ASSERT_EQ(thread_b, task_get_next_thread());
+
+  proc_a->stop_process();
+  proc_b->stop_process();
+  task_get_next_thread();
+
+  proc_a->destroy_process(0);
+  proc_b->destroy_process(0);
+  proc_a = nullptr;
+  proc_b = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+// Check that the scheduler only asks for a tick when it has a reason to, and that a processor whose tick is stopped is
+// signalled when a thread is added to its run queue.
+TEST(SchedulerTest, DynamicTick)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  shared_ptr<task_process> proc_b;
+  task_thread *thread_a;
+  task_thread *thread_b;
+  task_thread *idle_thread;
+  uint32_t wakes;
+
+  test_only_set_proc_count(2);
+  test_only_set_proc_id(0);
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+  test_set_system_timer_count(1000);
+
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a = proc_a->child_threads.head->item.get();
+  proc_b = task_process::create(dummy_thread_fn);
+  thread_b = proc_b->child_threads.head->item.get();
+
+  // A lone thread can run without interruption.
+  proc_a->start_process();
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  ASSERT_EQ(0, test_only_get_next_tick());
+
+  // Once another thread is waiting, the two must take turns.
+  proc_b->start_process();
+  ASSERT_EQ(time_task_mgr_int_period_ns, test_only_get_next_tick());
+  task_get_next_thread();
+  ASSERT_EQ(time_task_mgr_int_period_ns, test_only_get_next_tick());
+
+  // An idle processor with a sleeping thread only needs to wake when the thread does.
+  thread_b->stop_thread();
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  thread_a->stop_thread();
+  thread_a->wake_thread_after = 6000;
+  idle_thread = task_get_next_thread();
+  ASSERT_NE(thread_a, idle_thread);
+  ASSERT_EQ(5001, test_only_get_next_tick());
+
+  // Processor 1 has stopped its tick, so moving there and starting a thread signals processor 0.
+  test_only_set_proc_id(1);
+  task_get_next_thread();
+  ASSERT_EQ(0, test_only_get_next_tick());
+  wakes = test_only_get_proc_wakes();
+  thread_a->start_thread();
+  ASSERT_EQ(wakes + 1, test_only_get_proc_wakes());
+
+  test_only_set_proc_id(0);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+
+  proc_a->stop_process();
+  proc_b->stop_process();
+  task_get_next_thread();
+  test_only_set_proc_id(1);
+  task_get_next_thread();
+  test_only_set_proc_id(0);
+
+  proc_a->destroy_process(0);
+  proc_b->destroy_process(0);
+  proc_a = nullptr;
+  proc_b = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_set_proc_count(1);
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+// Check that threads only run on the processors in their affinity mask, and move when the mask changes.
+TEST(SchedulerTest, AffinityMasks)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  task_thread *thread_a;
+  uint32_t wakes;
+
+  test_only_set_proc_count(2);
+  test_only_set_proc_id(0);
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a = proc_a->child_threads.head->item.get();
+
+  // The mask must include at least one processor that exists.
+  ASSERT_EQ(ERR_CODE::INVALID_PARAM, task_set_thread_affinity(thread_a, 0));
+  ASSERT_EQ(ERR_CODE::INVALID_PARAM, task_set_thread_affinity(thread_a, 4));
+  ASSERT_EQ(THREAD_AFFINITY_ALL, thread_a->affinity);
+
+  // Thread A was created on processor 0, but may only run on processor 1.
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_affinity(thread_a, 2));
+  proc_a->start_process();
+  ASSERT_NE(thread_a, task_get_next_thread());
+  test_only_set_proc_id(1);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+  ASSERT_EQ(thread_a, task_get_next_thread());
+
+  // Processor 0 can't steal it either.
+  test_only_set_proc_id(0);
+  ASSERT_NE(thread_a, task_get_next_thread());
+
+  // Restricting it to processor 0 instead signals processor 1, which then hands the thread over.
+  wakes = test_only_get_proc_wakes();
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_affinity(thread_a, 1));
+  ASSERT_EQ(wakes + 1, test_only_get_proc_wakes());
+  test_only_set_proc_id(1);
+  ASSERT_NE(thread_a, task_get_next_thread());
+  test_only_set_proc_id(0);
+  ASSERT_EQ(thread_a, task_get_next_thread());
+
+  proc_a->stop_process();
+  task_get_next_thread();
+  test_only_set_proc_id(1);
+  task_get_next_thread();
+  test_only_set_proc_id(0);
+
+  proc_a->destroy_process(0);
+  proc_a = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_set_proc_count(1);
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+// Check that a woken thread takes over the processor at once if it should run ahead of the current thread, but
+// otherwise waits for the end of the timeslice.
+TEST(SchedulerTest, WakeupPreemption)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  shared_ptr<task_process> proc_b;
+  shared_ptr<task_process> proc_c;
+  task_thread *thread_a;
+  task_thread *thread_b;
+  task_thread *thread_c;
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+  test_set_system_timer_count(1000);
+
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a = proc_a->child_threads.head->item.get();
+  proc_b = task_process::create(dummy_thread_fn);
+  thread_b = proc_b->child_threads.head->item.get();
+  proc_c = task_process::create(dummy_thread_fn);
+  thread_c = proc_c->child_threads.head->item.get();
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_priority(thread_b, THREAD_PRIORITY::HIGH, 0));
+
+  // Waking a thread on an idle processor runs the scheduler straight away.
+  ASSERT_NE(thread_a, task_get_next_thread());
+  proc_a->start_process();
+  ASSERT_EQ(1, test_only_get_next_tick());
+  ASSERT_EQ(thread_a, task_get_next_thread());
+
+  // A thread at the same level, with a similar virtual runtime, waits for the end of the timeslice.
+  proc_c->start_process();
+  ASSERT_EQ(time_task_mgr_int_period_ns, test_only_get_next_tick());
+
+  // A higher priority thread takes over at once.
+  proc_b->start_process();
+  ASSERT_EQ(1, test_only_get_next_tick());
+  ASSERT_EQ(thread_b, task_get_next_thread());
+
+  proc_a->stop_process();
+  proc_b->stop_process();
+  proc_c->stop_process();
+  task_get_next_thread();
+
+  proc_a->destroy_process(0);
+  proc_b->destroy_process(0);
+  proc_c->destroy_process(0);
+  proc_a = nullptr;
+  proc_b = nullptr;
+  proc_c = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+// Check that a processor prefers to switch between threads of the same process, without giving the threads of other
+// processes an unfair share of its time.
+TEST(SchedulerTest, ProcessAffinity)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  shared_ptr<task_process> proc_b;
+  task_thread *thread_a1;
+  task_thread *thread_a2;
+  task_thread *thread_b;
+  task_thread *next;
+  uint64_t time_now = 1000;
+  uint32_t a1_count = 0;
+  uint32_t a2_count = 0;
+  uint32_t b_count = 0;
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+  test_set_system_timer_count(time_now);
+
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a1 = proc_a->child_threads.head->item.get();
+  thread_a2 = task_thread::create(dummy_thread_fn, proc_a).get();
+  proc_b = task_process::create(dummy_thread_fn);
+  thread_b = proc_b->child_threads.head->item.get();
+  proc_a->start_process();
+  proc_b->start_process();
+
+  // Use short timeslices, so that each thread's virtual runtime changes by less than the preference for the current
+  // process each time.
+  for (int i = 0; i < 300; i++)
+  {
+    time_now += 100000;
+    test_set_system_timer_count(time_now);
+    next = task_get_next_thread();
+    if (next == thread_a1)
+    {
+      a1_count++;
+    }
+    else if (next == thread_a2)
+    {
+      a2_count++;
+    }
+    else if (next == thread_b)
+    {
+      b_count++;
+    }
+  }
+
+  ASSERT_EQ(300, a1_count + a2_count + b_count);
+  ASSERT_GT(a1_count, 70);
+  ASSERT_GT(a2_count, 70);
+  ASSERT_GT(b_count, 70);
+
+  // Without the preference, almost every switch would be between processes.
+  ASSERT_GT(proc_a->same_process_switches, 0);
+  ASSERT_GT(proc_a->same_process_switches, proc_a->cross_process_switches);
+
+  proc_a->stop_process();
+  proc_b->stop_process();
+  task_get_next_thread();
+
+  proc_a->destroy_process(0);
+  proc_b->destroy_process(0);
+  proc_a = nullptr;
+  proc_b = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+// Check that a thread runs at the priority level it has inherited, if that is higher than its own, as soon as it
+// inherits it.
+TEST(SchedulerTest, InheritedPriority)
+{
+  shared_ptr<task_process> sys_proc;
+  shared_ptr<task_process> proc_a;
+  shared_ptr<task_process> proc_b;
+  task_thread *thread_a;
+  task_thread *thread_b;
+  uint64_t time_now = 1000;
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+  test_set_system_timer_count(time_now);
+
+  proc_a = task_process::create(dummy_thread_fn);
+  thread_a = proc_a->child_threads.head->item.get();
+  proc_b = task_process::create(dummy_thread_fn);
+  thread_b = proc_b->child_threads.head->item.get();
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_priority(thread_a, THREAD_PRIORITY::BATCH, 0));
+  proc_a->start_process();
+  proc_b->start_process();
+
+  // Thread A never gets a look in at its own level.
+  for (int i = 0; i < 10; i++)
+  {
+    time_now += 1000000;
+    test_set_system_timer_count(time_now);
+    ASSERT_EQ(thread_b, task_get_next_thread());
+  }
+
+  // Once it inherits a higher level, it moves up in the run queue and takes over at once, without having to wait to
+  // rejoin the queue.
+  task_set_inherited_priority(thread_a, THREAD_PRIORITY::HIGH);
+  ASSERT_EQ(THREAD_PRIORITY::HIGH, thread_a->priority);
+  ASSERT_EQ(1, test_only_get_next_tick());
+  for (int i = 0; i < 10; i++)
+  {
+    time_now += 1000000;
+    test_set_system_timer_count(time_now);
+    ASSERT_EQ(thread_a, task_get_next_thread());
+  }
+
+  // Changing its own priority doesn't lose the inherited one.
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_priority(thread_a, THREAD_PRIORITY::NORMAL, 0));
+  ASSERT_EQ(THREAD_PRIORITY::HIGH, thread_a->priority);
+
+  // Giving up the inherited level returns it to its own.
+  task_set_inherited_priority(thread_a, THREAD_PRIORITY::BATCH);
+  ASSERT_EQ(THREAD_PRIORITY::NORMAL, thread_a->priority);
+  ASSERT_EQ(ERR_CODE::NO_ERROR, task_set_thread_priority(thread_a, THREAD_PRIORITY::BATCH, 0));
+  for (int i = 0; i < 10; i++)
+  {
+    time_now += 1000000;
+    test_set_system_timer_count(time_now);
+    ASSERT_EQ(thread_b, task_get_next_thread());
+  }
+
+  proc_a->stop_process();
+  proc_b->stop_process();
+  task_get_next_thread();
+
+  proc_a->destroy_process(0);
+  proc_b->destroy_process(0);
+  proc_a = nullptr;
+  proc_b = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
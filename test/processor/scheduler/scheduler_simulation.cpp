@@ -0,0 +1,410 @@
+// A deterministic simulation of the scheduler under a mixed load.
+//
+// Thousands of simulated threads are run across several virtual processors, using only the task manager's normal
+// entry points. Each virtual processor runs its scheduler when the tick it programmed expires, when it is signalled
+// by another processor, or when the thread it is running blocks. The chosen thread then "runs" until that processor's
+// next event. Threads follow one of three patterns:
+// - CPU bound threads never block.
+// - Sleepers run for a short burst, then sleep until a given time.
+// - Blockers run for a short burst, then wait until they are woken by another processor, as if waiting for an event.
+//
+// The simulation reports the host time taken by each scheduling decision, how evenly processor time is shared between
+// the CPU bound threads, and the delay between a thread being woken and it running. Apart from the decision cost,
+// which is measured on the host, the results are the same each time, so they can be compared before and after a change
+// to the scheduler.
+
+#include "object_mgr/handles.h"
+#include "object_mgr/object_mgr.h"
+#include "system_tree/system_tree.h"
+#include "processor/processor.h"
+#include "processor/processor-int.h"
+#include "processor/timing/timing.h"
+#include "klib/klib.h"
+
+#include "test/test_core/test.h"
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+  /// @brief How a simulated thread behaves.
+  enum class SIM_BEHAVIOUR
+  {
+    CPU_BOUND, ///< Never blocks.
+    SLEEPER, ///< Runs for a burst, then sleeps for a while.
+    BLOCKER, ///< Runs for a burst, then waits to be woken by another processor.
+  };
+
+  /// @brief The simulation's view of a single thread.
+  struct sim_thread
+  {
+    task_thread *thread; ///< The real thread being simulated.
+    SIM_BEHAVIOUR behaviour; ///< How the thread behaves.
+    uint64_t burst_remaining; ///< How long the thread runs for before it next blocks. Unused for CPU bound threads.
+    uint64_t runtime; ///< The total time the thread has run for.
+    uint64_t woken_at; ///< When the thread last became runnable after blocking, or zero if it has run since.
+  };
+
+  /// @brief The simulation's view of a single virtual processor.
+  struct sim_proc
+  {
+    task_thread *running; ///< The thread chosen by this processor's scheduler.
+    uint64_t running_since; ///< When the scheduler last ran.
+    uint64_t next_tick; ///< When the scheduler is due to run again, or sim_never if the tick is stopped.
+  };
+
+  const uint64_t sim_never = ~0ULL;
+
+  const uint32_t sim_num_procs = 4;
+  const uint32_t sim_num_processes = 200;
+  const uint32_t sim_threads_per_process = 10;
+  const uint64_t sim_start_time = 1000;
+  const uint64_t sim_duration = 5000000000;
+
+  // The sleepers and blockers between them need about two thirds of the processors' time, with the CPU bound threads
+  // taking up the rest.
+  const uint64_t sim_burst_min = 20000;
+  const uint64_t sim_burst_max = 500000;
+  const uint64_t sim_sleep_min = 50000000;
+  const uint64_t sim_sleep_max = 500000000;
+  const uint64_t sim_block_min = 10000000;
+  const uint64_t sim_block_max = 200000000;
+
+  uint64_t sim_random_state;
+
+  uint64_t sim_random(uint64_t min, uint64_t max);
+  void sim_collect_signals(vector<sim_proc> &procs, uint64_t time_now);
+}
+
+TEST(SchedulerSimulation, MixedLoad)
+{
+  shared_ptr<task_process> sys_proc;
+  vector<shared_ptr<task_process>> processes;
+  vector<sim_thread> threads;
+  unordered_map<task_thread *, uint32_t> thread_index;
+  vector<sim_proc> procs(sim_num_procs);
+  priority_queue<pair<uint64_t, uint32_t>, vector<pair<uint64_t, uint32_t>>, greater<pair<uint64_t, uint32_t>>>
+    block_wakes;
+  shared_ptr<task_process> new_proc;
+  task_thread *new_thread;
+  sim_thread *st;
+  uint64_t time_now = sim_start_time;
+  uint64_t event_time;
+  uint64_t burst_end;
+  uint64_t elapsed;
+  uint64_t dummy_delay;
+  uint32_t event_proc;
+  bool event_is_wake;
+  uint32_t waker = 0;
+
+  uint64_t decisions = 0;
+  uint64_t decision_ns_total = 0;
+  uint64_t decision_ns_max = 0;
+  uint64_t wakes = 0;
+  uint64_t wake_latency_total = 0;
+  uint64_t wake_latency_max = 0;
+  uint64_t cpu_bound_count = 0;
+  double runtime_mean = 0.0;
+  double runtime_var = 0.0;
+  uint64_t runtime_min = sim_never;
+  uint64_t runtime_max = 0;
+
+  sim_random_state = 0x2545F4914F6CDD1DULL;
+
+  test_only_set_proc_count(sim_num_procs);
+  test_only_set_proc_id(0);
+
+  hm_gen_init();
+  system_tree_init();
+  sys_proc = task_init();
+  sys_proc->stop_process();
+  test_set_system_timer_count(time_now);
+
+  for (uint32_t i = 0; i < sim_num_procs; i++)
+  {
+    procs[i].running = nullptr;
+    procs[i].running_since = time_now;
+    procs[i].next_tick = time_now;
+    test_only_take_proc_tick(i, dummy_delay);
+    test_only_take_proc_kick(i);
+  }
+
+  for (uint32_t i = 0; i < sim_num_processes; i++)
+  {
+    new_proc = task_process::create(dummy_thread_fn);
+    processes.push_back(new_proc);
+
+    for (uint32_t j = 0; j < sim_threads_per_process; j++)
+    {
+      if (j == 0)
+      {
+        new_thread = new_proc->child_threads.head->item.get();
+      }
+      else
+      {
+        new_thread = task_thread::create(dummy_thread_fn, new_proc).get();
+      }
+
+      sim_thread t;
+      t.thread = new_thread;
+      t.behaviour = (j < 2) ? SIM_BEHAVIOUR::CPU_BOUND : ((j < 6) ? SIM_BEHAVIOUR::SLEEPER : SIM_BEHAVIOUR::BLOCKER);
+      t.burst_remaining = sim_random(sim_burst_min, sim_burst_max);
+      t.runtime = 0;
+      t.woken_at = 0;
+
+      thread_index[new_thread] = static_cast<uint32_t>(threads.size());
+      threads.push_back(t);
+    }
+  }
+
+  // Spread the processes' creation over the processors, as if they had been started by threads running on each.
+  for (uint32_t i = 0; i < sim_num_processes; i++)
+  {
+    test_only_set_proc_id(i % sim_num_procs);
+    processes[i]->start_process();
+  }
+  sim_collect_signals(procs, time_now);
+
+  while (time_now < (sim_start_time + sim_duration))
+  {
+    // Find the next event - a processor's scheduler running, or a blocked thread being woken.
+    event_time = sim_never;
+    event_proc = 0;
+    event_is_wake = false;
+
+    for (uint32_t i = 0; i < sim_num_procs; i++)
+    {
+      burst_end = sim_never;
+      if (thread_index.count(procs[i].running) != 0)
+      {
+        st = &threads[thread_index[procs[i].running]];
+        if (st->behaviour != SIM_BEHAVIOUR::CPU_BOUND)
+        {
+          burst_end = procs[i].running_since + st->burst_remaining;
+        }
+      }
+
+      if (procs[i].next_tick < event_time)
+      {
+        event_time = procs[i].next_tick;
+        event_proc = i;
+      }
+      if (burst_end < event_time)
+      {
+        event_time = burst_end;
+        event_proc = i;
+      }
+    }
+
+    if (!block_wakes.empty() && (block_wakes.top().first < event_time))
+    {
+      event_time = block_wakes.top().first;
+      event_is_wake = true;
+    }
+
+    ASSERT_NE(sim_never, event_time);
+    if (event_time > time_now)
+    {
+      time_now = event_time;
+    }
+    test_set_system_timer_count(time_now);
+
+    if (event_is_wake)
+    {
+      // Blocked threads are woken by each processor in turn.
+      st = &threads[block_wakes.top().second];
+      block_wakes.pop();
+
+      test_only_set_proc_id(waker);
+      waker = (waker + 1) % sim_num_procs;
+
+      st->woken_at = time_now;
+      st->thread->start_thread();
+    }
+    else
+    {
+      test_only_set_proc_id(event_proc);
+
+      // Account for the time the outgoing thread has just spent running, and block it if its burst is over.
+      if (thread_index.count(procs[event_proc].running) != 0)
+      {
+        st = &threads[thread_index[procs[event_proc].running]];
+        elapsed = time_now - procs[event_proc].running_since;
+        st->runtime += elapsed;
+
+        if (st->behaviour != SIM_BEHAVIOUR::CPU_BOUND)
+        {
+          st->burst_remaining = (elapsed < st->burst_remaining) ? st->burst_remaining - elapsed : 0;
+          if (st->burst_remaining == 0)
+          {
+            st->thread->stop_thread();
+
+            if (st->behaviour == SIM_BEHAVIOUR::SLEEPER)
+            {
+              st->thread->wake_thread_after = time_now + sim_random(sim_sleep_min, sim_sleep_max);
+              st->woken_at = st->thread->wake_thread_after;
+            }
+            else
+            {
+              block_wakes.push({ time_now + sim_random(sim_block_min, sim_block_max),
+                                 thread_index[procs[event_proc].running] });
+            }
+          }
+        }
+      }
+
+      auto start = chrono::steady_clock::now();
+      procs[event_proc].running = task_get_next_thread();
+      auto end = chrono::steady_clock::now();
+
+      elapsed = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+      decisions++;
+      decision_ns_total += elapsed;
+      if (elapsed > decision_ns_max)
+      {
+        decision_ns_max = elapsed;
+      }
+
+      procs[event_proc].running_since = time_now;
+      procs[event_proc].next_tick = sim_never;
+
+      if (thread_index.count(procs[event_proc].running) != 0)
+      {
+        st = &threads[thread_index[procs[event_proc].running]];
+        if (st->woken_at != 0)
+        {
+          elapsed = (time_now > st->woken_at) ? time_now - st->woken_at : 0;
+          wakes++;
+          wake_latency_total += elapsed;
+          if (elapsed > wake_latency_max)
+          {
+            wake_latency_max = elapsed;
+          }
+          st->woken_at = 0;
+        }
+
+        if ((st->behaviour != SIM_BEHAVIOUR::CPU_BOUND) && (st->burst_remaining == 0))
+        {
+          st->burst_remaining = sim_random(sim_burst_min, sim_burst_max);
+        }
+      }
+    }
+
+    sim_collect_signals(procs, time_now);
+  }
+
+  for (sim_thread &t : threads)
+  {
+    if (t.behaviour == SIM_BEHAVIOUR::CPU_BOUND)
+    {
+      cpu_bound_count++;
+      runtime_mean += static_cast<double>(t.runtime);
+      if (t.runtime < runtime_min)
+      {
+        runtime_min = t.runtime;
+      }
+      if (t.runtime > runtime_max)
+      {
+        runtime_max = t.runtime;
+      }
+    }
+  }
+  runtime_mean /= static_cast<double>(cpu_bound_count);
+  for (sim_thread &t : threads)
+  {
+    if (t.behaviour == SIM_BEHAVIOUR::CPU_BOUND)
+    {
+      runtime_var += (static_cast<double>(t.runtime) - runtime_mean) * (static_cast<double>(t.runtime) - runtime_mean);
+    }
+  }
+  runtime_var /= static_cast<double>(cpu_bound_count);
+
+  cout << "Simulated " << threads.size() << " threads on " << sim_num_procs << " processors for "
+       << sim_duration / 1000000 << " ms" << endl;
+  cout << "Scheduling decisions: " << decisions << ", average " << decision_ns_total / decisions << " ns, max "
+       << decision_ns_max << " ns (host time)" << endl;
+  cout << "CPU bound thread runtime (ms): mean " << runtime_mean / 1000000.0 << ", std dev "
+       << sqrt(runtime_var) / 1000000.0 << ", min " << runtime_min / 1000000.0 << ", max "
+       << runtime_max / 1000000.0 << endl;
+  cout << "Wake ups: " << wakes << ", average latency " << (wakes == 0 ? 0 : wake_latency_total / wakes) << " ns, max "
+       << wake_latency_max << " ns" << endl;
+
+  // These are only sanity checks. The figures above are the real output.
+  ASSERT_GT(decisions, 0);
+  ASSERT_GT(wakes, 0);
+  ASSERT_GT(runtime_min, 0);
+
+  for (shared_ptr<task_process> &p : processes)
+  {
+    p->stop_process();
+  }
+  for (uint32_t i = 0; i < sim_num_procs; i++)
+  {
+    test_only_set_proc_id(i);
+    task_get_next_thread();
+  }
+  test_only_set_proc_id(0);
+
+  for (shared_ptr<task_process> &p : processes)
+  {
+    p->destroy_process(0);
+  }
+  processes.clear();
+  new_proc = nullptr;
+  sys_proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_set_proc_count(1);
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
+
+namespace
+{
+  /// @brief Generate a pseudo-random number, the same sequence each run.
+  ///
+  /// @param min The smallest number to return.
+  ///
+  /// @param max The largest number to return.
+  ///
+  /// @return A number between min and max inclusive.
+  uint64_t sim_random(uint64_t min, uint64_t max)
+  {
+    // xorshift64*
+    sim_random_state ^= sim_random_state >> 12;
+    sim_random_state ^= sim_random_state << 25;
+    sim_random_state ^= sim_random_state >> 27;
+
+    return min + ((sim_random_state * 0x2545F4914F6CDD1DULL) % (max - min + 1));
+  }
+
+  /// @brief Update each virtual processor's next tick from the ticks programmed and signals sent since the last call.
+  ///
+  /// @param procs The virtual processors.
+  ///
+  /// @param time_now The current simulated time.
+  void sim_collect_signals(vector<sim_proc> &procs, uint64_t time_now)
+  {
+    uint64_t delay;
+
+    for (uint32_t i = 0; i < procs.size(); i++)
+    {
+      if (test_only_take_proc_tick(i, delay))
+      {
+        procs[i].next_tick = (delay == 0) ? sim_never : time_now + delay;
+      }
+      if (test_only_take_proc_kick(i))
+      {
+        procs[i].next_tick = time_now;
+      }
+    }
+  }
+}
@@ -1,6 +1,8 @@
 #include "test/test_core/test.h"
 #include "system_tree/system_tree.h"
 #include "system_tree/fs/mem/mem_fs.h"
+#include "mem/mem.h"
+#include "processor/processor.h"
 
 #include "gtest/gtest.h"
 
@@ -96,4 +98,37 @@ TEST(MemFsBasicTests, SetFileSize)
   {
     ASSERT_EQ(buffer[i], expected_out[i]);
   }
-}
\ No newline at end of file
+}
+TEST(MemFsBasicTests, SectionNoAddressSpace)
+{
+  shared_ptr<mem_fs_section> section;
+  void *map_addr = nullptr;
+  ERR_CODE ec;
+
+  system_tree_init();
+  task_gen_init();
+
+  shared_ptr<task_process> proc = task_process::create(dummy_thread_fn);
+  ASSERT_TRUE(proc);
+
+  section = mem_fs_section::create(1);
+  ASSERT_NE(section, nullptr);
+
+  // Use up the whole of the process's address space, so there's nowhere left to map the section.
+  for (uint64_t range_size = 0x1000000; range_size != 0; range_size /= 2)
+  {
+    while (mem_allocate_virtual_range(range_size, proc.get()) != nullptr)
+    {
+    }
+  }
+
+  ec = section->map_into_process(proc.get(), map_addr);
+  ASSERT_EQ(ec, ERR_CODE::OUT_OF_RESOURCE);
+
+  section = nullptr;
+  proc->destroy_process(0);
+  proc = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+}
@@ -113,6 +113,80 @@ TEST_F(MemFsSyscallTests, FileDoesntExist)
   ASSERT_EQ(fh, 123);
 }
 
+TEST_F(MemFsSyscallTests, SectionCreateWriteAndRead)
+{
+  ERR_CODE ec;
+  char section_name[] = "\\mem\\section";
+  unsigned char test_string[23] = "This is a test string.";
+  unsigned char output_buffer[23];
+  GEN_HANDLE section_handle;
+  GEN_HANDLE second_handle;
+  uint64_t br;
+
+  memset(output_buffer, 0, 23);
+
+  ec = syscall_create_section(section_name, strlen(section_name), 1, &section_handle);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  br = 0;
+  ec = syscall_get_handle_data_len(section_handle, &br);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ASSERT_EQ(br, MEM_PAGE_SIZE);
+
+  // Sections can't be resized.
+  ec = syscall_set_handle_data_len(section_handle, 23);
+  ASSERT_EQ(ec, ERR_CODE::INVALID_OP);
+
+  ec = syscall_write_handle(section_handle, 0, 23, test_string, 23, &br);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ASSERT_EQ(br, 23);
+
+  // A second handle to the same section sees the same data.
+  ec = syscall_open_handle(section_name, strlen(section_name), &second_handle, 0);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  ec = syscall_read_handle(second_handle, 0, 23, output_buffer, 23, &br);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ASSERT_EQ(br, 23);
+  ASSERT_STREQ((char *)output_buffer, (char *)test_string);
+
+  ec = syscall_close_handle(second_handle);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ec = syscall_close_handle(section_handle);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  ec = system_tree()->delete_child(section_name);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+}
+
+TEST_F(MemFsSyscallTests, SectionInvalidParams)
+{
+  ERR_CODE ec;
+  char section_name[] = "\\mem\\section";
+  char filename[] = "\\mem\\new_file";
+  GEN_HANDLE handle = 123;
+  void *map_addr = nullptr;
+
+  ec = syscall_create_section(section_name, strlen(section_name), 0, &handle);
+  ASSERT_EQ(ec, ERR_CODE::INVALID_PARAM);
+  ASSERT_EQ(handle, 123);
+
+  ec = syscall_create_section(section_name, strlen(section_name), mem_fs_max_section_pages + 1, &handle);
+  ASSERT_EQ(ec, ERR_CODE::INVALID_PARAM);
+  ASSERT_EQ(handle, 123);
+
+  // Only sections can be mapped.
+  ec = syscall_create_obj_and_handle(filename, strlen(filename), &handle);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  ec = syscall_map_section(handle, &map_addr);
+  ASSERT_EQ(ec, ERR_CODE::WRONG_TYPE);
+  ASSERT_EQ(map_addr, nullptr);
+
+  ec = syscall_close_handle(handle);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+}
+
 /* There isn't the ability to delete files yet.
 TEST_F(MemFsSyscallTests, CreateWriteDelete)
 {
@@ -4,6 +4,8 @@
 #include "system_tree/fs/fs_file_interface.h"
 #include "test/test_core/test.h"
 #include "klib/klib.h"
+#include "mem/mem.h"
+#include "user_interfaces/syscall.h"
 
 #include "gtest/gtest.h"
 
@@ -66,3 +68,70 @@ TEST(SystemTreeTest, ProcFsOneProcessIdFile)
   test_only_reset_system_tree();
   test_only_reset_allocator();
 }
+
+TEST(SystemTreeTest, ProcFsMemCounters)
+{
+  shared_ptr<ISystemTreeLeaf> leaf;
+  shared_ptr<IReadable> counter;
+  ERR_CODE ec;
+  char read_buffer[22];
+  char expected_buffer[22];
+  uint64_t br;
+
+  system_tree_init();
+  task_gen_init();
+
+  shared_ptr<task_process> proc = task_process::create(dummy_thread_fn);
+  ASSERT_TRUE(proc);
+
+  test_only_set_cur_thread(proc->child_threads.head->item.get());
+
+  // The process has at least one thread, so must have been charged for some kernel heap.
+  ec = system_tree()->get_child("\\proc\\0\\mem_kernel_heap", leaf);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  counter = dynamic_pointer_cast<IReadable>(leaf);
+  ASSERT_TRUE(counter);
+  memset(read_buffer, 0, 22);
+  ec = counter->read_bytes(0, 22, reinterpret_cast<uint8_t *>(read_buffer), 22, br);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ASSERT_NE(strtoull(read_buffer, nullptr, 10), 0);
+
+  // Limits can be set through the syscall interface and read back from proc.
+  ASSERT_TRUE(mem_acct_within_limits(proc.get(), 1, 1));
+  ec = syscall_set_mem_limits(0, 0, 2);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  ASSERT_TRUE(mem_acct_within_limits(proc.get(), 100, 1));
+  ASSERT_FALSE(mem_acct_within_limits(proc.get(), 0, 3));
+
+  // But a process can't raise or remove its own limits, only tighten them.
+  ASSERT_EQ(syscall_set_mem_limits(0, 0, 3), ERR_CODE::INVALID_OP);
+  ASSERT_EQ(syscall_set_mem_limits(0, 0, 0), ERR_CODE::INVALID_OP);
+  ASSERT_FALSE(mem_acct_within_limits(proc.get(), 0, 3));
+  ASSERT_EQ(syscall_set_mem_limits(0, 50, 2), ERR_CODE::NO_ERROR);
+  ASSERT_FALSE(mem_acct_within_limits(proc.get(), 100, 1));
+  ASSERT_EQ(syscall_set_mem_limits(0, 0, 2), ERR_CODE::INVALID_OP);
+
+  ec = system_tree()->get_child("\\proc\\0\\mem_limit_resident", leaf);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  counter = dynamic_pointer_cast<IReadable>(leaf);
+  ASSERT_TRUE(counter);
+  memset(read_buffer, 0, 22);
+  ec = counter->read_bytes(0, 22, reinterpret_cast<uint8_t *>(read_buffer), 22, br);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+  snprintf(expected_buffer, 22, "%lu", 2 * MEM_PAGE_SIZE);
+  ASSERT_EQ(strncmp(read_buffer, expected_buffer, 22), 0);
+  ASSERT_EQ(br, strlen(expected_buffer) + 1);
+
+  ec = system_tree()->get_child("\\proc\\0\\handles", leaf);
+  ASSERT_EQ(ec, ERR_CODE::NO_ERROR);
+
+  test_only_set_cur_thread(nullptr);
+  proc->destroy_process(0);
+  proc = nullptr;
+  counter = nullptr;
+  leaf = nullptr;
+
+  test_only_reset_task_mgr();
+  test_only_reset_system_tree();
+  test_only_reset_allocator();
+}
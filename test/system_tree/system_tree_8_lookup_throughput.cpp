@@ -0,0 +1,183 @@
+// System tree test 8.
+//
+// Concurrent lookups in System Tree and in Object Manager. Lookups in both don't exclude each other, so their
+// throughput is printed against the number of threads looking things up. The results depend on the host, so they are
+// not checked. There is also a check that lookups keep working while the tree is changed around them.
+
+#include "test/test_core/test.h"
+#include "system_tree/system_tree_simple_branch.h"
+#include "system_tree/system_tree.h"
+#include "object_mgr/object_mgr.h"
+#include "processor/processor.h"
+
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+  const uint64_t lookups_per_thread = 100000;
+  const uint32_t num_handles = 32;
+
+  class lookup_object : public ISystemTreeLeaf
+  {
+  public:
+    virtual ~lookup_object() { };
+  };
+
+  object_manager *lookup_om;
+  GEN_HANDLE lookup_handles[num_handles];
+  volatile bool stop_changes;
+
+  void tree_lookup_thread(bool *failed);
+  void om_lookup_thread(bool *failed);
+  double run_lookups(void (*thread_fn)(bool *), uint32_t thread_count, bool &failed);
+}
+
+TEST(SystemTreeTest, ConcurrentLookupThroughput)
+{
+  shared_ptr<system_tree_simple_branch> branch = make_shared<system_tree_simple_branch>();
+  shared_ptr<lookup_object> leaf = make_shared<lookup_object>();
+  unique_ptr<object_manager> om = make_unique<object_manager>();
+  uint32_t max_threads = thread::hardware_concurrency();
+  double tree_rate;
+  double om_rate;
+  bool failed;
+
+  if (max_threads < 2)
+  {
+    max_threads = 2;
+  }
+
+  system_tree_init();
+  ASSERT_EQ(system_tree()->add_child("\\branch", branch), ERR_CODE::NO_ERROR);
+  ASSERT_EQ(system_tree()->add_child("\\branch\\leaf", leaf), ERR_CODE::NO_ERROR);
+
+  lookup_om = om.get();
+  for (uint32_t i = 0; i < num_handles; i++)
+  {
+    object_data d;
+    d.object_ptr = leaf;
+    lookup_handles[i] = om->store_object(d);
+  }
+
+  cout << "Threads, system tree (Mlookups/s), object manager (Mlookups/s)" << endl;
+  for (uint32_t threads = 1; threads <= max_threads; threads *= 2)
+  {
+    failed = false;
+    tree_rate = run_lookups(tree_lookup_thread, threads, failed);
+    ASSERT_FALSE(failed);
+
+    om_rate = run_lookups(om_lookup_thread, threads, failed);
+    ASSERT_FALSE(failed);
+
+    cout << threads << ", " << tree_rate << ", " << om_rate << endl;
+  }
+
+  for (uint32_t i = 0; i < num_handles; i++)
+  {
+    om->remove_object(lookup_handles[i]);
+  }
+  lookup_om = nullptr;
+
+  ASSERT_EQ(system_tree()->delete_child("\\branch"), ERR_CODE::NO_ERROR);
+  test_only_reset_system_tree();
+}
+
+TEST(SystemTreeTest, LookupsDuringChanges)
+{
+  shared_ptr<system_tree_simple_branch> branch = make_shared<system_tree_simple_branch>();
+  shared_ptr<lookup_object> leaf = make_shared<lookup_object>();
+  shared_ptr<lookup_object> other_leaf = make_shared<lookup_object>();
+  bool failed = false;
+
+  system_tree_init();
+  ASSERT_EQ(system_tree()->add_child("\\branch", branch), ERR_CODE::NO_ERROR);
+  ASSERT_EQ(system_tree()->add_child("\\branch\\leaf", leaf), ERR_CODE::NO_ERROR);
+
+  // While the branch's children keep being replaced, the leaf that isn't changing must always be found.
+  stop_changes = false;
+  thread reader(tree_lookup_thread, &failed);
+  while (!stop_changes)
+  {
+    ASSERT_EQ(system_tree()->add_child("\\branch\\other", other_leaf), ERR_CODE::NO_ERROR);
+    ASSERT_EQ(system_tree()->rename_child("\\branch\\other", "\\branch\\renamed"), ERR_CODE::NO_ERROR);
+    ASSERT_EQ(system_tree()->delete_child("\\branch\\renamed"), ERR_CODE::NO_ERROR);
+  }
+  reader.join();
+  ASSERT_FALSE(failed);
+
+  // The deleted leaf isn't referred to by any old copies of the branch's children.
+  ASSERT_EQ(other_leaf.use_count(), 1);
+
+  ASSERT_EQ(system_tree()->delete_child("\\branch"), ERR_CODE::NO_ERROR);
+  test_only_reset_system_tree();
+}
+
+namespace
+{
+  /// @brief Run some lookup threads at once, and time them.
+  ///
+  /// @param thread_fn The function for each thread to run.
+  ///
+  /// @param thread_count The number of threads to run.
+  ///
+  /// @param[out] failed Set to true if any lookup failed.
+  ///
+  /// @return The total number of lookups per second, in millions.
+  double run_lookups(void (*thread_fn)(bool *), uint32_t thread_count, bool &failed)
+  {
+    vector<thread> threads;
+    chrono::steady_clock::time_point start;
+    chrono::duration<double> elapsed;
+    unique_ptr<bool[]> thread_failed = make_unique<bool[]>(thread_count);
+
+    start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+      thread_failed[i] = false;
+      threads.emplace_back(thread_fn, &thread_failed[i]);
+    }
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+      threads[i].join();
+      failed = failed || thread_failed[i];
+    }
+    elapsed = chrono::steady_clock::now() - start;
+
+    return (thread_count * lookups_per_thread) / elapsed.count() / 1000000.0;
+  }
+
+  void tree_lookup_thread(bool *failed)
+  {
+    shared_ptr<ISystemTreeLeaf> found;
+
+    for (uint64_t i = 0; i < lookups_per_thread; i++)
+    {
+      if ((system_tree()->get_child("\\branch\\leaf", found) != ERR_CODE::NO_ERROR) || !found)
+      {
+        *failed = true;
+        break;
+      }
+    }
+
+    stop_changes = true;
+  }
+
+  void om_lookup_thread(bool *failed)
+  {
+    for (uint64_t i = 0; i < lookups_per_thread; i++)
+    {
+      if (!lookup_om->retrieve_object(lookup_handles[i % num_handles]))
+      {
+        *failed = true;
+        break;
+      }
+    }
+  }
+}
@@ -39,6 +39,12 @@ void test_spin_sleep(uint64_t sleep_time_ns);
 // defined in processor.dummy.cpp
 class task_thread;
 void test_only_set_cur_thread(task_thread *thread);
+void test_only_set_proc_count(uint32_t count);
+void test_only_set_proc_id(uint32_t proc_id);
+uint64_t test_only_get_next_tick();
+uint32_t test_only_get_proc_wakes();
+bool test_only_take_proc_tick(uint32_t proc_id, uint64_t &delay_ns);
+bool test_only_take_proc_kick(uint32_t proc_id);
 void dummy_thread_fn();
 void test_init_proc_interrupt_table();
 void test_set_system_timer_count(uint64_t count);
@@ -0,0 +1,222 @@
+// Futex test 2.
+//
+// Wake operations should only wake as many threads as they are asked to, oldest waiter first, and requeue operations
+// should move the rest of the waiters without waking them. The number of wakeups is read from the process's
+// futex_wakeups counter in proc.
+
+#include "gtest/gtest.h"
+
+#include <azalea/azalea.h>
+
+#include <iostream>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+namespace
+{
+  void *waiter_thread(void *futex);
+  void start_waiters(volatile int32_t *futex, uint32_t count);
+  void join_waiters();
+  void let_waiters_run();
+  uint64_t read_futex_wakeups();
+
+  const uint32_t num_waiters = 4;
+
+  pthread_t waiters[num_waiters];
+  uint32_t waiters_started;
+
+  volatile int32_t first_futex;
+  volatile int32_t second_futex;
+
+  // The number of waiter threads that have been woken.
+  volatile uint32_t passed;
+}
+
+TEST(Futex, WakeCountLimitsWakeups)
+{
+  uint64_t wakeups;
+
+  first_futex = 0;
+  start_waiters(&first_futex, num_waiters);
+
+  // Waking one thread should only wake one, not all of them.
+  wakeups = read_futex_wakeups();
+  ASSERT_EQ(syscall_futex_op(&first_futex, FUTEX_OP::FUTEX_WAKE, 1, 0, nullptr, 0), ERR_CODE::NO_ERROR);
+  let_waiters_run();
+  ASSERT_EQ(passed, 1);
+  ASSERT_EQ(read_futex_wakeups() - wakeups, 1);
+
+  // Then wake the rest.
+  ASSERT_EQ(syscall_futex_op(&first_futex, FUTEX_OP::FUTEX_WAKE, INT32_MAX, 0, nullptr, 0), ERR_CODE::NO_ERROR);
+  let_waiters_run();
+  ASSERT_EQ(passed, num_waiters);
+  ASSERT_EQ(read_futex_wakeups() - wakeups, num_waiters);
+
+  // There's nobody left to wake.
+  ASSERT_EQ(syscall_futex_op(&first_futex, FUTEX_OP::FUTEX_WAKE, 1, 0, nullptr, 0), ERR_CODE::NOT_FOUND);
+
+  join_waiters();
+}
+
+TEST(Futex, RequeueAvoidsWakeups)
+{
+  uint64_t wakeups;
+
+  first_futex = 0;
+  second_futex = 0;
+  start_waiters(&first_futex, num_waiters);
+
+  // If the first futex has changed, nothing happens.
+  ASSERT_EQ(syscall_futex_op(&first_futex, FUTEX_OP::FUTEX_CMP_REQUEUE, 1, INT32_MAX, &second_futex, 1),
+            ERR_CODE::SYNC_VALUE_CHANGED);
+
+  // Like broadcasting a condition variable - wake one thread, and move the others to wait on the mutex rather than
+  // waking them all to fight over it.
+  wakeups = read_futex_wakeups();
+  ASSERT_EQ(syscall_futex_op(&first_futex, FUTEX_OP::FUTEX_CMP_REQUEUE, 1, INT32_MAX, &second_futex, 0),
+            ERR_CODE::NO_ERROR);
+  let_waiters_run();
+  ASSERT_EQ(passed, 1);
+  ASSERT_EQ(read_futex_wakeups() - wakeups, 1);
+
+  // None are left on the first futex, they're all waiting on the second.
+  ASSERT_EQ(syscall_futex_op(&first_futex, FUTEX_OP::FUTEX_WAKE, 1, 0, nullptr, 0), ERR_CODE::NOT_FOUND);
+
+  // Unlocking the "mutex" wakes them one at a time.
+  for (uint32_t i = 2; i <= num_waiters; i++)
+  {
+    ASSERT_EQ(syscall_futex_op(&second_futex, FUTEX_OP::FUTEX_WAKE, 1, 0, nullptr, 0), ERR_CODE::NO_ERROR);
+    let_waiters_run();
+    ASSERT_EQ(passed, i);
+    ASSERT_EQ(read_futex_wakeups() - wakeups, i);
+  }
+
+  join_waiters();
+}
+
+TEST(Futex, WakeOpChangesAndWakes)
+{
+  uint32_t encoded_op;
+
+  first_futex = 0;
+  second_futex = 0;
+  start_waiters(&first_futex, 1);
+  start_waiters(&second_futex, 1);
+
+  // Set the second futex to 1. Since it was 0 beforehand, wake its waiter as well as the first futex's.
+  encoded_op = FUTEX_WAKE_OP_ENCODE(FUTEX_ATOMIC_OP::SET, 1, FUTEX_ATOMIC_CMP::EQ, 0);
+  ASSERT_EQ(syscall_futex_op(&first_futex, FUTEX_OP::FUTEX_WAKE_OP, 1, 1, &second_futex, encoded_op),
+            ERR_CODE::NO_ERROR);
+  let_waiters_run();
+  ASSERT_EQ(second_futex, 1);
+  ASSERT_EQ(passed, 2);
+
+  join_waiters();
+
+  // This time the comparison fails, so only the first futex's waiter is woken.
+  start_waiters(&first_futex, 1);
+  start_waiters(&second_futex, 1);
+
+  encoded_op = FUTEX_WAKE_OP_ENCODE(FUTEX_ATOMIC_OP::ADD, 1, FUTEX_ATOMIC_CMP::EQ, 0);
+  ASSERT_EQ(syscall_futex_op(&first_futex, FUTEX_OP::FUTEX_WAKE_OP, 1, 1, &second_futex, encoded_op),
+            ERR_CODE::NO_ERROR);
+  let_waiters_run();
+  ASSERT_EQ(second_futex, 2);
+  ASSERT_EQ(passed, 1);
+
+  ASSERT_EQ(syscall_futex_op(&second_futex, FUTEX_OP::FUTEX_WAKE, 1, 0, nullptr, 0), ERR_CODE::NO_ERROR);
+  join_waiters();
+}
+
+namespace
+{
+  /// @brief Wait on a futex once, then record that this thread was woken.
+  ///
+  /// @param futex The futex to wait on. Its value is expected not to change while the thread waits.
+  ///
+  /// @return nullptr.
+  void *waiter_thread(void *futex)
+  {
+    volatile int32_t *f = reinterpret_cast<volatile int32_t *>(futex);
+
+    syscall_futex_op(f, FUTEX_OP::FUTEX_WAIT, *f, 0, nullptr, 0);
+    __atomic_fetch_add(&passed, 1, __ATOMIC_SEQ_CST);
+
+    return nullptr;
+  }
+
+  /// @brief Start some threads waiting on a futex, and give them time to start waiting.
+  ///
+  /// If no waiters are currently running, the count of threads that have passed is reset.
+  ///
+  /// @param futex The futex to wait on.
+  ///
+  /// @param count The number of threads to start.
+  void start_waiters(volatile int32_t *futex, uint32_t count)
+  {
+    if (waiters_started == 0)
+    {
+      passed = 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      ASSERT_LT(waiters_started, num_waiters);
+      pthread_create(&waiters[waiters_started], nullptr, waiter_thread, const_cast<int32_t *>(futex));
+      waiters_started++;
+    }
+
+    let_waiters_run();
+    ASSERT_EQ(passed, 0);
+  }
+
+  /// @brief Wait for all the waiter threads to finish.
+  void join_waiters()
+  {
+    for (uint32_t i = 0; i < waiters_started; i++)
+    {
+      pthread_join(waiters[i], nullptr);
+    }
+    waiters_started = 0;
+  }
+
+  /// @brief Sleep for long enough that any runnable waiter threads have run.
+  void let_waiters_run()
+  {
+    timespec a;
+    timespec b;
+
+    a.tv_sec = 0;
+    a.tv_nsec = 500000000;
+    nanosleep(&a, &b);
+  }
+
+  /// @brief Read this process's count of futex wakeups from proc.
+  ///
+  /// @return The number of times threads in this process have been woken from futexes.
+  uint64_t read_futex_wakeups()
+  {
+    const char *path = "\\proc\\0\\futex_wakeups";
+    GEN_HANDLE handle;
+    char buffer[22];
+    uint64_t bytes_read = 0;
+    uint64_t result = 0;
+
+    memset(buffer, 0, sizeof(buffer));
+
+    if (syscall_open_handle(path, strlen(path), &handle, 0) == ERR_CODE::NO_ERROR)
+    {
+      syscall_read_handle(handle, 0, sizeof(buffer) - 1, reinterpret_cast<unsigned char *>(buffer), sizeof(buffer),
+                          &bytes_read);
+      syscall_close_handle(handle);
+      result = strtoull(buffer, nullptr, 10);
+    }
+
+    return result;
+  }
+}
@@ -0,0 +1,68 @@
+// Futex test 3.
+//
+// Futexes used with FUTEX_SHARED_FLAG are identified by their physical address, and those used without it by their
+// process and virtual address, so a wake only finds waiters that used the same kind of futex.
+
+#include "gtest/gtest.h"
+
+#include <azalea/azalea.h>
+
+#include <iostream>
+#include <pthread.h>
+#include <time.h>
+
+using namespace std;
+
+namespace
+{
+  void *shared_waiter_thread(void *_);
+  void let_waiter_run();
+
+  volatile int32_t f{0};
+  volatile bool woken{false};
+
+  const FUTEX_OP shared_wait = static_cast<FUTEX_OP>(static_cast<uint32_t>(FUTEX_OP::FUTEX_WAIT) | FUTEX_SHARED_FLAG);
+  const FUTEX_OP shared_wake = static_cast<FUTEX_OP>(static_cast<uint32_t>(FUTEX_OP::FUTEX_WAKE) | FUTEX_SHARED_FLAG);
+}
+
+TEST(Futex, SharedWaitAndWake)
+{
+  pthread_t thread_b;
+
+  pthread_create(&thread_b, nullptr, shared_waiter_thread, nullptr);
+  let_waiter_run();
+  ASSERT_FALSE(woken);
+
+  // A private wake doesn't find a shared waiter.
+  ASSERT_EQ(syscall_futex_op(&f, FUTEX_OP::FUTEX_WAKE, 1, 0, nullptr, 0), ERR_CODE::NOT_FOUND);
+  let_waiter_run();
+  ASSERT_FALSE(woken);
+
+  ASSERT_EQ(syscall_futex_op(&f, shared_wake, 1, 0, nullptr, 0), ERR_CODE::NO_ERROR);
+  let_waiter_run();
+  ASSERT_TRUE(woken);
+
+  pthread_join(thread_b, nullptr);
+}
+
+namespace
+{
+  void *shared_waiter_thread(void *_)
+  {
+    syscall_futex_op(&f, shared_wait, 0, 0, nullptr, 0);
+    woken = true;
+
+    return nullptr;
+  }
+
+  /// @brief Sleep for long enough that the waiter thread has run, if it is runnable.
+  void let_waiter_run()
+  {
+    timespec a;
+    timespec b;
+
+    a.tv_sec = 0;
+    a.tv_nsec = 500000000;
+    nanosleep(&a, &b);
+  }
+}
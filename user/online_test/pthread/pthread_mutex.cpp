@@ -5,16 +5,24 @@
 #include <iostream>
 #include <pthread.h>
 #include <time.h>
+#include <stdlib.h>
+#include <string.h>
 
 using namespace std;
 
 namespace
 {
   void *other_thread(void *_);
+  void *contend_thread(void *_);
+  uint64_t read_futex_wakeups();
   bool other_thread_fault{false};
 
   pthread_mutex_t t_lock;
   volatile int f{0};
+
+  const uint32_t contend_threads = 4;
+  const uint32_t locks_per_thread = 2000;
+  volatile uint32_t lock_count{0};
 }
 
 TEST(PThread, BasicMutexWait)
@@ -44,6 +52,36 @@ TEST(PThread, BasicMutexWait)
   ASSERT_FALSE(other_thread_fault);
 }
 
+TEST(PThread, MutexContentionWakeups)
+{
+  pthread_t threads[contend_threads];
+  uint64_t wakeups;
+  const uint32_t total_locks = contend_threads * locks_per_thread;
+
+  ASSERT_EQ(pthread_mutex_init(&t_lock, nullptr), 0);
+  lock_count = 0;
+  other_thread_fault = false;
+
+  wakeups = read_futex_wakeups();
+  for (uint32_t i = 0; i < contend_threads; i++)
+  {
+    pthread_create(&threads[i], nullptr, contend_thread, nullptr);
+  }
+  for (uint32_t i = 0; i < contend_threads; i++)
+  {
+    pthread_join(threads[i], nullptr);
+  }
+  wakeups = read_futex_wakeups() - wakeups;
+
+  ASSERT_FALSE(other_thread_fault);
+  ASSERT_EQ(lock_count, total_locks);
+
+  // Each unlock wakes at most one waiting thread, rather than all of them. (Joining the threads may account for a few
+  // more wakeups.)
+  cout << wakeups << " futex wakeups for " << total_locks << " locks" << endl;
+  ASSERT_LE(wakeups, total_locks + contend_threads);
+}
+
 namespace
 {
   void *other_thread(void *_)
@@ -60,4 +98,51 @@ namespace
 
     return nullptr;
   }
+
+  void *contend_thread(void *_)
+  {
+    for (uint32_t i = 0; i < locks_per_thread; i++)
+    {
+      if (pthread_mutex_lock(&t_lock) != 0)
+      {
+        other_thread_fault = true;
+        break;
+      }
+
+      // Not an atomic increment, so that a failure to exclude other threads shows up in the total.
+      lock_count = lock_count + 1;
+
+      if (pthread_mutex_unlock(&t_lock) != 0)
+      {
+        other_thread_fault = true;
+        break;
+      }
+    }
+
+    return nullptr;
+  }
+
+  /// @brief Read this process's count of futex wakeups from proc.
+  ///
+  /// @return The number of times threads in this process have been woken from futexes.
+  uint64_t read_futex_wakeups()
+  {
+    const char *path = "\\proc\\0\\futex_wakeups";
+    GEN_HANDLE handle;
+    char buffer[22];
+    uint64_t bytes_read = 0;
+    uint64_t result = 0;
+
+    memset(buffer, 0, sizeof(buffer));
+
+    if (syscall_open_handle(path, strlen(path), &handle, 0) == ERR_CODE::NO_ERROR)
+    {
+      syscall_read_handle(handle, 0, sizeof(buffer) - 1, reinterpret_cast<unsigned char *>(buffer), sizeof(buffer),
+                          &bytes_read);
+      syscall_close_handle(handle);
+      result = strtoull(buffer, nullptr, 10);
+    }
+
+    return result;
+  }
 }
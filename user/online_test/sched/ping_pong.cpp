@@ -0,0 +1,199 @@
+// Futex ping-pong latency benchmark.
+//
+// Two threads pass a futex word back and forth, each waking the other and then waiting for its turn to come back. The
+// round trip time is dominated by how quickly a woken thread gets on to a processor, so it is measured once with both
+// threads sharing a processor (where the waker has to hand over the processor) and once with them on different
+// processors (where the waker has to signal the other processor). Times are in TSC cycles.
+
+#include "gtest/gtest.h"
+
+#include <azalea/azalea.h>
+
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+  void ping_thread();
+  void pong_thread();
+  bool run_ping_pong(uint64_t ping_affinity, uint64_t pong_affinity);
+  bool start_pinned_thread(void (*entry_point)(), uint64_t affinity, GEN_HANDLE &handle);
+  uint64_t read_tsc();
+
+  const uint64_t round_trips = 10000;
+
+  // Zero when it is the ping thread's turn, one when it is the pong thread's turn.
+  volatile int32_t ball{0};
+  volatile bool ping_done{false};
+  volatile bool pong_done{false};
+
+  uint64_t rtt_min;
+  uint64_t rtt_max;
+  uint64_t rtt_total;
+}
+
+TEST(Scheduler, FutexPingPongSameProcessor)
+{
+  ASSERT_TRUE(run_ping_pong(1, 1));
+
+  cout << "Same processor round trip: min " << rtt_min << ", avg " << rtt_total / round_trips << ", max " << rtt_max
+       << endl;
+}
+
+TEST(Scheduler, FutexPingPongDifferentProcessors)
+{
+  // An affinity mask covering no existing processors is rejected, so this fails to start on a single processor system.
+  if (!run_ping_pong(1, 2))
+  {
+    cout << "Skipped - a second processor is needed" << endl;
+    return;
+  }
+
+  cout << "Different processor round trip: min " << rtt_min << ", avg " << rtt_total / round_trips << ", max "
+       << rtt_max << endl;
+}
+
+namespace
+{
+  /// @brief Start the two ping-pong threads and wait for them to complete.
+  ///
+  /// @param ping_affinity The affinity mask for the thread that starts each round trip.
+  ///
+  /// @param pong_affinity The affinity mask for the thread that returns the ball.
+  ///
+  /// @return True if both threads ran, false if either couldn't be started.
+  bool run_ping_pong(uint64_t ping_affinity, uint64_t pong_affinity)
+  {
+    GEN_HANDLE ping;
+    GEN_HANDLE pong;
+
+    rtt_min = ~0ULL;
+    rtt_max = 0;
+    rtt_total = 0;
+    ball = 0;
+    ping_done = false;
+    pong_done = false;
+
+    if (!start_pinned_thread(pong_thread, pong_affinity, pong))
+    {
+      return false;
+    }
+    if (!start_pinned_thread(ping_thread, ping_affinity, ping))
+    {
+      // Let the pong thread finish, so it isn't left waiting forever.
+      ping_done = true;
+      ball = 1;
+      syscall_futex_op(&ball, FUTEX_OP::FUTEX_WAKE, 0, 0, nullptr, 0);
+      syscall_close_handle(pong);
+      return false;
+    }
+
+    while (!ping_done || !pong_done)
+    {
+      syscall_sleep_thread(10000000);
+    }
+
+    syscall_close_handle(ping);
+    syscall_close_handle(pong);
+
+    return true;
+  }
+
+  /// @brief Create a thread, restrict it to some processors, and start it.
+  ///
+  /// @param entry_point The thread's entry point.
+  ///
+  /// @param affinity The affinity mask to give the thread.
+  ///
+  /// @param[out] handle The handle of the new thread.
+  ///
+  /// @return True if the thread was started, false otherwise.
+  bool start_pinned_thread(void (*entry_point)(), uint64_t affinity, GEN_HANDLE &handle)
+  {
+    ERR_CODE ec;
+
+    ec = syscall_create_thread(entry_point, &handle, 0, nullptr);
+    if (ec != ERR_CODE::NO_ERROR)
+    {
+      return false;
+    }
+
+    ec = syscall_set_thread_affinity(handle, affinity);
+    if (ec == ERR_CODE::NO_ERROR)
+    {
+      ec = syscall_start_thread(handle);
+    }
+    if (ec != ERR_CODE::NO_ERROR)
+    {
+      syscall_close_handle(handle);
+      return false;
+    }
+
+    return true;
+  }
+
+  /// @brief Serve the ball, then wait for it to come back, timing each round trip.
+  void ping_thread()
+  {
+    uint64_t start;
+    uint64_t elapsed;
+
+    for (uint64_t i = 0; i < round_trips; i++)
+    {
+      start = read_tsc();
+
+      ball = 1;
+      syscall_futex_op(&ball, FUTEX_OP::FUTEX_WAKE, 0, 0, nullptr, 0);
+      while (ball == 1)
+      {
+        syscall_futex_op(&ball, FUTEX_OP::FUTEX_WAIT, 1, 0, nullptr, 0);
+      }
+
+      elapsed = read_tsc() - start;
+      rtt_total += elapsed;
+      if (elapsed < rtt_min)
+      {
+        rtt_min = elapsed;
+      }
+      if (elapsed > rtt_max)
+      {
+        rtt_max = elapsed;
+      }
+    }
+
+    ping_done = true;
+    syscall_exit_thread();
+  }
+
+  /// @brief Wait for the ball, then return it.
+  void pong_thread()
+  {
+    for (uint64_t i = 0; (i < round_trips) && !ping_done; i++)
+    {
+      while (ball == 0)
+      {
+        syscall_futex_op(&ball, FUTEX_OP::FUTEX_WAIT, 0, 0, nullptr, 0);
+      }
+
+      ball = 0;
+      syscall_futex_op(&ball, FUTEX_OP::FUTEX_WAKE, 0, 0, nullptr, 0);
+    }
+
+    pong_done = true;
+    syscall_exit_thread();
+  }
+
+  /// @brief Read the processor's time stamp counter.
+  ///
+  /// @return The current TSC value.
+  uint64_t read_tsc()
+  {
+    uint32_t low;
+    uint32_t high;
+
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return (static_cast<uint64_t>(high) << 32) | low;
+  }
+}
@@ -0,0 +1,167 @@
+// Scheduler scaling benchmark.
+//
+// One thread is pinned to each of the first N processors, and each thread yields repeatedly. Every yield runs the
+// scheduler on that thread's processor, which updates that processor's own scheduler state and nothing else. So if the
+// per-processor state is laid out well, the cost of a yield shouldn't depend on how many processors are yielding at
+// once. If neighbouring processors' state shares cache lines, the cost rises as N grows. Run this in a guest with at
+// least eight processors to see the effect clearly. Times are in TSC cycles.
+
+#include "gtest/gtest.h"
+
+#include <azalea/azalea.h>
+
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+  void yield_thread();
+  uint32_t run_yielders(uint32_t thread_count);
+  uint64_t read_tsc();
+
+  const uint32_t max_threads = 64;
+  const uint64_t yields_per_thread = 20000;
+
+  // Set to true to let the yielding threads start, so that they all run at the same time.
+  volatile bool go{false};
+
+  // The next result slot to be claimed by a starting thread.
+  uint32_t next_slot{0};
+
+  // The results of each yielding thread. Padded so that the threads don't disturb each other while recording them.
+  struct yield_result
+  {
+    volatile bool done;
+    uint64_t cycles;
+    uint8_t padding[48];
+  };
+  yield_result results[max_threads];
+}
+
+TEST(Scheduler, YieldScaling)
+{
+  uint64_t total_cycles;
+  uint32_t started;
+
+  for (uint32_t count = 1; count <= max_threads; count *= 2)
+  {
+    started = run_yielders(count);
+    if (started < count)
+    {
+      // There aren't this many processors, so there's nothing more to measure.
+      break;
+    }
+
+    total_cycles = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      total_cycles += results[i].cycles;
+    }
+
+    cout << count << " processors: " << total_cycles / (count * yields_per_thread) << " cycles per yield" << endl;
+  }
+}
+
+namespace
+{
+  /// @brief Start one yielding thread on each of the first few processors, and wait for them to finish.
+  ///
+  /// @param thread_count The number of threads to run, each on its own processor.
+  ///
+  /// @return The number of threads that ran. This is less than thread_count if there aren't enough processors, in
+  ///         which case the results shouldn't be used.
+  uint32_t run_yielders(uint32_t thread_count)
+  {
+    GEN_HANDLE handles[max_threads];
+    uint32_t started = 0;
+    ERR_CODE ec;
+    bool all_done;
+
+    go = false;
+    next_slot = 0;
+    for (uint32_t i = 0; i < max_threads; i++)
+    {
+      results[i].done = false;
+      results[i].cycles = 0;
+    }
+
+    for (; started < thread_count; started++)
+    {
+      ec = syscall_create_thread(yield_thread, &handles[started], 0, nullptr);
+      if (ec != ERR_CODE::NO_ERROR)
+      {
+        break;
+      }
+
+      // An affinity mask covering no existing processors is rejected.
+      ec = syscall_set_thread_affinity(handles[started], 1ULL << started);
+      if (ec == ERR_CODE::NO_ERROR)
+      {
+        ec = syscall_start_thread(handles[started]);
+      }
+      if (ec != ERR_CODE::NO_ERROR)
+      {
+        syscall_close_handle(handles[started]);
+        break;
+      }
+    }
+
+    // Even if not all the threads could be started, the ones that did start must be allowed to finish.
+    go = true;
+
+    do
+    {
+      syscall_sleep_thread(10000000);
+
+      all_done = true;
+      for (uint32_t i = 0; i < started; i++)
+      {
+        all_done = all_done && results[i].done;
+      }
+    } while (!all_done);
+
+    for (uint32_t i = 0; i < started; i++)
+    {
+      syscall_close_handle(handles[i]);
+    }
+
+    return started;
+  }
+
+  /// @brief Wait for the signal to start, then yield repeatedly, timing the whole run.
+  void yield_thread()
+  {
+    uint32_t slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_SEQ_CST);
+    uint64_t start;
+
+    while (!go)
+    {
+      // Spin, so that all threads start yielding at as close to the same time as possible.
+    }
+
+    start = read_tsc();
+    for (uint64_t i = 0; i < yields_per_thread; i++)
+    {
+      syscall_yield();
+    }
+
+    results[slot].cycles = read_tsc() - start;
+    results[slot].done = true;
+
+    syscall_exit_thread();
+  }
+
+  /// @brief Read the processor's time stamp counter.
+  ///
+  /// @return The current TSC value.
+  uint64_t read_tsc()
+  {
+    uint32_t low;
+    uint32_t high;
+
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return (static_cast<uint64_t>(high) << 32) | low;
+  }
+}
@@ -0,0 +1,194 @@
+// Kernel mutex contention benchmark.
+//
+// Threads pinned to the first N processors repeatedly lock a kernel mutex, hold it for a short time, and release it.
+// With short hold times, a contending thread should usually spin until the owner releases the mutex, rather than
+// sleeping, so the cost of each lock shouldn't rise much as N grows. With long hold times, contending threads should
+// sleep instead of burning processor time. The total count of locks also confirms that the mutex excluded the threads
+// from each other. Times are in TSC cycles.
+
+#include "gtest/gtest.h"
+
+#include <azalea/azalea.h>
+
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+  void contend_thread();
+  uint32_t run_contenders(uint32_t thread_count, uint64_t hold_cycles);
+  uint64_t read_tsc();
+
+  const uint32_t max_threads = 8;
+  const uint64_t locks_per_thread = 5000;
+
+  GEN_HANDLE mutex;
+  volatile uint64_t hold_time;
+  volatile uint64_t lock_count;
+
+  // Set to true to let the contending threads start, so that they all run at the same time.
+  volatile bool go{false};
+  uint32_t next_slot{0};
+
+  // The results of each contending thread. Padded so that the threads don't disturb each other while recording them.
+  struct contend_result
+  {
+    volatile bool done;
+    uint64_t cycles;
+    uint8_t padding[48];
+  };
+  contend_result results[max_threads];
+}
+
+TEST(KernelMutex, ContentionScaling)
+{
+  const uint64_t hold_lengths[] = { 100, 100000 };
+  uint64_t total_cycles;
+  uint32_t started;
+
+  ASSERT_EQ(syscall_create_mutex(&mutex), ERR_CODE::NO_ERROR);
+
+  for (uint64_t hold : hold_lengths)
+  {
+    for (uint32_t count = 1; count <= max_threads; count *= 2)
+    {
+      started = run_contenders(count, hold);
+      ASSERT_EQ(lock_count, started * locks_per_thread);
+      if (started < count)
+      {
+        // There aren't this many processors, so there's nothing more to measure.
+        break;
+      }
+
+      total_cycles = 0;
+      for (uint32_t i = 0; i < count; i++)
+      {
+        total_cycles += results[i].cycles;
+      }
+
+      cout << "Hold " << hold << " cycles, " << count << " processors: " << total_cycles / (count * locks_per_thread)
+           << " cycles per lock" << endl;
+    }
+  }
+
+  syscall_close_handle(mutex);
+}
+
+namespace
+{
+  /// @brief Start one contending thread on each of the first few processors, and wait for them to finish.
+  ///
+  /// @param thread_count The number of threads to run, each on its own processor.
+  ///
+  /// @param hold_cycles How long each thread holds the mutex for each time it locks it, in TSC cycles.
+  ///
+  /// @return The number of threads that ran. This is less than thread_count if there aren't enough processors, in
+  ///         which case the results shouldn't be used.
+  uint32_t run_contenders(uint32_t thread_count, uint64_t hold_cycles)
+  {
+    GEN_HANDLE handles[max_threads];
+    uint32_t started = 0;
+    ERR_CODE ec;
+    bool all_done;
+
+    go = false;
+    next_slot = 0;
+    hold_time = hold_cycles;
+    lock_count = 0;
+    for (uint32_t i = 0; i < max_threads; i++)
+    {
+      results[i].done = false;
+      results[i].cycles = 0;
+    }
+
+    for (; started < thread_count; started++)
+    {
+      ec = syscall_create_thread(contend_thread, &handles[started], 0, nullptr);
+      if (ec != ERR_CODE::NO_ERROR)
+      {
+        break;
+      }
+
+      // An affinity mask covering no existing processors is rejected.
+      ec = syscall_set_thread_affinity(handles[started], 1ULL << started);
+      if (ec == ERR_CODE::NO_ERROR)
+      {
+        ec = syscall_start_thread(handles[started]);
+      }
+      if (ec != ERR_CODE::NO_ERROR)
+      {
+        syscall_close_handle(handles[started]);
+        break;
+      }
+    }
+
+    // Even if not all the threads could be started, the ones that did start must be allowed to finish.
+    go = true;
+
+    do
+    {
+      syscall_sleep_thread(10000000);
+
+      all_done = true;
+      for (uint32_t i = 0; i < started; i++)
+      {
+        all_done = all_done && results[i].done;
+      }
+    } while (!all_done);
+
+    for (uint32_t i = 0; i < started; i++)
+    {
+      syscall_close_handle(handles[i]);
+    }
+
+    return started;
+  }
+
+  /// @brief Wait for the signal to start, then lock and release the mutex repeatedly, timing the whole run.
+  void contend_thread()
+  {
+    uint32_t slot = __atomic_fetch_add(&next_slot, 1, __ATOMIC_SEQ_CST);
+    uint64_t start;
+    uint64_t hold_start;
+
+    while (!go)
+    {
+      // Spin, so that all threads start contending at as close to the same time as possible.
+    }
+
+    start = read_tsc();
+    for (uint64_t i = 0; i < locks_per_thread; i++)
+    {
+      syscall_wait_for_object(mutex, SC_MAX_WAIT);
+
+      // Not an atomic increment, so that a failure to exclude other threads shows up in the total.
+      lock_count = lock_count + 1;
+      hold_start = read_tsc();
+      while ((read_tsc() - hold_start) < hold_time)
+      {
+        // Hold the mutex for a while.
+      }
+
+      syscall_release_mutex(mutex);
+    }
+
+    results[slot].cycles = read_tsc() - start;
+    results[slot].done = true;
+
+    syscall_exit_thread();
+  }
+
+  /// @brief Read the processor's time stamp counter.
+  ///
+  /// @return The current TSC value.
+  uint64_t read_tsc()
+  {
+    uint32_t low;
+    uint32_t high;
+
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return (static_cast<uint64_t>(high) << 32) | low;
+  }
+}
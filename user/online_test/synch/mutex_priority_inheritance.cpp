@@ -0,0 +1,177 @@
+// Kernel mutex priority inheritance test.
+//
+// A low priority thread locks a mutex, and then a normal priority thread occupies the processor without blocking. On
+// its own, the low priority thread would never run again until the normal priority thread stopped, so a high priority
+// thread waiting for the mutex would be held up for as long as the normal priority thread ran. With priority
+// inheritance, the low priority thread inherits the high priority and releases the mutex promptly. All three threads
+// are kept on the first processor, so that they have to share it.
+
+#include "gtest/gtest.h"
+
+#include <azalea/azalea.h>
+
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+  void low_thread();
+  void normal_thread();
+  void high_thread();
+  bool start_pinned_thread(void (*entry)(), THREAD_PRIORITY priority, GEN_HANDLE *handle);
+  void wait_for(volatile bool &flag);
+
+  GEN_HANDLE mutex;
+
+  volatile bool low_has_mutex;
+  volatile bool high_waiting;
+  volatile bool high_has_mutex;
+  volatile bool normal_running;
+  volatile bool stop_normal;
+  volatile bool low_done;
+  volatile bool normal_done;
+  volatile bool high_done;
+
+  // Set if the high priority thread acquired the mutex while the normal priority thread was still occupying the
+  // processor.
+  volatile bool acquired_while_normal_ran;
+}
+
+TEST(KernelMutex, PriorityInheritance)
+{
+  GEN_HANDLE handles[3];
+
+  low_has_mutex = false;
+  high_waiting = false;
+  high_has_mutex = false;
+  normal_running = false;
+  stop_normal = false;
+  low_done = false;
+  normal_done = false;
+  high_done = false;
+  acquired_while_normal_ran = false;
+
+  ASSERT_EQ(syscall_create_mutex(&mutex), ERR_CODE::NO_ERROR);
+
+  ASSERT_TRUE(start_pinned_thread(low_thread, THREAD_PRIORITY::BATCH, &handles[0]));
+  wait_for(low_has_mutex);
+
+  ASSERT_TRUE(start_pinned_thread(normal_thread, THREAD_PRIORITY::NORMAL, &handles[1]));
+  wait_for(normal_running);
+
+  ASSERT_TRUE(start_pinned_thread(high_thread, THREAD_PRIORITY::HIGH, &handles[2]));
+
+  // Without priority inheritance, the high priority thread can't get the mutex until the normal priority thread is
+  // stopped. Give it plenty of time.
+  for (int i = 0; (i < 200) && !high_has_mutex; i++)
+  {
+    syscall_sleep_thread(10000000);
+  }
+
+  stop_normal = true;
+  wait_for(low_done);
+  wait_for(normal_done);
+  wait_for(high_done);
+
+  ASSERT_TRUE(acquired_while_normal_ran);
+
+  for (GEN_HANDLE handle : handles)
+  {
+    syscall_close_handle(handle);
+  }
+  syscall_close_handle(mutex);
+}
+
+namespace
+{
+  /// @brief Lock the mutex, then hold it until the high priority thread is waiting for it.
+  ///
+  /// Once the normal priority thread is running, this thread can only get back on the processor by inheriting the high
+  /// priority thread's priority.
+  void low_thread()
+  {
+    syscall_wait_for_object(mutex, SC_MAX_WAIT);
+    low_has_mutex = true;
+
+    while (!high_waiting)
+    {
+      // Keep the mutex until there is a waiter to inherit from.
+    }
+
+    syscall_release_mutex(mutex);
+    low_done = true;
+
+    syscall_exit_thread();
+  }
+
+  /// @brief Occupy the processor without blocking, until told to stop.
+  void normal_thread()
+  {
+    normal_running = true;
+
+    while (!stop_normal)
+    {
+      // Keep the processor busy.
+    }
+
+    normal_done = true;
+
+    syscall_exit_thread();
+  }
+
+  /// @brief Wait for the mutex held by the low priority thread.
+  void high_thread()
+  {
+    high_waiting = true;
+    syscall_wait_for_object(mutex, SC_MAX_WAIT);
+
+    acquired_while_normal_ran = !stop_normal;
+    high_has_mutex = true;
+    syscall_release_mutex(mutex);
+    high_done = true;
+
+    syscall_exit_thread();
+  }
+
+  /// @brief Create a thread that may only run on the first processor, and start it.
+  ///
+  /// @param entry The thread's entry point.
+  ///
+  /// @param priority The priority level to run the thread at.
+  ///
+  /// @param[out] handle Handle to the new thread.
+  ///
+  /// @return True if the thread was started, false otherwise.
+  bool start_pinned_thread(void (*entry)(), THREAD_PRIORITY priority, GEN_HANDLE *handle)
+  {
+    ERR_CODE ec;
+
+    ec = syscall_create_thread(entry, handle, 0, nullptr);
+    if (ec == ERR_CODE::NO_ERROR)
+    {
+      ec = syscall_set_thread_affinity(*handle, 1);
+    }
+    if (ec == ERR_CODE::NO_ERROR)
+    {
+      ec = syscall_set_thread_priority(*handle, priority, 0);
+    }
+    if (ec == ERR_CODE::NO_ERROR)
+    {
+      ec = syscall_start_thread(*handle);
+    }
+
+    return (ec == ERR_CODE::NO_ERROR);
+  }
+
+  /// @brief Sleep until a flag set by one of the test threads becomes true.
+  ///
+  /// @param flag The flag to wait for.
+  void wait_for(volatile bool &flag)
+  {
+    while (!flag)
+    {
+      syscall_sleep_thread(10000000);
+    }
+  }
+}
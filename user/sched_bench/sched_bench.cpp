@@ -0,0 +1,202 @@
+// Scheduler benchmark.
+//
+// A high priority probe thread repeatedly sleeps for a short time, and records how long each sleep actually takes -
+// anything beyond the requested time is the delay in waking and scheduling it. This is measured first on an otherwise
+// idle system, then again while a number of spinner threads keep every processor busy. With working priorities the
+// two sets of results should be similar.
+//
+// Usage: sched_bench [spinner threads] [samples]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "azalea/syscall.h"
+
+extern "C" int main (int argc, char **argv);
+
+namespace
+{
+  void probe_thread();
+  void spinner_thread();
+  bool run_probe(uint64_t samples);
+  uint64_t read_tsc();
+
+  // How long the probe sleeps for each sample.
+  const uint64_t probe_sleep_ns = 1000000;
+
+  const uint64_t default_spinners = 4;
+  const uint64_t default_samples = 200;
+
+  volatile uint64_t probe_samples{0};
+  volatile bool probe_done{false};
+  volatile bool spinners_stop{false};
+  volatile uint64_t spinner_loops{0};
+
+  uint64_t lat_min;
+  uint64_t lat_max;
+  uint64_t lat_total;
+}
+
+int main (int argc, char **argv)
+{
+  uint64_t num_spinners = default_spinners;
+  uint64_t samples = default_samples;
+  GEN_HANDLE spinner;
+  ERR_CODE ec;
+
+  if (argc > 1)
+  {
+    num_spinners = strtoull(argv[1], nullptr, 10);
+  }
+  if (argc > 2)
+  {
+    samples = strtoull(argv[2], nullptr, 10);
+  }
+  if (samples == 0)
+  {
+    samples = 1;
+  }
+
+  printf("Probe thread sleeps %llu ns per sample, %llu samples. Sleep times are in TSC cycles.\n",
+         static_cast<unsigned long long>(probe_sleep_ns),
+         static_cast<unsigned long long>(samples));
+
+  if (!run_probe(samples))
+  {
+    return 1;
+  }
+  printf("Idle:  min %llu, avg %llu, max %llu\n",
+         static_cast<unsigned long long>(lat_min),
+         static_cast<unsigned long long>(lat_total / samples),
+         static_cast<unsigned long long>(lat_max));
+
+  // The spinners alternate between normal and batch priority, so both classes are represented in the load.
+  for (uint64_t i = 0; i < num_spinners; i++)
+  {
+    ec = syscall_create_thread(spinner_thread, &spinner, 0, nullptr);
+    if (ec == ERR_CODE::NO_ERROR)
+    {
+      ec = syscall_set_thread_priority(spinner,
+                                       ((i % 2) == 0) ? THREAD_PRIORITY::NORMAL : THREAD_PRIORITY::BATCH,
+                                       0);
+    }
+    if (ec == ERR_CODE::NO_ERROR)
+    {
+      ec = syscall_start_thread(spinner);
+    }
+    if (ec != ERR_CODE::NO_ERROR)
+    {
+      printf("Failed to start spinner thread: %d\n", static_cast<int>(ec));
+      return 1;
+    }
+  }
+
+  if (!run_probe(samples))
+  {
+    return 1;
+  }
+  printf("Loaded (%llu spinners): min %llu, avg %llu, max %llu\n",
+         static_cast<unsigned long long>(num_spinners),
+         static_cast<unsigned long long>(lat_min),
+         static_cast<unsigned long long>(lat_total / samples),
+         static_cast<unsigned long long>(lat_max));
+  printf("Spinner loops completed: %llu\n", static_cast<unsigned long long>(spinner_loops));
+
+  spinners_stop = true;
+
+  return 0;
+}
+
+namespace
+{
+  /// @brief Start a high priority probe thread and wait for it to collect its samples.
+  ///
+  /// @param samples The number of samples to collect.
+  ///
+  /// @return True if the probe ran, false if it couldn't be started.
+  bool run_probe(uint64_t samples)
+  {
+    GEN_HANDLE probe;
+    ERR_CODE ec;
+
+    lat_min = ~0ULL;
+    lat_max = 0;
+    lat_total = 0;
+    probe_samples = samples;
+    probe_done = false;
+
+    ec = syscall_create_thread(probe_thread, &probe, 0, nullptr);
+    if (ec == ERR_CODE::NO_ERROR)
+    {
+      ec = syscall_set_thread_priority(probe, THREAD_PRIORITY::HIGH, 0);
+    }
+    if (ec == ERR_CODE::NO_ERROR)
+    {
+      ec = syscall_start_thread(probe);
+    }
+    if (ec != ERR_CODE::NO_ERROR)
+    {
+      printf("Failed to start probe thread: %d\n", static_cast<int>(ec));
+      return false;
+    }
+
+    while (!probe_done)
+    {
+      syscall_sleep_thread(probe_sleep_ns * 10);
+    }
+
+    syscall_close_handle(probe);
+
+    return true;
+  }
+
+  /// @brief Sleep repeatedly, recording how long each sleep takes.
+  void probe_thread()
+  {
+    uint64_t start;
+    uint64_t elapsed;
+
+    for (uint64_t i = 0; i < probe_samples; i++)
+    {
+      start = read_tsc();
+      syscall_sleep_thread(probe_sleep_ns);
+      elapsed = read_tsc() - start;
+
+      lat_total += elapsed;
+      if (elapsed < lat_min)
+      {
+        lat_min = elapsed;
+      }
+      if (elapsed > lat_max)
+      {
+        lat_max = elapsed;
+      }
+    }
+
+    probe_done = true;
+    syscall_exit_thread();
+  }
+
+  /// @brief Keep a processor busy until told to stop.
+  void spinner_thread()
+  {
+    while (!spinners_stop)
+    {
+      spinner_loops = spinner_loops + 1;
+    }
+
+    syscall_exit_thread();
+  }
+
+  /// @brief Read the processor's timestamp counter.
+  ///
+  /// @return The current TSC value.
+  uint64_t read_tsc()
+  {
+    uint32_t low;
+    uint32_t high;
+
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return (static_cast<uint64_t>(high) << 32) | low;
+  }
+}